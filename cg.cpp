@@ -2,6 +2,7 @@
 #include "mathexpr.h"
 #include "sort.h"
 #include "errors.h"
+#include "rand.h"
 #include <cmath>
 
 #ifdef USE_OPENMP
@@ -26,6 +27,10 @@ CG_sparse::CG_sparse(double* As_in, int* Ai_in, const double tol_in, const int i
 	preconditioner = NULL;
 	preconditioner_transpose = NULL;
 	preconditioner_transpose_index = NULL;
+	logdet_nprobes = 0;
+	logdet_max_lanczos_steps = 50;
+	logdet_tol = 1e-4;
+	log_determinant_err = 0;
 
 	sorted_indices = new vector<int>[n];
 	sorted_indices_i = new vector<int>[n];
@@ -79,6 +84,10 @@ CG_sparse::CG_sparse(double** Amatrix, const int nn, const double tol_in, const
 	preconditioner = NULL;
 	preconditioner_transpose = NULL;
 	preconditioner_transpose_index = NULL;
+	logdet_nprobes = 0;
+	logdet_max_lanczos_steps = 50;
+	logdet_tol = 1e-4;
+	log_determinant_err = 0;
 	set_thread_num(1);
 }
 
@@ -228,14 +237,15 @@ void CG_sparse::solve(double* b, double* x)
 	static const double EPS=1.0e-14;
 	int j,k;
 
-	double p[n];
-	double r[n];
-	double z[n];
-	double y[n];
-	double y2[n];
-	double alpha[n];
-	double beta[n];
-	double akk[n], bkk[n];
+	// the work arrays are allocated on the heap, since n can be large enough to overflow the stack
+	double *p = new double[n];
+	double *r = new double[n];
+	double *z = new double[n];
+	double *y = new double[n];
+	double *alpha = new double[n];
+	double *beta = new double[n];
+	double *akk = new double[n];
+	double *bkk = new double[n];
 
 	double log_pre_det, log_pre_det_last, log_predet_temp;
 	double errnorm;
@@ -244,7 +254,9 @@ void CG_sparse::solve(double* b, double* x)
 
 	iterations=0;
 	k=0;
-	double rho[n], sigma[n], gamma[n]; // used to find determinant after solution has already converged
+	double *rho = new double[n]; // rho, sigma, gamma are used to find determinant after solution has already converged
+	double *sigma = new double[n];
+	double *gamma = new double[n];
 	double rnrm, old_rnrm=1.0, older_rnrm, signorm, old_signorm=1.0;
 
 #ifdef USE_OPENMP
@@ -473,26 +485,42 @@ void CG_sparse::solve(double* b, double* x)
 		//cout << "Determinant: " << det << endl;
 	}
 	ratio_mode = false;
+	delete[] p;
+	delete[] r;
+	delete[] z;
+	delete[] y;
+	delete[] alpha;
+	delete[] beta;
+	delete[] akk;
+	delete[] bkk;
+	delete[] rho;
+	delete[] sigma;
+	delete[] gamma;
 }
 
 double CG_sparse::calculate_log_determinant()
 {
+	if (logdet_nprobes > 0) return calculate_log_determinant_SLQ();
+
 	// note, the sparse version uses a diagonal preconditioner specifically
 	double ak,akden,bk,bkden=1.0,bknum,bnrm,dxnrm,xnrm,zm1nrm,znrm=0;
 	static const double EPS=1.0e-14;
 	int j,k;
 
-	double y[n];
-	double alpha[n];
-	double beta[n];
-	double akk[n], bkk[n];
+	double *y = new double[n];
+	double *alpha = new double[n];
+	double *beta = new double[n];
+	double *akk = new double[n];
+	double *bkk = new double[n];
 
 	double log_pre_det, log_pre_det_last, log_predet_temp;
 	log_pre_det_last = 0;
 	log_pre_det = 0;
 
 	k=0;
-	double rho[n], sigma[n], gamma[n];
+	double *rho = new double[n];
+	double *sigma = new double[n];
+	double *gamma = new double[n];
 	double signorm, old_signorm=1.0;
 
 #ifdef USE_OPENMP
@@ -577,9 +605,197 @@ double CG_sparse::calculate_log_determinant()
 	double log_preconditioner_det = 0;
 	for (int i=0; i < n; i++) log_preconditioner_det += log(A_sparse[i]);
 	log_determinant = log_pre_det + log_preconditioner_det; // determinant of preconditioned matrix times determinant of the preconditioner itself
+	log_determinant_err = 0;
+	delete[] y;
+	delete[] alpha;
+	delete[] beta;
+	delete[] akk;
+	delete[] bkk;
+	delete[] rho;
+	delete[] sigma;
+	delete[] gamma;
+	return log_determinant;
+}
+
+double CG_sparse::calculate_log_determinant_SLQ()
+{
+	// Stochastic Lanczos quadrature: log(det A) = tr(log A) is estimated by averaging z^T log(A) z over random probe vectors
+	// with entries of +/-1 (Hutchinson's estimator), where each quadratic form is given by the Gauss quadrature rule from a
+	// short Lanczos run started at z. The Lanczos runs use the Jacobi-scaled matrix D^(-1/2) A D^(-1/2) (D = diagonal of A),
+	// whose spectrum is much narrower, and log(det D) is added back at the end. Each probe has a fixed seed, so the estimate
+	// is the same every time the likelihood is evaluated. The probes are divided between the MPI processes, and then between
+	// threads; the spread between probes gives the statistical error of the estimate.
+	int i, probe;
+	double *dscale = new double[n];
+	double log_preconditioner_det = 0;
+	for (i=0; i < n; i++) {
+		if (A_sparse[i] != 0) {
+			dscale[i] = 1.0/sqrt(A_sparse[i]);
+			log_preconditioner_det += log(A_sparse[i]);
+		} else {
+			dscale[i] = 1.0;
+		}
+	}
+	int max_steps = imin(logdet_max_lanczos_steps,n);
+	double *probe_logdet = new double[logdet_nprobes];
+	for (probe=0; probe < logdet_nprobes; probe++) probe_logdet[probe] = 0;
+
+#ifdef USE_OPENMP
+	omp_set_num_threads(nthreads);
+#endif
+	#pragma omp parallel
+	{
+		double *v = new double[n];
+		double *v_prev = new double[n];
+		double *w = new double[n];
+		double *u = new double[n];
+		double *vtemp;
+		double *alpha = new double[max_steps];
+		double *beta = new double[max_steps];
+		double *d = new double[max_steps];
+		double *e = new double[max_steps];
+		double *z = new double[max_steps];
+		double normfac = 1.0/sqrt(n);
+		double a, b, quad, quad_prev;
+		unsigned long long int bits = 0;
+		int j, k, m;
+		bool lanczos_done;
+
+		#pragma omp for schedule(dynamic)
+		for (probe=mpi_id; probe < logdet_nprobes; probe += mpi_np) {
+			Random probe_rand(probe+1);
+			for (j=0; j < n; j++) {
+				if ((j % 64)==0) bits = probe_rand.int64();
+				v[j] = (bits & 1) ? normfac : -normfac;
+				bits >>= 1;
+				v_prev[j] = 0;
+			}
+			quad = quad_prev = 0;
+			for (m=1; m <= max_steps; m++) {
+				for (j=0; j < n; j++) u[j] = dscale[j]*v[j];
+				A_matrix_multiply_serial(u,w);
+				a = 0;
+				for (j=0; j < n; j++) {
+					w[j] *= dscale[j];
+					a += v[j]*w[j];
+				}
+				b = 0;
+				for (j=0; j < n; j++) {
+					w[j] -= a*v[j] + ((m > 1) ? beta[m-2]*v_prev[j] : 0);
+					b += w[j]*w[j];
+				}
+				b = sqrt(b);
+				alpha[m-1] = a;
+				beta[m-1] = b;
+				lanczos_done = ((m==max_steps) or (b <= 1e-12*fabs(a))); // a tiny beta means the Krylov subspace is exhausted, so the quadrature is exact
+				if ((lanczos_done) or ((m % 5)==0)) {
+					for (k=0; k < m; k++) {
+						d[k] = alpha[k];
+						e[k] = beta[k];
+					}
+					quad = lanczos_log_quadrature(d,e,z,m);
+					if ((m > 5) and (fabs(quad-quad_prev) <= logdet_tol*fabs(quad))) lanczos_done = true;
+					if (lanczos_done) break;
+					quad_prev = quad;
+				}
+				vtemp = v_prev;
+				v_prev = v;
+				v = vtemp;
+				for (j=0; j < n; j++) v[j] = w[j]/b;
+			}
+			probe_logdet[probe] = n*quad;
+		}
+		delete[] v;
+		delete[] v_prev;
+		delete[] w;
+		delete[] u;
+		delete[] alpha;
+		delete[] beta;
+		delete[] d;
+		delete[] e;
+		delete[] z;
+	}
+#ifdef USE_OPENMP
+	omp_set_num_threads(default_nthreads);
+#endif
+
+#ifdef USE_MPI
+	if (mpi_np > 1) MPI_Allreduce(MPI_IN_PLACE,probe_logdet,logdet_nprobes,MPI_DOUBLE,MPI_SUM,(*mpi_comm));
+#endif
+	double mean = 0, var = 0;
+	for (probe=0; probe < logdet_nprobes; probe++) mean += probe_logdet[probe];
+	mean /= logdet_nprobes;
+	if (logdet_nprobes > 1) {
+		for (probe=0; probe < logdet_nprobes; probe++) var += SQR(probe_logdet[probe]-mean);
+		var /= (logdet_nprobes-1);
+	}
+	log_determinant = mean + log_preconditioner_det;
+	log_determinant_err = sqrt(var/logdet_nprobes); // standard error of the mean over the probes
+	delete[] dscale;
+	delete[] probe_logdet;
 	return log_determinant;
 }
 
+double CG_sparse::lanczos_log_quadrature(double* d, double* e, double* z, const int m)
+{
+	// Returns e1^T log(T) e1 for the symmetric tridiagonal Lanczos matrix T with diagonal d[0..m-1] and off-diagonal e[0..m-2],
+	// i.e. the sum of log(theta_k) weighted by the squared first components of its eigenvectors. The eigenvalues are found by
+	// the implicit QL method; only the first row of the eigenvector matrix is needed, so only that row is rotated (in z).
+	// The contents of d and e are destroyed.
+	static const double EPS = 1e-15;
+	int i, k, l, mm, iter;
+	double b, c, f, g, p, r, s, dd;
+	for (i=0; i < m; i++) z[i] = 0;
+	z[0] = 1.0;
+	e[m-1] = 0.0;
+	for (l=0; l < m; l++) {
+		iter = 0;
+		do {
+			for (mm=l; mm < m-1; mm++) {
+				dd = fabs(d[mm]) + fabs(d[mm+1]);
+				if (fabs(e[mm]) <= EPS*dd) break;
+			}
+			if (mm != l) {
+				if (iter++ == 60) {
+					warn("too many iterations finding Lanczos matrix eigenvalues");
+					break;
+				}
+				g = (d[l+1]-d[l])/(2.0*e[l]);
+				r = sqrt(g*g+1.0);
+				g = d[mm]-d[l]+e[l]/(g + ((g >= 0) ? fabs(r) : -fabs(r)));
+				s = c = 1.0;
+				p = 0.0;
+				for (i=mm-1; i >= l; i--) {
+					f = s*e[i];
+					b = c*e[i];
+					e[i+1] = (r = sqrt(f*f+g*g));
+					if (r == 0.0) {
+						d[i+1] -= p;
+						e[mm] = 0.0;
+						break;
+					}
+					s = f/r;
+					c = g/r;
+					g = d[i+1]-p;
+					r = (d[i]-g)*s + 2.0*c*b;
+					d[i+1] = g + (p = s*r);
+					g = c*r-b;
+					f = z[i+1];
+					z[i+1] = s*z[i] + c*f;
+					z[i] = c*z[i] - s*f;
+				}
+				if ((r == 0.0) and (i >= l)) continue;
+				d[l] -= p;
+				e[l] = g;
+				e[mm] = 0.0;
+			}
+		} while (mm != l);
+	}
+	double quad = 0;
+	for (k=0; k < m; k++) quad += z[k]*z[k]*log(fabs(d[k]));
+	return quad;
+}
+
 void CG_Solver::error_norm(double* sx, double& err)
 {
 	// Compute one of two norms for a vector sx[0..n-1]. Used by solve.
@@ -629,6 +845,21 @@ void CG_sparse::A_matrix_multiply(const double* const x, double* const r)
 	}
 }
 
+void CG_sparse::A_matrix_multiply_serial(const double* const x, double* const r)
+{
+	// same as A_matrix_multiply, but done entirely by the calling thread (used when independent products run in parallel)
+	int i,j;
+	for (i=0; i < n; i++) {
+		r[i] = A_sparse[i] * x[i];
+		for (j=A_index[i]; j < A_index[i+1]; j++) {
+			r[i] += A_sparse[j] * x[A_index[j]];
+		}
+		for (j=0; j < sorted_indices[i].size(); j++) {
+			r[i] += A_sparse[sorted_indices[i][j]] * x[sorted_indices_i[i][j]];
+		}
+	}
+}
+
 void CG_sparse::incomplete_Cholesky_preconditioner()
 {
 	preconditioner = new double[A_length];
@@ -63,6 +63,8 @@ class CG_sparse : public CG_Solver
 	double *preconditioner;
 	double *preconditioner_transpose;
 	int *preconditioner_transpose_index;
+	int logdet_nprobes, logdet_max_lanczos_steps; // if logdet_nprobes > 0, the log-determinant is estimated by stochastic Lanczos quadrature
+	double logdet_tol, log_determinant_err;
 
 	public:
 	CG_sparse(double* As_in, int* Ai_in, const double tol_in, const int itmax_in, const int nt_in, const int mpi_np, const int mpi_id);
@@ -74,10 +76,17 @@ class CG_sparse : public CG_Solver
 
 	void solve(double* b, double* x);
 	double calculate_log_determinant();
+	void set_stochastic_logdet(const int nprobes, const int max_lanczos_steps, const double tol) { logdet_nprobes = nprobes; logdet_max_lanczos_steps = max_lanczos_steps; logdet_tol = tol; }
+	void get_log_determinant_error(double& logdet_err) { logdet_err = log_determinant_err; }
 	void A_matrix_multiply(const double* const x, double* const r);
 	void incomplete_Cholesky_preconditioner();
 	void preconditioner_solve(double* b, double* x);
 	void Cholesky_preconditioner_solve(double* b, double* x);
 	void indexx(int* arr, int* indx, int nn);
+
+	private:
+	double calculate_log_determinant_SLQ();
+	double lanczos_log_quadrature(double* d, double* e, double* z, const int m);
+	void A_matrix_multiply_serial(const double* const x, double* const r);
 };
 
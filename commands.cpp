@@ -168,6 +168,8 @@ void QLens::process_commands(bool read_file)
 						"imgsep_threshold -- if image distance to other images < threshold, discard one as 'duplicate'\n"
 						"imgsrch_mag_threshold -- warn if images have mag > threshold (or reject if reject_himag = on)\n"
 						"reject_himag -- reject images found that have magnification higher than imgsrch_mag_threshold\n"
+						"imgsrch_warmstart -- during fits, refine the previous images with Newton's method instead of a grid search\n"
+						"imgsrch_warmstart_refresh -- max number of warm-started searches per source before a full grid search\n"
 						"rmin_frac -- set minimum radius of innermost cells in radial grid (fraction of max radius)\n"
 						"galsubgrid -- subgrid around perturbing lenses not co-centered with primary lens (on/off)\n"
 						"galsub_radius -- scale factor for the optimal radius of perturber subgridding\n"
@@ -197,7 +199,14 @@ void QLens::process_commands(bool read_file)
 						"noise_threshold -- threshold (multiple of pixel noise) for automatic source pixel grid sizing\n"
 						"data_pixel_size -- specify the pixel size to assume for pixel data files\n"
 						"bg_pixel_noise -- pixel noise in data pixel images (loaded using 'sbmap loadimg')\n"
+						"correlated_noise -- use a stationary correlated pixel noise model in the likelihood (on/off)\n"
+						"noise_corr_length -- width (in pixels) of Gaussian noise correlation kernel\n"
+						"noise_corr_kernel -- load noise correlation kernel from file (or 'clear' to remove it)\n"
+						"whitening_threshold -- threshold for truncating the noise whitening kernel and flooring its power spectrum\n"
 						"inversion_nthreads -- number of OpenMP threads to use specifically for matrix inversion\n"
+						"cg_logdet_probes -- # of random probes for stochastic log-determinants in CG inversion (0 = exact)\n"
+						"cg_logdet_steps -- max # of Lanczos iterations per probe for stochastic CG log-determinants\n"
+						"cg_logdet_tol -- relative tolerance for ending Lanczos iterations for stochastic CG log-determinants\n"
 						"pixel_fraction -- fraction of srcpixels/imgpixels used to determine number of source pixels\n"
 						"regparam -- value of regularization parameter used for inverting lensed pixel images\n"
 						"vary_regparam -- vary the regularization as a free parameter during a fit (on/off)\n"
@@ -213,6 +222,8 @@ void QLens::process_commands(bool read_file)
 						"split_imgpixels -- if set to 'on', split image pixels and ray trace the subpixels, then average them\n"
 						"imgpixel_nsplit -- specify number of splittings of each pixel (if 'split_imgpixels' is on)\n"
 						"emask_nsplit -- specify number of pixel splittings for the extended mask (if 'split_imgpixels' is on)\n"
+						"adaptive_imgpixel_split -- split each masked pixel only as much as needed (up to imgpixel_nsplit)\n"
+						"imgpixel_split_tolerance -- max s.b. integration error per pixel for adaptive split (times pixel noise)\n"
 						"activate_unmapped_srcpixels -- when inverting, include srcpixels that don't map to any imgpixels\n"
 						"exclude_srcpixels_outside_mask -- when inverting, exclude srcpixels that map beyond pixel mask\n"
 						"remove_unmapped_subpixels -- when inverting, exclude *sub*pixels that don't map to any imgpixels\n"
@@ -247,6 +258,7 @@ void QLens::process_commands(bool read_file)
 						"\033[4mOptimization and Monte Carlo sampler settings\033[0m\n"
 						"nrepeat -- number of repeat chi-square optimizations after original run\n"
 						"find_errors -- calculate and show marginalized error in each parameter after chi-square fit\n"
+						"fisher_analytic_grad -- find Fisher matrix from analytic chi-square gradients if available (on/off)\n"
 						"simplex_nmax -- max number of iterations allowed when using downhill simplex (at temp=0)\n"
 						"simplex_nmax_anneal -- number of iterations at given temperature during simulated annealing\n"
 						"simplex_minchisq -- downhill simplex finishes immediately if chisq falls below this value\n"
@@ -254,6 +266,10 @@ void QLens::process_commands(bool read_file)
 						"simplex_temp0 -- initial annealing temperature for downhill simplex (zero --> no annealing)\n"
 						"simplex_tfac -- \"cooling factor\" controls how quickly temp is reduced during annealing\n"
 						"simplex_show_bestfit -- show the current best-fit parameters during annealing (if on)\n"
+						"parallel_minimizer -- divide simplex/Powell trial points between MPI groups (on/off)\n"
+						"chisqscan_refine -- number of refinement levels for 'fit plot_chisq1d/2d' near the minimum\n"
+						"chisqscan_dchisq -- chisq scans refine cells lying within this delta-chisq of the minimum\n"
+						"chisqscan_profile -- minimize over the other free parameters in 'fit plot_chisq1d/2d' (on/off)\n"
 						"data_info -- description of data that is stored in FITS file header and chain file headers\n"
 						"chain_info -- description of chain that can be stored using 'fit mkposts' command\n"
 						"param_markers -- parameter values to be marked in posteriors plotted by mkdist tool\n"
@@ -262,7 +278,9 @@ void QLens::process_commands(bool read_file)
 						"polychord_nrepeats -- num_repeats per parameter for PolyChord nested sampler\n"
 						"mcmc_chains -- number of chains used in MCMC routines (e.g. T-Walk)\n"
 						"mcmctol -- during MCMC, stop chains if Gelman-Rubin R-statistic falls below this threshold\n"
+						"mcmc_ess -- if nonzero, T-Walk also requires this effective sample size and split-R < mcmctol to stop\n"
 						"mcmclog -- output MCMC convergence, accept ratio etc. to log file while running (if on)\n"
+						"mcmc_checkpoint -- iterations between T-Walk/nested sampler checkpoints for 'fit run -resume'\n"
 						"random_seed -- random number generator seed for Monte Carlo samplers and simulated annealing\n"
 						"chisqlog -- output chi-square, parameter information to log file for each chisq evaluation\n"
 						"\n";
@@ -284,6 +302,7 @@ void QLens::process_commands(bool read_file)
 						"primary_lens -- sets which lens number is considered the 'primary' (set to 'auto' by default)\n"
 						"integral_method -- set numerical integration method (patterson/romberg/gauss)\n"
 						"integral_tolerance -- set tolerance for numerical integration (for romberg/patterson)\n"
+						"perturber_tree_theta -- use tree-based summation over many perturbers with given opening angle\n"
 						"major_axis_along_y -- orient major axis of lenses along y-direction when theta = 0 (on/off)\n"
 						"ellipticity_components -- if on, use components of ellipticity e=1-q instead of (q,theta)\n"
 						"shear_components -- if on, use components of external shear instead of (shear,theta)\n"
@@ -702,6 +721,8 @@ void QLens::process_commands(bool read_file)
 							"fit plotimg [src=#] [-nosrc]\n"
 							"fit plotsrc [src=#]\n"
 							"fit plotshear\n"
+							"fit plot_chisq1d ...\n"
+							"fit plot_chisq2d ...\n"
 							"fit data_imginfo       (NEED TO WRITE HELP DOCS FOR THIS)\n"
 							"fit method <method>\n"
 							"fit label <label>\n"
@@ -831,9 +852,11 @@ void QLens::process_commands(bool read_file)
 						cout << "fit run [-resume/process/noerrs]\n\n"
 							"Run the selected model fit routine, which can either be a minimization (e.g. Powell's method)\n"
 							"or a Monte Carlo sampler (e.g. MCMC or nested sampling method) depending on the fit method that\n"
-							"has been selected. If using MultiNest or PolyChord, you can add the argument '-resume' to continue\n"
-							"a previous run that had been interrupted; if a run has already been finished previously, you can\n"
-							"add the argument '-process' to process the chains from the previous run. If doing an optimization,\n"
+							"has been selected. If using MultiNest, PolyChord, T-Walk or the QLens nested sampler, you can add the\n"
+							"argument '-resume' to continue a previous run that had been interrupted (for T-Walk and the QLens\n"
+							"nested sampler, the run continues from the last checkpoint; see 'mcmc_checkpoint'). If a MultiNest or\n"
+							"PolyChord run has already been finished previously, you can add the argument '-process' to process\n"
+							"the chains from the previous run. If doing an optimization,\n"
 							"you can add the argument '-noerrs' to skip calculating Fisher matrix errors (this can also be\n"
 							"toggled using the 'find_errors' variable). For more info about the output produced by these\n"
 							"methods, type 'help fit method <method>'.\n";
@@ -853,6 +876,7 @@ void QLens::process_commands(bool read_file)
 								"sampling routine. Available fit methods are:\n\n"
 								"simplex -- minimize chi-square using downhill simplex method (+ optional simulated annealing)\n"
 								"powell -- minimize chi-square using Powell's method\n"
+								"lbfgs -- minimize chi-square using the L-BFGS quasi-Newton method\n"
 								"nest -- basic nested sampling\n"
 								"twalk -- T-Walk MCMC algorithm\n"
 #ifdef USE_POLYCHORD
@@ -883,12 +907,26 @@ void QLens::process_commands(bool read_file)
 								"temperature setting, not the total allowed number of iterations. By contrast, 'simplex_nmax' is\n"
 								"the max allowed iterations when the temperature is set to zero, which is the case for the final\n"
 								"iteration after annealing. Finally, one may also specify a chi-square threshold 'simplex_minchisq'\n"
-								"such that we skip to zero temperature if the chi-square falls below the given threshold.\n\n";
+								"such that we skip to zero temperature if the chi-square falls below the given threshold.\n\n"
+								"If 'parallel_minimizer' is on, the zero-temperature run uses a parallel Nelder-Mead algorithm,\n"
+								"where the worst N vertices are reflected at once (N = number of MPI groups) and the resulting\n"
+								"trial points are divided between the MPI groups.\n\n";
 						else if (words[3]=="powell")
 							cout << "fit method powell\n\n"
 								"Powell's method minimizes the chi-square function using Powell's conjugate direction method\n"
 								"and returns the best-fit parameter values. If 'find_errors' is on, the Fisher matrix is then\n"
 								"calculated numerically and marginalized error estimates are displayed for each parameter. The\n"
+								"convergence criterion is set by 'chisqtol'. If 'parallel_minimizer' is on and there is more than\n"
+								"one MPI group, each line minimization evaluates one trial point per MPI group at a time.\n\n";
+						else if (words[3]=="lbfgs")
+							cout << "fit method lbfgs\n\n"
+								"The L-BFGS method minimizes the chi-square function using a limited-memory quasi-Newton method,\n"
+								"where the inverse Hessian is built up from the gradients found at previous steps. If point images\n"
+								"are being fit using the source plane chi-square, the gradient is found from analytic derivatives\n"
+								"of the lens deflections with respect to the lens parameters; otherwise, the gradient is found by\n"
+								"finite differences. This typically requires far fewer chi-square evaluations than Powell's method\n"
+								"or downhill simplex when many parameters are varied. If 'find_errors' is on, the Fisher matrix\n"
+								"is then calculated and marginalized error estimates are displayed for each parameter. The\n"
 								"convergence criterion is set by 'chisqtol'.\n\n";
 						else if ((words[3]=="nest") or (words[3]=="multinest") or (words[3]=="polychord"))
 							cout << "fit method nest\n"
@@ -961,6 +999,23 @@ void QLens::process_commands(bool read_file)
 							"numbers can be listed using the command 'fit priors'. (NOTE: if you want to do this with a derived\n"
 							"parameter, enter the number of parameters plus the derived parameter index. e.g. if you have 16\n"
 							"parameters and you want derived parameter #2, then do 'fit adopt_point_prange 19 ...'.\n";
+					else if (words[2]=="plot_chisq1d")
+						cout << "fit plot_chisq1d <param_num> <nsteps> <initial> <final> [filename]\n\n"
+							"Evaluates the chi-square at nsteps+1 evenly spaced values of the given parameter between <initial> and <final>,\n"
+							"with the other parameters held at their current values, and writes the parameter value and chi-square to\n"
+							"<filename> (default: 'chisq1d.dat'). The points are divided among the MPI groups. If 'chisqscan_refine' is\n"
+							"nonzero, intervals having an endpoint within 'chisqscan_dchisq' of the minimum are bisected that many times.\n"
+							"If 'chisqscan_profile' is on, the chi-square is instead minimized over the other free parameters at each\n"
+							"point (using Powell's method), and their best-fit values are written after the chi-square.\n";
+					else if (words[2]=="plot_chisq2d")
+						cout << "fit plot_chisq2d <param1_num> <param2_num> <n1> <initial1> <final1> <n2> <initial2> <final2>\n\n"
+							"Evaluates the chi-square at the centers of an n1 x n2 grid of cells spanning the given ranges of two\n"
+							"parameters, and writes the chi-square map to 'chisq2d.dat' (with cell edges in 'chisq2d.x' and 'chisq2d.y')\n"
+							"and the likelihood exp(-chisq/2), normalized to 1 at the minimum, to 'like2d.dat'. The cells are divided\n"
+							"among the MPI groups. If 'chisqscan_refine' is nonzero, each refinement splits every cell into 2x2 subcells\n"
+							"and re-evaluates only those lying within (or bordering a cell within) 'chisqscan_dchisq' of the minimum;\n"
+							"the map is written at the finest resolution. If 'chisqscan_profile' is on, the chi-square is minimized over\n"
+							"the other free parameters in each cell, starting from the best fit of the parent cell.\n";
 					else if (words[2]=="mkposts")
 						cout << "fit mkposts <dirname> [-n#] [-N#] [-no2d] [-nohist] [-subonly]\n\n"
 							"After a chain has been generated using MCMC or nested sampling, 'fit mkposts' will run the mkdist tool\n"
@@ -1202,7 +1257,7 @@ void QLens::process_commands(bool read_file)
 							"wldata read <filename>\n"
 							"wldata add <x_coord> <y_coord>\n"
 							"wldata add_random <nsrc> <xmin> <xmax> <ymin> <ymax> <zsrc_min> <zsrc_max> [rmin]\n"
-							"wldata write <filename>\n"
+							"wldata write <filename> [binary]\n"
 							"wldata plot [filename]\n"
 							"wldata clear [dataset_number]\n\n"
 							"Commands for loading (or simulating) weak lensing data for lens model fitting. For help\n"
@@ -1217,11 +1272,15 @@ void QLens::process_commands(bool read_file)
 								"#ID   x    y    g1   g2   err_g1   err_g2    zsrc\n\n"
 								"where ID is an identifier name for a given source, g1 and g2 are the reduced shear values, with\n"
 								"corresponding errors err_g1 and err_g2, and zsrc is the redshift of the lensed source.\n"
-								"Note, comments (marked with #) can be placed at the end of any line or at the start of a line.\n";
+								"Note, comments (marked with #) can be placed at the end of any line or at the start of a line.\n"
+								"Alternatively, the file can be a binary catalog written by 'wldata write <filename> binary', which\n"
+								"is detected automatically and is much faster to read for large catalogs.\n";
 						else if (words[2]=="write")
-							cout << "wldata write <filename>\n\n"
+							cout << "wldata write <filename> [binary]\n\n"
 								"Outputs the current weak lensing data set to file, with the same format as required by\n"
-								"'wldata read' command. (For a description of the required format, type 'help wldata read')\n";
+								"'wldata read' command. (For a description of the required format, type 'help wldata read')\n"
+								"If 'binary' is added, the data is written in a binary catalog format, which is much faster\n"
+								"to read back in with 'wldata read' if there are many sources.\n";
 						else if (words[2]=="plot")
 							cout << "wldata plot <filename>\n\n"
 								"Plots the reduced shear from the current data set, where the lengths of the line segements are\n"
@@ -1750,6 +1809,17 @@ void QLens::process_commands(bool read_file)
 						"hence the error in the final estimate is usually a great deal smaller than the specified tol-\n"
 						"erance. For 'romberg', the error returned using Richardson extrapolation is required to be less\n"
 						"than the specified tolerance.\n";
+				else if (words[1]=="perturber_tree_theta")
+					cout << "perturber_tree_theta <theta>\n"
+						"perturber_tree_theta off\n\n"
+						"For models with a large number of perturbers (e.g. subhalos or line-of-sight halos), the lenses in\n"
+						"each lens plane can be grouped in a quadtree, so that the deflection from a distant group of perturbers\n"
+						"is found from a multipole expansion (up to hexadecapole) of their masses, rather than evaluating each\n"
+						"perturber separately. A group is treated this way if (group radius + largest half-mass radius of its\n"
+						"members) < theta*(distance to the group), so smaller values of theta are more accurate but slower.\n"
+						"Only lenses with a finite total mass are included in the tree (all others are always evaluated\n"
+						"exactly), and no tree is made for lens planes with fewer than 8 such lenses. Setting theta to zero\n"
+						"(or 'off') turns the tree off, which is the default.\n";
 				else if (words[1]=="major_axis_along_y")
 					cout << "major_axis_along_y <on/off>\n\n"
 						"Specify whether to orient major axis of lenses along the y-direction (if on) or x-direction\n"
@@ -1908,6 +1978,24 @@ void QLens::process_commands(bool read_file)
 						"If is turned on, any images found with magnifications higher than 'imgsrch_mag_threshold' are\n"
 						"discarded during the image searching. See 'help imgsrch_mag_threshold' for more information\n"
 						"on the use of these commands and their pros/cons in lens modeling.\n";
+				else if (words[1]=="imgsrch_warmstart")
+					cout << "imgsrch_warmstart <on/off>\n\n"
+						"If on, the image-plane chi-square does not create the grid and search it for images on every\n"
+						"evaluation. Instead, the images found for each source in the previous evaluation are used as\n"
+						"starting points for Newton's method. The result is only accepted if every image converges to a\n"
+						"distinct root with the same parity, no image jumps to the position of a neighboring image, and\n"
+						"the previous solution had at least as many images as the data and a complete set of parities\n"
+						"(one more positive- than negative-parity image, or equal numbers if the central image is\n"
+						"absent); otherwise (or after 'imgsrch_warmstart_refresh' consecutive warm starts) the full grid\n"
+						"search is done. Since a warm start cannot discover images created by the source crossing a\n"
+						"caustic, extra model images beyond the number of data images may be missed until the next full\n"
+						"search. The grid is only created when at least one source needs the full search, which can\n"
+						"greatly speed up fits with many sources. The first chi-square evaluation of each fit always uses\n"
+						"the full grid search.\n";
+				else if (words[1]=="imgsrch_warmstart_refresh")
+					cout << "imgsrch_warmstart_refresh <#>\n\n"
+						"Sets the maximum number of consecutive warm-started image searches for a given source before\n"
+						"a full grid search is forced (default=50). See 'help imgsrch_warmstart' for more information.\n";
 				else if (words[1]=="min_cellsize")
 					cout << "min_cellsize <#>\n\n"
 						"Specifies the minimum (average) length a cell can have and still be split (e.g. around\n"
@@ -1975,6 +2063,30 @@ void QLens::process_commands(bool read_file)
 						"Set the background image pixel noise, which is the dispersion in the surface brightness of each pixel.\n"
 						"Note that if a noise map is loaded using 'sbmap load_noisemap', then QLens will use only the noise\n"
 						"map and bg_pixel_noise will be ignored.\n";
+				else if (words[1]=="correlated_noise")
+					cout << "correlated_noise <on/off>\n\n"
+						"If on, the pixel noise is modeled as stationary correlated noise, with covariance C = S*Xi*S where S is\n"
+						"the pixel noise (from the noise map or 'bg_pixel_noise') and Xi is the noise correlation kernel, set by\n"
+						"either 'noise_corr_kernel' or 'noise_corr_length'. The inverse covariance is applied via a compact\n"
+						"whitening kernel (generated from the power spectrum of Xi), so the Fmatrix stays sparse. This is\n"
+						"appropriate for drizzled images, where the noise is correlated between neighboring pixels.\n";
+				else if (words[1]=="noise_corr_length")
+					cout << "noise_corr_length <length>\n\n"
+						"Set the width (in pixels) of the Gaussian noise correlation kernel, which is used for 'correlated_noise'\n"
+						"if no correlation kernel has been loaded with 'noise_corr_kernel'.\n";
+				else if (words[1]=="noise_corr_kernel")
+					cout << "noise_corr_kernel <filename>\n"
+						"noise_corr_kernel clear\n\n"
+						"Load the noise correlation kernel from a text file, which gives the kernel dimensions 'nx ny' followed\n"
+						"by the nx*ny kernel values (in the same order as surface brightness data files). The kernel is\n"
+						"normalized so that its central value is 1. Use 'clear' to remove the kernel, in which case the\n"
+						"Gaussian kernel set by 'noise_corr_length' is used instead.\n";
+				else if (words[1]=="whitening_threshold")
+					cout << "whitening_threshold <threshold>\n\n"
+						"Threshold used to generate the noise whitening kernel for 'correlated_noise'. The power spectrum of the\n"
+						"correlation kernel is floored at this fraction of its maximum (which limits the amplification of noise at\n"
+						"high frequencies), and the whitening kernel is truncated where it falls below this fraction of its central\n"
+						"value. A smaller threshold is more accurate, but gives a wider (and hence less sparse) kernel.\n";
 				else if (words[1]=="simulate_pixel_noise")
 					cout << "simulate_pixel_noise <on/off>\n\n"
 						"If on, add random Gaussian pixel noise to lensed pixel images (produced by the 'sbmap plotimg' command),\n"
@@ -2106,6 +2218,8 @@ void QLens::process_commands(bool read_file)
 					cout << "imgsep_threshold = " << redundancy_separation_threshold << endl;
 					cout << "imgsrch_mag_threshold = " << newton_magnification_threshold << endl;
 					cout << "reject_himag: " << display_switch(reject_himag_images) << endl;
+					cout << "imgsrch_warmstart: " << display_switch(warm_start_image_search) << endl;
+					cout << "imgsrch_warmstart_refresh = " << warm_start_refresh_interval << endl;
 					cout << "rmin_frac = " << rmin_frac << endl;
 					cout << "galsubgrid: " << display_switch(subgrid_around_perturbers) << endl;
 					cout << "galsub_radius = " << galsubgrid_radius_fraction << endl;
@@ -2139,7 +2253,14 @@ void QLens::process_commands(bool read_file)
 					if (data_pixel_size < 0) cout << "data_pixel_size: not specified\n";
 					else cout << "data_pixel_size: " << data_pixel_size << endl;
 					cout << "bg_pixel_noise = " << background_pixel_noise << endl;
+					cout << "correlated_noise: " << display_switch(correlated_noise) << endl;
+					if (noise_corr_kernel != NULL) cout << "noise_corr_kernel: " << noise_corr_npixels_x << "x" << noise_corr_npixels_y << " pixels" << endl;
+					else cout << "noise_corr_length = " << noise_corr_length << endl;
+					cout << "whitening_threshold = " << whitening_threshold << endl;
 					cout << "inversion_nthreads = " << inversion_nthreads << endl;
+					cout << "cg_logdet_probes = " << cg_logdet_nprobes << endl;
+					cout << "cg_logdet_steps = " << cg_logdet_lanczos_steps << endl;
+					cout << "cg_logdet_tol = " << cg_logdet_tol << endl;
 					cout << "lum_weighted_regularization: " << display_switch(use_lum_weighted_regularization) << endl;
 					cout << "dist_weighted_regularization: " << display_switch(use_distance_weighted_regularization) << endl;
 					cout << "mag_weighted_regularization: " << display_switch(use_mag_weighted_regularization) << endl;
@@ -2182,10 +2303,11 @@ void QLens::process_commands(bool read_file)
 					cout << "vary_wl_shearfac: " << display_switch(vary_wl_shear_factor_parameter) << endl;
 					cout << endl;
 					cout << "\033[4mOptimization and Monte Carlo sampler settings\033[0m\n";
-					cout << "fit method: " << ((fitmethod==POWELL) ? "powell\n" : (fitmethod==SIMPLEX) ? "simplex\n" : (fitmethod==NESTED_SAMPLING) ? "nest\n" : (fitmethod==TWALK) ? "twalk" : (fitmethod==POLYCHORD) ? "polychord" : (fitmethod==MULTINEST) ? "multinest" : "Unknown fitmethod\n");
+					cout << "fit method: " << ((fitmethod==POWELL) ? "powell\n" : (fitmethod==SIMPLEX) ? "simplex\n" : (fitmethod==QUASI_NEWTON) ? "lbfgs\n" : (fitmethod==NESTED_SAMPLING) ? "nest\n" : (fitmethod==TWALK) ? "twalk" : (fitmethod==POLYCHORD) ? "polychord" : (fitmethod==MULTINEST) ? "multinest" : "Unknown fitmethod\n");
 					cout << "fit source_mode: " << ((source_fit_mode==Point_Source) ? "ptsource\n" : (source_fit_mode==Cartesian_Source) ? "cartesian\n" : (source_fit_mode==Delaunay_Source) ? "delaunay" : (source_fit_mode==Parameterized_Source) ? "sbprofile\n" : (source_fit_mode==Shapelet_Source) ? "shapelet\n" : "unknown\n");
 					cout << "nrepeat = " << n_repeats << endl;
 					cout << "find_errors: " << display_switch(calculate_parameter_errors) << endl;
+					cout << "fisher_analytic_grad: " << display_switch(fisher_analytic_gradient) << endl;
 					cout << "simplex_nmax = " << simplex_nmax << endl;
 					cout << "simplex_nmax_anneal = " << simplex_nmax_anneal << endl;
 					cout << "simplex_minchisq = " << simplex_minchisq << endl;
@@ -2194,6 +2316,10 @@ void QLens::process_commands(bool read_file)
 					cout << "simplex_tempf = " << simplex_temp_final << endl;
 					cout << "simplex_cooling_factor = " << simplex_cooling_factor << endl;
 					cout << "simplex_show_bestfit: " << display_switch(simplex_show_bestfit) << endl;
+					cout << "parallel_minimizer: " << display_switch(use_parallel_minimizer) << endl;
+					cout << "chisqscan_refine = " << chisqscan_nrefine << endl;
+					cout << "chisqscan_dchisq = " << chisqscan_dchisq << endl;
+					cout << "chisqscan_profile: " << display_switch(chisqscan_profile) << endl;
 					if (data_info.empty()) cout << "data_info: none\n";
 					else cout << "data_info: '" << data_info << "'\n";
 					if (chain_info.empty()) cout << "chain_info: none\n";
@@ -2206,7 +2332,9 @@ void QLens::process_commands(bool read_file)
 					cout << "polychord_nrepeats = " << polychord_nrepeats << endl;
 					cout << "mcmc_chains = " << mcmc_threads << endl;
 					cout << "mcmctol = " << mcmc_tolerance << endl;
+					cout << "mcmc_ess = " << mcmc_target_ess << endl;
 					cout << "mcmc_logfile: " << display_switch(mcmc_logfile) << endl;
+					cout << "mcmc_checkpoint = " << mcmc_checkpoint_interval << endl;
 					cout << "random_seed = " << get_random_seed() << endl;
 					cout << "chisqlog: " << display_switch(open_chisq_logfile) << endl;
 					cout << endl;
@@ -2232,6 +2360,8 @@ void QLens::process_commands(bool read_file)
 					else if (LensProfile::integral_method==Gauss_Patterson_Quadrature) cout << "integral_method: Gauss-Patterson quadrature" << endl;
 					else if (LensProfile::integral_method==Gaussian_Quadrature) cout << "integral_method: Gaussian quadrature with " << Gauss_NN << " points" << endl;
 					cout << "integral_tolerance = " << integral_tolerance << endl;
+					if (perturber_tree_theta==0) cout << "perturber_tree_theta: off" << endl;
+					else cout << "perturber_tree_theta = " << perturber_tree_theta << endl;
 					cout << "major_axis_along_y: " << display_switch(LensProfile::orient_major_axis_north) << endl;
 					cout << "ellipticity_components: " << display_switch(LensProfile::use_ellipticity_components) << endl;
 					cout << "shear_components: " << display_switch(Shear::use_shear_component_params) << endl;
@@ -7143,6 +7273,7 @@ void QLens::process_commands(bool read_file)
 						if (mpi_id==0) {
 							if (fitmethod==POWELL) cout << "Fit method: powell" << endl;
 							else if (fitmethod==SIMPLEX) cout << "Fit method: simplex" << endl;
+							else if (fitmethod==QUASI_NEWTON) cout << "Fit method: lbfgs" << endl;
 							else if (fitmethod==NESTED_SAMPLING) cout << "Fit method: nest" << endl;
 							else if (fitmethod==POLYCHORD) cout << "Fit method: polychord" << endl;
 							else if (fitmethod==MULTINEST) cout << "Fit method: multinest" << endl;
@@ -7155,6 +7286,7 @@ void QLens::process_commands(bool read_file)
 						if (!(ws[2] >> setword)) Complain("invalid argument to 'fit method' command; must specify valid fit method");
 						if (setword=="powell") set_fitmethod(POWELL);
 						else if (setword=="simplex") set_fitmethod(SIMPLEX);
+						else if (setword=="lbfgs") set_fitmethod(QUASI_NEWTON);
 						else if (setword=="nest") set_fitmethod(NESTED_SAMPLING);
 						else if (setword=="twalk") set_fitmethod(TWALK);
 						else if (setword=="polychord") {
@@ -7653,6 +7785,22 @@ void QLens::process_commands(bool read_file)
 						plot_chisq_1d(p,n,ip,fp,filename);
 					} else Complain("invalid number of parameters for command 'fit plot_chisq1d' (need parameter#,npoints,initial,final)");
 				}
+				else if (words[1]=="plot_chisq2d")
+				{
+					if (nwords == 10) {
+						int p1,p2,n1,n2;
+						double i1,f1,i2,f2;
+						if (!(ws[2] >> p1)) Complain("invalid first parameter number");
+						if (!(ws[3] >> p2)) Complain("invalid second parameter number");
+						if (!(ws[4] >> n1)) Complain("invalid number of cells for first parameter");
+						if (!(ws[5] >> i1)) Complain("invalid initial value for first parameter");
+						if (!(ws[6] >> f1)) Complain("invalid final value for first parameter");
+						if (!(ws[7] >> n2)) Complain("invalid number of cells for second parameter");
+						if (!(ws[8] >> i2)) Complain("invalid initial value for second parameter");
+						if (!(ws[9] >> f2)) Complain("invalid final value for second parameter");
+						plot_chisq_2d(p1,p2,n1,i1,f1,n2,i2,f2);
+					} else Complain("invalid number of parameters for command 'fit plot_chisq2d' (need param1#,param2#,n1,initial1,final1,n2,initial2,final2)");
+				}
 				else if (words[1]=="mkposts")
 				{
 					bool copy_subplot_only = false;
@@ -7748,22 +7896,23 @@ void QLens::process_commands(bool read_file)
 					}
 					if ((make_imgdata) and ((!calculate_parameter_errors) or (no_errors))) Complain("parameter uncertainties required to generate image data from best-fit points");
 					if ((skip_run) and ((fitmethod != MULTINEST) and (fitmethod != POLYCHORD))) Complain("cannot process chains unless Polychord or Multinest is being used");
-					if ((resume) and ((fitmethod != MULTINEST) and (fitmethod != POLYCHORD))) Complain("cannot resume unless Polychord or Multinest is being used");
-					if ((make_imgdata) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX))) Complain("cannot make imgdata unless Powell or Simplex is being used");
+					if ((resume) and ((fitmethod != MULTINEST) and (fitmethod != POLYCHORD) and (fitmethod != NESTED_SAMPLING) and (fitmethod != TWALK))) Complain("cannot resume unless a nested sampler or T-Walk is being used");
+					if ((make_imgdata) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX) and (fitmethod != QUASI_NEWTON))) Complain("cannot make imgdata unless Powell, Simplex or L-BFGS is being used");
 					if ((make_imgdata) and (no_errors)) Complain("Errors must be turned on to make image data from fit");
 					bool old_error_setting;
-					if ((no_errors) and ((fitmethod==POWELL) or (fitmethod==SIMPLEX))) {
+					if ((no_errors) and ((fitmethod==POWELL) or (fitmethod==SIMPLEX) or (fitmethod==QUASI_NEWTON))) {
 						old_error_setting = calculate_parameter_errors;
 						calculate_parameter_errors = false;
 					}
 					if (fitmethod==POWELL) chi_square_fit_powell();
 					else if (fitmethod==SIMPLEX) chi_square_fit_simplex();
-					else if (fitmethod==NESTED_SAMPLING) nested_sampling();
+					else if (fitmethod==QUASI_NEWTON) chi_square_fit_lbfgs();
+					else if (fitmethod==NESTED_SAMPLING) nested_sampling(resume);
 					else if (fitmethod==POLYCHORD) polychord(resume,skip_run);
 					else if (fitmethod==MULTINEST) multinest(resume,skip_run);
-					else if (fitmethod==TWALK) chi_square_twalk();
+					else if (fitmethod==TWALK) chi_square_twalk(resume);
 					else Complain("unsupported fit method");
-					if ((no_errors) and ((fitmethod==POWELL) or (fitmethod==SIMPLEX))) calculate_parameter_errors = old_error_setting;
+					if ((no_errors) and ((fitmethod==POWELL) or (fitmethod==SIMPLEX) or (fitmethod==QUASI_NEWTON))) calculate_parameter_errors = old_error_setting;
 					if ((adopt_bestfit) and (adopt_model(bestfitparams)==false)) Complain("could not adopt best-fit model");
 					if (make_imgdata) {
 						int param_num, npar=0;
@@ -8341,13 +8490,13 @@ void QLens::process_commands(bool read_file)
 						if (!testbf.is_open()) Complain("best-fit lens model file '" << scriptfile_str << "' could not be opened");
 						string checklimits;
 						testbf >> checklimits;
-						if ((checklimits=="#limits") and ((fitmethod==SIMPLEX) or (fitmethod==POWELL))) {
+						if ((checklimits=="#limits") and ((fitmethod==SIMPLEX) or (fitmethod==POWELL) or (fitmethod==QUASI_NEWTON))) {
 							if (nwords==3) {
 								if (auto_fit_output_dir) scriptfile_str = "chains_" + words[2] + "/" + words[2] + "_bf_nolimits.in";
 								else scriptfile_str = fit_output_dir + "/" + words[2] + "_bf_nolimits.in";
 							}
 							else scriptfile_str = fit_output_dir + "/" + fit_output_filename + "_bf_nolimits.in";
-						} else if ((checklimits=="#nolimits") and ((fitmethod != SIMPLEX) and (fitmethod != POWELL))) {
+						} else if ((checklimits=="#nolimits") and ((fitmethod != SIMPLEX) and (fitmethod != POWELL) and (fitmethod != QUASI_NEWTON))) {
 							Complain("The best-fit model did not have parameter limits defined. Switch to simplex or powell and try again");
 						}
 						testbf.close();
@@ -8560,8 +8709,11 @@ void QLens::process_commands(bool read_file)
 					if (nwords != 3) Complain("One argument required for 'wldata read' (filename)");
 					if (load_weak_lensing_data(words[2])==false) Complain("unable to load weak lensing data");
 				} else if (words[1]=="write") {
-					if (nwords != 3) Complain("One argument required for 'wldata write' (filename)");
-					weak_lensing_data.write_to_file(words[2]);
+					if ((nwords != 3) and (nwords != 4)) Complain("One argument required for 'wldata write' (filename), plus optional 'binary' argument");
+					if (nwords==4) {
+						if (words[3] != "binary") Complain("invalid argument to 'wldata write'; second argument can only be 'binary'");
+						if (!weak_lensing_data.write_to_binary_file(words[2])) Complain("could not write weak lensing binary file");
+					} else weak_lensing_data.write_to_file(words[2]);
 				} else if (words[1]=="plot") {
 					if (nwords > 3) Complain("Only 0 or 1 arguments allowed for 'wldata plot'");
 					string filename = "shear.dat";
@@ -11557,6 +11709,15 @@ void QLens::process_commands(bool read_file)
 				set_switch(calculate_parameter_errors,setword);
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="fisher_analytic_grad")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Use analytic chi-square gradients for Fisher matrix: " << display_switch(fisher_analytic_gradient) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'fisher_analytic_grad' command; must specify 'on' or 'off'");
+				set_switch(fisher_analytic_gradient,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
 		else if (words[0]=="central_image")
 		{
 			if (nwords==1) {
@@ -11629,10 +11790,11 @@ void QLens::process_commands(bool read_file)
 					if (cosmo.get_n_vary_params()==0) lens_list[i]->update_cosmology_meta_parameters(true); // if the cosmology has changed, update cosmology info and any parameters that depend on them (this forces the issue even if cosmo params aren't being varied as fit parameters; otherwise will be done on next line)
 					lens_list[i]->update_meta_parameters(); // if the cosmology has changed, update cosmology info and any parameters that depend on them 
 				}
+				clear_perturber_trees(); // perturber masses can depend on the cosmology (e.g. if parametrized by m200)
 				cosmo.get_specific_varyflag("hubble",vary_hub);
 				//hubbleatter = hub;
 				//cosmo.set_cosmology(hubbleatter,0.04,hubble,2.215);
-				if ((vary_hub) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX))) {
+				if ((vary_hub) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX) and (fitmethod != QUASI_NEWTON))) {
 					if (mpi_id==0) cout << "Limits for hubble parameter:\n";
 					if (read_command(false)==false) return;
 					double hmin,hmax;
@@ -11669,7 +11831,7 @@ void QLens::process_commands(bool read_file)
 				//if (!(ws[1] >> h0param)) Complain("invalid hubble setting");
 				//hubble = h0param;
 				//cosmo.set_cosmology(omega_matter,0.04,hubble,2.215);
-				//if ((vary_hubble_parameter) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX))) {
+				//if ((vary_hubble_parameter) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX) and (fitmethod != QUASI_NEWTON))) {
 					//if (mpi_id==0) cout << "Limits for Hubble parameter:\n";
 					//if (read_command(false)==false) return;
 					//double hmin,hmax;
@@ -11706,10 +11868,11 @@ void QLens::process_commands(bool read_file)
 					if (cosmo.get_n_vary_params()==0) lens_list[i]->update_cosmology_meta_parameters(true); // if the cosmology has changed, update cosmology info and any parameters that depend on them (this forces the issue even if cosmo params aren't being varied as fit parameters; otherwise will be done on next line)
 					lens_list[i]->update_meta_parameters(); // if the cosmology has changed, update cosmology info and any parameters that depend on them 
 				}
+				clear_perturber_trees(); // perturber masses can depend on the cosmology (e.g. if parametrized by m200)
 				cosmo.get_specific_varyflag("omega_m",vary_om);
 				//omega_matter = om;
 				//cosmo.set_cosmology(omega_matter,0.04,hubble,2.215);
-				if ((vary_om) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX))) {
+				if ((vary_om) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX) and (fitmethod != QUASI_NEWTON))) {
 					if (mpi_id==0) cout << "Limits for omega_m parameter:\n";
 					if (read_command(false)==false) return;
 					double omin,omax;
@@ -11745,7 +11908,7 @@ void QLens::process_commands(bool read_file)
 			if (nwords == 2) {
 				if (!(ws[1] >> syserrparam)) Complain("invalid syserr_pos setting");
 				syserr_pos = syserrparam;
-				if ((vary_syserr_pos_parameter) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX))) {
+				if ((vary_syserr_pos_parameter) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX) and (fitmethod != QUASI_NEWTON))) {
 					if (mpi_id==0) cout << "Limits for systematic error parameter:\n";
 					if (read_command(false)==false) return;
 					double sigmin,sigmax;
@@ -11776,7 +11939,7 @@ void QLens::process_commands(bool read_file)
 			if (nwords == 2) {
 				if (!(ws[1] >> syserrparam)) Complain("invalid wl_shearfac setting");
 				wl_shear_factor = syserrparam;
-				if ((vary_wl_shear_factor_parameter) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX))) {
+				if ((vary_wl_shear_factor_parameter) and ((fitmethod != POWELL) and (fitmethod != SIMPLEX) and (fitmethod != QUASI_NEWTON))) {
 					if (mpi_id==0) cout << "Limits for weak lensing scale factor parameter:\n";
 					if (read_command(false)==false) return;
 					double sigmin,sigmax;
@@ -11904,6 +12067,28 @@ void QLens::process_commands(bool read_file)
 				set_switch(reject_himag_images,setword);
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="imgsrch_warmstart")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Warm-start image searches from the previous images during fits: " << display_switch(warm_start_image_search) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'imgsrch_warmstart' command; must specify 'on' or 'off'");
+				set_switch(warm_start_image_search,setword);
+				warm_start_images.clear();
+				n_warm_start_evals.clear();
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="imgsrch_warmstart_refresh")
+		{
+			int nrefresh;
+			if (nwords == 2) {
+				if (!(ws[1] >> nrefresh)) Complain("invalid imgsrch_warmstart_refresh setting");
+				if (nrefresh < 1) Complain("imgsrch_warmstart_refresh must be at least 1");
+				warm_start_refresh_interval = nrefresh;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Maximum number of consecutive warm-started image searches: imgsrch_warmstart_refresh = " << warm_start_refresh_interval << endl;
+			} else Complain("must specify either zero or one argument for imgsrch_warmstart_refresh");
+		}
 		else if (words[0]=="reject_img_outside_cell")
 		{
 			if (nwords==1) {
@@ -11923,7 +12108,6 @@ void QLens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "chi-square required accuracy = " << chisq_tolerance << endl;
 			} else Complain("must specify either zero or one argument (required chi-square precision)");
 		}
-		/*
 		else if (words[0]=="chisqtol_lumreg")
 		{
 			double tol;
@@ -11934,7 +12118,6 @@ void QLens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "chi-square tolerance for convergence of luminosity regularization = " << chisqtol_lumreg << endl;
 			} else Complain("must specify either zero or one argument for chisqtol_lumreg");
 		}
-		*/
 		else if (words[0]=="lumreg_max_it")
 		{
 			int maxit;
@@ -12437,6 +12620,17 @@ void QLens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "MCMC tolerance = " << mcmc_tolerance << endl;
 			} else Complain("must specify either zero or one argument (tolerance for MCMC)");
 		}
+		else if (words[0]=="mcmc_ess")
+		{
+			double ess;
+			if (nwords == 2) {
+				if (!(ws[1] >> ess)) Complain("invalid target effective sample size for MCMC");
+				if (ess < 0) Complain("target effective sample size cannot be negative");
+				mcmc_target_ess = ess;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "MCMC target effective sample size = " << mcmc_target_ess << " (0 = no ESS requirement)" << endl;
+			} else Complain("must specify either zero or one argument (target effective sample size for MCMC)");
+		}
 		else if (words[0]=="mcmclog")
 		{
 			if (nwords==1) {
@@ -12446,6 +12640,17 @@ void QLens::process_commands(bool read_file)
 				set_switch(mcmc_logfile,setword);
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="mcmc_checkpoint")
+		{
+			int interval;
+			if (nwords == 2) {
+				if (!(ws[1] >> interval)) Complain("invalid number of iterations between checkpoints");
+				if (interval < 0) Complain("number of iterations between checkpoints cannot be negative");
+				mcmc_checkpoint_interval = interval;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Iterations between sampler checkpoints = " << mcmc_checkpoint_interval << " (0 = no checkpoints)" << endl;
+			} else Complain("must specify either zero or one argument (number of iterations between checkpoints)");
+		}
 		else if (words[0]=="chisqlog")
 		{
 			if (nwords==1) {
@@ -12464,6 +12669,46 @@ void QLens::process_commands(bool read_file)
 				set_switch(simplex_show_bestfit,setword);
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="parallel_minimizer")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Divide trial points of simplex/Powell minimization between MPI groups: " << display_switch(use_parallel_minimizer) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'parallel_minimizer' command; must specify 'on' or 'off'");
+				set_switch(use_parallel_minimizer,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="chisqscan_refine")
+		{
+			int nref;
+			if (nwords == 2) {
+				if (!(ws[1] >> nref)) Complain("invalid chisqscan_refine setting");
+				if (nref < 0) Complain("chisqscan_refine cannot be negative");
+				chisqscan_nrefine = nref;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Number of refinement levels for chi-square scans = " << chisqscan_nrefine << endl;
+			} else Complain("must specify either zero or one argument for chisqscan_refine");
+		}
+		else if (words[0]=="chisqscan_dchisq")
+		{
+			double dchisq;
+			if (nwords == 2) {
+				if (!(ws[1] >> dchisq)) Complain("invalid chisqscan_dchisq setting");
+				if (dchisq <= 0) Complain("chisqscan_dchisq must be greater than zero");
+				chisqscan_dchisq = dchisq;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Chi-square scans refine cells within delta-chisq = " << chisqscan_dchisq << " of the minimum" << endl;
+			} else Complain("must specify either zero or one argument for chisqscan_dchisq");
+		}
+		else if (words[0]=="chisqscan_profile")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Minimize over remaining free parameters during chi-square scans: " << display_switch(chisqscan_profile) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'chisqscan_profile' command; must specify 'on' or 'off'");
+				set_switch(chisqscan_profile,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
 		else if (words[0]=="psf_mpi")
 		{
 			if (nwords==1) {
@@ -13443,6 +13688,80 @@ void QLens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "background image pixel surface brightness dispersion = " << background_pixel_noise << endl;
 			} else Complain("must specify either zero or one argument (background image pixel surface brightness dispersion)");
 		}
+		else if (words[0]=="correlated_noise")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Use correlated pixel noise model: " << display_switch(correlated_noise) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'correlated_noise' command; must specify 'on' or 'off'");
+				bool corr_noise;
+				set_switch(corr_noise,setword);
+				if ((corr_noise) and (noise_corr_kernel==NULL) and (noise_corr_length <= 0)) Complain("noise correlation kernel must be loaded (with 'noise_corr_kernel') or 'noise_corr_length' must be set first");
+				correlated_noise = corr_noise;
+				if (correlated_noise) {
+					if (!generate_noise_whitening_kernel(mpi_id==0)) {
+						correlated_noise = false;
+						Complain("could not generate noise whitening kernel");
+					}
+				} else delete_whitening_kernel();
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="noise_corr_length")
+		{
+			double corr_length;
+			if (nwords == 2) {
+				if (!(ws[1] >> corr_length)) Complain("invalid noise correlation length");
+				if (corr_length < 0) Complain("noise correlation length cannot be negative");
+				noise_corr_length = corr_length;
+				delete_whitening_kernel();
+				if ((correlated_noise) and (noise_corr_kernel==NULL)) {
+					if (noise_corr_length==0) {
+						correlated_noise = false;
+						if (mpi_id==0) cout << "NOTE: noise correlation length is zero, so correlated_noise has been turned off" << endl;
+					}
+					else if (!generate_noise_whitening_kernel(mpi_id==0)) Complain("could not generate noise whitening kernel");
+				}
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Noise correlation length (in pixels) = " << noise_corr_length << endl;
+			} else Complain("must specify either zero or one argument (noise correlation length in pixels)");
+		}
+		else if (words[0]=="noise_corr_kernel")
+		{
+			if (nwords == 2) {
+				if (words[1]=="clear") {
+					delete_noise_corr_kernel();
+					delete_whitening_kernel();
+					if (correlated_noise) {
+						if (noise_corr_length <= 0) {
+							correlated_noise = false;
+							if (mpi_id==0) cout << "NOTE: no noise correlation kernel or length has been set, so correlated_noise has been turned off" << endl;
+						}
+						else if (!generate_noise_whitening_kernel(mpi_id==0)) Complain("could not generate noise whitening kernel");
+					}
+				} else {
+					if (!load_noise_corr_kernel(words[1])) Complain("could not load noise correlation kernel from file '" << words[1] << "'");
+					if ((correlated_noise) and (!generate_noise_whitening_kernel(mpi_id==0))) Complain("could not generate noise whitening kernel");
+				}
+			} else if (nwords==1) {
+				if (mpi_id==0) {
+					if (noise_corr_kernel==NULL) cout << "No noise correlation kernel has been loaded" << endl;
+					else cout << "Noise correlation kernel: " << noise_corr_npixels_x << "x" << noise_corr_npixels_y << " pixels" << endl;
+				}
+			} else Complain("must specify either zero or one argument (filename for noise correlation kernel, or 'clear')");
+		}
+		else if (words[0]=="whitening_threshold")
+		{
+			double threshold;
+			if (nwords == 2) {
+				if (!(ws[1] >> threshold)) Complain("invalid whitening threshold");
+				if ((threshold <= 0) or (threshold >= 1)) Complain("whitening threshold must be greater than 0 and less than 1");
+				whitening_threshold = threshold;
+				delete_whitening_kernel();
+				if ((correlated_noise) and (!generate_noise_whitening_kernel(mpi_id==0))) Complain("could not generate noise whitening kernel");
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Noise whitening kernel threshold = " << whitening_threshold << endl;
+			} else Complain("must specify either zero or one argument (noise whitening kernel threshold)");
+		}
 		else if (words[0]=="simulate_pixel_noise")
 		{
 			if (nwords==1) {
@@ -13851,6 +14170,27 @@ void QLens::process_commands(bool read_file)
 				set_switch(use_dualtree_kmeans,setword);
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="native_kmeans")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Use built-in k-means algorithm for clustering (instead of mlpack): " << display_switch(use_native_kmeans) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'native_kmeans' command; must specify 'on' or 'off'");
+#ifndef USE_MLPACK
+				if (setword=="off") Complain("qlens must be compiled with mlpack (-DUSE_MLPACK) to use mlpack k-means algorithm");
+#endif
+				set_switch(use_native_kmeans,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="kmeans_warm_start")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Warm-start k-means clustering from centroids of previous evaluation: " << display_switch(kmeans_warm_start) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'kmeans_warm_start' command; must specify 'on' or 'off'");
+				set_switch(kmeans_warm_start,setword);
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
 		else if (words[0]=="clustering_rand_init")
 		{
 			if (nwords==1) {
@@ -13902,6 +14242,7 @@ void QLens::process_commands(bool read_file)
 			} else if (nwords==2) {
 				if (!(ws[1] >> setword)) Complain("invalid argument to 'PSF supersampling' command; must specify 'on' or 'off'");
 				if ((setword=="on") and (!split_imgpixels)) Complain("cannot use PSF supersampling unless 'split_imgpixels' is set to 'on'");
+				if ((setword=="on") and (adaptive_imgpixel_split)) Complain("cannot use PSF supersampling if 'adaptive_imgpixel_split' is set to 'on'");
 				bool ss_orig = psf_supersampling;
 				set_switch(psf_supersampling,setword);
 				if (psf_supersampling != ss_orig) {
@@ -13935,6 +14276,44 @@ void QLens::process_commands(bool read_file)
 				}
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="adaptive_imgpixel_split")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) cout << "Split image pixels adaptively to meet imgpixel_split_tolerance: " << display_switch(adaptive_imgpixel_split) << endl;
+			} else if (nwords==2) {
+				if (!(ws[1] >> setword)) Complain("invalid argument to 'adaptive_imgpixel_split' command; must specify 'on' or 'off'");
+				if ((setword=="on") and (psf_supersampling)) Complain("cannot use adaptive pixel splitting if 'psf_supersampling' is set to 'on'");
+				set_switch(adaptive_imgpixel_split,setword);
+				if (image_pixel_grids != NULL) {
+					for (int i=0; i < n_extended_src_redshifts; i++) {
+						if (image_pixel_grids[i] != NULL) {
+							image_pixel_grids[i]->delete_ray_tracing_arrays();
+							image_pixel_grids[i]->setup_ray_tracing_arrays();
+							if (nlens > 0) image_pixel_grids[i]->calculate_sourcepts_and_areas(true);
+						}
+					}
+				}
+			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
+		}
+		else if (words[0]=="imgpixel_split_tolerance")
+		{
+			if (nwords == 2) {
+				double tol;
+				if (!(ws[1] >> tol)) Complain("invalid tolerance for adaptive image pixel splitting");
+				imgpixel_split_tolerance = tol;
+				if ((adaptive_imgpixel_split) and (image_pixel_grids != NULL)) {
+					for (int i=0; i < n_extended_src_redshifts; i++) {
+						if (image_pixel_grids[i] != NULL) {
+							image_pixel_grids[i]->delete_ray_tracing_arrays();
+							image_pixel_grids[i]->setup_ray_tracing_arrays();
+							if (nlens > 0) image_pixel_grids[i]->calculate_sourcepts_and_areas(true);
+						}
+					}
+				}
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "tolerance for adaptive image pixel splitting = " << imgpixel_split_tolerance << " (times pixel noise)" << endl;
+			} else Complain("must specify either zero or one argument (tolerance for adaptive image pixel splitting)");
+		}
 		else if (words[0]=="delaunay_from_pixel_centers")
 		{
 			if (nwords==1) {
@@ -14103,6 +14482,22 @@ void QLens::process_commands(bool read_file)
 				set_switch(multithread_perturber_deflections,setword);
 			} else Complain("invalid number of arguments; can only specify 'on' or 'off'");
 		}
+		else if (words[0]=="perturber_tree_theta")
+		{
+			if (nwords==1) {
+				if (mpi_id==0) {
+					if (perturber_tree_theta==0) cout << "Perturber tree: off" << endl;
+					else cout << "Perturber tree opening angle = " << perturber_tree_theta << endl;
+				}
+			} else if (nwords==2) {
+				double theta;
+				if (words[1]=="off") theta = 0;
+				else if (!(ws[1] >> theta)) Complain("invalid opening angle for perturber tree");
+				if ((theta < 0) or (theta >= 1)) Complain("perturber tree opening angle must be between 0 and 1 (or 0/'off' to turn the tree off)");
+				perturber_tree_theta = theta;
+				clear_perturber_trees();
+			} else Complain("must specify either zero or one argument for perturber_tree_theta");
+		}
 		else if (words[0]=="inversion_nthreads")
 		{
 			if (nwords == 2) {
@@ -14113,6 +14508,42 @@ void QLens::process_commands(bool read_file)
 				if (mpi_id==0) cout << "inversion # of threads = " << inversion_nthreads << endl;
 			} else Complain("must specify either zero or one argument (number of threads for inversion)");
 		}
+		else if (words[0]=="cg_logdet_probes")
+		{
+			if (nwords == 2) {
+				int np;
+				if (!(ws[1] >> np)) Complain("invalid number of probes");
+				if (np < 0) Complain("number of probes cannot be negative");
+				cg_logdet_nprobes = np;
+			} else if (nwords==1) {
+				if (mpi_id==0) {
+					if (cg_logdet_nprobes==0) cout << "CG log-determinant probes = 0 (exact Lanczos recursion)" << endl;
+					else cout << "CG log-determinant probes = " << cg_logdet_nprobes << endl;
+				}
+			} else Complain("must specify either zero or one argument (number of probes for stochastic log-determinants)");
+		}
+		else if (words[0]=="cg_logdet_steps")
+		{
+			if (nwords == 2) {
+				int ns;
+				if (!(ws[1] >> ns)) Complain("invalid number of Lanczos steps");
+				if (ns < 1) Complain("number of Lanczos steps must be at least 1");
+				cg_logdet_lanczos_steps = ns;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "max Lanczos steps for CG log-determinants = " << cg_logdet_lanczos_steps << endl;
+			} else Complain("must specify either zero or one argument (max number of Lanczos steps per probe)");
+		}
+		else if (words[0]=="cg_logdet_tol")
+		{
+			if (nwords == 2) {
+				double tol;
+				if (!(ws[1] >> tol)) Complain("invalid tolerance");
+				if (tol <= 0) Complain("tolerance must be positive");
+				cg_logdet_tol = tol;
+			} else if (nwords==1) {
+				if (mpi_id==0) cout << "Lanczos tolerance for CG log-determinants = " << cg_logdet_tol << endl;
+			} else Complain("must specify either zero or one argument (Lanczos tolerance)");
+		}
 		else if (words[0]=="raytrace_method") {
 			if (nwords==1) {
 				if (mpi_id==0) {
@@ -10,6 +10,10 @@
 #include "errors.h"
 #include "brent.h"
 #include "cosmo.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
 using namespace std;
 
 const double Cosmology::default_k_pivot = 0.05;
@@ -116,6 +120,13 @@ void Cosmology::setup_parameters(const bool initial_setup)
 		// default initial values
 		omega_m = 0.3;
 		hubble = 0.7;
+		distance_table_omega_m = -1; // ensures the distance table gets built the first time set_cosmology is called
+		distance_table_omega_lambda = -1;
+		distance_table_id = 0;
+		n_zcache = 0;
+		zcache_next = 0;
+		normalize_power_by_sigma8 = true;
+		power_spectrum_normalized = false;
 
 		setup_parameter_arrays(2);
 	} else {
@@ -250,18 +261,27 @@ int Cosmology::set_cosmology(double omega_matter, double omega_baryon, double ne
 	alpha_gamma = sqrt(alpha_nu);
 	beta_c = 1/(1-0.949*f_bnu);
 
-	if (normalize_by_sigma8) {
-		double sig8 = rms_sigma8();
-		variance_normalization *= SQR(default_sigma8/sig8); // enforce sigma8 = 0.8 as temporary fix... need to understand why A_s giving crazy sigma8
-		power_k_normalization = variance_normalization*(2*M_PI*M_PI);
-	}
+	// The sigma8 normalization and rms sigma spline are expensive and not needed for lensing distances, so they are only
+	// computed once something asks for the power spectrum (see normalize_power_spectrum)
+	normalize_power_by_sigma8 = normalize_by_sigma8;
+	power_spectrum_normalized = false;
 
 	 spline_comoving_distance();
-	 rms_tophat_spline();
 
 	 return qwarn;
 }
 
+void Cosmology::normalize_power_spectrum()
+{
+	power_spectrum_normalized = true; // set first, since rms_sigma8() and rms_tophat_spline() call this indirectly
+	if (normalize_power_by_sigma8) {
+		double sig8 = rms_sigma8();
+		variance_normalization *= SQR(default_sigma8/sig8); // enforce sigma8 = 0.8 as temporary fix... need to understand why A_s giving crazy sigma8
+		power_k_normalization = variance_normalization*(2*M_PI*M_PI);
+	}
+	rms_tophat_spline();
+}
+
 double Cosmology::transfer_function(double kk)
 {
 	// Fitting Formulae for CDM + Baryon + Massive Neutrino (MDM) cosmologies.
@@ -379,12 +399,14 @@ double Cosmology::curvature_power_spectrum(double k)
 
 double Cosmology::matter_power_spectrum(double k)
 {
+	if (!power_spectrum_normalized) normalize_power_spectrum();
 	double logkappa = log(k/k_pivot);
 	return power_k_normalization*k*SQR(transfer_function(k))*scaled_curvature_perturbation(logkappa);
 }
 
 double Cosmology::matter_power_spectrum(double k, double z)
 {
+	if (!power_spectrum_normalized) normalize_power_spectrum();
 	double logkappa = log(k/k_pivot);
 	double redshift_factor = growth_function(1.0/(1+z))/growth_factor;
 	return power_k_normalization*SQR(redshift_factor)*k*SQR(transfer_function(k))*scaled_curvature_perturbation(logkappa);
@@ -392,12 +414,14 @@ double Cosmology::matter_power_spectrum(double k, double z)
 
 double Cosmology::variance(double k)
 {
+	if (!power_spectrum_normalized) normalize_power_spectrum();
 	double logkappa = log(k/k_pivot);
 	return variance_normalization*QUARTIC(k)*SQR(transfer_function(k))*scaled_curvature_perturbation(logkappa);
 }
 
 double Cosmology::variance(double k, double z)
 {
+	if (!power_spectrum_normalized) normalize_power_spectrum();
 	double logkappa = log(k/k_pivot);
 	double redshift_factor = growth_function(1.0/(1+z))/growth_factor;
 	return variance_normalization*SQR(redshift_factor)*QUARTIC(k)*SQR(transfer_function(k))*scaled_curvature_perturbation(logkappa);
@@ -405,6 +429,7 @@ double Cosmology::variance(double k, double z)
 
 double Cosmology::rms_sigma_tophat(const double mass, const double z) // dM/M: rms mass fluctuation of CDM halos
 {
+	if (!power_spectrum_normalized) normalize_power_spectrum();
 	double mass_fluctuation;
 	tophat_window_R = pow(3 * mass / (M_4PI*omega_m*dcrit0*CUBE(1+z)), (1.0/3.0)); // unit of length is Mpc
 
@@ -417,6 +442,7 @@ double Cosmology::rms_sigma_tophat(const double mass, const double z) // dM/M: r
 
 double Cosmology::rms_sigma8() // dM/M: rms mass fluctuation of CDM halos
 {
+	if (!power_spectrum_normalized) normalize_power_spectrum();
 	double mass_fluctuation;
 	tophat_window_R = 8.0/hubble;
 	double (Romberg::*tophat_ptr)(const double);
@@ -453,20 +479,50 @@ void Cosmology::rms_tophat_spline()
 
 void Cosmology::spline_comoving_distance(void)
 {
+	// The table is in units of the Hubble length, so it only needs to be rebuilt if omega_m or omega_lambda changes (varying
+	// the Hubble parameter just rescales the distances). Each redshift interval is integrated with Gauss-Legendre quadrature and
+	// accumulated, which is much faster than integrating from z=0 for every redshift in the table.
+	if ((omega_m==distance_table_omega_m) and (omega_lambda==distance_table_omega_lambda)) return;
+	static const int n_gl = 6;
+	static const double gl_points[n_gl] = { -0.9324695142031521, -0.6612093864662645, -0.2386191860831969, 0.2386191860831969, 0.6612093864662645, 0.9324695142031521 };
+	static const double gl_weights[n_gl] = { 0.1713244923791704, 0.3607615730950898, 0.4679139345726910, 0.4679139345726910, 0.3607615730950898, 0.1713244923791704 };
 	const int zsteps = 200;
 	dvector z_table(zsteps), d_table(zsteps);
-	int i;
-	double z, zmin, zmax, zstep;
+	int i,k;
+	double zmin, zmax, zstep, zmid, sum;
 	zmin=0, zmax=10, zstep=(zmax-zmin)/(zsteps-1);
 
-	double (Romberg::*comoving_dist_ptr)(const double);
-	comoving_dist_ptr = static_cast<double (Romberg::*)(const double)> (&Cosmology::comoving_distance_derivative);
-	for (i=0, z=zmin; i < zsteps; i++, z += zstep) {
-		z_table[i] = z;
-		d_table[i] = romberg(comoving_dist_ptr, 0, z, 1e-6, 5);
+	z_table[0] = zmin;
+	d_table[0] = 0;
+	for (i=1; i < zsteps; i++) {
+		z_table[i] = zmin + i*zstep;
+		zmid = z_table[i] - 0.5*zstep;
+		sum = 0;
+		for (k=0; k < n_gl; k++) sum += gl_weights[k]*inverse_hubble_function(zmid + 0.5*zstep*gl_points[k]);
+		d_table[i] = d_table[i-1] + 0.5*zstep*sum;
 	}
 
-	comoving_distance_spline.input(z_table, d_table);
+	scaled_comoving_distance_spline.input(z_table, d_table);
+	distance_table_omega_m = omega_m;
+	distance_table_omega_lambda = omega_lambda;
+	distance_table_id++;
+	n_zcache = 0; // the memoized distances are no longer valid
+	zcache_next = 0;
+}
+
+double Cosmology::scaled_comoving_distance(const double z)
+{
+	// Memoized lookups are only stored outside of parallel regions, so the cache can safely be read by multiple threads
+	for (int i=0; i < n_zcache; i++) if (zcache[i]==z) return dcache[i];
+	double dc = scaled_comoving_distance_spline.splint(z);
+#ifdef USE_OPENMP
+	if (omp_in_parallel()) return dc;
+#endif
+	zcache[zcache_next] = z;
+	dcache[zcache_next] = dc;
+	if (n_zcache < max_zcache) n_zcache++;
+	zcache_next = (zcache_next+1) % max_zcache;
+	return dc;
 }
 
 void Cosmology::redshift_distribution(void)
@@ -508,7 +564,7 @@ double Cosmology::angular_radius(double chi)
 
 double Cosmology::comoving_distance_derivative(const double z)
 {
-	return (hubble_length*pow(omega_m*CUBE(1+z)+(1-omega_m-omega_lambda)*SQR(1+z) + omega_lambda, -0.5));
+	return (hubble_length*inverse_hubble_function(z));
 	//return pow(1+z,-1.5);
 }
 
@@ -558,8 +614,8 @@ double Cosmology::cored_concentration_root_equation(const double c)
 double Cosmology::time_delay_factor_arcsec(double zl, double zs) // for lensing
 {
 	double dc_s, dc_l, dc_ls;    // comoving distances
-	dc_s = comoving_distance_spline.splint(zs) * 1e-3;   // The 1e3 factor converts from Mpc to Gpc 
-	dc_l = comoving_distance_spline.splint(zl) * 1e-3;
+	dc_s = comoving_distance(zs) * 1e-3;   // The 1e3 factor converts from Mpc to Gpc 
+	dc_l = comoving_distance(zl) * 1e-3;
 	if (dc_l >= dc_s) {
 		//warn("source is further away than the lensing object (zlens = %f, zsource = %f)", zl, zs);
 		return 0.0;
@@ -584,8 +640,8 @@ double Cosmology::sigma_crit_kpc(double zl, double zs) // for lensing
 {
 	double dc_s, dc_l, dc_ls;    // comoving distances
 	double da_s, da_l, da_ls;    // angular diameter distances
-	dc_s = comoving_distance_spline.splint(zs) * 1e-3;   // The 1e3 factor converts from Mpc to Gpc 
-	dc_l = comoving_distance_spline.splint(zl) * 1e-3;
+	dc_s = comoving_distance(zs) * 1e-3;   // The 1e3 factor converts from Mpc to Gpc 
+	dc_l = comoving_distance(zl) * 1e-3;
 	if (dc_l >= dc_s) die("source must be further away than the lensing object (zlens = %f, zsource = %f)", zl, zs);
 	dc_ls = dc_s - dc_l;
 
@@ -599,8 +655,8 @@ double Cosmology::sigma_crit_kpc(double zl, double zs) // for lensing
 double Cosmology::deflection_scale_factor(double zl, double zs) // for lensing
 {
 	double dc_s, dc_l, dc_ls;    // comoving distances
-	dc_s = comoving_distance_spline.splint(zs) * 1e-3;   // The 1e3 factor converts from Mpc to Gpc 
-	dc_l = comoving_distance_spline.splint(zl) * 1e-3;
+	dc_s = comoving_distance(zs) * 1e-3;   // The 1e3 factor converts from Mpc to Gpc 
+	dc_l = comoving_distance(zl) * 1e-3;
 	if (dc_l >= dc_s) die("source must be further away than the lensing object (zlens = %f, zsource = %f)", zl, zs);
 	dc_ls = dc_s - dc_l;
 
@@ -613,9 +669,9 @@ double Cosmology::kappa_ratio(double zl, double zs, double zs0) // for lensing
 	double da_s, da_ls;    // angular diameter distances
 	double dc_s0, dc_ls0;    // comoving distances
 	double da_s0, da_ls0;    // angular diameter distances
-	dc_s = comoving_distance_spline.splint(zs);
-	dc_s0 = comoving_distance_spline.splint(zs0);
-	dc_l = comoving_distance_spline.splint(zl);
+	dc_s = comoving_distance(zs);
+	dc_s0 = comoving_distance(zs0);
+	dc_l = comoving_distance(zl);
 	if (dc_l >= dc_s) {
 		//warn("source is further away than the lensing object (zlens = %f, zsource = %f)", zl, zs);
 		return 0.0;
@@ -637,9 +693,9 @@ double Cosmology::calculate_beta_factor(double zl1, double zl2, double zs) // fo
 	if (zl1 > zl2) die("zl2 must be greater than zl1");
 	double dc_l1, dc_l2, dc_s;
 	double da_12, da_l2, da_s, da_l1s;
-	dc_l1 = comoving_distance_spline.splint(zl1);
-	dc_l2 = comoving_distance_spline.splint(zl2);
-	dc_s = comoving_distance_spline.splint(zs);
+	dc_l1 = comoving_distance(zl1);
+	dc_l2 = comoving_distance(zl2);
+	dc_s = comoving_distance(zs);
 	//if (dc_l1 >= dc_s) die("source must be further away than lens 1 (zlens1 = %f, zsource = %f)", zl1, zs);
 	if (dc_l1 >= dc_s) return 0.0;
 	//if (dc_l2 >= dc_s) die("source must be further away than lens 2 (zlens2 = %f, zsource = %f)", zl2, zs);
@@ -661,9 +717,9 @@ double Cosmology::calculate_sigpert_scale_factor(double zl1, double zl2, double
 	// NOTE: here, zl2 is the perturber's redshift, z1 is the primary lens redshift
 	double dc_l1, dc_l2, dc_s;
 	double da_l2, da_l1, da_l1s, da_l2s;
-	dc_l1 = comoving_distance_spline.splint(zl1);
-	dc_l2 = comoving_distance_spline.splint(zl2);
-	dc_s = comoving_distance_spline.splint(zs);
+	dc_l1 = comoving_distance(zl1);
+	dc_l2 = comoving_distance(zl2);
+	dc_s = comoving_distance(zs);
 	//if (dc_l1 >= dc_s) die("source must be further away than lens 1 (zlens1 = %f, zsource = %f)", zl1, zs);
 	if (dc_l1 >= dc_s) return 0.0;
 	//if (dc_l2 >= dc_s) die("source must be further away than lens 2 (zlens2 = %f, zsource = %f)", zl2, zs);
@@ -686,9 +742,9 @@ double Cosmology::calculate_menc_scale_factor(double zl1, double zl2, double zs,
 {
 	double dc_l1, dc_l2, dc_s;
 	double da_l2, da_l1, da_l1s, da_l2s;
-	dc_l1 = comoving_distance_spline.splint(zl1);
-	dc_l2 = comoving_distance_spline.splint(zl2);
-	dc_s = comoving_distance_spline.splint(zs);
+	dc_l1 = comoving_distance(zl1);
+	dc_l2 = comoving_distance(zl2);
+	dc_s = comoving_distance(zs);
 	//if (dc_l1 >= dc_s) die("source must be further away than lens 1 (zlens1 = %f, zsource = %f)", zl1, zs);
 	if (dc_l1 >= dc_s) return 0.0;
 	//if (dc_l2 >= dc_s) die("source must be further away than lens 2 (zlens2 = %f, zsource = %f)", zl2, zs);
@@ -868,6 +924,7 @@ double Cosmology::d_plus(const double z)   // empirical fitting function for gro
 
 double Cosmology::rms_lsig(const double rad)
 {
+	if (!power_spectrum_normalized) normalize_power_spectrum();
 	double sigma_spline;
 	double mass = omega_m*dcrit0*M_PI*(4.0/3.0)*CUBE(rad);
 	sigma_spline = rms_sigma.splint(mass);
@@ -876,6 +933,7 @@ double Cosmology::rms_lsig(const double rad)
 
 double Cosmology::mass_function_ST(const double mass, const double z)
 {
+	if (!power_spectrum_normalized) normalize_power_spectrum();
 	double dsigma_dlogm, dr_dm, matter_density, sig, rad, der, nu, ans;
 	matter_density = omega_m*dcrit0;
 	sig = rms_sigma.splint(mass);
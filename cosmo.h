@@ -66,8 +66,17 @@ class Cosmology : public ModelParams, public Spline, public Romberg, public Bren
 
 	private:
 	double tophat_window_R;
-	Spline comoving_distance_spline;
+	Spline scaled_comoving_distance_spline; // comoving distance in units of the Hubble length
 	Spline rms_sigma;
+	double distance_table_omega_m, distance_table_omega_lambda; // values used to build the comoving distance table
+	int distance_table_id; // incremented every time the distance table is rebuilt, so users of distance ratios know when to update
+	bool normalize_power_by_sigma8;
+	bool power_spectrum_normalized; // if false, the sigma8 normalization and rms sigma spline must be updated before they are used
+
+	// recently requested comoving distances are memoized, since the same few lens/source redshifts are used over and over
+	static const int max_zcache = 32;
+	double zcache[max_zcache], dcache[max_zcache];
+	int n_zcache, zcache_next;
 
 	// See bottom of this file for a description of the following variables, used in the transfer function
 	double alpha_gamma, alpha_nu, beta_c, num_degen_hdm, f_baryon, f_bnu, f_cb, f_cdm, f_hdm, growth_small_k, growth_to_z0, k_equality,
@@ -155,12 +164,13 @@ class Cosmology : public ModelParams, public Spline, public Romberg, public Bren
 
 	// note: the following distance functions assume a flat universe
 	void spline_comoving_distance(void);
+	int get_distance_table_id() { return distance_table_id; }
 	void redshift_distribution(void);
 	double comoving_distance_derivative(const double z);
 	double angular_radius(double chi);
-	double comoving_distance(const double z) { return (comoving_distance_spline.splint(z)); }
-	double angular_diameter_distance(const double z) { return (angular_radius(comoving_distance_spline.splint(z)) / (1+z)); }
-	double luminosity_distance(const double z) { return (angular_radius(comoving_distance_spline.splint(z)) * (1+z)); }
+	double comoving_distance(const double z) { return (hubble_length*scaled_comoving_distance(z)); }
+	double angular_diameter_distance(const double z) { return (angular_radius(comoving_distance(z)) / (1+z)); }
+	double luminosity_distance(const double z) { return (angular_radius(comoving_distance(z)) * (1+z)); }
 	double comoving_distance_exact(const double z);
 	double angular_diameter_distance_exact(const double z) { return (angular_radius(comoving_distance_exact(z)) / (1+z)); }
 	double luminosity_distance_exact(const double z) { return (angular_radius(comoving_distance_exact(z)) * (1+z)); }
@@ -192,6 +202,9 @@ class Cosmology : public ModelParams, public Spline, public Romberg, public Bren
 	private:
 	double growth_function_integrand(double a);
 	double tophat_window_k(double k);
+	double inverse_hubble_function(const double z) { return pow(omega_m*CUBE(1+z)+(1-omega_m-omega_lambda)*SQR(1+z) + omega_lambda, -0.5); }
+	double scaled_comoving_distance(const double z);
+	void normalize_power_spectrum();
 };
 
 
@@ -10,7 +10,6 @@ using namespace std;
 #ifdef USE_FITPACK
 extern "C" {
 	void curfit_(int *iopt, int *m, double *x, double *y, double *w, double *xb, double *xe, int *order, double *s, int *bspline_nmax, int *n_knots, double *knots, double *coefs, double *minchisq, double *work, int *lwork, int *iwork, int *ier);
-	void splev_(double *knots, int *n_knots, double *coefs, int *order, double *x, double *y, int *m, int *e, int *ier);
 }
 #endif
 
@@ -69,12 +68,6 @@ EllipticityGradient::~EllipticityGradient()
 
 bool EllipticityGradient::setup_egrad_params(const int egrad_mode_in, const int ellipticity_mode_in, const dvector& egrad_params, int& n_egrad_params_tot, const int n_bspline_coefs, const dvector& knots, const double ximin, const double ximax, const double xiref, const bool linear_xivals)
 {
-#ifndef USE_FITPACK
-	if (egrad_mode_in==0) {
-		warn("qlens must be compiled with FITPACK in order to use B-spline mode");
-		return false;
-	}
-#endif
 	for (int i=0; i < 4; i++) {
 		if (geometric_param[i] != NULL) delete[] geometric_param[i];
 		if (geometric_knots[i] != NULL) delete[] geometric_knots[i];
@@ -456,14 +449,15 @@ double EllipticityGradient::egrad_tanh_function(const double xi, double *paramva
 	return (paramvals[0]*(1-stepf) + paramvals[1]*(1+stepf))/2;
 }
 
-double EllipticityGradient::egrad_bspline_function(const double xi, double *paramvals, const int param_index)
+double EllipticityGradient::egrad_tanh_function_deriv(const double xi, double *paramvals, const int param_index, double& deriv)
 {
-	double ans = 0.0;
-#ifdef USE_FITPACK
-	int m = 1; // Evaluate a single point
-	int e = 0;
-	int ier = 0;
+	double stepf = tanh((xi-paramvals[2])/paramvals[3]);
+	deriv = (paramvals[1]-paramvals[0])*(1-stepf*stepf)/(2*paramvals[3]);
+	return (paramvals[0]*(1-stepf) + paramvals[1]*(1+stepf))/2;
+}
 
+double EllipticityGradient::egrad_bspline_function(const double xi, double *paramvals, const int param_index)
+{
 	double logxi;
 	if (xi < xi_initial_egrad) logxi = log(xi_initial_egrad)/ln10;
 	else if (xi > xi_final_egrad) logxi = log(xi_final_egrad)/ln10;
@@ -472,30 +466,68 @@ double EllipticityGradient::egrad_bspline_function(const double xi, double *para
 	double *knots;
 	if (param_index < 4) knots = geometric_knots[param_index];
 	else knots = fourier_knots[param_index-4];
-	//if (param_index >= 4) {
-		////cout << "FOURIER KNOTS: " << endl;
-		////for (int i=0; i < n_bspline_knots_tot; i++) cout << knots[i] << endl;
-		//cout << "COEFS: " << endl;
-		//for (int i=0; i < n_bspline_knots_tot-4; i++) cout << paramvals[i] << endl;
-	//}
-
-	splev_(knots, &n_bspline_knots_tot, paramvals, &bspline_order, &logxi, &ans, &m, &e, &ier);
-	if (ier > 0) {
-		stringstream s;
-		s << "Error evaluating B-Spline curve using splev() at point " << xi << ": " << ier;
-		throw runtime_error(s.str());
-	}
-	//if (param_index >= 4) {
-		//cout << "ANS=" << ans << endl;
-		//cout << "PINDEX=" << param_index << endl;
-		//die();
-	//}
+
+	double ans = bspline_value(knots,paramvals,logxi,NULL);
 	if ((param_index==0) and (ans > 1)) return 1.0; // in case something greater than q=1 is returned
-#endif
+	return ans;
+}
+
+double EllipticityGradient::egrad_bspline_function_deriv(const double xi, double *paramvals, const int param_index, double& deriv)
+{
+	double logxi;
+	bool clamped = true;
+	if (xi < xi_initial_egrad) logxi = log(xi_initial_egrad)/ln10;
+	else if (xi > xi_final_egrad) logxi = log(xi_final_egrad)/ln10;
+	else { logxi = log(xi)/ln10; clamped = false; }
 
+	double *knots;
+	if (param_index < 4) knots = geometric_knots[param_index];
+	else knots = fourier_knots[param_index-4];
+
+	double ans = bspline_value(knots,paramvals,logxi,&deriv);
+	if (clamped) deriv = 0;
+	else deriv /= xi*ln10; // the spline is in log10(xi)
+	if ((param_index==0) and (ans > 1)) {
+		deriv = 0;
+		return 1.0;
+	}
 	return ans;
 }
 
+double EllipticityGradient::bspline_value(const double *knots, const double *coefs, const double logxi, double *deriv)
+{
+	// de Boor's algorithm, using the same knot interval convention as splev() in FITPACK (the last interval is closed
+	// on the right, and points just outside the knot range are extrapolated using the first or last polynomial piece)
+	const int k = bspline_order;
+	int lo = k, hi = n_bspline_knots_tot-k-1, l;
+	if (logxi >= knots[hi]) l = hi-1;
+	else if (logxi < knots[lo]) l = lo;
+	else {
+		while (hi-lo > 1) {
+			l = (lo+hi) >> 1;
+			if (logxi < knots[l]) hi = l;
+			else lo = l;
+		}
+		l = lo;
+	}
+
+	const int max_order = 5; // FITPACK (curfit) only supports spline orders up to 5
+	if (k > max_order) { die("B-spline order cannot be greater than %i",max_order); return 0; }
+	double d[max_order+1];
+	int j,r;
+	for (j=0; j <= k; j++) d[j] = coefs[l-k+j];
+	double alpha;
+	for (r=1; r <= k; r++) {
+		if ((r==k) and (deriv != NULL)) (*deriv) = k*(d[k]-d[k-1])/(knots[l+1]-knots[l]);
+		for (j=k; j >= r; j--) {
+			alpha = (logxi-knots[j+l-k])/(knots[j+1+l-r]-knots[j+l-k]);
+			d[j] = (1-alpha)*d[j-1] + alpha*d[j];
+		}
+	}
+	if ((k==0) and (deriv != NULL)) (*deriv) = 0;
+	return d[k];
+}
+
 void EllipticityGradient::allocate_bspline_work_arrays(const int n_data)
 {
 	bspline_nmax = n_data + bspline_order + 1;
@@ -584,8 +616,31 @@ void EllipticityGradient::plot_fourier_functions(const double ximin, const doubl
 
 double EllipticityGradient::elliptical_radius_root(const double x, const double y)
 {
-	double (Brent::*xiptr)(const double, const double&, const double&);
-	xiptr = static_cast<double (Brent::*)(const double, const double&, const double&)> (&EllipticityGradient::elliptical_radius_root_eq);
+	// initial guess: the elliptical radius of (x,y) using the contour shape at xi = r (exact if there is no gradient)
+	double rsq = x*x+y*y;
+	if (rsq==0) return 0;
+	double deriv;
+	double xi_guess = sqrt(dmax(rsq-elliptical_radius_root_eq_deriv(sqrt(rsq),x,y,deriv),0));
+	return elliptical_radius_root(x,y,xi_guess);
+}
+
+void EllipticityGradient::elliptical_radius_root(const int npts, const double *x, const double *y, double *xivals)
+{
+	// Batched version for pixel grids: neighboring points have similar elliptical radii, so each root search is started
+	// from the previous solution, rescaled by the ratio of the radii
+	double r, r_prev = 0, xi_prev = 0;
+	for (int i=0; i < npts; i++) {
+		r = sqrt(x[i]*x[i]+y[i]*y[i]);
+		if (r==0) xivals[i] = 0;
+		else if (xi_prev > 0) xivals[i] = elliptical_radius_root(x[i],y[i],xi_prev*r/r_prev);
+		else xivals[i] = elliptical_radius_root(x[i],y[i]);
+		r_prev = r;
+		xi_prev = xivals[i];
+	}
+}
+
+double EllipticityGradient::elliptical_radius_root(const double x, const double y, const double xi_guess)
+{
 	double xisqrmax, xisqrmin;
 	xisqrmax = xisqrmin = (x*x+y*y);
 	if (egrad_minq > 1.0) die("egrad_minq has not been set (egrad_minq=%g)",egrad_minq);
@@ -620,7 +675,37 @@ double EllipticityGradient::elliptical_radius_root(const double x, const double
 	//double xi = BrentsMethod(xiptr,x,y,0.9*ximin,1.1*ximax,1e-4);
 	//cout << "Trying x=" << x << ", y=" << y << ", minq=" << egrad_minq << ", ximin=" << ximin << ", ximax=" << ximax << endl;
 	double acc = dmin(1e-7,0.1*(ximax-ximin));
-	double xi = BrentsMethod(xiptr,x,y,0.4*ximin,1.6*ximax,acc);
+
+	// Safeguarded Newton's method, using the analytic derivative of the root equation; a Newton step that would leave the
+	// current bracket, or that is not decreasing fast enough, is replaced by bisection. Since egrad_minq is the minimum
+	// axis ratio, the root equation is guaranteed to be negative at the lower end of the bracket and positive at the upper end.
+	double xl = 0.4*ximin, xh = 1.6*ximax;
+	double xi = xi_guess, f, df, dx, dxold;
+	if ((xi <= xl) or (xi >= xh)) xi = 0.5*(xl+xh);
+	dx = dxold = xh-xl;
+	f = elliptical_radius_root_eq_deriv(xi,x,y,df);
+	bool converged = false;
+	for (int it=0; it < 100; it++) {
+		if ((((xi-xh)*df-f)*((xi-xl)*df-f) > 0.0) or (fabs(2.0*f) > fabs(dxold*df))) {
+			dxold = dx;
+			dx = 0.5*(xh-xl);
+			xi = xl + dx;
+		} else {
+			dxold = dx;
+			dx = f/df;
+			xi -= dx;
+		}
+		if (fabs(dx) < acc) { converged = true; break; }
+		f = elliptical_radius_root_eq_deriv(xi,x,y,df);
+		if (f==0) { converged = true; break; }
+		if (f < 0) xl = xi;
+		else xh = xi;
+	}
+	if (!converged) {
+		double (Brent::*xiptr)(const double, const double&, const double&);
+		xiptr = static_cast<double (Brent::*)(const double, const double&, const double&)> (&EllipticityGradient::elliptical_radius_root_eq);
+		xi = BrentsMethod(xiptr,x,y,0.4*ximin,1.6*ximax,acc);
+	}
 	if ((xi > (1.1*ximax)) or (xi < (0.9*ximin))) {
 		cout << "WARNING: xi out of expected range (xi=" << xi << ", ximin=" << ximin << ", ximax=" << ximax << ")" << endl;
 		double ep,th;
@@ -672,14 +757,42 @@ double EllipticityGradient::elliptical_radius_root_eq(const double xi, const dou
 	return (xi*xi - fsqinv*(xprime*xprime + (yprime*yprime)/(1-ep)));
 }
 
+double EllipticityGradient::elliptical_radius_root_eq_deriv(const double xi, const double x, const double y, double& deriv)
+{
+	// same as above, but also returns the derivative with respect to xi
+	double q, dq, theta, dtheta;
+	q = (this->*egrad_deriv_ptr)(xi,geometric_param[0],0,dq);
+	theta = (this->*egrad_deriv_ptr)(xi,geometric_param[1],1,dtheta);
+	double costh, sinth, xprime, yprime, xpsq, ypsq;
+	costh = cos(theta);
+	sinth = sin(theta);
+	xprime = x*costh + y*sinth;
+	yprime = -x*sinth + y*costh;
+	xpsq = xprime*xprime;
+	ypsq = yprime*yprime;
+	double g, dg; // right-hand side of the root equation and its derivative (note d(xprime)/dtheta = yprime, d(yprime)/dtheta = -xprime)
+	if (egrad_ellipticity_mode==0) {
+		g = xpsq + ypsq/(q*q);
+		dg = 2*xprime*yprime*dtheta*(1-1.0/(q*q)) - 2*ypsq*dq/(q*q*q);
+	} else {
+		g = q*xpsq + ypsq/q;
+		dg = dq*(xpsq - ypsq/(q*q)) + 2*xprime*yprime*dtheta*(q-1.0/q);
+	}
+	deriv = 2*xi - dg;
+	return (xi*xi - g);
+}
+
 void EllipticityGradient::set_egrad_ptr()
 {
 	if (egrad_mode==0) {
 		egrad_ptr = &EllipticityGradient::egrad_bspline_function;
+		egrad_deriv_ptr = &EllipticityGradient::egrad_bspline_function_deriv;
 	} else if ((egrad_mode==1) or (egrad_mode==2)) {
 		egrad_ptr = &EllipticityGradient::egrad_tanh_function;
+		egrad_deriv_ptr = &EllipticityGradient::egrad_tanh_function_deriv;
 	} else {
 		egrad_ptr = NULL;
+		egrad_deriv_ptr = NULL;
 	}
 }
 
@@ -72,16 +72,23 @@ class EllipticityGradient : public Brent
 	void fourier_mode_function(const double xi, double* cosamp, double* sinamp);
 	void fourier_mode_function(const double xi, const int mval, double& cosamp, double& sinamp);
 	double (EllipticityGradient::*egrad_ptr)(const double xi, double *paramvals, const int param_index);
+	double (EllipticityGradient::*egrad_deriv_ptr)(const double xi, double *paramvals, const int param_index, double& deriv); // also returns d/dxi
 	double egrad_tanh_function(const double xi, double *paramvals, const int param_index);
 	double egrad_bspline_function(const double xi, double *paramvals, const int param_index);
+	double egrad_tanh_function_deriv(const double xi, double *paramvals, const int param_index, double& deriv);
+	double egrad_bspline_function_deriv(const double xi, double *paramvals, const int param_index, double& deriv);
 	double elliptical_radius_root(const double x, const double y);
+	void elliptical_radius_root(const int npts, const double *x, const double *y, double *xivals);
 	void plot_ellipticity_function(const double ximin, const double ximax, const int nn, const std::string dir, const std::string suffix = "");
 	void plot_fourier_functions(const double ximin, const double ximax, const int nn, const std::string dir, const std::string suffix = "");
 	void output_egrad_values_and_knots(std::ofstream& outfile);
 	int get_egrad_mode() { return egrad_mode; }
 
 	private:
+	double bspline_value(const double *knots, const double *coefs, const double logxi, double *deriv);
+	double elliptical_radius_root(const double x, const double y, const double xi_guess);
 	double elliptical_radius_root_eq(const double xi, const double &xi_root_x, const double &xi_root_y);
+	double elliptical_radius_root_eq_deriv(const double xi, const double x, const double y, double& deriv);
 	double egrad_minq; // useful for finding expected range of elliptical radius at a given point (for root finder)
 	// the following are used during the B-spline fitting, but are no longer used once the B-spline coefficients and knots have been determined.
 	int bspline_nmax;
@@ -9,11 +9,34 @@ using namespace std;
 const double GaussianIntegral::EPS = 1e-6;
 const double GaussianIntegral::RT4M_PI_INV = 0.7511255444649425;
 
+// The quadrature nodes and weights never change once computed, so rather than have every lens profile (and every copy of
+// it made for fitting) compute and store its own, the tables are kept in these lists and shared. Tables are never freed.
+struct GaussLegendreTable
+{
+	int N;
+	double *points, *weights;
+	GaussLegendreTable *next;
+};
+
+struct ClenshawCurtisTable
+{
+	int nlevels;
+	bool include_endpoints;
+	int *lvals;
+	double *points;
+	double **weights;
+	ClenshawCurtisTable *next;
+};
+
+static GaussLegendreTable *gauss_legendre_tables = NULL;
+static ClenshawCurtisTable *clenshaw_curtis_tables = NULL;
+
 GaussianIntegral::GaussianIntegral(int N)
 {
      numberOfPoints = N;
      weights = new double[N];
      points = new double[N];
+	  shared_nodes = false;
 }
 
 GaussianIntegral::GaussianIntegral()
@@ -21,10 +44,12 @@ GaussianIntegral::GaussianIntegral()
 	numberOfPoints = 0;
 	weights = NULL;
 	points = NULL;
+	shared_nodes = false;
 }
 
 GaussianIntegral::~GaussianIntegral()
 {
+	if (shared_nodes) return;
    if (points != NULL) delete[] points;
 	if (weights != NULL) delete[] weights;
 }
@@ -36,12 +61,35 @@ GaussLegendre::GaussLegendre(int N) : GaussianIntegral(N)
 
 void GaussLegendre::SetGaussLegendre(int N)
 {
+	if (!shared_nodes) {
+		if (points != NULL) delete[] points;
+		if (weights != NULL) delete[] weights;
+	}
+	GaussLegendreTable *table;
+	#pragma omp critical (gauss_legendre_tables)
+	{
+		for (table = gauss_legendre_tables; table != NULL; table = table->next) {
+			if (table->N==N) break;
+		}
+		if (table==NULL) {
+			table = new GaussLegendreTable;
+			table->N = N;
+			table->points = new double[N];
+			table->weights = new double[N];
+			compute_nodes(N,table->points,table->weights);
+			table->next = gauss_legendre_tables;
+			gauss_legendre_tables = table;
+		}
+	}
 	numberOfPoints = N;
-	if (points != NULL) delete[] points;
-	if (weights != NULL) delete[] weights;
-	weights = new double[N];
-	points = new double[N];
+	points = table->points;
+	weights = table->weights;
+	shared_nodes = true;
+}
 
+void GaussLegendre::compute_nodes(const int numberOfPoints, double *points, double *weights)
+{
+	int N = numberOfPoints;
 	int max = (numberOfPoints + 1)/2;
 	double z1, z, pp, p3, p2, p1;
 	 
@@ -75,10 +123,13 @@ void GaussLegendre::SetGaussLegendre(int N)
 void GaussLegendre::SetGaussLegendre(int N, double *points_in, double *weights_in)
 {
 	numberOfPoints = N;
-	if (points != NULL) delete[] points;
-	if (weights != NULL) delete[] weights;
+	if (!shared_nodes) {
+		if (points != NULL) delete[] points;
+		if (weights != NULL) delete[] weights;
+	}
 	weights = new double[N];
 	points = new double[N];
+	shared_nodes = false;
 	for (int i=0; i < N; i++) {
 		points[i] = points_in[i];
 		weights[i] = weights_in[i];
@@ -332,36 +383,63 @@ ClenshawCurtis::ClenshawCurtis()
 	cc_lvals = NULL;
 	cc_funcs = NULL;
 	cc_funcs2 = NULL;
+	cc_N = 0;
+	cc_nlevels = 0;
 	show_convergence_warning = true;
 	//SetClenshawCurtis(12,1e-6,true);
 }
 
 void ClenshawCurtis::SetClenshawCurtis(const int nlevels_in, const double tol_in, const bool include_endpoints_in, const bool show_warnings)
 {
-	// Computing weights is very fast for nlevels up to 12 or 13; beyond that, it gets dramatically slower as nlevels is increased
-	// If you really need nlevels > 13, the weights should be computed via the fast Fourier transform technique which is much faster.
-	// However I have never needed such a high number of levels, and if I did, it's not clear that Romberg integration wouldn't be
-	// just as good. But it's something to keep in mind down the road.
-	
 	cc_tolerance = tol_in;
 	cc_tolerance_outer = tol_in;
 	include_endpoints = include_endpoints_in;
 	show_convergence_warning = show_warnings;
-	if (cc_points != NULL) delete[] cc_points;
-	if (cc_funcs != NULL) delete[] cc_funcs;
-	if (cc_funcs2 != NULL) delete[] cc_funcs2; // useful if doing nested integrals (albeit an ugly solution)
-	if (cc_lvals != NULL) delete[] cc_lvals;
-	if (cc_weights != NULL) {
-		for (int i=0; i < cc_nlevels; i++) delete[] cc_weights[i];
-		delete[] cc_weights;
-	}
+	int old_N = cc_N;
 	cc_nlevels = nlevels_in;
 	cc_N = pow(2,cc_nlevels-1)+1; // this gives the number of points for the max level (not counting the negative points here)
-	cc_lvals = new int [cc_nlevels];
-	cc_points = new double[cc_N];
-	cc_funcs = new double[cc_N];
-	cc_funcs2 = new double[cc_N];
-	cc_weights = new double*[cc_nlevels];
+
+	ClenshawCurtisTable *table;
+	#pragma omp critical (clenshaw_curtis_tables)
+	{
+		for (table = clenshaw_curtis_tables; table != NULL; table = table->next) {
+			if ((table->nlevels==cc_nlevels) and (table->include_endpoints==include_endpoints)) break;
+		}
+		if (table==NULL) {
+			table = new ClenshawCurtisTable;
+			table->nlevels = cc_nlevels;
+			table->include_endpoints = include_endpoints;
+			table->lvals = new int[cc_nlevels];
+			table->points = new double[cc_N];
+			table->weights = new double*[cc_nlevels];
+			compute_weights(cc_nlevels,include_endpoints,table->lvals,table->points,table->weights);
+			table->next = clenshaw_curtis_tables;
+			clenshaw_curtis_tables = table;
+		}
+	}
+	cc_lvals = table->lvals;
+	cc_points = table->points;
+	cc_weights = table->weights;
+
+	// the function values are scratch space, so each object needs its own
+	if ((cc_funcs != NULL) and (old_N != cc_N)) {
+		delete[] cc_funcs;
+		delete[] cc_funcs2;
+		cc_funcs = NULL;
+	}
+	if (cc_funcs == NULL) {
+		cc_funcs = new double[cc_N];
+		cc_funcs2 = new double[cc_N]; // useful if doing nested integrals (albeit an ugly solution)
+	}
+}
+
+void ClenshawCurtis::compute_weights(const int cc_nlevels, const bool include_endpoints, int *cc_lvals, double *cc_points, double **cc_weights)
+{
+	// Computing weights is very fast for nlevels up to 12 or 13; beyond that, it gets dramatically slower as nlevels is increased
+	// If you really need nlevels > 13, the weights should be computed via the fast Fourier transform technique which is much faster.
+	// However I have never needed such a high number of levels, and if I did, it's not clear that Romberg integration wouldn't be
+	// just as good. But it's something to keep in mind down the road.
+	int cc_N = pow(2,cc_nlevels-1)+1;
 	int i,j,k,l = 1;
 	for (int i=0; i < cc_nlevels; i++) {
 		cc_lvals[i] = l;
@@ -430,14 +508,8 @@ void ClenshawCurtis::SetClenshawCurtis(const int nlevels_in, const double tol_in
 
 ClenshawCurtis::~ClenshawCurtis()
 {
-	if (cc_points != NULL) delete[] cc_points;
 	if (cc_funcs != NULL) delete[] cc_funcs;
 	if (cc_funcs2 != NULL) delete[] cc_funcs2;
-	if (cc_lvals != NULL) delete[] cc_lvals;
-	if (cc_weights != NULL) {
-		for (int i=0; i < cc_nlevels; i++) delete[] cc_weights[i];
-		delete[] cc_weights;
-	}
 }
 
 void ClenshawCurtis::set_cc_tolerance(const double tol_in)
@@ -506,9 +578,13 @@ double ClenshawCurtis::AdaptiveQuadCC(double (ClenshawCurtis::*func)(double), do
 	return abdif*result;
 }
 
+double **GaussPatterson::shared_pat_weights = NULL;
+double GaussPatterson::shared_pat_points[511];
+int GaussPatterson::shared_pat_orders[9];
+
 GaussPatterson::GaussPatterson()
 {
-	//pat_points = NULL;
+	pat_points = NULL;
 	pat_weights = NULL;
 	pat_orders = NULL;
 	//pat_funcs = NULL;
@@ -520,29 +596,22 @@ GaussPatterson::GaussPatterson()
 
 void GaussPatterson::SetGaussPatterson(const double tol_in, const bool show_warnings)
 {
+	static const bool tables_initialized = setup_shared_tables(); // only done once (thread-safe, since it's a local static)
+	if (!tables_initialized) die();
 	pat_tolerance = tol_in;
 	pat_tolerance_outer = tol_in;
 	show_convergence_warning = show_warnings;
 	pat_N = 511;
-	//if (pat_points != NULL) delete[] pat_points;
-	//if (pat_funcs != NULL) delete[] pat_funcs;
-	//if (pat_funcs_mult != NULL) {
-		//for (int i=0; i < 6; i++) delete[] pat_funcs_mult[i];
-		//delete[] pat_funcs_mult;
-	//}
-	//if (pat_funcs2 != NULL) delete[] pat_funcs2; // useful if doing nested integrals (albeit an ugly solution)
-	if (pat_orders != NULL) delete[] pat_orders;
-	if (pat_weights != NULL) {
-		for (int i=0; i < 9; i++) delete[] pat_weights[i];
-		delete[] pat_weights;
-	}
-	pat_orders = new int [9];
-	//pat_points = new double[511];
-	//pat_funcs = new double[511];
-	//pat_funcs2 = new double[511];
-	//pat_funcs_mult = new double*[6];
-	//for (int i=0; i < 6; i++) pat_funcs_mult[i] = new double[511];
-	pat_weights = new double*[9];
+	pat_points = shared_pat_points;
+	pat_weights = shared_pat_weights;
+	pat_orders = shared_pat_orders;
+}
+
+bool GaussPatterson::setup_shared_tables()
+{
+	double *pat_points = shared_pat_points;
+	int *pat_orders = shared_pat_orders;
+	double **pat_weights = new double*[9];
 	pat_weights[0] = new double[1];
 	pat_weights[1] = new double[3];
 	pat_weights[2] = new double[7];
@@ -552,6 +621,7 @@ void GaussPatterson::SetGaussPatterson(const double tol_in, const bool show_warn
 	pat_weights[6] = new double[127];
 	pat_weights[7] = new double[255];
 	pat_weights[8] = new double[511];
+	shared_pat_weights = pat_weights;
 
 	pat_orders[0] = 1;
 	pat_orders[1] = 3;
@@ -2096,6 +2166,7 @@ void GaussPatterson::SetGaussPatterson(const double tol_in, const bool show_warn
     pat_weights[8][508] = 0.736624069102321668857E-05;
     pat_weights[8][509] = 0.345456507169149134898E-05;
     pat_weights[8][510] = 0.945715933950007048827E-06;
+	return true;
 }
 
 void GaussPatterson::set_pat_tolerance_inner(const double tol_in)
@@ -2110,20 +2181,7 @@ void GaussPatterson::set_pat_tolerance_outer(const double tol_in)
 
 GaussPatterson::~GaussPatterson()
 {
-	//if (pat_points != NULL) delete[] pat_points;
-	//if (pat_funcs != NULL) delete[] pat_funcs;
-	//if (pat_funcs2 != NULL) delete[] pat_funcs2;
-	//if (pat_funcs_mult != NULL) {
-		//for (int i=0; i < 6; i++) delete[] pat_funcs_mult[i];
-		//delete[] pat_funcs_mult;
-	//}
-	if (pat_orders != NULL) delete[] pat_orders;
-	if (pat_weights != NULL) {
-		for (int i=0; i < 9; i++) {
-			delete[] pat_weights[i];
-		}
-		delete[] pat_weights;
-	}
+	// nothing to delete, since the nodes and weights are shared
 }
 
 double GaussPatterson::AdaptiveQuad(double (GaussPatterson::*func)(double), double a, double b, bool &converged, bool outer)
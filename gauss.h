@@ -9,6 +9,7 @@ class GaussianIntegral
          double *weights;
          double *points;
          int numberOfPoints;
+			bool shared_nodes; // if true, points/weights belong to a shared table (see GaussLegendre) and must not be deleted
 			static const double EPS;
 			static const double RT4M_PI_INV;
 			double Gamma(const double xx);
@@ -29,6 +30,7 @@ class GaussLegendre : public GaussianIntegral
           GaussLegendre(int);
           void SetGaussLegendre(int);
 			 void SetGaussLegendre(int N, double *points_in, double *weights_in);
+			 static void compute_nodes(const int N, double *points, double *weights);
 };
 
 class GaussHermite : public GaussianIntegral
@@ -42,14 +44,19 @@ class GaussHermite : public GaussianIntegral
 class GaussPatterson
 {
      protected:
-         double **pat_weights;
-         double pat_points[512];
+         double **pat_weights; // the nodes, weights and orders point to tables shared by all GaussPatterson objects
+         double *pat_points;
 			double pat_funcs[512];
 			//double pat_funcs_mult[512][6];
 			int *pat_orders;
          int pat_N;
 			double pat_tolerance, pat_tolerance_outer;
 			bool show_convergence_warning;
+
+			static double **shared_pat_weights;
+			static double shared_pat_points[511];
+			static int shared_pat_orders[9];
+			static bool setup_shared_tables();
           
      public:
 			 GaussPatterson();
@@ -65,7 +72,7 @@ class GaussPatterson
 class ClenshawCurtis
 {
      protected:
-         double **cc_weights;
+         double **cc_weights; // cc_weights, cc_points and cc_lvals point to tables shared by all objects with the same nlevels
          double *cc_points;
 			double *cc_funcs;
 			double *cc_funcs2;
@@ -74,6 +81,7 @@ class ClenshawCurtis
 			double cc_tolerance, cc_tolerance_outer;
 			bool include_endpoints; // if set to "false", use Fejer's quadarture rule (type 2) which excludes endpoints
 			bool show_convergence_warning;
+			static void compute_weights(const int nlevels, const bool include_endpoints, int *lvals, double *points, double **weights);
           
      public:
 			ClenshawCurtis();
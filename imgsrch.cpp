@@ -1759,7 +1759,48 @@ void QLens::find_images()
 
 	Grid::reset_search_parameters();
 	images_found = grid->tree_search();
+	convert_time_delays_to_days();
+}
+
+bool QLens::find_images_from_seeds(const lensvector &source_in, const vector<image>& seeds, double *zfacs, double **betafacs)
+{
+	// Warm-started image search: instead of searching the grid, each image found for this source in the previous chi-square
+	// evaluation is refined with Newton's method. This is only trusted if every seed converges to a distinct image with the
+	// same parity, and no seed wanders further than half the smallest separation between the seeds (which would mean it
+	// jumped to a neighboring image); otherwise false is returned and the caller must do the full grid search.
+	int n_seeds = seeds.size();
+	if (n_seeds==0) return false;
+	// Since no new images can be found this way, the seeds must also form a complete image set: by the odd number theorem,
+	// there is one more positive- than negative-parity image, or the same number if the central image is absent
+	int j,k,parity_sum=0;
+	for (j=0; j < n_seeds; j++) parity_sum += seeds[j].parity;
+	if ((parity_sum != 0) and (parity_sum != 1)) return false;
+	source[0] = source_in[0];
+	source[1] = source_in[1];
+	Grid::set_lens(this);
+	Grid::set_zfactors(zfacs,betafacs);
+	Grid::reset_search_parameters();
+
+	double min_sepsqr = 1e30;
+	for (j=0; j < n_seeds; j++) {
+		for (k=j+1; k < n_seeds; k++) {
+			min_sepsqr = dmin(min_sepsqr,SQR(seeds[j].pos[0]-seeds[k].pos[0]) + SQR(seeds[j].pos[1]-seeds[k].pos[1]));
+		}
+	}
+	images_found = Grid::image_list();
+	lensvector imgpos;
+	for (j=0; j < n_seeds; j++) {
+		imgpos = seeds[j].pos;
+		if (Grid::add_image_from_seed(imgpos,0)==false) return false;
+		if (SQR(imgpos[0]-seeds[j].pos[0]) + SQR(imgpos[1]-seeds[j].pos[1]) > 0.25*min_sepsqr) return false;
+		if (images_found[j].parity != seeds[j].parity) return false; // image crossed a critical curve, so images may have merged or been created
+	}
+	convert_time_delays_to_days();
+	return true;
+}
 
+void QLens::convert_time_delays_to_days()
+{
 	if (include_time_delays) {
 		double td_factor = cosmo.time_delay_factor_arcsec(lens_redshift,reference_source_redshift);
 		double min_td=1e30;
@@ -2154,6 +2195,40 @@ bool Grid::run_newton(lensvector& xroot, const int& thread)
 	return status;
 }
 
+bool Grid::add_image_from_seed(lensvector& xroot, const int& thread)
+{
+	// Same root checks as run_newton, minus those that refer to a grid cell; used for warm-started image searches.
+	// Failures are not warned about, since the caller simply falls back to the full grid search.
+	if (NewtonsMethod(xroot, newton_check[thread], thread)==false) return false;
+	if (newton_check[thread]==true) return false;
+	// A seed that already passes the convergence test is returned unchanged, which would make the chi-square piecewise constant
+	// in the lens parameters (stalling the optimizer); one more full Newton step restores the smooth dependence on the model
+	lensvector p;
+	lensmatrix fjac;
+	lens->lens_equation(xroot, fvec[thread], thread, grid_zfactors, grid_betafactors);
+	lens->hessian(xroot[0],xroot[1],fjac,thread,grid_zfactors,grid_betafactors);
+	fjac[0][0] = -1 + fjac[0][0];
+	fjac[1][1] = -1 + fjac[1][1];
+	p[0] = -fvec[thread][0];
+	p[1] = -fvec[thread][1];
+	SolveLinearEqs(fjac, p);
+	xroot[0] += p[0];
+	xroot[1] += p[1];
+	if (lens->n_singular_points > 0) {
+		double singular_pt_accuracy = 2*image_pos_accuracy;
+		for (int i=0; i < lens->n_singular_points; i++) {
+			if ((abs(xroot[0]-lens->singular_pts[i][0]) < singular_pt_accuracy) and (abs(xroot[1]-lens->singular_pts[i][1]) < singular_pt_accuracy)) return false;
+		}
+	}
+	double mag = lens->magnification(xroot,thread,grid_zfactors,grid_betafactors);
+	if ((lens->reject_himag_images) and (abs(mag) > lens->newton_magnification_threshold)) return false;
+	if ((lens->include_central_image==false) and (mag > 0) and (lens->kappa(xroot,grid_zfactors,grid_betafactors) > 1)) return false;
+	double sep;
+	if ((redundancy(xroot,sep)) or (nfound >= max_images)) return false;
+	add_image_to_list(xroot);
+	return true;
+}
+
 bool Grid::NewtonsMethod(lensvector& x, bool &check, const int& thread)
 {
 	check = false;
@@ -0,0 +1,270 @@
+#include "kmeans.h"
+#include "errors.h"
+#include <cmath>
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+KMeans2D::KMeans2D()
+{
+	n_centroids = 0;
+	centroids_x = NULL;
+	centroids_y = NULL;
+	nearest_pt = NULL;
+	hash_nx = hash_ny = 0;
+	hash_cell_start = NULL;
+	hash_cell_centroids = NULL;
+	hash_ncells_allocated = 0;
+	n_iterations = 0;
+}
+
+void KMeans2D::reset()
+{
+	if (centroids_x != NULL) {
+		delete[] centroids_x;
+		delete[] centroids_y;
+		delete[] nearest_pt;
+		delete[] hash_cell_centroids;
+		centroids_x = NULL;
+		centroids_y = NULL;
+		nearest_pt = NULL;
+		hash_cell_centroids = NULL;
+	}
+	if (hash_cell_start != NULL) {
+		delete[] hash_cell_start;
+		hash_cell_start = NULL;
+	}
+	hash_ncells_allocated = 0;
+	n_centroids = 0;
+}
+
+void KMeans2D::allocate_centroids(const int nc)
+{
+	if ((centroids_x != NULL) and (n_centroids==nc)) return;
+	if (centroids_x != NULL) {
+		delete[] centroids_x;
+		delete[] centroids_y;
+		delete[] nearest_pt;
+		delete[] hash_cell_centroids;
+	}
+	n_centroids = nc;
+	centroids_x = new double[nc];
+	centroids_y = new double[nc];
+	nearest_pt = new int[nc];
+	hash_cell_centroids = new int[nc];
+}
+
+void KMeans2D::build_spatial_hash()
+{
+	int i,k,ci,cj;
+	double xmin=1e30, xmax=-1e30, ymin=1e30, ymax=-1e30;
+	for (i=0; i < n_centroids; i++) {
+		if (centroids_x[i] < xmin) xmin = centroids_x[i];
+		if (centroids_x[i] > xmax) xmax = centroids_x[i];
+		if (centroids_y[i] < ymin) ymin = centroids_y[i];
+		if (centroids_y[i] > ymax) ymax = centroids_y[i];
+	}
+	double width = xmax-xmin, height = ymax-ymin;
+	double maxlength = (width > height) ? width : height;
+	if (maxlength <= 0) maxlength = 1.0;
+	if (width < 1e-6*maxlength) width = 1e-6*maxlength;
+	if (height < 1e-6*maxlength) height = 1e-6*maxlength;
+
+	// choose the cell size so there is roughly one centroid per cell
+	hash_cellsize = sqrt(width*height/n_centroids);
+	hash_nx = (int) (width/hash_cellsize) + 1;
+	hash_ny = (int) (height/hash_cellsize) + 1;
+	hash_xmin = xmin;
+	hash_ymin = ymin;
+
+	int ncells = hash_nx*hash_ny;
+	if (ncells+1 > hash_ncells_allocated) {
+		if (hash_cell_start != NULL) delete[] hash_cell_start;
+		hash_ncells_allocated = ncells+1;
+		hash_cell_start = new int[hash_ncells_allocated];
+	}
+	for (k=0; k <= ncells; k++) hash_cell_start[k] = 0;
+
+	// counting sort of the centroids by cell
+	int *centroid_cell = new int[n_centroids];
+	for (i=0; i < n_centroids; i++) {
+		ci = (int) ((centroids_x[i]-hash_xmin)/hash_cellsize);
+		cj = (int) ((centroids_y[i]-hash_ymin)/hash_cellsize);
+		if (ci >= hash_nx) ci = hash_nx-1;
+		if (cj >= hash_ny) cj = hash_ny-1;
+		centroid_cell[i] = cj*hash_nx + ci;
+		hash_cell_start[centroid_cell[i]+1]++;
+	}
+	for (k=0; k < ncells; k++) hash_cell_start[k+1] += hash_cell_start[k];
+	int *fill = new int[ncells];
+	for (k=0; k < ncells; k++) fill[k] = hash_cell_start[k];
+	for (i=0; i < n_centroids; i++) hash_cell_centroids[fill[centroid_cell[i]]++] = i;
+	delete[] fill;
+	delete[] centroid_cell;
+}
+
+int KMeans2D::find_nearest_centroid(const double x, const double y, double& sqrdist)
+{
+	int ci, cj;
+	ci = (int) floor((x-hash_xmin)/hash_cellsize);
+	cj = (int) floor((y-hash_ymin)/hash_cellsize);
+	if (ci < 0) ci = 0;
+	else if (ci >= hash_nx) ci = hash_nx-1;
+	if (cj < 0) cj = 0;
+	else if (cj >= hash_ny) cj = hash_ny-1;
+
+	// Search rings of cells (in Chebyshev distance r) around the cell containing the point. Any centroid in a ring beyond r
+	// is at least r*cellsize away from the point, so we can stop once the best distance found is within that bound.
+	int i, j, k, n, r, rmax;
+	int imin, imax, jmin, jmax;
+	double dx, dy, dsq, bound;
+	int best = -1;
+	double best_sqrdist = 1e300;
+	rmax = (hash_nx > hash_ny) ? hash_nx : hash_ny;
+	for (r=0; r <= rmax; r++) {
+		imin = ci-r; imax = ci+r;
+		jmin = cj-r; jmax = cj+r;
+		for (j=jmin; j <= jmax; j++) {
+			if ((j < 0) or (j >= hash_ny)) continue;
+			for (i=imin; i <= imax; i++) {
+				if ((i < 0) or (i >= hash_nx)) continue;
+				if ((j != jmin) and (j != jmax) and (i != imin) and (i != imax)) continue; // only search the edge of the ring
+				k = j*hash_nx + i;
+				for (n=hash_cell_start[k]; n < hash_cell_start[k+1]; n++) {
+					dx = x - centroids_x[hash_cell_centroids[n]];
+					dy = y - centroids_y[hash_cell_centroids[n]];
+					dsq = dx*dx + dy*dy;
+					if (dsq < best_sqrdist) {
+						best_sqrdist = dsq;
+						best = hash_cell_centroids[n];
+					}
+				}
+			}
+		}
+		if (best >= 0) {
+			bound = r*hash_cellsize;
+			if (best_sqrdist <= bound*bound) break;
+		}
+	}
+	sqrdist = best_sqrdist;
+	return best;
+}
+
+int KMeans2D::cluster(const double *xvals, const double *yvals, const double *weights, const int npts, const int nc, double *cx, double *cy, const int max_iterations, const bool warm_start, int *nearest_pts)
+{
+	// On input, (cx,cy) are the initial centroids, which are used unless warm_start is true and the centroids from the previous call
+	// are available (i.e. the number of centroids is the same). On output, (cx,cy) contain the final centroids.
+	if (nc <= 0) die("number of centroids for k-means clustering must be positive");
+	int i, k, thread, nthreads;
+	if (warm_start and warm_start_available(nc)) {
+		for (k=0; k < nc; k++) {
+			cx[k] = centroids_x[k];
+			cy[k] = centroids_y[k];
+		}
+	} else {
+		allocate_centroids(nc);
+		for (k=0; k < nc; k++) {
+			centroids_x[k] = cx[k];
+			centroids_y[k] = cy[k];
+		}
+	}
+
+#ifdef USE_OPENMP
+	nthreads = omp_get_max_threads();
+#else
+	nthreads = 1;
+#endif
+	int *assignments = new int[npts];
+	for (i=0; i < npts; i++) assignments[i] = -1;
+	double *wsum = new double[nthreads*nc];
+	double *wxsum = new double[nthreads*nc];
+	double *wysum = new double[nthreads*nc];
+	double *mindist = new double[nthreads*nc];
+	int *minpt = new int[nthreads*nc];
+
+	int n_changed, iteration;
+	double *wsum_t, *wxsum_t, *wysum_t, *mindist_t;
+	int *minpt_t;
+	double w, sqrdist;
+	for (iteration=0; iteration < max_iterations; iteration++) {
+		build_spatial_hash();
+		n_changed = 0;
+		for (k=0; k < nthreads*nc; k++) {
+			wsum[k] = wxsum[k] = wysum[k] = 0;
+			mindist[k] = 1e300;
+			minpt[k] = -1;
+		}
+		#pragma omp parallel private(i,k,thread,w,sqrdist,wsum_t,wxsum_t,wysum_t,mindist_t,minpt_t)
+		{
+#ifdef USE_OPENMP
+			thread = omp_get_thread_num();
+#else
+			thread = 0;
+#endif
+			wsum_t = wsum + thread*nc;
+			wxsum_t = wxsum + thread*nc;
+			wysum_t = wysum + thread*nc;
+			mindist_t = mindist + thread*nc;
+			minpt_t = minpt + thread*nc;
+			#pragma omp for schedule(static) reduction(+:n_changed)
+			for (i=0; i < npts; i++) {
+				k = find_nearest_centroid(xvals[i],yvals[i],sqrdist);
+				if (k != assignments[i]) {
+					assignments[i] = k;
+					n_changed++;
+				}
+				w = (weights==NULL) ? 1.0 : weights[i];
+				wsum_t[k] += w;
+				wxsum_t[k] += w*xvals[i];
+				wysum_t[k] += w*yvals[i];
+				if (sqrdist < mindist_t[k]) {
+					mindist_t[k] = sqrdist;
+					minpt_t[k] = i;
+				}
+			}
+		}
+		for (thread=1; thread < nthreads; thread++) {
+			for (k=0; k < nc; k++) {
+				wsum[k] += wsum[thread*nc+k];
+				wxsum[k] += wxsum[thread*nc+k];
+				wysum[k] += wysum[thread*nc+k];
+				if (mindist[thread*nc+k] < mindist[k]) {
+					mindist[k] = mindist[thread*nc+k];
+					minpt[k] = minpt[thread*nc+k];
+				}
+			}
+		}
+		for (k=0; k < nc; k++) nearest_pt[k] = minpt[k];
+		if (n_changed==0) break; // assignments have converged, so the centroids will not move any further
+		for (k=0; k < nc; k++) {
+			// if no points were assigned to a centroid, it is left where it is
+			if (wsum[k] > 0) {
+				centroids_x[k] = wxsum[k]/wsum[k];
+				centroids_y[k] = wysum[k]/wsum[k];
+			}
+		}
+	}
+	n_iterations = (iteration < max_iterations) ? iteration+1 : max_iterations;
+
+	for (k=0; k < nc; k++) {
+		cx[k] = centroids_x[k];
+		cy[k] = centroids_y[k];
+	}
+	if (nearest_pts != NULL) {
+		for (k=0; k < nc; k++) nearest_pts[k] = nearest_pt[k];
+	}
+
+	delete[] assignments;
+	delete[] wsum;
+	delete[] wxsum;
+	delete[] wysum;
+	delete[] mindist;
+	delete[] minpt;
+	return n_iterations;
+}
+
+KMeans2D::~KMeans2D()
+{
+	reset();
+}
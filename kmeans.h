@@ -0,0 +1,40 @@
+#ifndef KMEANS_H
+#define KMEANS_H
+
+#include <cstdlib>
+
+// Weighted k-means clustering of points in two dimensions (used to place the source pixels of a Delaunay source grid).
+// Each point is assigned to its nearest centroid by searching a uniform-grid spatial hash of the centroids, so a Lloyd
+// iteration costs roughly O(npts) rather than O(npts*ncentroids). The centroids found in the previous call are retained,
+// so that if the clustering is repeated on a slightly perturbed set of points (e.g. between neighboring MCMC steps), it
+// can be warm-started from them and will typically converge in a few iterations.
+
+class KMeans2D
+{
+	int n_centroids;
+	double *centroids_x, *centroids_y;
+	int *nearest_pt; // index of the data point closest to each centroid (-1 if no points were assigned to it)
+
+	// uniform-grid spatial hash of the centroids
+	int hash_nx, hash_ny;
+	double hash_xmin, hash_ymin, hash_cellsize;
+	int *hash_cell_start; // centroids in cell (i,j) are hash_cell_centroids[hash_cell_start[k]..hash_cell_start[k+1]-1], k = j*hash_nx+i
+	int *hash_cell_centroids;
+	int hash_ncells_allocated;
+
+	int n_iterations;
+
+	void allocate_centroids(const int nc);
+	void build_spatial_hash();
+	int find_nearest_centroid(const double x, const double y, double& sqrdist);
+
+	public:
+	KMeans2D();
+	~KMeans2D();
+	void reset();
+	bool warm_start_available(const int nc) { return ((centroids_x != NULL) and (n_centroids==nc)); }
+	int cluster(const double *xvals, const double *yvals, const double *weights, const int npts, const int nc, double *cx, double *cy, const int max_iterations, const bool warm_start, int *nearest_pts = NULL);
+	int get_n_iterations() { return n_iterations; }
+};
+
+#endif // KMEANS_H
@@ -0,0 +1,177 @@
+#include "lbfgs.h"
+#include "errors.h"
+#include <cstdlib>
+#include <iostream>
+#include <csignal>
+#include <cmath>
+using namespace std;
+
+const int LBFGS::ITMAX = 1000;
+const int LBFGS::MAX_BACKTRACK = 40;
+const double LBFGS::ARMIJO_C1 = 1.0e-4;
+
+int LBFGS_KEEP_RUNNING = 1;
+
+void lbfgs_sighandler(int)
+{
+	LBFGS_KEEP_RUNNING = 0;
+}
+
+void lbfgs_quitproc(int)
+{
+	exit(0);
+}
+
+void LBFGS::initial_direction(const int n, const double* g, const double* initial_stepsizes, double* d, double& step)
+{
+	// Steepest descent, preconditioned by the square of the initial stepsizes; the step is scaled so that no parameter
+	// changes by more than its stepsize
+	double dmax = 0;
+	for (int j=0; j < n; j++) {
+		d[j] = -g[j]*initial_stepsizes[j]*initial_stepsizes[j];
+		if (abs(d[j]) > dmax*initial_stepsizes[j]) dmax = abs(d[j])/initial_stepsizes[j];
+	}
+	step = (dmax > 0) ? 1.0/dmax : 0;
+}
+
+bool LBFGS::lbfgs_minimize(double* p, const int n, const double* initial_stepsizes)
+{
+	// Returns false if the minimization was interrupted or the line search failed to make progress; on output, p contains
+	// the best point found.
+	const double TINY = 1.0e-25;
+	LBFGS_KEEP_RUNNING = 1;
+	int i, j, k, it, nback;
+	int m = lbfgs_memory;
+	int npairs = 0, newest = -1; // the correction pairs are kept in a circular buffer
+	double **s = new double*[m];
+	double **y = new double*[m];
+	for (k=0; k < m; k++) {
+		s[k] = new double[n];
+		y[k] = new double[n];
+	}
+	double *rho = new double[m];
+	double *alpha = new double[m];
+	double *g = new double[n];
+	double *gnew = new double[n];
+	double *d = new double[n];
+	double *pnew = new double[n];
+
+	double f, fnew, step, gd, sy, yy, beta;
+	bool status = true, steepest_descent;
+	f = (this->*lbfgs_func)(p);
+	(this->*lbfgs_gradfunc)(p,g);
+	for (it=0; it < ITMAX; it++) {
+		steepest_descent = (npairs==0);
+		if (steepest_descent) {
+			initial_direction(n,g,initial_stepsizes,d,step);
+		} else {
+			// two-loop recursion to find d = -H*g, where H approximates the inverse Hessian
+			for (j=0; j < n; j++) d[j] = -g[j];
+			for (i=0, k=newest; i < npairs; i++, k = (k+m-1) % m) {
+				alpha[k] = 0;
+				for (j=0; j < n; j++) alpha[k] += s[k][j]*d[j];
+				alpha[k] *= rho[k];
+				for (j=0; j < n; j++) d[j] -= alpha[k]*y[k][j];
+			}
+			sy = yy = 0;
+			for (j=0; j < n; j++) {
+				sy += s[newest][j]*y[newest][j];
+				yy += y[newest][j]*y[newest][j];
+			}
+			for (j=0; j < n; j++) d[j] *= sy/yy;
+			for (i=0, k = (newest+m-npairs+1) % m; i < npairs; i++, k = (k+1) % m) {
+				beta = 0;
+				for (j=0; j < n; j++) beta += y[k][j]*d[j];
+				beta *= rho[k];
+				for (j=0; j < n; j++) d[j] += (alpha[k]-beta)*s[k][j];
+			}
+			step = 1.0;
+		}
+		gd = 0;
+		for (j=0; j < n; j++) gd += g[j]*d[j];
+		if (gd >= 0) {
+			// not a descent direction (can happen if the gradient is noisy), so start over with steepest descent
+			npairs = 0;
+			steepest_descent = true;
+			initial_direction(n,g,initial_stepsizes,d,step);
+			gd = 0;
+			for (j=0; j < n; j++) gd += g[j]*d[j];
+		}
+		if ((step==0) or (gd==0)) break; // gradient vanishes, so we're already at the minimum
+
+		// backtracking line search; if a step fails, the new step is found by minimizing a quadratic fit along the line
+		for (nback=0; nback < MAX_BACKTRACK; nback++) {
+			for (j=0; j < n; j++) pnew[j] = p[j] + step*d[j];
+			fnew = (this->*lbfgs_func)(pnew);
+			if ((fnew < 1e30) and (fnew <= f + ARMIJO_C1*step*gd)) break;
+			if (fnew < 1e30) {
+				double step_quad = -gd*step*step/(2*(fnew-f-gd*step));
+				if (step_quad < 0.1*step) step *= 0.1;
+				else if (step_quad > 0.5*step) step *= 0.5;
+				else step = step_quad;
+			} else {
+				step *= 0.1; // we've hit a penalty region, so back off a lot
+			}
+		}
+		if (nback==MAX_BACKTRACK) {
+			if (npairs > 0) {
+				npairs = 0; // try again with steepest descent before giving up
+				continue;
+			}
+			status = false;
+			break;
+		}
+
+		(this->*lbfgs_gradfunc)(pnew,gnew);
+		k = (newest+1) % m;
+		sy = 0;
+		for (j=0; j < n; j++) {
+			s[k][j] = pnew[j] - p[j];
+			y[k][j] = gnew[j] - g[j];
+			sy += s[k][j]*y[k][j];
+		}
+		if (sy > 0) {
+			// only keep the correction pair if the curvature is positive, so the inverse Hessian stays positive definite
+			rho[k] = 1.0/sy;
+			newest = k;
+			if (npairs < m) npairs++;
+		}
+		for (j=0; j < n; j++) {
+			p[j] = pnew[j];
+			g[j] = gnew[j];
+		}
+
+		signal(SIGABRT, &lbfgs_sighandler);
+		signal(SIGTERM, &lbfgs_sighandler);
+		signal(SIGINT, &lbfgs_sighandler);
+		signal(SIGUSR1, &lbfgs_sighandler);
+		signal(SIGQUIT, &lbfgs_quitproc);
+		if (!LBFGS_KEEP_RUNNING) { status = false; break; }
+
+		if (2.0*(f-fnew) <= lbfgs_ftol*(abs(f) + abs(fnew)) + TINY) {
+			f = fnew;
+			// If the step had to be cut back (e.g. by running into a penalty region), the small decrease may just reflect
+			// a poor search direction, so we try once more with steepest descent before declaring convergence
+			if ((nback==0) or (steepest_descent)) break;
+			npairs = 0;
+			continue;
+		}
+		f = fnew;
+	}
+	if (it==ITMAX) warn("L-BFGS minimization exceeded maximum number of iterations (%i)",ITMAX);
+	lbfgs_n_iterations = it;
+
+	for (k=0; k < m; k++) {
+		delete[] s[k];
+		delete[] y[k];
+	}
+	delete[] s;
+	delete[] y;
+	delete[] rho;
+	delete[] alpha;
+	delete[] g;
+	delete[] gnew;
+	delete[] d;
+	delete[] pnew;
+	return status;
+}
@@ -0,0 +1,39 @@
+#ifndef LBFGS_H
+#define LBFGS_H
+
+#include "errors.h"
+#include <iostream>
+#include <csignal>
+
+// Limited-memory BFGS minimization, for functions whose gradient is available (either analytically or by finite differences).
+// The inverse Hessian is approximated from the last few position and gradient changes using the standard two-loop recursion,
+// and each step uses a backtracking line search satisfying the Armijo (sufficient decrease) condition.
+
+class LBFGS
+{
+	private:
+	double (LBFGS::*lbfgs_func)(double*);
+	bool (LBFGS::*lbfgs_gradfunc)(double*, double*);
+	double lbfgs_ftol;
+	int lbfgs_memory; // number of (s,y) correction pairs used to approximate the inverse Hessian
+	int lbfgs_n_iterations;
+	static const int ITMAX;
+	static const int MAX_BACKTRACK;
+	static const double ARMIJO_C1;
+
+	void initial_direction(const int n, const double* g, const double* initial_stepsizes, double* d, double& step);
+
+	public:
+	LBFGS() { lbfgs_func = NULL; lbfgs_gradfunc = NULL; lbfgs_ftol = 1.0e-6; lbfgs_memory = 8; lbfgs_n_iterations = 0; }
+	void initialize_lbfgs(double (LBFGS::*funcc)(double*), bool (LBFGS::*gradfuncc)(double*, double*), const double ftoll)
+	{
+		lbfgs_func = funcc;
+		lbfgs_gradfunc = gradfuncc;
+		lbfgs_ftol = ftoll;
+	}
+	void lbfgs_set_memory(const int m) { lbfgs_memory = (m > 0) ? m : 1; }
+	int get_lbfgs_iterations() { return lbfgs_n_iterations; }
+	bool lbfgs_minimize(double* p, const int n, const double* initial_stepsizes);
+};
+
+#endif // LBFGS_H
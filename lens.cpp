@@ -271,13 +271,21 @@ QLens::QLens() : UCMC()
 	simplex_minchisq = -1e30;
 	simplex_minchisq_anneal = -1e30;
 	simplex_show_bestfit = false;
+	use_parallel_minimizer = false;
+	chisqscan_nrefine = 0;
+	chisqscan_dchisq = 11.8; // 99.7% confidence region for two parameters
+	chisqscan_profile = false;
+	chisqscan_param_fixed = NULL;
+	chisqscan_fullparams = NULL;
 	n_livepts = 1000; // for nested sampling
 	multinest_constant_eff_mode = false;
 	multinest_target_efficiency = 0.1;
 	polychord_nrepeats = 5;
 	mcmc_threads = 1;
 	mcmc_tolerance = 1.01; // Gelman-Rubin statistic for T-Walk sampler
+	mcmc_target_ess = 0; // zero means no effective sample size requirement
 	mcmc_logfile = false;
+	mcmc_checkpoint_interval = 500;
 	open_chisq_logfile = false;
 	psf_convolution_mpi = false;
 	use_input_psf_matrix = false;
@@ -285,6 +293,14 @@ QLens::QLens() : UCMC()
 	psf_ptsrc_threshold = 1e-2;
 	ignore_foreground_in_chisq = false;
 	psf_ptsrc_nsplit = 5; // for subpixel evaluation of point source PSF
+	correlated_noise = false;
+	noise_corr_length = 0;
+	noise_corr_kernel = NULL;
+	noise_corr_npixels_x = noise_corr_npixels_y = 0;
+	whitening_kernel = NULL;
+	whitening_kernel_npixels_x = whitening_kernel_npixels_y = 0;
+	whitening_threshold = 1e-3;
+	noise_corr_logdet_per_pixel = 0;
 	fft_convolution = false;
 	n_image_prior = false;
 	n_image_threshold = 1.5; // ************THIS SHOULD BE SPECIFIED BY THE USER, AND ONLY GETS USED IF n_image_prior IS SET TO 'TRUE'
@@ -339,7 +355,7 @@ QLens::QLens() : UCMC()
 	source_fit_mode = Point_Source;
 	use_ansi_characters = false;
 	chisq_tolerance = 1e-3;
-	//chisqtol_lumreg = 1e-3;
+	chisqtol_lumreg = 0;
 	lumreg_max_it = 0;
 	//lumreg_max_it_final = 20;
 	chisq_magnification_threshold = 0;
@@ -347,6 +363,7 @@ QLens::QLens() : UCMC()
 	chisq_imgplane_substitute_threshold = -1; // if > 0, will evaluate the source plane chi-square and if above the threshold, use instead of image plane chi-square (if imgplane_chisq is on)
 	n_repeats = 1;
 	calculate_parameter_errors = true;
+	fisher_analytic_gradient = false;
 	imgplane_chisq = false;
 	use_magnification_in_chisq = true;
 	use_magnification_in_chisq_during_repeats = true;
@@ -444,6 +461,7 @@ QLens::QLens() : UCMC()
 	Fmatrix_nn = 0;
 	use_noise_map = false;
 	dense_Rmatrix = false;
+	Rmatrix_reg_method = None;
 	find_covmatrix_inverse = true;
 	use_covariance_matrix = false;
 	penalize_defective_covmatrix = true;
@@ -479,6 +497,9 @@ QLens::QLens() : UCMC()
 	psf_matrix = NULL;
 	supersampled_psf_matrix = NULL;
 	inversion_nthreads = 1;
+	cg_logdet_nprobes = 0;
+	cg_logdet_lanczos_steps = 50;
+	cg_logdet_tol = 1e-4;
 	adaptive_subgrid = false;
 	base_srcpixel_imgpixel_ratio = 0.8; // for lowest mag source pixel, this sets fraction of image pixel area covered by it (when mapped to image plane)
 	exclude_source_pixels_beyond_fit_window = true;
@@ -491,6 +512,8 @@ QLens::QLens() : UCMC()
 	weight_initial_centroids = false;
 	use_random_delaunay_srcgrid = false;
 	use_dualtree_kmeans = true;
+	use_native_kmeans = true;
+	kmeans_warm_start = false;
 	n_src_clusters = -1;
 	n_cluster_iterations = 20;
 	regrid_if_unmapped_source_subpixels = false;
@@ -498,6 +521,8 @@ QLens::QLens() : UCMC()
 	emask_imgpixel_nsplit = 1;
 	split_imgpixels = true;
 	split_high_mag_imgpixels = false;
+	adaptive_imgpixel_split = false;
+	imgpixel_split_tolerance = 0.1;
 	delaunay_from_pixel_centers = false;
 	raytrace_using_pixel_centers = false;
 	psf_supersampling = false;
@@ -520,6 +545,10 @@ QLens::QLens() : UCMC()
 	skip_newtons_method = false;
 	use_perturber_flags = false;
 	multithread_perturber_deflections = false;
+	perturber_tree_theta = 0;
+	perturber_trees = NULL;
+	n_perturber_trees = 0;
+	perturber_trees_valid = false;
 	subgrid_around_perturbers = true;
 	subgrid_only_near_data_images = false; // if on, only subgrids around perturber galaxies (during fit) if a data image is within the determined subgridding radius (dangerous if not all images are observed!)
 	galsubgrid_radius_fraction = 1.3;
@@ -531,6 +560,8 @@ QLens::QLens() : UCMC()
 	newton_magnification_threshold = 10000;
 	reject_himag_images = true;
 	reject_images_found_outside_cell = false;
+	warm_start_image_search = false;
+	warm_start_refresh_interval = 50;
 	redundancy_separation_threshold = 1e-5;
 
 	warnings = true;
@@ -649,12 +680,20 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	simplex_minchisq = lens_in->simplex_minchisq;
 	simplex_minchisq_anneal = lens_in->simplex_minchisq_anneal;
 	simplex_show_bestfit = lens_in->simplex_show_bestfit;
+	use_parallel_minimizer = lens_in->use_parallel_minimizer;
+	chisqscan_nrefine = lens_in->chisqscan_nrefine;
+	chisqscan_dchisq = lens_in->chisqscan_dchisq;
+	chisqscan_profile = lens_in->chisqscan_profile;
+	chisqscan_param_fixed = NULL;
+	chisqscan_fullparams = NULL;
 	n_livepts = lens_in->n_livepts; // for nested sampling
 	multinest_constant_eff_mode = lens_in->multinest_constant_eff_mode;
 	multinest_target_efficiency = lens_in->multinest_target_efficiency;
 	polychord_nrepeats = lens_in->polychord_nrepeats;
 	mcmc_tolerance = lens_in->mcmc_tolerance; // for T-Walk sampler
+	mcmc_target_ess = lens_in->mcmc_target_ess;
 	mcmc_logfile = lens_in->mcmc_logfile;
+	mcmc_checkpoint_interval = lens_in->mcmc_checkpoint_interval;
 	open_chisq_logfile = lens_in->open_chisq_logfile;
 	psf_convolution_mpi = lens_in->psf_convolution_mpi;
 	use_input_psf_matrix = lens_in->use_input_psf_matrix;
@@ -662,6 +701,24 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	psf_ptsrc_threshold = lens_in->psf_ptsrc_threshold;
 	ignore_foreground_in_chisq = lens_in->ignore_foreground_in_chisq;
 	psf_ptsrc_nsplit = lens_in->psf_ptsrc_nsplit;
+	correlated_noise = lens_in->correlated_noise;
+	noise_corr_length = lens_in->noise_corr_length;
+	if (lens_in->noise_corr_kernel==NULL) {
+		noise_corr_kernel = NULL;
+		noise_corr_npixels_x = noise_corr_npixels_y = 0;
+	} else {
+		noise_corr_npixels_x = lens_in->noise_corr_npixels_x;
+		noise_corr_npixels_y = lens_in->noise_corr_npixels_y;
+		noise_corr_kernel = new double*[noise_corr_npixels_x];
+		for (int i=0; i < noise_corr_npixels_x; i++) {
+			noise_corr_kernel[i] = new double[noise_corr_npixels_y];
+			for (int j=0; j < noise_corr_npixels_y; j++) noise_corr_kernel[i][j] = lens_in->noise_corr_kernel[i][j];
+		}
+	}
+	whitening_kernel = NULL; // the whitening kernel is regenerated when it is needed
+	whitening_kernel_npixels_x = whitening_kernel_npixels_y = 0;
+	whitening_threshold = lens_in->whitening_threshold;
+	noise_corr_logdet_per_pixel = lens_in->noise_corr_logdet_per_pixel;
 	fft_convolution = lens_in->fft_convolution;
 	n_image_prior = lens_in->n_image_prior;
 	n_image_threshold = lens_in->n_image_threshold;
@@ -703,7 +760,7 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	source_fit_mode = lens_in->source_fit_mode;
 	use_ansi_characters = lens_in->use_ansi_characters;
 	chisq_tolerance = lens_in->chisq_tolerance;
-	//chisqtol_lumreg = lens_in->chisqtol_lumreg;
+	chisqtol_lumreg = lens_in->chisqtol_lumreg;
 	lumreg_max_it = lens_in->lumreg_max_it;
 	//lumreg_max_it_final = lens_in->lumreg_max_it_final;
 	chisq_magnification_threshold = lens_in->chisq_magnification_threshold;
@@ -711,6 +768,7 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	chisq_imgplane_substitute_threshold = lens_in->chisq_imgplane_substitute_threshold;
 	n_repeats = lens_in->n_repeats;
 	calculate_parameter_errors = lens_in->calculate_parameter_errors;
+	fisher_analytic_gradient = lens_in->fisher_analytic_gradient;
 	imgplane_chisq = lens_in->imgplane_chisq;
 	use_magnification_in_chisq = lens_in->use_magnification_in_chisq;
 	use_magnification_in_chisq_during_repeats = lens_in->use_magnification_in_chisq_during_repeats;
@@ -828,6 +886,7 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	Fmatrix_nn = 0;
 	use_noise_map = lens_in->use_noise_map;
 	dense_Rmatrix = lens_in->dense_Rmatrix;
+	Rmatrix_reg_method = None;
 	find_covmatrix_inverse = lens_in->find_covmatrix_inverse;
 	use_covariance_matrix = lens_in->use_covariance_matrix;
 	covmatrix_epsilon = lens_in->covmatrix_epsilon;
@@ -883,6 +942,9 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	source_pixel_location_Lmatrix = NULL;
 	Lmatrix = NULL;
 	inversion_nthreads = lens_in->inversion_nthreads;
+	cg_logdet_nprobes = lens_in->cg_logdet_nprobes;
+	cg_logdet_lanczos_steps = lens_in->cg_logdet_lanczos_steps;
+	cg_logdet_tol = lens_in->cg_logdet_tol;
 	adaptive_subgrid = lens_in->adaptive_subgrid;
 	base_srcpixel_imgpixel_ratio = lens_in->base_srcpixel_imgpixel_ratio; // for lowest mag source pixel, this sets fraction of image pixel area covered by it (when mapped to image plane)
 	exclude_source_pixels_beyond_fit_window = lens_in->exclude_source_pixels_beyond_fit_window;
@@ -895,6 +957,8 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	weight_initial_centroids = lens_in->weight_initial_centroids;
 	use_random_delaunay_srcgrid = lens_in->use_random_delaunay_srcgrid;
 	use_dualtree_kmeans = lens_in->use_dualtree_kmeans;
+	use_native_kmeans = lens_in->use_native_kmeans;
+	kmeans_warm_start = lens_in->kmeans_warm_start;
 	n_src_clusters = lens_in->n_src_clusters;
 	n_cluster_iterations = lens_in->n_cluster_iterations;
 	regrid_if_unmapped_source_subpixels = lens_in->regrid_if_unmapped_source_subpixels;
@@ -902,6 +966,8 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	emask_imgpixel_nsplit = lens_in->emask_imgpixel_nsplit;
 	split_imgpixels = lens_in->split_imgpixels;
 	split_high_mag_imgpixels = lens_in->split_high_mag_imgpixels;
+	adaptive_imgpixel_split = lens_in->adaptive_imgpixel_split;
+	imgpixel_split_tolerance = lens_in->imgpixel_split_tolerance;
 	delaunay_from_pixel_centers = lens_in->delaunay_from_pixel_centers;
 	raytrace_using_pixel_centers = lens_in->raytrace_using_pixel_centers;
 	psf_supersampling = lens_in->psf_supersampling;
@@ -924,6 +990,10 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	skip_newtons_method = lens_in->skip_newtons_method;
 	use_perturber_flags = lens_in->use_perturber_flags;
 	multithread_perturber_deflections = lens_in->multithread_perturber_deflections;
+	perturber_tree_theta = lens_in->perturber_tree_theta;
+	perturber_trees = NULL;
+	n_perturber_trees = 0;
+	perturber_trees_valid = false;
 	subgrid_around_perturbers = lens_in->subgrid_around_perturbers;
 	subgrid_only_near_data_images = lens_in->subgrid_only_near_data_images; // if on, only subgrids around perturber galaxies if a data image is within the determined subgridding radius
 	galsubgrid_radius_fraction = lens_in->galsubgrid_radius_fraction;
@@ -934,6 +1004,8 @@ QLens::QLens(QLens *lens_in) : UCMC() // creates lens object with same settings
 	n_singular_points = 0; // the singular points will be recalculated
 	newton_magnification_threshold = lens_in->newton_magnification_threshold;
 	reject_himag_images = lens_in->reject_himag_images;
+	warm_start_image_search = lens_in->warm_start_image_search;
+	warm_start_refresh_interval = lens_in->warm_start_refresh_interval;
 	reject_images_found_outside_cell = lens_in->reject_images_found_outside_cell;
 	redundancy_separation_threshold = lens_in->redundancy_separation_threshold;
 
@@ -1334,7 +1406,7 @@ bool QLens::add_qtabulated_lens_from_file(const double zl, const double zs, cons
 
 void QLens::add_lens(LensProfile *new_lens, const double zl, const double zs)
 {
-	// NOTE: the integration points/weights should NOT be in the LensProfile classes. They should be in one place so they don't get computed & copied multiple times. FIX THIS!!!
+	// The integration points/weights are shared between all lenses (see gauss.cpp), so they only get computed once for a given number of points
 	new_lens->set_integration_parameters(Gauss_NN, integral_tolerance);
 	new_lens->setup_cosmology(this,zl,zs);
 
@@ -2450,6 +2522,7 @@ void QLens::remove_lens(int lensnumber)
 	if (nlens > 0) lens_redshift_idx = new_lens_redshift_idx;
 	else lens_redshift_idx = NULL;
 	for (int i=0; i < nlens; i++) lens_list[i]->lens_number = i;
+	clear_perturber_trees(); // the trees point to the lenses, so they must be rebuilt
 	reset_grid();
 
 	param_settings->remove_params(pi,pf);
@@ -2523,6 +2596,7 @@ void QLens::clear_lenses()
 
 		n_lens_redshifts = 0;
 
+		clear_perturber_trees(); // the trees point to the lenses, so they must be rebuilt
 		reset_grid();
 		get_parameter_names(); // parameter names must be updated whenever lens models are removed/added
 		clear_derived_params();
@@ -3744,7 +3818,7 @@ void QLens::plot_shear_field(double xmin, double xmax, int nx, double ymin, doub
 
 void QLens::plot_weak_lensing_shear_data(const bool include_model_shear, const string filename)
 {
-	double *zfacs = new double[n_lens_redshifts];
+	if (include_model_shear) update_weak_lensing_zfactors();
 	int i, j, k;
 	double x, y;
 	double shearval,shear_angle,shear1,shear2,xp,yp,t;
@@ -3768,7 +3842,6 @@ void QLens::plot_weak_lensing_shear_data(const bool include_model_shear, const s
 	double ystep = (ymax-ymin)/nsteps_approx;
 	double scale_factor = 1.7; // slightly enlarges the "arrows" so they're easier to see on the screen
 	double scale = scale_factor*dmin(xstep,ystep)/2.0;
-	double zsrc;
 	int compass_steps = 2;
 	double compass_step, model_compass_step;
 
@@ -3777,10 +3850,6 @@ void QLens::plot_weak_lensing_shear_data(const bool include_model_shear, const s
 	for (i=0; i < weak_lensing_data.n_sources; i++) {
 		x = weak_lensing_data.pos[i][0];
 		y = weak_lensing_data.pos[i][1];
-		zsrc = weak_lensing_data.zsrc[i];
-		for (int i=0; i < n_lens_redshifts; i++) {
-			zfacs[i] = cosmo.kappa_ratio(lens_redshifts[i],zsrc,reference_source_redshift);
-		}
 		shear1 = weak_lensing_data.reduced_shear1[i];
 		shear2 = weak_lensing_data.reduced_shear2[i];
 		shearval = sqrt(shear1*shear1+shear2*shear2);
@@ -3798,7 +3867,7 @@ void QLens::plot_weak_lensing_shear_data(const bool include_model_shear, const s
 
 		if (include_model_shear) {
 			lensvector xvec(x,y);
-			reduced_shear_components(xvec,model_shear1,model_shear2,0,zfacs);
+			reduced_shear_components(xvec,model_shear1,model_shear2,0,weak_lensing_data.source_zfactors(i));
 			model_shearval = sqrt(model_shear1*model_shear1 + model_shear2*model_shear2);
 			model_shear_angle = atan(abs(model_shear2/model_shear1));
 			if (model_shear1 < 0) {
@@ -3830,7 +3899,6 @@ void QLens::plot_weak_lensing_shear_data(const bool include_model_shear, const s
 		sout << endl;
 	}
 	sout.close();
-	delete[] zfacs;
 }
 
 /*
@@ -5728,72 +5796,71 @@ vector<ImageDataSet> QLens::export_to_ImageDataSet()
 
 bool QLens::load_weak_lensing_data(string filename)
 {
-	int i,j,k;
+	// The file can either be a text file (see 'help wldata read' for the format) or a binary catalog written by 'wldata write'
+	if (WeakLensingData::is_binary_file(filename)) {
+		ifstream binfile(filename.c_str(), ios::binary);
+		if (!weak_lensing_data.read_binary_file(binfile)) { warn("could not read weak lensing binary file '%s'",filename.c_str()); return false; }
+		if (weak_lensing_data.n_sources==0) return false;
+		include_weak_lensing_chisq = true;
+		return true;
+	}
+
 	ifstream data_infile(filename.c_str());
 	if (!data_infile.is_open()) { warn("Error: input file '%s' could not be opened",filename.c_str()); return false; }
 
 	int n_datawords;
 	vector<string> datawords;
-	int n_wl_sources = 0;
-	while (read_data_line(data_infile,datawords,n_datawords)) n_wl_sources++;
-	data_infile.close();
-
-	if (n_wl_sources==0) return false;
-	data_infile.open(filename.c_str());
-
-	weak_lensing_data.input(n_wl_sources);
-	for (j=0; j < n_wl_sources; j++) {
-		if (read_data_line(data_infile,datawords,n_datawords)==false) { 
+	string id;
+	lensvector pos;
+	double g1, g2, sig_g1, sig_g2, zsrc;
+	weak_lensing_data.clear();
+	while (read_data_line(data_infile,datawords,n_datawords)) {
+		id = datawords[0];
+		if (n_datawords < 8) {
+			warn("weak lensing source entry should have 8 columns (id, x, y, g1, g2, sig_g1, sig_g2, zsrc); could not read entry for source ID %s",id.c_str());
 			weak_lensing_data.clear();
 			return false;
 		}
-		weak_lensing_data.id[j] = datawords[0];
-		if (datastring_convert(datawords[1],weak_lensing_data.pos[j][0])==false) {
-			warn("weak lensing source x-coordinate has incorrect format; could not read entry for source ID %s",weak_lensing_data.id[j].c_str());
+		if (datastring_convert(datawords[1],pos[0])==false) {
+			warn("weak lensing source x-coordinate has incorrect format; could not read entry for source ID %s",id.c_str());
 			weak_lensing_data.clear();
 			return false;
 		}
-		if (datastring_convert(datawords[2],weak_lensing_data.pos[j][1])==false) {
-			warn("weak lensing source y-coordinate has incorrect format; could not read entry for source ID %s",weak_lensing_data.id[j].c_str());
+		if (datastring_convert(datawords[2],pos[1])==false) {
+			warn("weak lensing source y-coordinate has incorrect format; could not read entry for source ID %s",id.c_str());
 			weak_lensing_data.clear();
 			return false;
 		}
-		if (datastring_convert(datawords[3],weak_lensing_data.reduced_shear1[j])==false) {
-			warn("weak lensing source reduced shear1 has incorrect format; could not read entry for source ID %s",weak_lensing_data.id[j].c_str());
+		if (datastring_convert(datawords[3],g1)==false) {
+			warn("weak lensing source reduced shear1 has incorrect format; could not read entry for source ID %s",id.c_str());
 			weak_lensing_data.clear();
 			return false;
 		}
-		if (datastring_convert(datawords[4],weak_lensing_data.reduced_shear2[j])==false) {
-			warn("weak lensing source reduced shear2 has incorrect format; could not read entry for source ID %s",weak_lensing_data.id[j].c_str());
+		if (datastring_convert(datawords[4],g2)==false) {
+			warn("weak lensing source reduced shear2 has incorrect format; could not read entry for source ID %s",id.c_str());
 			weak_lensing_data.clear();
 			return false;
 		}
-		if (datastring_convert(datawords[5],weak_lensing_data.sigma_shear1[j])==false) {
-			warn("source shear1 measurement error has incorrect format; could not read entry for source ID %s",weak_lensing_data.id[j].c_str());
+		if (datastring_convert(datawords[5],sig_g1)==false) {
+			warn("source shear1 measurement error has incorrect format; could not read entry for source ID %s",id.c_str());
 			weak_lensing_data.clear();
 			return false;
 		}
-		if (datastring_convert(datawords[6],weak_lensing_data.sigma_shear2[j])==false) {
-			warn("source shear2 measurement error has incorrect format; could not read entry for source ID %s",weak_lensing_data.id[j].c_str());
+		if (datastring_convert(datawords[6],sig_g2)==false) {
+			warn("source shear2 measurement error has incorrect format; could not read entry for source ID %s",id.c_str());
 			weak_lensing_data.clear();
 			return false;
 		}
-		if (datastring_convert(datawords[7],weak_lensing_data.zsrc[j])==false) {
-			warn("source redshift thas incorrect format; could not read entry for source ID %s",weak_lensing_data.id[j].c_str());
+		if (datastring_convert(datawords[7],zsrc)==false) {
+			warn("source redshift thas incorrect format; could not read entry for source ID %s",id.c_str());
 			weak_lensing_data.clear();
 			return false;
 		}
+		weak_lensing_data.add_source(id,pos,g1,g2,sig_g1,sig_g2,zsrc);
 	}
+	if (weak_lensing_data.n_sources==0) return false;
 
-	// For starters, let's not store specific_ptsrc_zfactors, we'll just calculate them when we evaluate the chi-square. We can always put
-	// the specific_ptsrc_zfactors in to save time later.
-	//if (n_lens_redshifts > 0) {
-		//for (i=0; i < n_sourcepts_fit; i++) {
-			//for (j=0; j < n_lens_redshifts; j++) {
-				//weak_lensing_data.specific_ptsrc_zfactors[i][j] = cosmo.kappa_ratio(lens_redshifts[j],specific_ptsrc_redshifts[i],reference_source_redshift);
-			//}
-		//}
-	//}
+	// The zfactors for each source are calculated the first time the chi-square is evaluated, and cached after that (see update_weak_lensing_zfactors)
 
 	// I don't think beta factors should matter for weak lensing, but you can check this later
 	//if (n_lens_redshifts > 1) {
@@ -6166,48 +6233,19 @@ ImageData::~ImageData()
 	}
 }
 
+const char WeakLensingData::binary_file_tag[4] = {'Q','L','W','L'};
+const int WeakLensingData::binary_file_version = 1;
+
 void WeakLensingData::input(const int &nn)
 {
-	if (n_sources != 0) {
-		// delete arrays so we can re-create them
-		delete[] id;
-		delete[] pos;
-		delete[] reduced_shear1;
-		delete[] reduced_shear2;
-		delete[] sigma_shear1;
-		delete[] sigma_shear2;
-		delete[] zsrc;
-	}
+	clear();
+	reserve(nn);
 	n_sources = nn;
-	id = new string[n_sources];
-	pos = new lensvector[n_sources];
-	reduced_shear1 = new double[n_sources];
-	reduced_shear2 = new double[n_sources];
-	sigma_shear1 = new double[n_sources];
-	sigma_shear2 = new double[n_sources];
-	zsrc = new double[n_sources];
 }
 
 void WeakLensingData::input(const WeakLensingData& wl_in)
 {
-	if (n_sources != 0) {
-		// delete arrays so we can re-create them
-		delete[] id;
-		delete[] pos;
-		delete[] reduced_shear1;
-		delete[] reduced_shear2;
-		delete[] sigma_shear1;
-		delete[] sigma_shear2;
-		delete[] zsrc;
-	}
-	n_sources = wl_in.n_sources;
-	id = new string[n_sources];
-	pos = new lensvector[n_sources];
-	reduced_shear1 = new double[n_sources];
-	reduced_shear2 = new double[n_sources];
-	sigma_shear1 = new double[n_sources];
-	sigma_shear2 = new double[n_sources];
-	zsrc = new double[n_sources];
+	input(wl_in.n_sources);
 	for (int i=0; i < n_sources; i++) {
 		id[i] = wl_in.id[i];
 		pos[i] = wl_in.pos[i];
@@ -6219,27 +6257,28 @@ void WeakLensingData::input(const WeakLensingData& wl_in)
 	}
 }
 
-void WeakLensingData::add_source(const string id_in, lensvector& pos_in, const double g1_in, const double g2_in, const double g1_err_in, const double g2_err_in, const double zsrc_in)
+void WeakLensingData::reserve(const int nn)
 {
-	int n_sources_new = n_sources+1;
-	if (n_sources != 0) {
-		string *new_id = new string[n_sources_new];
-		lensvector *new_pos = new lensvector[n_sources_new];
-		double *new_reduced_shear1 = new double[n_sources_new];
-		double *new_reduced_shear2 = new double[n_sources_new];
-		double *new_sigma_shear1 = new double[n_sources_new];
-		double *new_sigma_shear2 = new double[n_sources_new];
-		double *new_zsrc = new double[n_sources_new];
-		for (int i=0; i < n_sources; i++) {
-			new_id[i] = id[i];
-			new_pos[i][0] = pos[i][0];
-			new_pos[i][1] = pos[i][1];
-			new_reduced_shear1[i] = reduced_shear1[i];
-			new_reduced_shear2[i] = reduced_shear2[i];
-			new_sigma_shear1[i] = sigma_shear1[i];
-			new_sigma_shear2[i] = sigma_shear2[i];
-			new_zsrc[i] = zsrc[i];
-		}
+	// Makes room for nn sources, keeping the sources that have already been stored
+	if (nn <= n_allocated) return;
+	string *new_id = new string[nn];
+	lensvector *new_pos = new lensvector[nn];
+	double *new_reduced_shear1 = new double[nn];
+	double *new_reduced_shear2 = new double[nn];
+	double *new_sigma_shear1 = new double[nn];
+	double *new_sigma_shear2 = new double[nn];
+	double *new_zsrc = new double[nn];
+	for (int i=0; i < n_sources; i++) {
+		new_id[i].swap(id[i]);
+		new_pos[i][0] = pos[i][0];
+		new_pos[i][1] = pos[i][1];
+		new_reduced_shear1[i] = reduced_shear1[i];
+		new_reduced_shear2[i] = reduced_shear2[i];
+		new_sigma_shear1[i] = sigma_shear1[i];
+		new_sigma_shear2[i] = sigma_shear2[i];
+		new_zsrc[i] = zsrc[i];
+	}
+	if (n_allocated != 0) {
 		delete[] id;
 		delete[] pos;
 		delete[] reduced_shear1;
@@ -6247,32 +6286,30 @@ void WeakLensingData::add_source(const string id_in, lensvector& pos_in, const d
 		delete[] sigma_shear1;
 		delete[] sigma_shear2;
 		delete[] zsrc;
-		id = new_id;
-		pos = new_pos;
-		reduced_shear1 = new_reduced_shear1;
-		reduced_shear2 = new_reduced_shear2;
-		sigma_shear1 = new_sigma_shear1;
-		sigma_shear2 = new_sigma_shear2;
-		zsrc = new_zsrc;
-		n_sources++;
-	} else {
-		n_sources = 1;
-		id = new string[n_sources];
-		pos = new lensvector[n_sources];
-		reduced_shear1 = new double[n_sources];
-		reduced_shear2 = new double[n_sources];
-		sigma_shear1 = new double[n_sources];
-		sigma_shear2 = new double[n_sources];
-		zsrc = new double[n_sources];
-	}
-	id[n_sources-1] = id_in;
-	pos[n_sources-1][0] = pos_in[0];
-	pos[n_sources-1][1] = pos_in[1];
-	reduced_shear1[n_sources-1] = g1_in;
-	reduced_shear2[n_sources-1] = g2_in;
-	sigma_shear1[n_sources-1] = g1_err_in;
-	sigma_shear2[n_sources-1] = g2_err_in;
-	zsrc[n_sources-1] = zsrc_in;
+	}
+	id = new_id;
+	pos = new_pos;
+	reduced_shear1 = new_reduced_shear1;
+	reduced_shear2 = new_reduced_shear2;
+	sigma_shear1 = new_sigma_shear1;
+	sigma_shear2 = new_sigma_shear2;
+	zsrc = new_zsrc;
+	n_allocated = nn;
+}
+
+void WeakLensingData::add_source(const string id_in, lensvector& pos_in, const double g1_in, const double g2_in, const double g1_err_in, const double g2_err_in, const double zsrc_in)
+{
+	if (n_sources==n_allocated) reserve((n_allocated < 16) ? 16 : 2*n_allocated);
+	id[n_sources] = id_in;
+	pos[n_sources][0] = pos_in[0];
+	pos[n_sources][1] = pos_in[1];
+	reduced_shear1[n_sources] = g1_in;
+	reduced_shear2[n_sources] = g2_in;
+	sigma_shear1[n_sources] = g1_err_in;
+	sigma_shear2[n_sources] = g2_err_in;
+	zsrc[n_sources] = zsrc_in;
+	n_sources++;
+	zfactors_valid = false;
 }
 
 void WeakLensingData::print_list(bool use_sci)
@@ -6310,22 +6347,98 @@ void WeakLensingData::write_to_file(string filename)
 	}
 }
 
+// Binary catalog format: the 4-character tag "QLWL", the format version and number of sources (ints), then the source IDs
+// (each stored as an int length followed by the characters), followed by the columns x, y, g1, g2, sig_g1, sig_g2, zsrc
+// (n_sources doubles each). Numbers are stored in the native byte order.
+
+bool WeakLensingData::write_to_binary_file(string filename)
+{
+	ofstream outfile(filename.c_str(), ios::binary);
+	if (!outfile.is_open()) return false;
+	int i, len;
+	outfile.write(binary_file_tag, 4);
+	outfile.write((char *)&binary_file_version, sizeof(int));
+	outfile.write((char *)&n_sources, sizeof(int));
+	for (i=0; i < n_sources; i++) {
+		len = id[i].size();
+		outfile.write((char *)&len, sizeof(int));
+		outfile.write(id[i].data(), len);
+	}
+	double *column = new double[n_sources];
+	for (i=0; i < n_sources; i++) column[i] = pos[i][0];
+	outfile.write((char *)column, n_sources*sizeof(double));
+	for (i=0; i < n_sources; i++) column[i] = pos[i][1];
+	outfile.write((char *)column, n_sources*sizeof(double));
+	delete[] column;
+	outfile.write((char *)reduced_shear1, n_sources*sizeof(double));
+	outfile.write((char *)reduced_shear2, n_sources*sizeof(double));
+	outfile.write((char *)sigma_shear1, n_sources*sizeof(double));
+	outfile.write((char *)sigma_shear2, n_sources*sizeof(double));
+	outfile.write((char *)zsrc, n_sources*sizeof(double));
+	return outfile.good();
+}
+
+bool WeakLensingData::is_binary_file(string filename)
+{
+	ifstream infile(filename.c_str(), ios::binary);
+	char tag[4];
+	if (!infile.read(tag,4)) return false;
+	for (int i=0; i < 4; i++) if (tag[i] != binary_file_tag[i]) return false;
+	return true;
+}
+
+bool WeakLensingData::read_binary_file(ifstream& infile)
+{
+	char tag[4];
+	int i, version, nsrc, len;
+	if (!infile.read(tag,4)) return false;
+	for (i=0; i < 4; i++) if (tag[i] != binary_file_tag[i]) return false;
+	infile.read((char *)&version, sizeof(int));
+	infile.read((char *)&nsrc, sizeof(int));
+	if ((!infile) or (nsrc < 0)) return false;
+	if (version != binary_file_version) { warn("unrecognized weak lensing binary file version (%i)",version); return false; }
+	input(nsrc);
+	string idbuffer;
+	for (i=0; i < n_sources; i++) {
+		infile.read((char *)&len, sizeof(int));
+		if ((!infile) or (len < 0)) { clear(); return false; }
+		idbuffer.resize(len);
+		if (len > 0) infile.read(&idbuffer[0], len);
+		id[i] = idbuffer;
+	}
+	double *column = new double[n_sources];
+	infile.read((char *)column, n_sources*sizeof(double));
+	for (i=0; i < n_sources; i++) pos[i][0] = column[i];
+	infile.read((char *)column, n_sources*sizeof(double));
+	for (i=0; i < n_sources; i++) pos[i][1] = column[i];
+	delete[] column;
+	infile.read((char *)reduced_shear1, n_sources*sizeof(double));
+	infile.read((char *)reduced_shear2, n_sources*sizeof(double));
+	infile.read((char *)sigma_shear1, n_sources*sizeof(double));
+	infile.read((char *)sigma_shear2, n_sources*sizeof(double));
+	infile.read((char *)zsrc, n_sources*sizeof(double));
+	if (!infile) { clear(); return false; }
+	return true;
+}
+
+void WeakLensingData::clear_zfactors()
+{
+	if (zfactors != NULL) delete[] zfactors;
+	if (zfactor_lens_redshifts != NULL) delete[] zfactor_lens_redshifts;
+	zfactors = NULL;
+	zfactor_lens_redshifts = NULL;
+	n_zfactor_planes = 0;
+	zfactors_valid = false;
+}
+
 WeakLensingData::~WeakLensingData()
 {
-	if (n_sources != 0) {
-		delete[] id;
-		delete[] pos;
-		delete[] reduced_shear1;
-		delete[] reduced_shear2;
-		delete[] sigma_shear1;
-		delete[] sigma_shear2;
-		delete[] zsrc;
-	}
+	clear();
 }
 
 void WeakLensingData::clear()
 {
-	if (n_sources != 0) {
+	if (n_allocated != 0) {
 		delete[] id;
 		delete[] pos;
 		delete[] reduced_shear1;
@@ -6335,6 +6448,8 @@ void WeakLensingData::clear()
 		delete[] zsrc;
 	}
 	n_sources = 0;
+	n_allocated = 0;
+	clear_zfactors();
 }
 
 /******************************************** Functions for lens model fitting ******************************************/
@@ -6366,6 +6481,14 @@ bool QLens::initialize_fitmodel(const bool running_fit_in)
 	fitmodel = new QLens(this);
 	fitmodel->use_ansi_characters = running_fit_in;
 	//fitmodel->set_gridcenter(grid_xcenter,grid_ycenter);
+	// the first chi-square evaluation of every fit must use the full image search, so no warm-start images are carried over
+	warm_start_images.clear();
+	n_warm_start_evals.clear();
+	fitmodel->warm_start_images.clear();
+	fitmodel->n_warm_start_evals.clear();
+	// likewise, a gradient saved by DLogLike during a previous fit belongs to a different model, so it is discarded
+	loglike_gradient_params.input(0);
+	loglike_gradient.input(0);
 
 	int i,j,k;
 	if (n_lens_redshifts > 0) {
@@ -6605,7 +6728,7 @@ bool QLens::initialize_fitmodel(const bool running_fit_in)
 	fitmodel->srcmodel_fit_parameters = srcmodel_fit_parameters;
 	fitmodel->pixsrc_fit_parameters = pixsrc_fit_parameters;
 	fitmodel->ptsrc_fit_parameters = ptsrc_fit_parameters;
-	if ((fitmethod!=POWELL) and (fitmethod!=SIMPLEX)) fitmodel->setup_limits();
+	if ((fitmethod!=POWELL) and (fitmethod!=SIMPLEX) and (fitmethod!=QUASI_NEWTON)) fitmodel->setup_limits();
 
 	if (open_chisq_logfile) {
 		string logfile_str = fit_output_dir + "/" + fit_output_filename + ".log";
@@ -6625,7 +6748,7 @@ bool QLens::initialize_fitmodel(const bool running_fit_in)
 
 	fitmodel->update_parameter_list();
 	if ((source_fit_mode != Point_Source) and (!redo_lensing_calculations_before_inversion)) {
-		for (int i=0; i < n_extended_src_redshifts; i++) fitmodel->image_pixel_grids[i]->redo_lensing_calculations(); 
+		ImagePixelGrid::redo_lensing_calculations(fitmodel->image_pixel_grids,n_extended_src_redshifts);
 	}
 	return true;
 }
@@ -6916,6 +7039,206 @@ double QLens::chisq_pos_source_plane()
 	return chisq;
 }
 
+bool QLens::chisq_pos_source_plane_gradient(double& chisq, double* dchisq)
+{
+	// Finds the source plane chi-square together with its gradient w.r.t. the (untransformed) fit parameters. Writing the
+	// residual for each image as v = M*(beta - beta_j), where M is the magnification matrix (or the identity if magnification
+	// is not used), the derivative w.r.t. a lens parameter p is dv/dp = M*(z*dalpha/dp) + M*(z*dH/dp)*M*(beta - beta_j); the
+	// derivatives of the deflection and hessian are found by LensProfile::param_derivatives. If the analytic best-fit source
+	// is used, it minimizes the chi-square, so its own dependence on the parameters drops out of the gradient.
+	// Returns false if the model isn't supported (multiple lens planes, anchored parameters, or varying redshifts/cosmology),
+	// in which case the gradient has to be found numerically.
+	int i,j,k,l,m,n;
+	if (n_lens_redshifts > 1) return false;
+	if (cosmo.get_n_vary_params() > 0) return false;
+	for (k=0; k < nlens; k++) {
+		if ((lens_list[k]->at_least_one_param_anchored) or (lens_list[k]->anchor_special_parameter) or (lens_list[k]->lensed_center_coords) or (lens_list[k]->transform_center_coords_to_pixsrc_frame)) return false;
+		for (m=0; m < lens_list[k]->n_params; m++) {
+			if ((lens_list[k]->vary_params[m]) and (lens_list[k]->param[m]==&lens_list[k]->zlens)) return false;
+		}
+	}
+	for (i=0; i < n_ptsrc; i++) {
+		for (m=0; m < ptsrc_list[i]->n_params; m++) {
+			if ((ptsrc_list[i]->active_params[m]) and (ptsrc_list[i]->vary_params[m]) and (ptsrc_list[i]->param[m]==&ptsrc_list[i]->zsrc)) return false;
+		}
+	}
+
+	int npts=0;
+	for (i=0; i < n_ptsrc; i++) {
+		for (j=0; j < image_data[i].n_images; j++) {
+			if (image_data[i].use_in_chisq[j]) npts++;
+		}
+	}
+	lensvector *pts = new lensvector[npts];
+	lensvector *delta_beta = new lensvector[npts];
+	lensvector *resid = new lensvector[npts]; // residual M*delta_beta
+	lensmatrix *mags = (use_magnification_in_chisq) ? new lensmatrix[npts] : NULL;
+	double *sigsq = new double[npts];
+	double *zfac = new double[npts];
+	int *ptsrc_num = new int[npts];
+
+	lensvector beta_j, src_bf;
+	lensmatrix jac, magsqr, amatrix, ainv;
+	lensvector bvec;
+	double siginv, src_norm;
+	bool singular = false;
+	int redshift_idx, n_start;
+	n=0;
+	for (i=0; i < n_ptsrc; i++) {
+		redshift_idx = ptsrc_redshift_idx[i];
+		amatrix[0][0] = amatrix[0][1] = amatrix[1][0] = amatrix[1][1] = 0;
+		bvec[0] = bvec[1] = 0;
+		src_bf[0] = src_bf[1] = 0;
+		src_norm=0;
+		n_start = n;
+		for (j=0; j < image_data[i].n_images; j++) {
+			if (image_data[i].use_in_chisq[j]) {
+				pts[n] = image_data[i].pos[j];
+				zfac[n] = ptsrc_zfactors[redshift_idx][0];
+				ptsrc_num[n] = i;
+				sigsq[n] = SQR(image_data[i].sigma_pos[j]) + syserr_pos*syserr_pos;
+				siginv = 1.0/sigsq[n];
+				if (use_magnification_in_chisq) {
+					sourcept_jacobian(pts[n],beta_j,jac,0,ptsrc_zfactors[redshift_idx],ptsrc_beta_factors[redshift_idx]);
+					mags[n] = jac.inverse();
+					if (use_analytic_bestfit_src) {
+						lensmatsqr(mags[n],magsqr);
+						amatrix += siginv*magsqr;
+						bvec[0] += (magsqr[0][0]*beta_j[0] + magsqr[0][1]*beta_j[1])*siginv;
+						bvec[1] += (magsqr[1][0]*beta_j[0] + magsqr[1][1]*beta_j[1])*siginv;
+					}
+				} else {
+					find_sourcept(pts[n],beta_j,0,ptsrc_zfactors[redshift_idx],ptsrc_beta_factors[redshift_idx]);
+					if (use_analytic_bestfit_src) {
+						src_bf[0] += beta_j[0]*siginv;
+						src_bf[1] += beta_j[1]*siginv;
+						src_norm += siginv;
+					}
+				}
+				delta_beta[n] = beta_j; // for the moment, this stores beta_j; it gets subtracted from the source point below
+				n++;
+			}
+		}
+		if (use_analytic_bestfit_src) {
+			if (use_magnification_in_chisq) {
+				if (amatrix.invert(ainv)==false) { singular = true; break; }
+				src_bf = ainv*bvec;
+			} else {
+				src_bf[0] /= src_norm;
+				src_bf[1] /= src_norm;
+			}
+			ptsrc_list[i]->pos[0] = src_bf[0];
+			ptsrc_list[i]->pos[1] = src_bf[1];
+		} else {
+			src_bf = ptsrc_list[i]->pos;
+		}
+		for (l=n_start; l < n; l++) {
+			delta_beta[l][0] = src_bf[0] - delta_beta[l][0];
+			delta_beta[l][1] = src_bf[1] - delta_beta[l][1];
+			if (use_magnification_in_chisq) {
+				resid[l][0] = mags[l][0][0]*delta_beta[l][0] + mags[l][0][1]*delta_beta[l][1];
+				resid[l][1] = mags[l][0][1]*delta_beta[l][0] + mags[l][1][1]*delta_beta[l][1];
+			} else {
+				resid[l] = delta_beta[l];
+			}
+		}
+	}
+
+	bool status = !singular;
+	if (status) {
+		chisq = 0;
+		for (n=0; n < npts; n++) {
+			chisq += resid[n].sqrnorm() / sigsq[n];
+			if (syserr_pos != 0.0) chisq += 2*log(sigsq[n]/(sigsq[n] - syserr_pos*syserr_pos)); // correction for unknown systematic error
+		}
+
+		for (i=0; i < n_fit_parameters; i++) dchisq[i] = 0;
+		lensvector *ddef = new lensvector[npts];
+		lensvector *ddef_anchored = new lensvector[npts];
+		lensmatrix *dhess = (use_magnification_in_chisq) ? new lensmatrix[npts] : NULL;
+		lensmatrix *dhess_anchored = (use_magnification_in_chisq) ? new lensmatrix[npts] : NULL;
+		lensvector dv, mdb;
+		double dchisq_dp;
+		int coord, index = 0;
+		for (k=0; k < nlens; k++) {
+			for (m=0; m < lens_list[k]->n_params; m++) {
+				if (!lens_list[k]->vary_params[m]) continue;
+				lens_list[k]->param_derivatives(m,npts,pts,ddef,dhess);
+				if ((lens_list[k]->param[m]==&lens_list[k]->x_center) or (lens_list[k]->param[m]==&lens_list[k]->y_center)) {
+					// lenses whose centers are anchored to this lens move along with it
+					coord = (lens_list[k]->param[m]==&lens_list[k]->x_center) ? 0 : 1;
+					for (l=0; l < nlens; l++) {
+						if ((l != k) and (lens_list[l]->center_anchored) and (lens_list[l]->center_anchor_lens==lens_list[k])) {
+							lens_list[l]->center_param_derivatives(coord,npts,pts,ddef_anchored,dhess_anchored);
+							for (n=0; n < npts; n++) {
+								ddef[n] += ddef_anchored[n];
+								if (dhess != NULL) dhess[n] += dhess_anchored[n];
+							}
+						}
+					}
+				}
+				dchisq_dp = 0;
+				for (n=0; n < npts; n++) {
+					if (use_magnification_in_chisq) {
+						// dv = z*M*(dalpha + dH*M*delta_beta)
+						mdb = resid[n];
+						dv[0] = ddef[n][0] + dhess[n][0][0]*mdb[0] + dhess[n][0][1]*mdb[1];
+						dv[1] = ddef[n][1] + dhess[n][1][0]*mdb[0] + dhess[n][1][1]*mdb[1];
+						mdb = dv;
+						dv[0] = zfac[n]*(mags[n][0][0]*mdb[0] + mags[n][0][1]*mdb[1]);
+						dv[1] = zfac[n]*(mags[n][0][1]*mdb[0] + mags[n][1][1]*mdb[1]);
+					} else {
+						dv[0] = zfac[n]*ddef[n][0];
+						dv[1] = zfac[n]*ddef[n][1];
+					}
+					dchisq_dp += 2*(resid[n][0]*dv[0] + resid[n][1]*dv[1]) / sigsq[n];
+				}
+				dchisq[index++] = dchisq_dp;
+			}
+		}
+		index += srcmodel_fit_parameters + pixsrc_fit_parameters; // these don't affect the point image chi-square
+		for (i=0; i < n_ptsrc; i++) {
+			for (m=0; m < ptsrc_list[i]->n_params; m++) {
+				if ((!ptsrc_list[i]->active_params[m]) or (!ptsrc_list[i]->vary_params[m])) continue;
+				dchisq_dp = 0;
+				if ((m < 2) and (!use_analytic_bestfit_src)) {
+					// parameters 0 and 1 are the source coordinates; dv/d(beta) = M
+					for (n=0; n < npts; n++) {
+						if (ptsrc_num[n] != i) continue;
+						if (use_magnification_in_chisq) dchisq_dp += 2*(mags[n][m][0]*resid[n][0] + mags[n][m][1]*resid[n][1]) / sigsq[n];
+						else dchisq_dp += 2*resid[n][m] / sigsq[n];
+					}
+				}
+				dchisq[index++] = dchisq_dp;
+			}
+		}
+		if (vary_syserr_pos_parameter) {
+			dchisq_dp = 0;
+			for (n=0; n < npts; n++) {
+				dchisq_dp += 2*syserr_pos*(2.0 - resid[n].sqrnorm()/sigsq[n])/sigsq[n];
+			}
+			dchisq[index++] = dchisq_dp;
+		}
+		if (vary_wl_shear_factor_parameter) dchisq[index++] = 0;
+
+		delete[] ddef;
+		delete[] ddef_anchored;
+		if (dhess != NULL) {
+			delete[] dhess;
+			delete[] dhess_anchored;
+		}
+	}
+
+	delete[] pts;
+	delete[] delta_beta;
+	delete[] resid;
+	if (mags != NULL) delete[] mags;
+	delete[] sigsq;
+	delete[] zfac;
+	delete[] ptsrc_num;
+	return status;
+}
+
 double QLens::chisq_pos_image_plane()
 {
 	int n_redshift_groups = ptsrc_redshift_groups.size()-1;
@@ -6942,13 +7265,21 @@ double QLens::chisq_pos_image_plane()
 	if (syserr_pos == 0.0) signormfac = 0.0; // signormfac is the correction to chi-square to account for unknown systematic error
 	int i,j,k,m,n;
 	int redshift_idx;
+	bool grid_created;
 	for (m=mpi_start; m < mpi_start + mpi_chunk; m++) {
 		redshift_idx = ptsrc_redshift_idx[ptsrc_redshift_groups[m]];
-		create_grid(false,ptsrc_zfactors[redshift_idx],ptsrc_beta_factors[redshift_idx],m);
+		// with warm starts, the grid is only created if at least one source in this group needs the full image search
+		grid_created = false;
+		if (!warm_start_image_search) {
+			create_grid(false,ptsrc_zfactors[redshift_idx],ptsrc_beta_factors[redshift_idx],m);
+			grid_created = true;
+		} else {
+			record_singular_points(ptsrc_zfactors[redshift_idx]);
+		}
 		for (i=ptsrc_redshift_groups[m]; i < ptsrc_redshift_groups[m+1]; i++) {
 			if (ptsrc_redshift_idx[i] != redshift_idx) die("AWW fuck the redshift groups aren't sorted right");
 			chisq_each_srcpt = 0;
-			image *img = get_images(ptsrc_list[i]->pos, n_images, false);
+			image *img = find_ptsrc_images_for_chisq(i,m,grid_created,n_images);
 			n_visible_images = n_images;
 			bool *ignore = new bool[n_images];
 			for (j=0; j < n_images; j++) ignore[j] = false;
@@ -7051,6 +7382,34 @@ double QLens::chisq_pos_image_plane()
 	return chisq;
 }
 
+image* QLens::find_ptsrc_images_for_chisq(const int i, const int group_num, bool& grid_created, int& n_images)
+{
+	// Finds the images of point source i for the image plane chi-square. If warm starts are on, the images found in the previous
+	// evaluation are refined where possible (see find_images_from_seeds), and the grid for this source plane is only created
+	// (with grid_created set to true) once a full image search is needed.
+	int redshift_idx = ptsrc_redshift_idx[i];
+	image *img;
+	if ((warm_start_image_search) and ((int) warm_start_images.size() != n_ptsrc)) {
+		warm_start_images.assign(n_ptsrc,vector<image>());
+		n_warm_start_evals.assign(n_ptsrc,0);
+	}
+	// a warm start cannot produce new images, so it is only tried if the previous solution had at least as many images as the data
+	if ((warm_start_image_search) and (n_warm_start_evals[i] < warm_start_refresh_interval) and ((int) warm_start_images[i].size() >= image_data[i].n_images) and (find_images_from_seeds(ptsrc_list[i]->pos,warm_start_images[i],ptsrc_zfactors[redshift_idx],ptsrc_beta_factors[redshift_idx]))) {
+		img = images_found;
+		n_images = Grid::nfound;
+		n_warm_start_evals[i]++;
+	} else {
+		if (!grid_created) {
+			create_grid(false,ptsrc_zfactors[redshift_idx],ptsrc_beta_factors[redshift_idx],group_num);
+			grid_created = true;
+		}
+		img = get_images(ptsrc_list[i]->pos, n_images, false);
+		if (warm_start_image_search) n_warm_start_evals[i] = 0;
+	}
+	if (warm_start_image_search) warm_start_images[i].assign(img,img+n_images);
+	return img;
+}
+
 double QLens::chisq_pos_image_plane_diagnostic(const bool verbose, const bool output_residuals_to_file, double &rms_imgpos_err, int &n_matched_images, const string output_filename)
 {
 	int n_redshift_groups = ptsrc_redshift_groups.size()-1;
@@ -7079,15 +7438,27 @@ double QLens::chisq_pos_image_plane_diagnostic(const bool verbose, const bool ou
 	if (syserr_pos == 0.0) signormfac = 0.0; // signormfac is the correction to chi-square to account for unknown systematic error
 	int i,j,k,m,n;
 	int redshift_idx;
+	bool grid_created;
 	for (m=mpi_start; m < mpi_start + mpi_chunk; m++) {
 		redshift_idx = ptsrc_redshift_idx[ptsrc_redshift_groups[m]];
-		create_grid(false,ptsrc_zfactors[redshift_idx],ptsrc_beta_factors[redshift_idx],m);
-		if ((mpi_id==0) and (verbose)) cout << endl << "zsrc=" << ptsrc_redshifts[redshift_idx] << ": grid = (" << (grid_xcenter-grid_xlength/2) << "," << (grid_xcenter+grid_xlength/2) << ") x (" << (grid_ycenter-grid_ylength/2) << "," << (grid_ycenter+grid_ylength/2) << ")" << endl;
+		// as in chisq_pos_image_plane, the grid is only created here if warm starts are off
+		grid_created = false;
+		if (!warm_start_image_search) {
+			create_grid(false,ptsrc_zfactors[redshift_idx],ptsrc_beta_factors[redshift_idx],m);
+			grid_created = true;
+		} else {
+			record_singular_points(ptsrc_zfactors[redshift_idx]);
+		}
+		if ((mpi_id==0) and (verbose)) {
+			cout << endl << "zsrc=" << ptsrc_redshifts[redshift_idx];
+			if (grid_created) cout << ": grid = (" << (grid_xcenter-grid_xlength/2) << "," << (grid_xcenter+grid_xlength/2) << ") x (" << (grid_ycenter-grid_ylength/2) << "," << (grid_ycenter+grid_ylength/2) << ")" << endl;
+			else cout << ": warm-started image search" << endl;
+		}
 		for (i=ptsrc_redshift_groups[m]; i < ptsrc_redshift_groups[m+1]; i++) {
 			chisq_each_srcpt = 0;
 			n_matched_images_each_srcpt = 0;
 			rms_err_each_srcpt = 0;
-			image *img = get_images(ptsrc_list[i]->pos, n_images, false);
+			image *img = find_ptsrc_images_for_chisq(i,m,grid_created,n_images);
 			n_visible_images = n_images;
 			bool *ignore = new bool[n_images];
 			for (j=0; j < n_images; j++) ignore[j] = false;
@@ -7554,16 +7925,50 @@ double QLens::chisq_time_delays_from_model_imgs()
 	return chisq;
 }
 
-double QLens::chisq_weak_lensing()
+void QLens::update_weak_lensing_zfactors()
 {
+	// The kappa ratios only depend on distance ratios, which don't change with the Hubble parameter; so they only need to be
+	// recalculated if the data, lens redshifts, reference source redshift, or the cosmological distance table has changed
 	int i,j,nsrc = weak_lensing_data.n_sources;
+	bool recalculate = false;
+	if ((!weak_lensing_data.zfactors_valid) or (weak_lensing_data.n_zfactor_planes != n_lens_redshifts) or (weak_lensing_data.zfactor_distance_table_id != cosmo.get_distance_table_id()) or (weak_lensing_data.zfactor_reference_zsrc != reference_source_redshift)) recalculate = true;
+	else {
+		for (j=0; j < n_lens_redshifts; j++) {
+			if (weak_lensing_data.zfactor_lens_redshifts[j] != lens_redshifts[j]) {
+				recalculate = true;
+				break;
+			}
+		}
+	}
+	if (!recalculate) return;
+
+	weak_lensing_data.clear_zfactors();
+	weak_lensing_data.n_zfactor_planes = n_lens_redshifts;
+	if (n_lens_redshifts > 0) {
+		weak_lensing_data.zfactors = new double[nsrc*n_lens_redshifts];
+		weak_lensing_data.zfactor_lens_redshifts = new double[n_lens_redshifts];
+		for (j=0; j < n_lens_redshifts; j++) weak_lensing_data.zfactor_lens_redshifts[j] = lens_redshifts[j];
+	}
+	double *zfacs;
+	#pragma omp parallel for private(i,j,zfacs) schedule(static)
+	for (i=0; i < nsrc; i++) {
+		zfacs = weak_lensing_data.source_zfactors(i);
+		for (j=0; j < n_lens_redshifts; j++) {
+			zfacs[j] = cosmo.kappa_ratio(lens_redshifts[j],weak_lensing_data.zsrc[i],reference_source_redshift);
+		}
+	}
+	weak_lensing_data.zfactor_distance_table_id = cosmo.get_distance_table_id();
+	weak_lensing_data.zfactor_reference_zsrc = reference_source_redshift;
+	weak_lensing_data.zfactors_valid = true;
+}
+
+double QLens::chisq_weak_lensing()
+{
+	int i,nsrc = weak_lensing_data.n_sources;
 	if (nsrc==0) return 0;
 	double chisq=0;
 	double g1,g2;
-	double **zfacs = new double*[nsrc];
-	for (i=0; i < nsrc; i++) {
-		zfacs[i] = new double[n_lens_redshifts];
-	}
+	update_weak_lensing_zfactors();
 	#pragma omp parallel
 	{
 		int thread;
@@ -7573,43 +7978,30 @@ double QLens::chisq_weak_lensing()
 		thread = 0;
 #endif
 
-		#pragma omp for private(i,j,g1,g2) schedule(static) reduction(+:chisq)
+		#pragma omp for private(i,g1,g2) schedule(static) reduction(+:chisq)
 		for (i=0; i < nsrc; i++) {
-			for (j=0; j < n_lens_redshifts; j++) {
-				zfacs[i][j] = cosmo.kappa_ratio(lens_redshifts[j],weak_lensing_data.zsrc[i],reference_source_redshift);
-			}
-			reduced_shear_components(weak_lensing_data.pos[i],g1,g2,thread,zfacs[i]);
+			reduced_shear_components(weak_lensing_data.pos[i],g1,g2,thread,weak_lensing_data.source_zfactors(i));
 			chisq += SQR((wl_shear_factor*g1-weak_lensing_data.reduced_shear1[i])/weak_lensing_data.sigma_shear1[i]) + SQR((wl_shear_factor*g2-weak_lensing_data.reduced_shear2[i])/weak_lensing_data.sigma_shear2[i]);
 
 		}
 	}
-	for (i=0; i < nsrc; i++) delete[] zfacs[i];
-	delete[] zfacs;
 	return chisq;
 }
 
 bool QLens::output_weak_lensing_chivals(string filename)
 {
-	int i,j,nsrc = weak_lensing_data.n_sources;
+	int i,nsrc = weak_lensing_data.n_sources;
 	if (nsrc==0) return false;
 	ofstream chifile(filename.c_str());
 	double chi1, chi2;
 	double g1,g2;
-	double **zfacs = new double*[nsrc];
+	update_weak_lensing_zfactors();
 	for (i=0; i < nsrc; i++) {
-		zfacs[i] = new double[n_lens_redshifts];
-	}
-	for (i=0; i < nsrc; i++) {
-		for (j=0; j < n_lens_redshifts; j++) {
-			zfacs[i][j] = cosmo.kappa_ratio(lens_redshifts[j],weak_lensing_data.zsrc[i],reference_source_redshift);
-		}
-		reduced_shear_components(weak_lensing_data.pos[i],g1,g2,0,zfacs[i]);
+		reduced_shear_components(weak_lensing_data.pos[i],g1,g2,0,weak_lensing_data.source_zfactors(i));
 		chi1 = (wl_shear_factor*g1-weak_lensing_data.reduced_shear1[i])/weak_lensing_data.sigma_shear1[i];
 		chi2 = (wl_shear_factor*g2-weak_lensing_data.reduced_shear2[i])/weak_lensing_data.sigma_shear2[i];
 		chifile << chi1 << " " << chi2 << endl;
 	}
-	for (i=0; i < nsrc; i++) delete[] zfacs[i];
-	delete[] zfacs;
 	return true;
 }
 
@@ -7748,7 +8140,7 @@ bool QLens::setup_fit_parameters(const bool ignore_limits)
 	transformed_latex_parameter_names.resize(n_fit_parameters);
 	param_settings->transform_parameter_names(fit_parameter_names.data(),transformed_parameter_names.data(),latex_parameter_names.data(),transformed_latex_parameter_names.data());
 
-	if ((!ignore_limits) and (fitmethod!=POWELL) and (fitmethod!=SIMPLEX)) return setup_limits();
+	if ((!ignore_limits) and (fitmethod!=POWELL) and (fitmethod!=SIMPLEX) and (fitmethod!=QUASI_NEWTON)) return setup_limits();
 	return true;
 }
 
@@ -8175,6 +8567,10 @@ double QLens::chisq_single_evaluation(bool init_fitmodel, bool show_total_wtime,
 void QLens::plot_chisq_2d(const int param1, const int param2, const int n1, const double i1, const double f1, const int n2, const double i2, const double f2)
 {
 	if (setup_fit_parameters()==false) return;
+	if ((param1 < 0) or (param1 >= n_fit_parameters)) { warn("Parameter %i does not exist (%i parameters total)",param1,n_fit_parameters); return; }
+	if ((param2 < 0) or (param2 >= n_fit_parameters)) { warn("Parameter %i does not exist (%i parameters total)",param2,n_fit_parameters); return; }
+	if (param1==param2) { warn("the two parameters being scanned must be different"); return; }
+	if ((n1 <= 0) or (n2 <= 0)) { warn("number of grid cells must be greater than zero"); return; }
 	fit_set_optimizations();
 	if (fit_output_dir != ".") create_output_directory();
 	if (!initialize_fitmodel(false)) {
@@ -8182,74 +8578,162 @@ void QLens::plot_chisq_2d(const int param1, const int param2, const int n1, cons
 		return;
 	}
 
-	if (param1 >= n_fit_parameters) { warn("Parameter %i does not exist (%i parameters total)",param1,n_fit_parameters); return; }
-	if (param2 >= n_fit_parameters) { warn("Parameter %i does not exist (%i parameters total)",param2,n_fit_parameters); return; }
-
-	double (QLens::*loglikeptr)(double*);
-	if (source_fit_mode==Point_Source) {
-		loglikeptr = static_cast<double (QLens::*)(double*)> (&QLens::fitmodel_loglike_point_source);
-	} else {
-		loglikeptr = static_cast<double (QLens::*)(double*)> (&QLens::fitmodel_loglike_extended_source);
-	}
-
+	// The chi-square is first evaluated at the centers of an n1 x n2 grid of cells. Each refinement level splits every cell into 2x2 subcells,
+	// but only cells that lie within chisqscan_dchisq of the minimum (or that border such a cell) are evaluated again; the remaining subcells
+	// inherit the value of their parent cell. The map is then written out at the finest resolution, so it is plotted the same way either way.
+	// Cell (i,j) is stored in element j*nx+i.
+	int scan_params[2] = { param1, param2 };
+	int i,j,k,l,m,ii,jj,level,npts,kmin;
+	int nx = n1, ny = n2;
 	double step1 = (f1-i1)/n1;
 	double step2 = (f2-i2)/n2;
-	int i,j;
-	double p1,p2;
-	ofstream p1out("chisq2d.x");
-	ofstream l1out("like2d.x");
-	for (i=0, p1=i1; i <= n1; i++, p1 += step1) {
-		p1out << p1 << endl;
-		l1out << p1 << endl;
-	}
-	p1out.close();
-	l1out.close();
-	ofstream p2out("chisq2d.y");
-	ofstream l2out("like2d.y");
-	for (i=0, p2=i2; i <= n2; i++, p2 += step2) {
-		p2out << p2 << endl;
-		l2out << p2 << endl;
-	}
-	p2out.close();
-	l2out.close();
+	double *chisqvals = new double[nx*ny];
+	double *cell_params = (chisqscan_profile) ? new double[nx*ny*n_fit_parameters] : NULL;
+	double *scan_vals = new double[2*nx*ny];
+	for (j=0, k=0; j < ny; j++) {
+		for (i=0; i < nx; i++, k++) {
+			scan_vals[2*k] = i1 + (i+0.5)*step1;
+			scan_vals[2*k+1] = i2 + (j+0.5)*step2;
+			if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) cell_params[k*n_fit_parameters+l] = fitparams[l];
+		}
+	}
+	evaluate_chisq_scan_points(nx*ny,2,scan_params,scan_vals,cell_params,chisqvals);
+	delete[] scan_vals;
 
 	double chisqmin=1e30;
-	dmatrix chisqvals(n1,n2);
-	ofstream chisqout("chisq2d.dat");
-	double p1min, p2min;
-	for (j=0, p2=i2+0.5*step2; j < n2; j++, p2 += step2) {
-		for (i=0, p1=i1+0.5*step1; i < n1; i++, p1 += step1) {
-			cout << "p1=" << p1 << " p2=" << p2 << endl;
-			fitparams[param1] = p1;
-			fitparams[param2] = p2;
-			chisqvals[i][j] = 2.0 * (this->*loglikeptr)(fitparams.array());
-			if (chisqvals[i][j] < chisqmin) {
-				chisqmin = chisqvals[i][j];
-				p1min = p1;
-				p2min = p2;
+	kmin = 0;
+	for (k=0; k < nx*ny; k++) {
+		if (chisqvals[k] < chisqmin) {
+			chisqmin = chisqvals[k];
+			kmin = k;
+		}
+	}
+
+	bool *refine_cell;
+	double *point_chisq, *point_params, *chisqvals_new, *cell_params_new;
+	for (level=1; level <= chisqscan_nrefine; level++) {
+		refine_cell = new bool[nx*ny];
+		npts = 0;
+		for (j=0, k=0; j < ny; j++) {
+			for (i=0; i < nx; i++, k++) {
+				refine_cell[k] = false;
+				for (jj=imax(j-1,0); jj <= imin(j+1,ny-1); jj++) {
+					for (ii=imax(i-1,0); ii <= imin(i+1,nx-1); ii++) {
+						if (chisqvals[jj*nx+ii]-chisqmin <= chisqscan_dchisq) refine_cell[k] = true;
+					}
+				}
+				if (refine_cell[k]) npts += 4;
 			}
-			chisqout << chisqvals[i][j] << " ";
 		}
-		chisqout << endl;
-	}
-	chisqout.close();
-	if (mpi_id==0) cout << "min chisq=" << chisqmin << ", occurs at (" << p1min << "," << p2min << ")\n";
+		if (npts==0) {
+			delete[] refine_cell;
+			break;
+		}
+		step1 *= 0.5;
+		step2 *= 0.5;
+		scan_vals = new double[2*npts];
+		point_chisq = new double[npts];
+		point_params = (chisqscan_profile) ? new double[npts*n_fit_parameters] : NULL;
+		for (j=0, k=0, m=0; j < ny; j++) {
+			for (i=0; i < nx; i++, k++) {
+				if (!refine_cell[k]) continue;
+				for (jj=0; jj < 2; jj++) {
+					for (ii=0; ii < 2; ii++, m++) {
+						scan_vals[2*m] = i1 + (2*i+ii+0.5)*step1;
+						scan_vals[2*m+1] = i2 + (2*j+jj+0.5)*step2;
+						if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) point_params[m*n_fit_parameters+l] = cell_params[k*n_fit_parameters+l]; // start from the parent cell's best fit
+					}
+				}
+			}
+		}
+		evaluate_chisq_scan_points(npts,2,scan_params,scan_vals,point_params,point_chisq);
 
-	ofstream likeout("like2d.dat");
-	for (i=0; i < n1; i++) {
-		for (j=0; j < n2; j++) {
-			likeout << exp(-0.5*SQR(chisqvals[i][j]-chisqmin)) << " ";
+		chisqvals_new = new double[4*nx*ny];
+		cell_params_new = (chisqscan_profile) ? new double[4*nx*ny*n_fit_parameters] : NULL;
+		int knew;
+		for (j=0, k=0, m=0; j < ny; j++) {
+			for (i=0; i < nx; i++, k++) {
+				for (jj=0; jj < 2; jj++) {
+					for (ii=0; ii < 2; ii++) {
+						knew = (2*j+jj)*(2*nx) + 2*i+ii;
+						if (refine_cell[k]) {
+							chisqvals_new[knew] = point_chisq[m];
+							if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) cell_params_new[knew*n_fit_parameters+l] = point_params[m*n_fit_parameters+l];
+							m++;
+						} else {
+							chisqvals_new[knew] = chisqvals[k];
+							if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) cell_params_new[knew*n_fit_parameters+l] = cell_params[k*n_fit_parameters+l];
+						}
+					}
+				}
+			}
+		}
+		delete[] chisqvals;
+		chisqvals = chisqvals_new;
+		if (chisqscan_profile) {
+			delete[] cell_params;
+			cell_params = cell_params_new;
+			delete[] point_params;
+		}
+		delete[] point_chisq;
+		delete[] scan_vals;
+		delete[] refine_cell;
+		nx *= 2;
+		ny *= 2;
+		for (k=0; k < nx*ny; k++) {
+			if (chisqvals[k] < chisqmin) {
+				chisqmin = chisqvals[k];
+				kmin = k;
+			}
 		}
-		likeout << endl;
+		if (mpi_id==0) cout << "Refinement level " << level << ": evaluated " << npts << " points on " << nx << "x" << ny << " grid (min chisq=" << chisqmin << ")" << endl;
 	}
-	likeout.close();
 
+	if (mpi_id==0) {
+		ofstream p1out("chisq2d.x");
+		ofstream l1out("like2d.x");
+		for (i=0; i <= nx; i++) {
+			p1out << i1 + i*step1 << endl;
+			l1out << i1 + i*step1 << endl;
+		}
+		p1out.close();
+		l1out.close();
+		ofstream p2out("chisq2d.y");
+		ofstream l2out("like2d.y");
+		for (j=0; j <= ny; j++) {
+			p2out << i2 + j*step2 << endl;
+			l2out << i2 + j*step2 << endl;
+		}
+		p2out.close();
+		l2out.close();
+
+		ofstream chisqout("chisq2d.dat");
+		ofstream likeout("like2d.dat");
+		for (j=0; j < ny; j++) {
+			for (i=0; i < nx; i++) {
+				chisqout << chisqvals[j*nx+i] << " ";
+				likeout << exp(-0.5*(chisqvals[j*nx+i]-chisqmin)) << " ";
+			}
+			chisqout << endl;
+			likeout << endl;
+		}
+		chisqout.close();
+		likeout.close();
+		cout << "min chisq=" << chisqmin << ", occurs at (" << (i1 + (kmin%nx+0.5)*step1) << "," << (i2 + (kmin/nx+0.5)*step2) << ")\n";
+	}
+
+	delete[] chisqvals;
+	if (chisqscan_profile) delete[] cell_params;
 	fit_restore_defaults();
+	delete fitmodel;
+	fitmodel = NULL;
 }
 
 void QLens::plot_chisq_1d(const int param, const int n, const double ip, const double fp, string filename)
 {
 	if (setup_fit_parameters()==false) return;
+	if ((param < 0) or (param >= n_fit_parameters)) { warn("Parameter %i does not exist (%i parameters total)",param,n_fit_parameters); return; }
+	if (n <= 0) { warn("number of steps must be greater than zero"); return; }
 	fit_set_optimizations();
 	if (fit_output_dir != ".") create_output_directory();
 	if (!initialize_fitmodel(false)) {
@@ -8257,68 +8741,222 @@ void QLens::plot_chisq_1d(const int param, const int n, const double ip, const d
 		return;
 	}
 
-	if (param >= n_fit_parameters) { warn("Parameter %i does not exist (%i parameters total)",param,n_fit_parameters); return; }
-
-	double (QLens::*LogLikePtr)(double*);
-	if (source_fit_mode==Point_Source) {
-		LogLikePtr = static_cast<double (QLens::*)(double*)> (&QLens::fitmodel_loglike_point_source);
-	} else {
-		LogLikePtr = static_cast<double (QLens::*)(double*)> (&QLens::fitmodel_loglike_extended_source);
-	}
-
+	// The chi-square is first evaluated at n+1 evenly spaced points from ip to fp. Each refinement level then adds the midpoint of every interval
+	// that has at least one endpoint within chisqscan_dchisq of the minimum.
+	int i,j,k,l,level,n_new;
+	int npts = n+1;
 	double step = (fp-ip)/n;
-	int i,j;
-	double p;
+	double *pvals = new double[npts];
+	double *chisqvals = new double[npts];
+	double *point_params = (chisqscan_profile) ? new double[npts*n_fit_parameters] : NULL;
+	for (i=0; i < npts; i++) {
+		pvals[i] = ip + i*step;
+		if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) point_params[i*n_fit_parameters+l] = fitparams[l];
+	}
+	evaluate_chisq_scan_points(npts,1,&param,pvals,point_params,chisqvals);
 
 	double chisqmin=1e30;
-	dvector chisqvals(n);
-	ofstream chisqout(filename.c_str());
-	double pmin;
-	for (i=0, p=ip; i <= n; i++, p += step) {
-		fitparams[param] = p;
-		chisqvals[i] = 2.0 * (this->*LogLikePtr)(fitparams.array());
+	double pmin = ip;
+	for (i=0; i < npts; i++) {
 		if (chisqvals[i] < chisqmin) {
 			chisqmin = chisqvals[i];
-			pmin = p;
+			pmin = pvals[i];
+		}
+	}
+
+	double *new_pvals, *new_chisq, *new_params, *pvals_merged, *chisqvals_merged, *params_merged;
+	for (level=1; level <= chisqscan_nrefine; level++) {
+		n_new = 0;
+		for (i=0; i < npts-1; i++) {
+			if (dmin(chisqvals[i],chisqvals[i+1])-chisqmin <= chisqscan_dchisq) n_new++;
+		}
+		if (n_new==0) break;
+		new_pvals = new double[n_new];
+		new_chisq = new double[n_new];
+		new_params = (chisqscan_profile) ? new double[n_new*n_fit_parameters] : NULL;
+		for (i=0, j=0; i < npts-1; i++) {
+			if (dmin(chisqvals[i],chisqvals[i+1])-chisqmin > chisqscan_dchisq) continue;
+			new_pvals[j] = 0.5*(pvals[i]+pvals[i+1]);
+			k = (chisqvals[i] <= chisqvals[i+1]) ? i : i+1; // start from the best fit of the better endpoint
+			if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) new_params[j*n_fit_parameters+l] = point_params[k*n_fit_parameters+l];
+			j++;
+		}
+		evaluate_chisq_scan_points(n_new,1,&param,new_pvals,new_params,new_chisq);
+
+		pvals_merged = new double[npts+n_new];
+		chisqvals_merged = new double[npts+n_new];
+		params_merged = (chisqscan_profile) ? new double[(npts+n_new)*n_fit_parameters] : NULL;
+		for (i=0, j=0, k=0; i < npts; i++) {
+			pvals_merged[k] = pvals[i];
+			chisqvals_merged[k] = chisqvals[i];
+			if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) params_merged[k*n_fit_parameters+l] = point_params[i*n_fit_parameters+l];
+			k++;
+			if ((i < npts-1) and (dmin(chisqvals[i],chisqvals[i+1])-chisqmin <= chisqscan_dchisq)) {
+				pvals_merged[k] = new_pvals[j];
+				chisqvals_merged[k] = new_chisq[j];
+				if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) params_merged[k*n_fit_parameters+l] = new_params[j*n_fit_parameters+l];
+				j++;
+				k++;
+			}
+		}
+		delete[] pvals;
+		delete[] chisqvals;
+		pvals = pvals_merged;
+		chisqvals = chisqvals_merged;
+		if (chisqscan_profile) {
+			delete[] point_params;
+			delete[] new_params;
+			point_params = params_merged;
+		}
+		delete[] new_pvals;
+		delete[] new_chisq;
+		npts += n_new;
+		for (i=0; i < npts; i++) {
+			if (chisqvals[i] < chisqmin) {
+				chisqmin = chisqvals[i];
+				pmin = pvals[i];
+			}
 		}
-		chisqout << p << " " << chisqvals[i] << endl;
+		if (mpi_id==0) cout << "Refinement level " << level << ": evaluated " << n_new << " points (min chisq=" << chisqmin << ")" << endl;
 	}
-	chisqout.close();
-	if (mpi_id==0) cout << "min chisq=" << chisqmin << ", occurs at " << pmin << endl;
 
+	if (mpi_id==0) {
+		// if the scan is profiled, the best-fit values of all the parameters at each point are written after the chi-square
+		ofstream chisqout(filename.c_str());
+		for (i=0; i < npts; i++) {
+			chisqout << pvals[i] << " " << chisqvals[i];
+			if (chisqscan_profile) for (l=0; l < n_fit_parameters; l++) chisqout << " " << point_params[i*n_fit_parameters+l];
+			chisqout << endl;
+		}
+		chisqout.close();
+		cout << "min chisq=" << chisqmin << ", occurs at " << pmin << endl;
+	}
+
+	delete[] pvals;
+	delete[] chisqvals;
+	if (chisqscan_profile) delete[] point_params;
 	fit_restore_defaults();
+	delete fitmodel;
+	fitmodel = NULL;
 }
 
-double QLens::chi_square_fit_simplex()
+void QLens::evaluate_chisq_scan_points(const int npts, const int nscan, const int *scan_params, const double *scan_vals, double *point_params, double *chisqvals)
 {
-	fitmethod = SIMPLEX;
-	if (setup_fit_parameters()==false) return 0.0;
-	fit_set_optimizations();
-	if (!initialize_fitmodel(false)) {
-		if (mpi_id==0) warn(warnings,"Warning: could not evaluate chi-square function");
-		return 1e30;
-	}
+	// Evaluates the chi-square at each point of a parameter scan, with the parameters scan_params set to the values in scan_vals and the others
+	// taken from point_params (or from fitparams if point_params is NULL). If chisqscan_profile is on, the other parameters are minimized over
+	// with Powell's method (starting from point_params) and point_params is overwritten with the best-fit values.
+	// The points are divided among the MPI groups (each with its own copy of the model); the results for group g are stored in slots
+	// g*npts_per_group ... (g+1)*npts_per_group-1 so that each group's results can be broadcast in one piece.
+	int i,j,k,slot;
+	int n_free = n_fit_parameters - nscan;
+	bool profile = ((chisqscan_profile) and (point_params != NULL) and (n_free > 0));
+	int stride = n_fit_parameters + 1;
+	int npts_per_group = (npts + mpi_ngroups - 1) / mpi_ngroups;
+	double *results = new double[npts_per_group*mpi_ngroups*stride];
+	for (i=0; i < npts_per_group*mpi_ngroups*stride; i++) results[i] = 0;
 
-	double (Simplex::*loglikeptr)(double*);
+	double (QLens::*loglikeptr)(double*);
 	if (source_fit_mode==Point_Source) {
-		loglikeptr = static_cast<double (Simplex::*)(double*)> (&QLens::fitmodel_loglike_point_source);
+		loglikeptr = static_cast<double (QLens::*)(double*)> (&QLens::fitmodel_loglike_point_source);
 	} else {
-		loglikeptr = static_cast<double (Simplex::*)(double*)> (&QLens::fitmodel_loglike_extended_source);
+		loglikeptr = static_cast<double (QLens::*)(double*)> (&QLens::fitmodel_loglike_extended_source);
 	}
 
-	dvector stepsizes(param_settings->stepsizes,n_fit_parameters);
-	if (mpi_id==0) {
-		cout << "Initial stepsizes: ";
-		for (int i=0; i < n_fit_parameters; i++) cout << stepsizes[i] << " ";
-		cout << endl << endl;
+	double *free_params, *free_stepsizes;
+	if (profile) {
+		chisqscan_loglikeptr = loglikeptr;
+		chisqscan_param_fixed = new bool[n_fit_parameters];
+		for (j=0; j < n_fit_parameters; j++) chisqscan_param_fixed[j] = false;
+		for (k=0; k < nscan; k++) chisqscan_param_fixed[scan_params[k]] = true;
+		free_params = new double[n_free];
+		free_stepsizes = new double[n_free];
+		for (j=0, k=0; j < n_fit_parameters; j++) {
+			if (!chisqscan_param_fixed[j]) free_stepsizes[k++] = param_settings->stepsizes[j];
+		}
+		initialize_powell(static_cast<double (Powell::*)(double*)> (&QLens::chisq_scan_profile_loglike),chisq_tolerance);
+		powell_set_parallel(false); // each MPI group minimizes its own points
 	}
 
-	initialize_simplex(fitparams.array(),n_fit_parameters,stepsizes.array(),chisq_tolerance);
-	simplex_set_display_bfpont(simplex_show_bestfit);
-	simplex_set_function(loglikeptr);
-	simplex_set_fmin(simplex_minchisq/2);
-	simplex_set_fmin_anneal(simplex_minchisq_anneal/2);
-	//int iterations = 0;
+	double *params;
+	for (i=group_num; i < npts; i += mpi_ngroups) {
+		slot = (i % mpi_ngroups)*npts_per_group + i/mpi_ngroups;
+		params = results + slot*stride + 1;
+		for (j=0; j < n_fit_parameters; j++) params[j] = (point_params != NULL) ? point_params[i*n_fit_parameters+j] : fitparams[j];
+		for (k=0; k < nscan; k++) params[scan_params[k]] = scan_vals[i*nscan+k];
+		if (profile) {
+			chisqscan_fullparams = params;
+			for (j=0, k=0; j < n_fit_parameters; j++) {
+				if (!chisqscan_param_fixed[j]) free_params[k++] = params[j];
+			}
+			powell_minimize(free_params,n_free,free_stepsizes);
+			results[slot*stride] = 2.0 * chisq_scan_profile_loglike(free_params); // this also leaves the best-fit values in params
+		} else {
+			results[slot*stride] = 2.0 * (this->*loglikeptr)(params);
+		}
+	}
+#ifdef USE_MPI
+	for (int groupnum=0; groupnum < mpi_ngroups; groupnum++) {
+		MPI_Bcast(results + groupnum*npts_per_group*stride,npts_per_group*stride,MPI_DOUBLE,group_leader[groupnum],MPI_COMM_WORLD);
+	}
+#endif
+	for (i=0; i < npts; i++) {
+		slot = (i % mpi_ngroups)*npts_per_group + i/mpi_ngroups;
+		chisqvals[i] = results[slot*stride];
+		if (profile) for (j=0; j < n_fit_parameters; j++) point_params[i*n_fit_parameters+j] = results[slot*stride+1+j];
+	}
+
+	if (profile) {
+		delete[] chisqscan_param_fixed;
+		delete[] free_params;
+		delete[] free_stepsizes;
+		chisqscan_param_fixed = NULL;
+		chisqscan_fullparams = NULL;
+	}
+	delete[] results;
+}
+
+double QLens::chisq_scan_profile_loglike(double* free_params)
+{
+	for (int i=0, j=0; i < n_fit_parameters; i++) {
+		if (!chisqscan_param_fixed[i]) chisqscan_fullparams[i] = free_params[j++];
+	}
+	return (this->*chisqscan_loglikeptr)(chisqscan_fullparams);
+}
+
+double QLens::chi_square_fit_simplex()
+{
+	fitmethod = SIMPLEX;
+	if (setup_fit_parameters()==false) return 0.0;
+	fit_set_optimizations();
+	if (!initialize_fitmodel(false)) {
+		if (mpi_id==0) warn(warnings,"Warning: could not evaluate chi-square function");
+		return 1e30;
+	}
+
+	double (Simplex::*loglikeptr)(double*);
+	if (source_fit_mode==Point_Source) {
+		loglikeptr = static_cast<double (Simplex::*)(double*)> (&QLens::fitmodel_loglike_point_source);
+	} else {
+		loglikeptr = static_cast<double (Simplex::*)(double*)> (&QLens::fitmodel_loglike_extended_source);
+	}
+
+	dvector stepsizes(param_settings->stepsizes,n_fit_parameters);
+	if (mpi_id==0) {
+		cout << "Initial stepsizes: ";
+		for (int i=0; i < n_fit_parameters; i++) cout << stepsizes[i] << " ";
+		cout << endl << endl;
+	}
+
+	initialize_simplex(fitparams.array(),n_fit_parameters,stepsizes.array(),chisq_tolerance);
+	simplex_set_display_bfpont(simplex_show_bestfit);
+	simplex_set_function(loglikeptr);
+	simplex_set_parallel(use_parallel_minimizer);
+#ifdef USE_MPI
+	simplex_set_mpi_groups(mpi_ngroups,group_num,group_leader);
+#endif
+	simplex_set_fmin(simplex_minchisq/2);
+	simplex_set_fmin_anneal(simplex_minchisq_anneal/2);
+	//int iterations = 0;
 	//downhill_simplex(iterations,max_iterations,0); // last argument is temperature for simulated annealing, but there is no cooling schedule with this function
 	set_annealing_schedule_parameters(simplex_temp_initial,simplex_temp_final,simplex_cooling_factor,simplex_nmax_anneal,simplex_nmax);
 	int n_iterations;
@@ -8409,6 +9047,10 @@ double QLens::chi_square_fit_powell()
 	}
 
 	initialize_powell(loglikeptr,chisq_tolerance);
+	powell_set_parallel(use_parallel_minimizer);
+#ifdef USE_MPI
+	powell_set_mpi_groups(mpi_ngroups,group_num,group_leader);
+#endif
 
 	dvector stepsizes(param_settings->stepsizes,n_fit_parameters);
 	if (mpi_id==0) {
@@ -8470,6 +9112,86 @@ double QLens::chi_square_fit_powell()
 	return chisq_bestfit;
 }
 
+double QLens::chi_square_fit_lbfgs()
+{
+	fitmethod = QUASI_NEWTON;
+	if (setup_fit_parameters()==false) return 0.0;
+	fit_set_optimizations();
+	if (!initialize_fitmodel(true)) {
+		if (mpi_id==0) warn(warnings,"Warning: could not evaluate chi-square function");
+		return 1e30;
+	}
+
+	double (LBFGS::*loglikeptr)(double*);
+	if (source_fit_mode==Point_Source) {
+		loglikeptr = static_cast<double (LBFGS::*)(double*)> (&QLens::fitmodel_loglike_point_source);
+	} else {
+		loglikeptr = static_cast<double (LBFGS::*)(double*)> (&QLens::fitmodel_loglike_extended_source);
+	}
+	bool (LBFGS::*gradptr)(double*,double*) = static_cast<bool (LBFGS::*)(double*,double*)> (&QLens::fitmodel_loglike_gradient);
+
+	initialize_lbfgs(loglikeptr,gradptr,chisq_tolerance);
+
+	dvector stepsizes(param_settings->stepsizes,n_fit_parameters);
+	if (mpi_id==0) {
+		cout << "Initial stepsizes: ";
+		for (int i=0; i < n_fit_parameters; i++) cout << stepsizes[i] << " ";
+		cout << endl << endl;
+	}
+
+	double chisq_initial = (this->*loglikeptr)(fitparams.array());
+	if ((chisq_initial >= 1e30) and (mpi_id==0)) warn(warnings,"Your initial parameter values are returning a large \"penalty\" chi-square--this likely means\none or more parameters have unphysical values or are out of the bounds specified by 'fit plimits'");
+
+	display_chisq_status = true;
+
+	fitmodel->chisq_it = 0;
+	if (use_ansi_output_during_fit) use_ansi_characters = true;
+	else use_ansi_characters = false;
+	if ((!lbfgs_minimize(fitparams.array(),n_fit_parameters,stepsizes.array())) and (mpi_id==0)) warn(warnings,"L-BFGS minimization was interrupted or could not find a downhill step");
+	use_ansi_characters = false;
+	chisq_bestfit = 2*(this->*loglikeptr)(fitparams.array());
+	int chisq_evals = fitmodel->chisq_it;
+	fitmodel->chisq_it = 0; // To ensure it displays the chi-square status
+	if (display_chisq_status) {
+		(this->*loglikeptr)(fitparams.array());
+		if (mpi_id==0) cout << endl;
+	}
+
+	bool turned_on_chisqmag = false;
+	if (n_repeats > 0) {
+		if ((source_fit_mode==Point_Source) and (!use_magnification_in_chisq) and (use_magnification_in_chisq_during_repeats) and (!imgplane_chisq)) {
+			turned_on_chisqmag = true;
+			use_magnification_in_chisq = true;
+			fitmodel->use_magnification_in_chisq = true;
+			cout << "Now using magnification in position chi-square function during repeats...\n";
+		}
+		for (int i=0; i < n_repeats; i++) {
+			if (mpi_id==0) cout << "Repeating optimization (trial " << i+1 << ")\n";
+			use_ansi_characters = true;
+			lbfgs_minimize(fitparams.array(),n_fit_parameters,stepsizes.array());
+			use_ansi_characters = false;
+			chisq_bestfit = 2*(this->*loglikeptr)(fitparams.array());
+			chisq_evals += fitmodel->chisq_it;
+			fitmodel->chisq_it = 0; // To ensure it displays the chi-square status
+			if (display_chisq_status) {
+				(this->*loglikeptr)(fitparams.array());
+				if (mpi_id==0) cout << endl;
+			}
+		}
+	}
+	bestfitparams.input(fitparams);
+	display_chisq_status = false;
+	if (group_id==0) fitmodel->logfile << "Optimization finished: min chisq = " << chisq_bestfit << endl;
+
+	output_fit_results(stepsizes,chisq_bestfit,chisq_evals);
+
+	if (turned_on_chisqmag) use_magnification_in_chisq = false; // restore chisqmag to original setting
+	fit_restore_defaults();
+	delete fitmodel;
+	fitmodel = NULL;
+	return chisq_bestfit;
+}
+
 void QLens::output_fit_results(dvector &stepsizes, const double chisq_bestfit, const int chisq_evals)
 {
 	bool fisher_matrix_is_nonsingular;
@@ -8562,6 +9284,8 @@ bool QLens::calculate_fisher_matrix(const dvector &params, const dvector &stepsi
 	double x0, curvature;
 	int i,j;
 	double step, derivlo, derivhi;
+	dvector gradlo(n_fit_parameters), gradhi(n_fit_parameters);
+	bool analytic_row;
 	for (i=0; i < n_fit_parameters; i++) {
 		x0 = params[i];
 		xhi[i] += increment2*stepsizes[i];
@@ -8569,9 +9293,19 @@ bool QLens::calculate_fisher_matrix(const dvector &params, const dvector &stepsi
 		xlo[i] -= increment2*stepsizes[i];
 		if ((param_settings->use_penalty_limits[i]==true) and (xlo[i] < param_settings->penalty_limits_lo[i])) xlo[i] = x0;
 		step = xhi[i] - xlo[i];
+		// if fisher_analytic_gradient is on, each row of the Fisher matrix is a difference of two analytic gradients where these are available
+		analytic_row = false;
+		if (fisher_analytic_gradient) {
+			if ((fitmodel_loglike_gradient_analytic(xlo.array(),gradlo.array())) and (fitmodel_loglike_gradient_analytic(xhi.array(),gradhi.array()))) analytic_row = true;
+		}
 		for (j=0; j < n_fit_parameters; j++) {
-			derivlo = loglike_deriv(xlo,j,stepsizes[j]);
-			derivhi = loglike_deriv(xhi,j,stepsizes[j]);
+			if (analytic_row) {
+				derivlo = gradlo[j];
+				derivhi = gradhi[j];
+			} else {
+				derivlo = loglike_deriv(xlo,j,stepsizes[j]);
+				derivhi = loglike_deriv(xhi,j,stepsizes[j]);
+			}
 			fisher[i][j] = (derivhi - derivlo) / step;
 			if (fisher[i][j]*0.0) warn(warnings,"Fisher matrix element (%i,%i) calculated as 'nan'",i,j);
 			//if (i==j) cout << abs(derivlo+derivhi) << " " << sqrt(abs(fisher[i][j])) << endl;
@@ -8628,18 +9362,113 @@ double QLens::loglike_deriv(const dvector &params, const int index, const double
 	return (((this->*loglikeptr)(xhi.array()) - (this->*loglikeptr)(xlo.array())) / dif);
 }
 
-void QLens::nested_sampling()
+bool QLens::fitmodel_loglike_gradient(double* params, double* grad)
+{
+	// Finds the gradient of the -log(likelihood) returned by fitmodel_loglike_point_source (or fitmodel_loglike_extended_source)
+	// w.r.t. the (transformed) fit parameters. If the point image positions are being fit using the source plane chi-square and
+	// nothing else, the gradient is found analytically (see chisq_pos_source_plane_gradient); otherwise, it is found by finite
+	// differences in each parameter. Returns true if the analytic gradient was used.
+	bool analytic = fitmodel_loglike_gradient_analytic(params,grad);
+	if (!analytic) {
+		dvector pvec(params,n_fit_parameters);
+		for (int i=0; i < n_fit_parameters; i++) grad[i] = loglike_deriv(pvec,i,param_settings->stepsizes[i]);
+	}
+	return analytic;
+}
+
+bool QLens::fitmodel_loglike_gradient_analytic(double* params, double* grad)
+{
+	// Analytic part of fitmodel_loglike_gradient; returns false (leaving grad unchanged) if the analytic gradient is not available
+	static const double increment = 1e-5;
+	int i,j;
+	bool analytic = false;
+	if ((source_fit_mode==Point_Source) and (include_imgpos_chisq) and (!imgplane_chisq) and (!include_flux_chisq) and (!include_time_delay_chisq) and (!include_weak_lensing_chisq)) {
+		double chisq;
+		double transformed_params[n_fit_parameters];
+		fitmodel->param_settings->inverse_transform_parameters(params,transformed_params);
+		bool penalty_incurred = false;
+		for (i=0; i < n_fit_parameters; i++) {
+			if ((fitmodel->param_settings->use_penalty_limits[i]==true) and ((transformed_params[i] < fitmodel->param_settings->penalty_limits_lo[i]) or (transformed_params[i] > fitmodel->param_settings->penalty_limits_hi[i]))) penalty_incurred = true;
+		}
+		if ((!penalty_incurred) and (fitmodel->update_model(transformed_params) < 1e30)) {
+			double *dchisq = new double[n_fit_parameters];
+			if ((fitmodel->chisq_pos_source_plane_gradient(chisq,dchisq)) and (chisq >= chisq_imgplane_substitute_threshold)) {
+				// The chain rule is applied through the parameter transformations (which can mix parameters, e.g. ratios);
+				// the prior and Jacobian terms are cheap to evaluate, so they are differentiated numerically. The custom and Einstein
+				// radius priors depend on the lens model itself, so for these the model is updated at each step (no images are found).
+				bool model_priors = ((use_custom_prior) or ((einstein_radius_prior) and (nlens > 0)));
+				analytic = true;
+				double *params_hi = new double[n_fit_parameters];
+				double *params_lo = new double[n_fit_parameters];
+				double *tparams_hi = new double[n_fit_parameters];
+				double *tparams_lo = new double[n_fit_parameters];
+				double step, loglike_hi, loglike_lo;
+				for (i=0; i < n_fit_parameters; i++) {
+					for (j=0; j < n_fit_parameters; j++) params_hi[j] = params_lo[j] = params[j];
+					step = increment*param_settings->stepsizes[i];
+					params_hi[i] += step;
+					params_lo[i] -= step;
+					fitmodel->param_settings->inverse_transform_parameters(params_hi,tparams_hi);
+					fitmodel->param_settings->inverse_transform_parameters(params_lo,tparams_lo);
+					grad[i] = 0;
+					for (j=0; j < n_fit_parameters; j++) {
+						if (tparams_hi[j] != tparams_lo[j]) grad[i] += dchisq[j]*(tparams_hi[j]-tparams_lo[j])/(4*step); // the loglike is chisq/2
+					}
+					loglike_hi = loglike_lo = 0;
+					fitmodel->param_settings->add_prior_terms_to_loglike(params_hi,loglike_hi);
+					fitmodel->param_settings->add_jacobian_terms_to_loglike(tparams_hi,loglike_hi);
+					fitmodel->param_settings->add_prior_terms_to_loglike(params_lo,loglike_lo);
+					fitmodel->param_settings->add_jacobian_terms_to_loglike(tparams_lo,loglike_lo);
+					if (model_priors) {
+						fitmodel->update_model(tparams_hi);
+						if (use_custom_prior) loglike_hi += fitmodel_custom_prior();
+						if ((einstein_radius_prior) and (nlens > 0)) loglike_hi += fitmodel->get_einstein_radius_prior(false);
+						fitmodel->update_model(tparams_lo);
+						if (use_custom_prior) loglike_lo += fitmodel_custom_prior();
+						if ((einstein_radius_prior) and (nlens > 0)) loglike_lo += fitmodel->get_einstein_radius_prior(false);
+					}
+					grad[i] += (loglike_hi - loglike_lo)/(2*step);
+				}
+				if (model_priors) fitmodel->update_model(transformed_params);
+				delete[] params_hi;
+				delete[] params_lo;
+				delete[] tparams_hi;
+				delete[] tparams_lo;
+			}
+			delete[] dchisq;
+		}
+	}
+	return analytic;
+}
+
+double QLens::DLogLike(double* params, const int i)
+{
+	// The HMC sampler asks for one component of the gradient at a time, so the full gradient is found once and saved for the given point
+	bool same_point = (loglike_gradient_params.size()==n_fit_parameters);
+	for (int j=0; (same_point) and (j < n_fit_parameters); j++) {
+		if (loglike_gradient_params[j] != params[j]) same_point = false;
+	}
+	if (!same_point) {
+		loglike_gradient_params.input(params,n_fit_parameters);
+		loglike_gradient.input(n_fit_parameters);
+		fitmodel_loglike_gradient(params,loglike_gradient.array());
+	}
+	return loglike_gradient[i];
+}
+
+void QLens::nested_sampling(const bool resume_previous)
 {
 	fitmethod = NESTED_SAMPLING;
 	if (setup_fit_parameters()==false) return;
 	fit_set_optimizations();
-	if ((mpi_id==0) and (fit_output_dir != ".")) {
+	if ((mpi_id==0) and (!resume_previous) and (fit_output_dir != ".")) {
 		string rmstring = "if [ -e " + fit_output_dir + " ]; then rm -r " + fit_output_dir + "; fi";
 		if (system(rmstring.c_str()) != 0) warn("could not delete old output directory for nested sampling results"); // delete the old output directory and remake it, just in case there is old data that might get mixed up when running mkdist
 		// I should probably give the nested sampling output a unique extension like ".nest" or something, so that mkdist can't ever confuse it with twalk output in the same dir
 		// Do this later...
 		create_output_directory();
 	}
+	else if (resume_previous) create_output_directory(); // in case the previous run was stopped before it got started
 
 	if (!initialize_fitmodel(true)) {
 		if (mpi_id==0) warn(warnings,"Warning: could not evaluate chi-square function");
@@ -8700,6 +9529,7 @@ void QLens::nested_sampling()
 	display_chisq_status = false; // just in case it was turned on
 	double lnZ;
 
+	SetCheckpoint(mcmc_checkpoint_interval,resume_previous);
 	use_ansi_characters = true;
 	MonoSample(filename.c_str(),n_livepts,lnZ,fitparams.array(),param_errors,mcmc_logfile,NULL,chain_info,data_info);
 	use_ansi_characters = false;
@@ -9246,15 +10076,16 @@ void QLens::polychord(const bool resume_previous, const bool skip_run)
 #endif
 }
 
-void QLens::chi_square_twalk()
+void QLens::chi_square_twalk(const bool resume_previous)
 {
 	if (setup_fit_parameters()==false) return;
 	fit_set_optimizations();
-	if ((mpi_id==0) and (fit_output_dir != ".")) {
+	if ((mpi_id==0) and (!resume_previous) and (fit_output_dir != ".")) {
 		string rmstring = "if [ -e " + fit_output_dir + " ]; then rm -r " + fit_output_dir + "; fi";
 		if (system(rmstring.c_str()) != 0) warn("could not delete old output directory for twalk results"); // delete the old output directory and remake it, just in case there is old data that might get mixed up when running mkdist
 		create_output_directory();
 	}
+	else if (resume_previous) create_output_directory(); // in case the previous run was stopped before it got started
 	if (!initialize_fitmodel(true)) {
 		if (mpi_id==0) warn(warnings,"Warning: could not evaluate chi-square function");
 		return;
@@ -9312,6 +10143,8 @@ void QLens::chi_square_twalk()
 
 	display_chisq_status = false; // just in case it was turned on
 
+	SetCheckpoint(mcmc_checkpoint_interval,resume_previous);
+	SetStoppingRule(mcmc_target_ess);
 	use_ansi_characters = true;
 	TWalk(filename.c_str(),0.9836,4,2.4,2.5,6.0,mcmc_tolerance,mcmc_threads,fitparams.array(),mcmc_logfile,NULL,chain_info,data_info);
 	use_ansi_characters = false;
@@ -9359,9 +10192,7 @@ bool QLens::adopt_model(dvector &fitpars)
 		if (transform_center_coords) {
 			if ((image_pixel_grids == NULL) or (image_pixel_grids[0]==NULL)) {
 				load_pixel_grid_from_data();
-				for (int i=0; i < n_extended_src_redshifts; i++) {
-					image_pixel_grids[i]->redo_lensing_calculations(false);
-				}
+				ImagePixelGrid::redo_lensing_calculations(image_pixel_grids,n_extended_src_redshifts,false);
 			}
 			update_lens_centers_from_pixsrc_coords();  
 		}
@@ -9432,7 +10263,7 @@ void QLens::output_bestfit_model()
 		}
 		outfile << endl;
 	} else {
-		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX)) {
+		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX) or (fitmethod==QUASI_NEWTON)) {
 			outfile << "Best-fit model: 2*loglike = " << chisq_bestfit << " (warning: errors omitted here because Fisher matrix was not calculated):\n";
 		} else {
 			outfile << "Best-fit model: 2*loglike = " << chisq_bestfit << endl;
@@ -9473,7 +10304,7 @@ void QLens::output_bestfit_model()
 		model->adopt_model(bestfitparams);
 	}
 	bool include_limits;
-	if ((fitmethod==POWELL) or (fitmethod==SIMPLEX)) include_limits = false;
+	if ((fitmethod==POWELL) or (fitmethod==SIMPLEX) or (fitmethod==QUASI_NEWTON)) include_limits = false;
 	else include_limits = true;
 	if (include_limits) {
 		// save version without limits in case user wants to load best-fit model while in Simplex or Powell mode
@@ -9563,89 +10394,94 @@ bool QLens::add_dparams_to_chain(string file_ext)
 	ifstream chain_file_old0(chain_old_str.c_str());
 
 	int j,line,nlines=0;
-	while (!chain_file_old0.eof()) {
-		chain_file_old0.getline(dataline,n_characters);
-		if (dataline[0]=='#') continue;
+	while (chain_file_old0.getline(dataline,n_characters)) {
+		if ((dataline[0]=='#') or (dataline[0]=='\0')) continue;
 		nlines++;
 	}
-	double **dparams_new = new double*[nlines];
-	for (i=0; i < nlines; i++) dparams_new[i] = new double[n_derived_params];
-	char **chain_lines = new char*[nlines];
-	for (i=0; i < nlines; i++) chain_lines[i] = new char[5000];
 	chain_file_old0.close();
 
+	// The chain is read and processed in blocks, so memory use does not grow with the length of the chain. Within each block, the points
+	// are divided among the MPI groups (each with its own copy of the model); the results for group g are stored in slots
+	// g*nlines_per_group ... (g+1)*nlines_per_group-1 of the block, so that each group's results can be broadcast in one piece and the
+	// new chain is written in the original order.
+	const int nlines_per_group = 1000;
+	int block_size = nlines_per_group*mpi_ngroups;
+	char **chain_lines = new char*[block_size];
+	for (i=0; i < block_size; i++) chain_lines[i] = new char[n_characters];
+	double *dparams_new = new double[block_size*n_derived_params];
+	for (i=0; i < block_size*n_derived_params; i++) dparams_new[i] = 0;
+
+	ofstream chain_file;
+	if (mpi_id==0) chain_file.open(chain_str.c_str());
 	chain_file_old0.open(chain_old_str.c_str());
-	for (line=0; line < nlines; line++) {
-		chain_file_old0.getline(chain_lines[line],n_characters);
-		if (chain_lines[line][0]=='#') { line--; continue; }
-	}
-
-	int nlines_chunk = nlines/20;
 	if (mpi_id==0) cout << "Calculating derived parameters: [\033[20C]" << endl << endl << flush;
+	int n_block, line_in_block, slot;
 	int prev_icount, icount = 0;
-	for (line=group_num; line < nlines; line += mpi_ngroups) {
-		istringstream datastream(chain_lines[line]);
-		datastream >> weight;
-		for (i=0; i < n_fit_parameters; i++) {
-			datastream >> params[i];
+	for (line=0; line < nlines; line += n_block) {
+		n_block = 0;
+		while ((n_block < block_size) and (chain_file_old0.getline(chain_lines[n_block],n_characters))) {
+			if ((chain_lines[n_block][0]=='#') or (chain_lines[n_block][0]=='\0')) continue;
+			n_block++;
+		}
+		if (n_block==0) break;
+		for (line_in_block=group_num; line_in_block < n_block; line_in_block += mpi_ngroups) {
+			istringstream datastream(chain_lines[line_in_block]);
+			datastream >> weight;
+			for (i=0; i < n_fit_parameters; i++) {
+				datastream >> params[i];
+			}
+			slot = (line_in_block % mpi_ngroups)*nlines_per_group + line_in_block/mpi_ngroups;
+			fitmodel_calculate_derived_params(params, dparams_new + slot*n_derived_params);
 		}
-		fitmodel_calculate_derived_params(params, dparams_new[line]);
-
-		prev_icount = icount;
-		icount = line/nlines_chunk;
-		if ((mpi_id==0) and (prev_icount != icount)) {
-			cout << "\033[2ACalculating derived parameters: [" << flush;
-			for (j=0; j < icount; j++) cout << "=" << flush;
-			cout << "\033[1B" << endl << flush;
-		}
-	}
-	if (mpi_id==0) {
-		cout << "\033[2ACalculating derived parameters: [" << flush;
-		for (j=0; j < 20; j++) cout << "=" << flush;
-		cout << "\033[1B" << endl << flush;
-	}
-	if (mpi_id==0) cout << endl;
-	//cout << "icount=" << icount << " prev=" << prev_icount << "line=" << line << " chunk=" << nlines_chunk << endl;
 
 #ifdef USE_MPI
-	int id;
-	for (int groupnum=0; groupnum < mpi_ngroups; groupnum++) {
-		for (i=groupnum; i < nlines; i += mpi_ngroups) {
-			id = group_leader[groupnum];
-			MPI_Bcast(dparams_new[i],n_derived_params,MPI_DOUBLE,id,MPI_COMM_WORLD);
+		for (int groupnum=0; groupnum < mpi_ngroups; groupnum++) {
+			MPI_Bcast(dparams_new + groupnum*nlines_per_group*n_derived_params,nlines_per_group*n_derived_params,MPI_DOUBLE,group_leader[groupnum],MPI_COMM_WORLD);
 		}
-	}
 #endif
 
-	if (mpi_id==0) {
-		ofstream chain_file(chain_str.c_str());
-		for (line=0; line < nlines; line++) {
-			istringstream datastream(chain_lines[line]);
-			datastream >> weight;
-			chain_file << weight << "   ";
-			for (i=0; i < n_fit_parameters; i++) {
-				datastream >> params[i];
-				chain_file << params[i] << "   ";
+		if (mpi_id==0) {
+			for (line_in_block=0; line_in_block < n_block; line_in_block++) {
+				istringstream datastream(chain_lines[line_in_block]);
+				datastream >> weight;
+				chain_file << weight << "   ";
+				for (i=0; i < n_fit_parameters; i++) {
+					datastream >> params[i];
+					chain_file << params[i] << "   ";
+				}
+				for (i=0; i < n_dparams_old; i++) {
+					datastream >> dparams_old[i];
+					chain_file << dparams_old[i] << "   ";
+				}
+				datastream >> chisq;
+				slot = (line_in_block % mpi_ngroups)*nlines_per_group + line_in_block/mpi_ngroups;
+				for (i=0; i < n_derived_params; i++) chain_file << dparams_new[slot*n_derived_params+i] << "   ";
+				chain_file << chisq << endl;
 			}
-			for (i=0; i < n_dparams_old; i++) {
-				datastream >> dparams_old[i];
-				chain_file << dparams_old[i] << "   ";
+
+			prev_icount = icount;
+			icount = (int) ((20.0*(line+n_block))/nlines);
+			if (prev_icount != icount) {
+				cout << "\033[2ACalculating derived parameters: [" << flush;
+				for (j=0; j < icount; j++) cout << "=" << flush;
+				cout << "\033[1B" << endl << flush;
 			}
-			datastream >> chisq;
-			for (i=0; i < n_derived_params; i++) chain_file << dparams_new[line][i] << "   ";
-			chain_file << chisq << endl;
 		}
-		chain_file.close();
 	}
+	if (mpi_id==0) {
+		cout << "\033[2ACalculating derived parameters: [" << flush;
+		for (j=0; j < 20; j++) cout << "=" << flush;
+		cout << "\033[1B" << endl << flush;
+	}
+	if (mpi_id==0) cout << endl;
+	chain_file_old0.close();
+	if (mpi_id==0) chain_file.close();
 
 	delete[] params;
 	delete[] dparams_old;
-	for (i=0; i < nlines; i++) {
-		delete[] chain_lines[i];
-		delete[] dparams_new[i];
-	}
-	delete[] dparams_new;
+	for (i=0; i < block_size; i++) delete[] chain_lines[i];
 	delete[] chain_lines;
+	delete[] dparams_new;
 	fit_restore_defaults();
 	delete fitmodel;
 	fitmodel = NULL;
@@ -9850,18 +10686,17 @@ bool QLens::plot_kappa_profile_percentiles_from_chain(int lensnum, double rmin,
 
 	static const int n_characters = 5000;
 	char dataline[n_characters];
-	double *params = new double[n_fit_parameters];
 
 	string chain_str = fit_output_dir + "/" + fit_output_filename;
 	ifstream chain_file(chain_str.c_str());
 
 	unsigned long n_points=0;
-	while (!chain_file.eof()) {
-		chain_file.getline(dataline,n_characters);
-		if (dataline[0]=='#') continue;
+	while (chain_file.getline(dataline,n_characters)) {
+		if ((dataline[0]=='#') or (dataline[0]=='\0')) continue;
 		n_points++;
 	}
 	chain_file.close();
+	if (n_points==0) { warn("no points found in chain file '%s'",chain_str.c_str()); delete[] rvals; return false; }
 
 	double **weights = new double*[nbins];
 	double **weights2 = new double*[nbins];
@@ -9876,35 +10711,78 @@ bool QLens::plot_kappa_profile_percentiles_from_chain(int lensnum, double rmin,
 	double *kappa_r_vals = new double[nbins];
 	double *kappa_avg_vals = new double[nbins];
 
+	// The chain points are divided among the MPI groups. The profiles computed by group g are stored in slots
+	// g*npts_per_group ... (g+1)*npts_per_group-1 so that each group's results can be broadcast in one piece.
+	unsigned long npts_per_group = (n_points + mpi_ngroups - 1) / mpi_ngroups;
+	unsigned long slot;
+	double *kappa_profiles = new double[npts_per_group*mpi_ngroups*2*nbins];
+	for (slot=0; slot < npts_per_group*mpi_ngroups*2*nbins; slot++) kappa_profiles[slot] = 0;
+
 	chain_file.open(chain_str.c_str());
-	int j=0;
+	unsigned long j=0;
 	double weight, tot=0;
-	while (!chain_file.eof()) {
-		chain_file.getline(dataline,n_characters);
-		if (dataline[0]=='#') continue;
+	dvector chain_params(n_fit_parameters);
+	while (chain_file.getline(dataline,n_characters)) {
+		if ((dataline[0]=='#') or (dataline[0]=='\0')) continue;
 
 		istringstream datastream(dataline);
 		datastream >> weight;
 		tot += weight;
-		for (i=0; i < n_fit_parameters; i++) {
-			datastream >> params[i];
-		}
-		dvector chain_params(params,n_fit_parameters);
-		adopt_model(chain_params);
-		//print_lens_list(false);
-		lens_list[lensnum]->plot_kappa_profile(nbins,rvals,kappa_r_vals,kappa_avg_vals);
 		for (i=0; i < nbins; i++) {
-			kappa_r_pts[i][j] = kappa_r_vals[i];
-			kappa_avg_pts[i][j] = kappa_avg_vals[i];
-			//cout << "RK: " << rvals[i] << " " << kappa_r_pts[i][j] << endl;
 			weights[i][j] = weight;
 			weights2[i][j] = weight;
 		}
-
+		if (j % mpi_ngroups == group_num) {
+			for (i=0; i < n_fit_parameters; i++) {
+				datastream >> chain_params[i];
+			}
+			adopt_model(chain_params);
+			//print_lens_list(false);
+			lens_list[lensnum]->plot_kappa_profile(nbins,rvals,kappa_r_vals,kappa_avg_vals);
+			slot = ((j % mpi_ngroups)*npts_per_group + j/mpi_ngroups)*2*nbins;
+			for (i=0; i < nbins; i++) {
+				kappa_profiles[slot+i] = kappa_r_vals[i];
+				kappa_profiles[slot+nbins+i] = kappa_avg_vals[i];
+			}
+		}
 		j++;
 	}
 	chain_file.close();
 
+#ifdef USE_MPI
+	for (int groupnum=0; groupnum < mpi_ngroups; groupnum++) {
+		MPI_Bcast(kappa_profiles + groupnum*npts_per_group*2*nbins,npts_per_group*2*nbins,MPI_DOUBLE,group_leader[groupnum],MPI_COMM_WORLD);
+	}
+#endif
+	for (j=0; j < n_points; j++) {
+		slot = ((j % mpi_ngroups)*npts_per_group + j/mpi_ngroups)*2*nbins;
+		for (i=0; i < nbins; i++) {
+			kappa_r_pts[i][j] = kappa_profiles[slot+i];
+			kappa_avg_pts[i][j] = kappa_profiles[slot+nbins+i];
+			//cout << "RK: " << rvals[i] << " " << kappa_r_pts[i][j] << endl;
+		}
+	}
+	delete[] kappa_profiles;
+
+	if ((mpi_ngroups > 1) and ((n_points-1) % mpi_ngroups != group_num)) {
+		// every process should end up with the model from the last point in the chain, as it would if the points had been done in order
+		chain_file.open(chain_str.c_str());
+		j=0;
+		while (chain_file.getline(dataline,n_characters)) {
+			if ((dataline[0]=='#') or (dataline[0]=='\0')) continue;
+			if (j++ < n_points-1) continue;
+			istringstream datastream(dataline);
+			datastream >> weight;
+			for (i=0; i < n_fit_parameters; i++) {
+				datastream >> chain_params[i];
+			}
+			adopt_model(chain_params);
+		}
+		chain_file.close();
+	}
+
+	// the bins are independent, so they can be sorted in parallel
+	#pragma omp parallel for private(i) schedule(dynamic)
 	for (i=0; i < nbins; i++) {
 		sort(n_points,kappa_r_pts[i],weights[i]);
 		sort(n_points,kappa_avg_pts[i],weights2[i]);
@@ -9914,7 +10792,8 @@ bool QLens::plot_kappa_profile_percentiles_from_chain(int lensnum, double rmin,
 	double slope_lo1, slope_lo2, slope_hi1, slope_hi2;
 	double kavglo1, kavglo2, kavghi1, kavghi2;
 	double mavglo1, mavglo2, mavghi1, mavghi2;
-	ofstream outfile(kappa_filename.c_str());
+	ofstream outfile;
+	if (mpi_id==0) outfile.open(kappa_filename.c_str());
 	double sigma_cr_arcsec = cosmo.sigma_crit_arcsec(zl, reference_source_redshift);
 	double arcsec_to_kpc = cosmo.angular_diameter_distance(zl)/(1e-3*(180/M_PI)*3600);
 	double rval_kpc;
@@ -9956,7 +10835,6 @@ bool QLens::plot_kappa_profile_percentiles_from_chain(int lensnum, double rmin,
 		outfile << rvals[i] << " " << rval_kpc << " " << kaplo1 << " " << kaphi1 << " " << kaplo2 << " " << kaphi2 << " " << kavglo1 << " " << kavghi1 << " " << kavglo2 << " " << kavghi2 << " " << mavglo1 << " " << mavghi1 << " " << mavglo2 << " " << mavghi2 << " " << slope_lo1 << " " << slope_hi1 << " " << slope_lo2 << " " << slope_hi2 << endl;
 	}
 
-	delete[] params;
 	delete[] rvals;
 	delete[] kappa_r_vals;
 	delete[] kappa_avg_vals;
@@ -9981,6 +10859,7 @@ double QLens::find_percentile(const unsigned long npoints, const double pct, con
 		totsofar += weights[j];
 		if (totsofar/tot >= pct)
 		{
+			if (j==0) return pts[0];
 			return pts[j] + (pts[j-1] - pts[j])*(totsofar - pct*tot)/weights[j];
 		}
 	}
@@ -10050,9 +10929,8 @@ bool QLens::output_scaled_percentiles_from_egrad_fits(const int srcnum, const do
 		ifstream chain_file(chain_str.c_str());
 
 		unsigned long n_points=0;
-		while (!chain_file.eof()) {
-			chain_file.getline(dataline,n_characters);
-			if (dataline[0]=='#') continue;
+		while (chain_file.getline(dataline,n_characters)) {
+			if ((dataline[0]=='#') or (dataline[0]=='\0')) continue;
 			n_points++;
 		}
 		chain_file.close();
@@ -10067,9 +10945,8 @@ bool QLens::output_scaled_percentiles_from_egrad_fits(const int srcnum, const do
 		chain_file.open(chain_str.c_str());
 		j=0;
 		double weight, tot=0;
-		while (!chain_file.eof()) {
-			chain_file.getline(dataline,n_characters);
-			if (dataline[0]=='#') continue;
+		while (chain_file.getline(dataline,n_characters)) {
+			if ((dataline[0]=='#') or (dataline[0]=='\0')) continue;
 
 			istringstream datastream(dataline);
 			datastream >> weight;
@@ -10094,11 +10971,20 @@ bool QLens::output_scaled_percentiles_from_egrad_fits(const int srcnum, const do
 		if (k==0) scalefac = dmin(5,qtheta_pct_scaling); // SB parameter errors are more trustworthy so they don't need to be scaled as much
 		else if ((k==1) or (k==2)) scalefac = qtheta_pct_scaling; // SB parameter errors are more trustworthy so they don't need to be scaled as much
 		else scalefac = fmode_pct_scaling;
+		double *lopcts = new double[nparams];
+		double *hipcts = new double[nparams];
+		double *medpcts = new double[nparams];
+		#pragma omp parallel for private(i) schedule(dynamic)
 		for (i=0; i < nparams; i++) {
 			sort(n_points,paramvals[i],weights[i]);
-			lopct = find_percentile(n_points, 0.02275, tot, paramvals[i], weights[i]);
-			hipct = find_percentile(n_points, 0.97725, tot, paramvals[i], weights[i]);
-			medpct = find_percentile(n_points, 0.5, tot, paramvals[i], weights[i]);
+			lopcts[i] = find_percentile(n_points, 0.02275, tot, paramvals[i], weights[i]);
+			hipcts[i] = find_percentile(n_points, 0.97725, tot, paramvals[i], weights[i]);
+			medpcts[i] = find_percentile(n_points, 0.5, tot, paramvals[i], weights[i]);
+		}
+		for (i=0; i < nparams; i++) {
+			lopct = lopcts[i];
+			hipct = hipcts[i];
+			medpct = medpcts[i];
 			lowerr = scalefac*(medpct - lopct);
 			hierr = scalefac*(hipct - medpct);
 			scaled_lopct = medpct - lowerr;
@@ -10136,6 +11022,10 @@ bool QLens::output_scaled_percentiles_from_egrad_fits(const int srcnum, const do
 		delete[] weights;
 		delete[] priorlo;
 		delete[] priorhi;
+		delete[] params;
+		delete[] lopcts;
+		delete[] hipcts;
+		delete[] medpcts;
 	}
 	scriptout << "source update 0 xc=" << xcavg << " yc=" << ycavg << endl << endl;
 
@@ -10168,9 +11058,8 @@ bool QLens::output_scaled_percentiles_from_chain(const double pct_scaling)
 	ifstream chain_file(chain_str.c_str());
 
 	unsigned long n_points=0;
-	while (!chain_file.eof()) {
-		chain_file.getline(dataline,n_characters);
-		if (dataline[0]=='#') continue;
+	while (chain_file.getline(dataline,n_characters)) {
+		if ((dataline[0]=='#') or (dataline[0]=='\0')) continue;
 		n_points++;
 	}
 	chain_file.close();
@@ -10185,9 +11074,8 @@ bool QLens::output_scaled_percentiles_from_chain(const double pct_scaling)
 	chain_file.open(chain_str.c_str());
 	j=0;
 	double weight, tot=0;
-	while (!chain_file.eof()) {
-		chain_file.getline(dataline,n_characters);
-		if (dataline[0]=='#') continue;
+	while (chain_file.getline(dataline,n_characters)) {
+		if ((dataline[0]=='#') or (dataline[0]=='\0')) continue;
 
 		istringstream datastream(dataline);
 		datastream >> weight;
@@ -10202,12 +11090,23 @@ bool QLens::output_scaled_percentiles_from_chain(const double pct_scaling)
 
 	scriptout << "fit priors limits" << endl;
 
-	double lopct, hipct, medpct, lowerr, hierr, scaled_lopct, scaled_hipct;
+	// the parameters are independent, so their percentiles can be found in parallel
+	double *lopcts = new double[nparams];
+	double *hipcts = new double[nparams];
+	double *medpcts = new double[nparams];
+	#pragma omp parallel for private(i) schedule(dynamic)
 	for (i=0; i < nparams; i++) {
 		sort(n_points,paramvals[i],weights[i]);
-		lopct = find_percentile(n_points, 0.02275, tot, paramvals[i], weights[i]);
-		hipct = find_percentile(n_points, 0.97725, tot, paramvals[i], weights[i]);
-		medpct = find_percentile(n_points, 0.5, tot, paramvals[i], weights[i]);
+		lopcts[i] = find_percentile(n_points, 0.02275, tot, paramvals[i], weights[i]);
+		hipcts[i] = find_percentile(n_points, 0.97725, tot, paramvals[i], weights[i]);
+		medpcts[i] = find_percentile(n_points, 0.5, tot, paramvals[i], weights[i]);
+	}
+
+	double lopct, hipct, medpct, lowerr, hierr, scaled_lopct, scaled_hipct;
+	for (i=0; i < nparams; i++) {
+		lopct = lopcts[i];
+		hipct = hipcts[i];
+		medpct = medpcts[i];
 		lowerr = pct_scaling*(medpct - lopct);
 		hierr = pct_scaling*(hipct - medpct);
 		scaled_lopct = medpct - lowerr;
@@ -10224,6 +11123,11 @@ bool QLens::output_scaled_percentiles_from_chain(const double pct_scaling)
 	}
 	delete[] paramvals;
 	delete[] weights;
+	delete[] lopcts;
+	delete[] hipcts;
+	delete[] medpcts;
+	delete[] params;
+	delete[] paramnames;
 
 	return true;
 }
@@ -11045,7 +11949,7 @@ void QLens::print_fit_model()
 		print_point_source_list(true);
 	}
 	if (vary_syserr_pos_parameter) {
-		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX)) {
+		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX) or (fitmethod==QUASI_NEWTON)) {
 			cout << "Systematic error parameter: " << syserr_pos << endl;
 		} else {
 			if ((syserr_pos_lower_limit==1e30) or (syserr_pos_upper_limit==1e30)) cout << "\nsyserr_pos parameter: lower/upper limits not given (these must be set by 'syserr_pos' command before fit)\n";
@@ -11053,7 +11957,7 @@ void QLens::print_fit_model()
 		}
 	}
 	if (vary_wl_shear_factor_parameter) {
-		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX)) {
+		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX) or (fitmethod==QUASI_NEWTON)) {
 			cout << "Weak lensing shear factor parameter: " << wl_shear_factor << endl;
 		} else {
 			if ((wl_shear_factor_lower_limit==1e30) or (wl_shear_factor_upper_limit==1e30)) cout << "\nwl_shearfac parameter: lower/upper limits not given (these must be set by 'wl_shear_factor' command before fit)\n";
@@ -11652,10 +12556,8 @@ bool QLens::create_sourcegrid_from_imggrid_delaunay(const bool use_weighted_srcp
 
 	bool find_invmag = ((use_mag_weighted_regularization) and (zsrc_i==0)) ? true : false;
 	if ((use_srcpixel_clustering) or (use_weighted_srcpixel_clustering)) {
-#ifdef USE_MLPACK
 		int *iweights_norm;
 		double min_weight = 1e30;
-		double *input_data = new double[2*npix];
 		double *weights = new double[npix];
 		double *initial_centroids;
 		int *ivals_centroids;
@@ -11706,9 +12608,7 @@ bool QLens::create_sourcegrid_from_imggrid_delaunay(const bool use_weighted_srcp
 		jvals_centroids = new int[n_src_centroids];
 		if (icent_offset >= data_reduce_factor) die("FOOK");
 		if (!use_weighted_initial_centroids) {
-			for (i=0,j=0,k=0,l=0; i < npix; i++) {
-				input_data[j++] = srcpts_x[i];
-				input_data[j++] = srcpts_y[i];
+			for (i=0,k=0,l=0; i < npix; i++) {
 				if (i%data_reduce_factor==icent_offset) {
 					initial_centroids[k++] = srcpts_x[i];
 					initial_centroids[k++] = srcpts_y[i];
@@ -11721,9 +12621,7 @@ bool QLens::create_sourcegrid_from_imggrid_delaunay(const bool use_weighted_srcp
 			if (l != n_src_centroids) die("centroid miscount: %i %i",l,n_src_centroids);
 		} else {
 			int m,n,wnorm;
-			for (i=0,j=0,k=0,l=0,n=0; i < npix; i++) {
-				input_data[j++] = srcpts_x[i];
-				input_data[j++] = srcpts_y[i];
+			for (i=0,k=0,l=0,n=0; i < npix; i++) {
 				wnorm = iweights_norm[i];
 				if (wnorm >= 2*data_reduce_factor) cout << "RUHROH! Will count a centroid twice due to overweighting" << endl;
 				for (m=0; m < wnorm; m++) {
@@ -11741,49 +12639,89 @@ bool QLens::create_sourcegrid_from_imggrid_delaunay(const bool use_weighted_srcp
 			delete[] iweights_norm;
 		}
 
-		arma::mat dataset(input_data, 2, npix);
-		arma::Col<double> weightvec(weights, npix);
-		arma::mat centroids(initial_centroids, 2, n_src_centroids);
-
-		bool guess_initial_clusters;
-		if (!clustering_random_initialization) guess_initial_clusters = true;
-		else guess_initial_clusters = false;
-
 		double *src_centroids_x = new double[n_src_centroids];
 		double *src_centroids_y = new double[n_src_centroids];
 
-		if (!use_dualtree_kmeans) {
-			KMeans<EuclideanDistance, SampleInitialization, MaxVarianceNewCluster, NaiveKMeans> clus(n_cluster_iterations);
-			clus.Cluster(dataset, n_src_centroids, centroids, weightvec, use_weighted_srcpixel_clustering, guess_initial_clusters);
+		if (use_native_kmeans) {
+			KMeans2D *clus = &delaunay_srcgrids[src_i]->srcpt_clustering;
+			bool warm_start = ((kmeans_warm_start) and (clus->warm_start_available(n_src_centroids))) ? true : false;
+			if ((clustering_random_initialization) and (!warm_start)) {
+				// pick initial centroids randomly from the data points (rather than the evenly spaced subset chosen above)
+				for (i=0; i < n_src_centroids; i++) {
+					j = (int) (npix*RandomNumber());
+					if (j >= npix) j = npix-1;
+					initial_centroids[2*i] = srcpts_x[j];
+					initial_centroids[2*i+1] = srcpts_y[j];
+					ivals_centroids[i] = ivals[j];
+					jvals_centroids[i] = jvals[j];
+				}
+			}
 			for (i=0; i < n_src_centroids; i++) {
-				src_centroids_x[i] = (double) centroids(0,i);
-				src_centroids_y[i] = (double) centroids(1,i);
+				src_centroids_x[i] = initial_centroids[2*i];
+				src_centroids_y[i] = initial_centroids[2*i+1];
 			}
-
-		} else {
-			KMeans<EuclideanDistance, SampleInitialization, MaxVarianceNewCluster, DefaultDualTreeKMeans> clus(n_cluster_iterations);
-			bool status;
-			status = clus.Cluster(dataset, n_src_centroids, centroids, weightvec, use_weighted_srcpixel_clustering, guess_initial_clusters);
-			if (status==false) {
-				warn("Dual-tree k-means algorithm failed, so using naive k-means instead");
-				// Dual Tree didn't work, so let's use naive k-means instead
-				arma::mat dataset2(input_data, 2, npix);
-				arma::Col<double> weightvec2(weights, npix);
-				arma::mat centroids2(initial_centroids, 2, n_src_centroids);
-				KMeans<EuclideanDistance, SampleInitialization, MaxVarianceNewCluster, NaiveKMeans> clus_naive(n_cluster_iterations);
-				clus_naive.Cluster(dataset2, n_src_centroids, centroids2, weightvec2, use_weighted_srcpixel_clustering, guess_initial_clusters);
-				for (i=0; i < n_src_centroids; i++) {
-					src_centroids_x[i] = (double) centroids2(0,i);
-					src_centroids_y[i] = (double) centroids2(1,i);
+			int *nearest_pts = new int[n_src_centroids];
+			clus->cluster(srcpts_x,srcpts_y,(use_weighted_srcpixel_clustering) ? weights : NULL,npix,n_src_centroids,src_centroids_x,src_centroids_y,n_cluster_iterations,warm_start,nearest_pts);
+			for (i=0; i < n_src_centroids; i++) {
+				// use the image pixel of the data point nearest to each final centroid to help locate it when ray-tracing
+				if (nearest_pts[i] >= 0) {
+					ivals_centroids[i] = ivals[nearest_pts[i]];
+					jvals_centroids[i] = jvals[nearest_pts[i]];
 				}
-			} else {
+			}
+			delete[] nearest_pts;
+			if ((mpi_id==0) and (verbal)) cout << "k-means clustering " << ((warm_start) ? "(warm start) " : "") << "took " << clus->get_n_iterations() << " iterations" << endl;
+		} else {
+#ifdef USE_MLPACK
+			double *input_data = new double[2*npix];
+			for (i=0,j=0; i < npix; i++) {
+				input_data[j++] = srcpts_x[i];
+				input_data[j++] = srcpts_y[i];
+			}
+			arma::mat dataset(input_data, 2, npix);
+			arma::Col<double> weightvec(weights, npix);
+			arma::mat centroids(initial_centroids, 2, n_src_centroids);
+
+			bool guess_initial_clusters;
+			if (!clustering_random_initialization) guess_initial_clusters = true;
+			else guess_initial_clusters = false;
+
+			if (!use_dualtree_kmeans) {
+				KMeans<EuclideanDistance, SampleInitialization, MaxVarianceNewCluster, NaiveKMeans> clus(n_cluster_iterations);
+				clus.Cluster(dataset, n_src_centroids, centroids, weightvec, use_weighted_srcpixel_clustering, guess_initial_clusters);
 				for (i=0; i < n_src_centroids; i++) {
 					src_centroids_x[i] = (double) centroids(0,i);
 					src_centroids_y[i] = (double) centroids(1,i);
 				}
+
+			} else {
+				KMeans<EuclideanDistance, SampleInitialization, MaxVarianceNewCluster, DefaultDualTreeKMeans> clus(n_cluster_iterations);
+				bool status;
+				status = clus.Cluster(dataset, n_src_centroids, centroids, weightvec, use_weighted_srcpixel_clustering, guess_initial_clusters);
+				if (status==false) {
+					warn("Dual-tree k-means algorithm failed, so using naive k-means instead");
+					// Dual Tree didn't work, so let's use naive k-means instead
+					arma::mat dataset2(input_data, 2, npix);
+					arma::Col<double> weightvec2(weights, npix);
+					arma::mat centroids2(initial_centroids, 2, n_src_centroids);
+					KMeans<EuclideanDistance, SampleInitialization, MaxVarianceNewCluster, NaiveKMeans> clus_naive(n_cluster_iterations);
+					clus_naive.Cluster(dataset2, n_src_centroids, centroids2, weightvec2, use_weighted_srcpixel_clustering, guess_initial_clusters);
+					for (i=0; i < n_src_centroids; i++) {
+						src_centroids_x[i] = (double) centroids2(0,i);
+						src_centroids_y[i] = (double) centroids2(1,i);
+					}
+				} else {
+					for (i=0; i < n_src_centroids; i++) {
+						src_centroids_x[i] = (double) centroids(0,i);
+						src_centroids_y[i] = (double) centroids(1,i);
+					}
+				}
 			}
+			delete[] input_data;
+#else
+			die("Must compile with -DUSE_MLPACK option to use mlpack clustering algorithm (otherwise turn on 'native_kmeans')");
+#endif
 		}
-		delete[] input_data;
 		delete[] initial_centroids;
 		delete[] weights;
 
@@ -11797,9 +12735,6 @@ bool QLens::create_sourcegrid_from_imggrid_delaunay(const bool use_weighted_srcp
 		delete[] src_centroids_y;
 		delete[] ivals_centroids;
 		delete[] jvals_centroids;
-#else
-		die("Must compile with -DUSE_MLPACK option to use source pixel clustering algorithm with adaptive grid");
-#endif
 	} else {
 		if ((mpi_id==0) and (verbal)) cout << "Delaunay grid has n_pixels=" << npix << endl;
 		if (delaunay_srcgrids[src_i]==NULL) delaunay_srcgrids[src_i] = new DelaunayGrid(this);
@@ -12362,11 +13297,11 @@ double QLens::invert_image_surface_brightness_map(double &chisq0, const bool ver
 #endif
 
 	if ((redo_lensing_calculations_before_inversion) and (ranchisq_i==0)) {
-		for (zsrc_i=0; zsrc_i < n_extended_src_redshifts; zsrc_i++) {
-			image_pixel_grids[zsrc_i]->redo_lensing_calculations(verbal);
-			if ((n_extended_src_redshifts > 1) and (zsrc_i==0)) {
-				update_lens_centers_from_pixsrc_coords();
-			}
+		image_pixel_grids[0]->redo_lensing_calculations(verbal);
+		if (n_extended_src_redshifts > 1) {
+			update_lens_centers_from_pixsrc_coords();
+			// the remaining source planes do not depend on each other, so they are ray-traced together
+			ImagePixelGrid::redo_lensing_calculations(image_pixel_grids+1,n_extended_src_redshifts-1,verbal);
 		}
 	}
 	//if ((source_fit_mode==Cartesian_Source) or (source_fit_mode==Delaunay_Source) or (source_fit_mode==Shapelet_Source) or (n_image_prior)) image_pixel_grids[0]->redo_lensing_calculations(verbal);
@@ -12985,32 +13920,66 @@ double QLens::invert_image_surface_brightness_map(double &chisq0, const bool ver
 		ImagePixelGrid* image_pixel_grid = image_pixel_grids[zsrc_i]; 
 		n_data_pixels = 0;
 		chisq0_zsrc = 0;
+		// with correlated noise, the noise-scaled residuals are stored so they can be whitened before squaring
+		bool whiten = use_noise_whitening();
+		double **scaled_residual = NULL;
+		bool **included = NULL;
+		if (whiten) {
+			scaled_residual = new double*[image_pixel_data->npixels_x];
+			included = new bool*[image_pixel_data->npixels_x];
+			for (i=0; i < image_pixel_data->npixels_x; i++) {
+				scaled_residual[i] = new double[image_pixel_data->npixels_y];
+				included[i] = new bool[image_pixel_data->npixels_y];
+				for (j=0; j < image_pixel_data->npixels_y; j++) included[i][j] = false;
+			}
+		}
+		double residual;
+		bool pixel_included;
 		for (i=0; i < image_pixel_data->npixels_x; i++) {
 			for (j=0; j < image_pixel_data->npixels_y; j++) {
 				if ((image_pixel_grid->pixel_in_mask[i][j]) or ((include_foreground_sb_array) and (image_pixel_data->foreground_mask[i][j]))) {
 					n_data_pixels++;
 					if (use_noise_map) cov_inverse = image_pixel_data->covinv_map[i][j];
+					pixel_included = true;
 					if ((image_pixel_grid->pixel_in_mask[i][j]) and (image_pixel_grid->maps_to_source_pixel[i][j])) {
 						//img_index = image_pixel_grid->pixel_index[i][j]; // we won't need this anymore (I think), but leaving here just in case
 						if (include_foreground_sb_array) {
-							chisq0_zsrc += SQR(image_pixel_grid->surface_brightness[i][j] + image_pixel_grid->foreground_surface_brightness[i][j] - image_pixel_data->surface_brightness[i][j])*cov_inverse; // generalize to full cov_inverse matrix later
+							residual = image_pixel_grid->surface_brightness[i][j] + image_pixel_grid->foreground_surface_brightness[i][j] - image_pixel_data->surface_brightness[i][j];
 							//if (chisq0_zsrc*0.0 != 0.0) die("chisq0_zsrc has NaN value");
 							foreground_count++;
 						} else {
-							chisq0_zsrc += SQR(image_pixel_grid->surface_brightness[i][j] - image_pixel_data->surface_brightness[i][j])*cov_inverse; // generalize to full cov_inverse matrix later
+							residual = image_pixel_grid->surface_brightness[i][j] - image_pixel_data->surface_brightness[i][j];
 						}
 						count++;
 					} else {
 						// NOTE that if a pixel is not in the foreground mask, the foreground_surface_brightness has already been set to zero for that pixel
 						if (include_foreground_sb_array) {
-							chisq0_zsrc += SQR(image_pixel_grid->foreground_surface_brightness[i][j] - image_pixel_data->surface_brightness[i][j])*cov_inverse;
+							residual = image_pixel_grid->foreground_surface_brightness[i][j] - image_pixel_data->surface_brightness[i][j];
 							foreground_count++;
 						}
-						else if (image_pixel_grid->pixel_in_mask[i][j]) chisq0_zsrc += SQR(image_pixel_data->surface_brightness[i][j])*cov_inverse; // if we're not modeling foreground, then only add to chi-square if it's inside the primary mask
+						else if (image_pixel_grid->pixel_in_mask[i][j]) residual = -image_pixel_data->surface_brightness[i][j]; // if we're not modeling foreground, then only add to chi-square if it's inside the primary mask
+						else pixel_included = false;
+					}
+					if (pixel_included) {
+						if (whiten) {
+							scaled_residual[i][j] = residual*sqrt(cov_inverse);
+							included[i][j] = true;
+						} else {
+							chisq0_zsrc += SQR(residual)*cov_inverse;
+						}
 					}
 				}
 			}
 		}
+		if (whiten) {
+			chisq0_zsrc = correlated_noise_chisq(scaled_residual,included,image_pixel_data->npixels_x,image_pixel_data->npixels_y);
+			for (i=0; i < image_pixel_data->npixels_x; i++) {
+				delete[] scaled_residual[i];
+				delete[] included[i];
+			}
+			delete[] scaled_residual;
+			delete[] included;
+		}
 		chisq0 += chisq0_zsrc;
 		loglike_times_two += chisq0_zsrc; // loglike_times_two includes the prior terms
 
@@ -13039,6 +14008,7 @@ double QLens::invert_image_surface_brightness_map(double &chisq0, const bool ver
 			} else {
 				loglike_times_two -= n_data_pixels*log(cov_inverse); // if the loglike_reference_noise is equal to sqrt(noise_covariance), then this term becomes zero and it just looks like chi-square (which looks prettier)
 			}
+			if (use_noise_whitening()) loglike_times_two += n_data_pixels*noise_corr_logdet_per_pixel; // log-determinant of the noise correlation matrix
 			loglike_times_two += n_data_pixels*log(M_2PI);
 		}
 		if ((mpi_id==0) and (verbal)) {
@@ -13240,11 +14210,85 @@ void QLens::reset_grid()
 	sorted_critical_curves = false;
 	sorted_critical_curve.clear();
 	singular_pts.clear();
+	if (perturber_trees_valid) check_perturber_trees(); // lenses may have been added or changed, in which case the trees must be rebuilt
+}
+
+void QLens::build_perturber_trees()
+{
+	// This may be called from within a parallel region the first time the deflection is needed, so only one thread builds the trees
+	#pragma omp critical(perturber_trees)
+	{
+		if (!perturber_trees_valid) {
+			clear_perturber_trees();
+			if (n_lens_redshifts > 0) {
+				n_perturber_trees = n_lens_redshifts;
+				perturber_trees = new LensTree*[n_perturber_trees];
+				for (int i=0; i < n_perturber_trees; i++) {
+					perturber_trees[i] = new LensTree();
+					if (!perturber_trees[i]->build(lens_list,zlens_group_lens_indx[i],zlens_group_size[i],perturber_tree_theta)) {
+						delete perturber_trees[i];
+						perturber_trees[i] = NULL;
+					}
+				}
+			}
+			get_perturber_tree_model_state(perturber_tree_model_state);
+			#pragma omp flush
+			perturber_trees_valid = true;
+		}
+	}
+}
+
+void QLens::get_perturber_tree_model_state(std::vector<double>& state)
+{
+	// The trees depend only on the parameters of the lenses within them (including any derived from the cosmology, e.g. if
+	// parametrized by m200) and on how many lenses there are; lenses outside the trees are evaluated exactly, and the redshift
+	// factors are applied to each plane's total deflection afterward, so neither is needed here
+	int i,j,k,np;
+	state.clear();
+	state.push_back(nlens); // if lenses have been added, they are not in the trees yet
+	if (perturber_trees==NULL) return;
+	LensProfile *lens;
+	double *lensparams;
+	for (i=0; i < n_perturber_trees; i++) {
+		if (perturber_trees[i]==NULL) continue;
+		for (j=0; j < perturber_trees[i]->get_n_tree_lenses(); j++) {
+			lens = perturber_trees[i]->get_tree_lens(j);
+			np = lens->get_n_params();
+			lensparams = new double[np];
+			lens->get_parameters(lensparams);
+			for (k=0; k < np; k++) state.push_back(lensparams[k]);
+			delete[] lensparams;
+		}
+	}
+	for (i=0; i < cosmo.n_params; i++) state.push_back(*(cosmo.param[i]));
+}
+
+void QLens::check_perturber_trees()
+{
+	// If the perturber parameters or the cosmology have changed since the trees were built, they must be rebuilt; otherwise
+	// they are kept, so fits in which only the macromodel (or source) is varied do not rebuild them for every evaluation
+	std::vector<double> state;
+	get_perturber_tree_model_state(state);
+	if (state != perturber_tree_model_state) clear_perturber_trees();
+}
+
+void QLens::clear_perturber_trees()
+{
+	if (perturber_trees != NULL) {
+		for (int i=0; i < n_perturber_trees; i++) {
+			if (perturber_trees[i] != NULL) delete perturber_trees[i];
+		}
+		delete[] perturber_trees;
+		perturber_trees = NULL;
+	}
+	n_perturber_trees = 0;
+	perturber_trees_valid = false;
 }
 
 QLens::~QLens()
 {
 	int i,j;
+	clear_perturber_trees();
 	if (nlens > 0) {
 		for (i=0; i < nlens; i++) {
 			delete lens_list[i];
@@ -13285,6 +14329,8 @@ QLens::~QLens()
 		for (int i=0; i < psf_npixels_x; i++) delete[] psf_matrix[i];
 		delete[] psf_matrix;
 	}
+	delete_noise_corr_kernel();
+	delete_whitening_kernel();
 
 	if (n_ptsrc_redshifts > 0) {
 		delete[] ptsrc_redshifts;
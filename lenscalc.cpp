@@ -40,6 +40,7 @@ double QLens::potential(const double& x, const double& y, double* zfacs, double*
 
 void QLens::deflection(const double& x, const double& y, lensvector& def_tot, const int &thread, double* zfacs, double** betafacs)
 {
+	LensTree **trees = get_perturber_trees();
 	lensvector *x_i = &xvals_i[thread];
 	lensvector *def = &defs_i[thread];
 	lensvector **def_i = &defs_subtot[thread];
@@ -63,11 +64,15 @@ void QLens::deflection(const double& x, const double& y, lensvector& def_tot, co
 				(*x_i)[0] -= betafacs[i-1][j]*(*def_i)[j][0];
 				(*x_i)[1] -= betafacs[i-1][j]*(*def_i)[j][1];
 			}
-			for (j=0; j < zlens_group_size[i]; j++) {
-				lens_list[zlens_group_lens_indx[i][j]]->deflection((*x_i)[0],(*x_i)[1],(*def));
-				//std::cout << "Lens redshift " << i << ", lens " << zlens_group_lens_indx[i][j] << " def=" << (*def)[0] << " " << (*def)[1] << std::endl;
-				(*def_i)[i][0] += (*def)[0];
-				(*def_i)[i][1] += (*def)[1];
+			if ((trees != NULL) and (trees[i] != NULL)) {
+				trees[i]->deflection((*x_i)[0],(*x_i)[1],(*def_i)[i],(*def),hesses_i[thread]);
+			} else {
+				for (j=0; j < zlens_group_size[i]; j++) {
+					lens_list[zlens_group_lens_indx[i][j]]->deflection((*x_i)[0],(*x_i)[1],(*def));
+					//std::cout << "Lens redshift " << i << ", lens " << zlens_group_lens_indx[i][j] << " def=" << (*def)[0] << " " << (*def)[1] << std::endl;
+					(*def_i)[i][0] += (*def)[0];
+					(*def_i)[i][1] += (*def)[1];
+				}
 			}
 			//std::cout << "Lens redshift" << i << " (z=" << lens_redshifts[i] << "): xi=" << (*x_i)[0] << " " << (*x_i)[1] << std::endl;
 			(*def_i)[i][0] *= zfacs[i];
@@ -80,6 +85,7 @@ void QLens::deflection(const double& x, const double& y, lensvector& def_tot, co
 
 void QLens::deflection(const double& x, const double& y, double& def_tot_x, double& def_tot_y, const int &thread, double* zfacs, double** betafacs)
 {
+	LensTree **trees = get_perturber_trees();
 	lensvector *x_i = &xvals_i[thread];
 	lensvector *def = &defs_i[thread];
 	lensvector **def_i = &defs_subtot[thread];
@@ -99,10 +105,14 @@ void QLens::deflection(const double& x, const double& y, double& def_tot_x, doub
 				(*x_i)[0] -= betafacs[i-1][j]*(*def_i)[j][0];
 				(*x_i)[1] -= betafacs[i-1][j]*(*def_i)[j][1];
 			}
-			for (j=0; j < zlens_group_size[i]; j++) {
-				lens_list[zlens_group_lens_indx[i][j]]->deflection((*x_i)[0],(*x_i)[1],(*def));
-				(*def_i)[i][0] += (*def)[0];
-				(*def_i)[i][1] += (*def)[1];
+			if ((trees != NULL) and (trees[i] != NULL)) {
+				trees[i]->deflection((*x_i)[0],(*x_i)[1],(*def_i)[i],(*def),hesses_i[thread]);
+			} else {
+				for (j=0; j < zlens_group_size[i]; j++) {
+					lens_list[zlens_group_lens_indx[i][j]]->deflection((*x_i)[0],(*x_i)[1],(*def));
+					(*def_i)[i][0] += (*def)[0];
+					(*def_i)[i][1] += (*def)[1];
+				}
 			}
 			(*def_i)[i][0] *= zfacs[i];
 			(*def_i)[i][1] *= zfacs[i];
@@ -172,6 +182,7 @@ void QLens::lens_equation(const lensvector& x, lensvector& f, const int& thread,
 void QLens::map_to_lens_plane(const int& redshift_i, const double& x, const double& y, lensvector& xi, const int &thread, double* zfacs, double** betafacs)
 {
 	if (redshift_i >= n_lens_redshifts) die("lens redshift index does not exist");
+	LensTree **trees = get_perturber_trees();
 	lensvector *x_i = &xvals_i[thread];
 	lensvector *def = &defs_i[thread];
 	lensvector **def_i = &defs_subtot[thread];
@@ -190,10 +201,14 @@ void QLens::map_to_lens_plane(const int& redshift_i, const double& x, const doub
 			(*x_i)[1] -= betafacs[i-1][j]*(*def_i)[j][1];
 		}
 		if (i==redshift_i) break;
-		for (j=0; j < zlens_group_size[i]; j++) {
-			lens_list[zlens_group_lens_indx[i][j]]->deflection((*x_i)[0],(*x_i)[1],(*def));
-			(*def_i)[i][0] += (*def)[0];
-			(*def_i)[i][1] += (*def)[1];
+		if ((trees != NULL) and (trees[i] != NULL)) {
+			trees[i]->deflection((*x_i)[0],(*x_i)[1],(*def_i)[i],(*def),hesses_i[thread]);
+		} else {
+			for (j=0; j < zlens_group_size[i]; j++) {
+				lens_list[zlens_group_lens_indx[i][j]]->deflection((*x_i)[0],(*x_i)[1],(*def));
+				(*def_i)[i][0] += (*def)[0];
+				(*def_i)[i][1] += (*def)[1];
+			}
 		}
 		(*def_i)[i][0] *= zfacs[i];
 		(*def_i)[i][1] *= zfacs[i];
@@ -204,6 +219,7 @@ void QLens::map_to_lens_plane(const int& redshift_i, const double& x, const doub
 
 void QLens::hessian(const double& x, const double& y, lensmatrix& hess_tot, const int &thread, double* zfacs, double** betafacs) // calculates the Hessian of the lensing potential
 {
+	LensTree **trees = get_perturber_trees();
 	if (n_lens_redshifts > 1) {
 		lensvector *x_i = &xvals_i[thread];
 		lensmatrix *A_i = &Amats_i[thread];
@@ -240,15 +256,19 @@ void QLens::hessian(const double& x, const double& y, lensmatrix& hess_tot, cons
 					(*A_i)[1][0] -= (betafacs[i-1][j])*((*hess_i)[j])[1][0];
 					(*A_i)[0][1] -= (betafacs[i-1][j])*((*hess_i)[j])[0][1];
 				}
-				for (j=0; j < zlens_group_size[i]; j++) {
-					lens_list[zlens_group_lens_indx[i][j]]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def),(*hess));
-					(*hess_i)[i][0][0] += (*hess)[0][0];
-					(*hess_i)[i][1][1] += (*hess)[1][1];
-					(*hess_i)[i][0][1] += (*hess)[0][1];
-					(*hess_i)[i][1][0] += (*hess)[1][0];
-					if (i < n_lens_redshifts-1) {
-						(*def_i)[i][0] += (*def)[0];
-						(*def_i)[i][1] += (*def)[1];
+				if ((trees != NULL) and (trees[i] != NULL)) {
+					trees[i]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def_i)[i],(*hess_i)[i],(*def),(*hess));
+				} else {
+					for (j=0; j < zlens_group_size[i]; j++) {
+						lens_list[zlens_group_lens_indx[i][j]]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def),(*hess));
+						(*hess_i)[i][0][0] += (*hess)[0][0];
+						(*hess_i)[i][1][1] += (*hess)[1][1];
+						(*hess_i)[i][0][1] += (*hess)[0][1];
+						(*hess_i)[i][1][0] += (*hess)[1][0];
+						if (i < n_lens_redshifts-1) {
+							(*def_i)[i][0] += (*def)[0];
+							(*def_i)[i][1] += (*def)[1];
+						}
 					}
 				}
 				if (i < n_lens_redshifts-1) {
@@ -280,12 +300,16 @@ void QLens::hessian(const double& x, const double& y, lensmatrix& hess_tot, cons
 		hess_tot[1][1] = 0;
 		hess_tot[0][1] = 0;
 		hess_tot[1][0] = 0;
-		for (j=0; j < nlens; j++) {
-			lens_list[j]->hessian(x,y,(*hess));
-			hess_tot[0][0] += (*hess)[0][0];
-			hess_tot[1][1] += (*hess)[1][1];
-			hess_tot[0][1] += (*hess)[0][1];
-			hess_tot[1][0] += (*hess)[1][0];
+		if ((trees != NULL) and (trees[0] != NULL)) {
+			trees[0]->hessian(x,y,hess_tot,defs_i[thread],(*hess));
+		} else {
+			for (j=0; j < nlens; j++) {
+				lens_list[j]->hessian(x,y,(*hess));
+				hess_tot[0][0] += (*hess)[0][0];
+				hess_tot[1][1] += (*hess)[1][1];
+				hess_tot[0][1] += (*hess)[0][1];
+				hess_tot[1][0] += (*hess)[1][0];
+			}
 		}
 		hess_tot[0][0] *= zfacs[0];
 		hess_tot[1][1] *= zfacs[0];
@@ -609,6 +633,7 @@ double QLens::kappa_exclude(const lensvector &x, bool* exclude, double* zfacs, d
 void QLens::kappa_inverse_mag_sourcept(const lensvector& xvec, lensvector& srcpt, double &kap_tot, double &invmag, const int &thread, double* zfacs, double** betafacs)
 {
 	double x = xvec[0], y = xvec[1];
+	LensTree **trees = get_perturber_trees();
 	lensmatrix *jac = &jacs[thread];
 	lensvector *def_tot = &defs[thread];
 
@@ -649,14 +674,18 @@ void QLens::kappa_inverse_mag_sourcept(const lensvector& xvec, lensvector& srcpt
 				(*A_i)[1][0] -= (betafacs[i-1][j])*((*hess_i)[j])[1][0];
 				(*A_i)[0][1] -= (betafacs[i-1][j])*((*hess_i)[j])[0][1];
 			}
-			for (j=0; j < zlens_group_size[i]; j++) {
-				lens_list[zlens_group_lens_indx[i][j]]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def),(*hess));
-				(*hess_i)[i][0][0] += (*hess)[0][0];
-				(*hess_i)[i][1][1] += (*hess)[1][1];
-				(*hess_i)[i][0][1] += (*hess)[0][1];
-				(*hess_i)[i][1][0] += (*hess)[1][0];
-				(*def_i)[i][0] += (*def)[0];
-				(*def_i)[i][1] += (*def)[1];
+			if ((trees != NULL) and (trees[i] != NULL)) {
+				trees[i]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def_i)[i],(*hess_i)[i],(*def),(*hess));
+			} else {
+				for (j=0; j < zlens_group_size[i]; j++) {
+					lens_list[zlens_group_lens_indx[i][j]]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def),(*hess));
+					(*hess_i)[i][0][0] += (*hess)[0][0];
+					(*hess_i)[i][1][1] += (*hess)[1][1];
+					(*hess_i)[i][0][1] += (*hess)[0][1];
+					(*hess_i)[i][1][0] += (*hess)[1][0];
+					(*def_i)[i][0] += (*def)[0];
+					(*def_i)[i][1] += (*def)[1];
+				}
 			}
 			(*def_i)[i][0] *= zfacs[i];
 			(*def_i)[i][1] *= zfacs[i];
@@ -690,7 +719,9 @@ void QLens::kappa_inverse_mag_sourcept(const lensvector& xvec, lensvector& srcpt
 		(*def_tot)[1] = 0;
 		kap_tot = 0;
 
-		if ((nthreads==1) or (!multithread_perturber_deflections)) {
+		if ((trees != NULL) and (trees[0] != NULL)) {
+			trees[0]->kappa_and_potential_derivatives(x,y,kap_tot,(*def_tot),(*jac),defs_i[thread],hesses_i[thread]);
+		} else if ((nthreads==1) or (!multithread_perturber_deflections)) {
 			int j;
 			double kap;
 			(*jac)[0][0] = 0;
@@ -811,6 +842,7 @@ void QLens::kappa_inverse_mag_sourcept(const lensvector& xvec, lensvector& srcpt
 void QLens::sourcept_jacobian(const lensvector& xvec, lensvector& srcpt, lensmatrix& jac_tot, const int &thread, double* zfacs, double** betafacs)
 {
 	double x = xvec[0], y = xvec[1];
+	LensTree **trees = get_perturber_trees();
 	lensvector *def_tot = &defs[thread];
 
 	if (n_lens_redshifts > 1) {
@@ -850,14 +882,18 @@ void QLens::sourcept_jacobian(const lensvector& xvec, lensvector& srcpt, lensmat
 				(*A_i)[1][0] -= (betafacs[i-1][j])*((*hess_i)[j])[1][0];
 				(*A_i)[0][1] -= (betafacs[i-1][j])*((*hess_i)[j])[0][1];
 			}
-			for (j=0; j < zlens_group_size[i]; j++) {
-				lens_list[zlens_group_lens_indx[i][j]]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def),(*hess));
-				(*hess_i)[i][0][0] += (*hess)[0][0];
-				(*hess_i)[i][1][1] += (*hess)[1][1];
-				(*hess_i)[i][0][1] += (*hess)[0][1];
-				(*hess_i)[i][1][0] += (*hess)[1][0];
-				(*def_i)[i][0] += (*def)[0];
-				(*def_i)[i][1] += (*def)[1];
+			if ((trees != NULL) and (trees[i] != NULL)) {
+				trees[i]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def_i)[i],(*hess_i)[i],(*def),(*hess));
+			} else {
+				for (j=0; j < zlens_group_size[i]; j++) {
+					lens_list[zlens_group_lens_indx[i][j]]->potential_derivatives((*x_i)[0],(*x_i)[1],(*def),(*hess));
+					(*hess_i)[i][0][0] += (*hess)[0][0];
+					(*hess_i)[i][1][1] += (*hess)[1][1];
+					(*hess_i)[i][0][1] += (*hess)[0][1];
+					(*hess_i)[i][1][0] += (*hess)[1][0];
+					(*def_i)[i][0] += (*def)[0];
+					(*def_i)[i][1] += (*def)[1];
+				}
 			}
 			(*def_i)[i][0] *= zfacs[i];
 			(*def_i)[i][1] *= zfacs[i];
@@ -889,7 +925,9 @@ void QLens::sourcept_jacobian(const lensvector& xvec, lensvector& srcpt, lensmat
 		(*def_tot)[0] = 0;
 		(*def_tot)[1] = 0;
 
-		if ((nthreads==1) or (!multithread_perturber_deflections)) {
+		if ((trees != NULL) and (trees[0] != NULL)) {
+			trees[0]->potential_derivatives(x,y,(*def_tot),jac_tot,defs_i[thread],hesses_i[thread]);
+		} else if ((nthreads==1) or (!multithread_perturber_deflections)) {
 			lensvector *def = &defs_i[0];
 			lensmatrix *hess = &hesses_i[0];
 			int j;
@@ -0,0 +1,485 @@
+#include "lenstree.h"
+#include "profile.h"
+#include "errors.h"
+#include <cmath>
+using namespace std;
+
+const int LensTree::leaf_size = 4;
+const int LensTree::min_tree_lenses = 8;
+const int LensTree::rgrid_points_per_decade = 16;
+const int LensTree::quadrupole_nphi = 32;
+const int LensTree::quadrupole_decades_below = 3;
+
+LensTree::LensTree()
+{
+	n_lenses = 0;
+	lenses = NULL;
+	n_exact_lenses = 0;
+	exact_lenses = NULL;
+	n_tree_lenses = 0;
+	tree_lenses = NULL;
+	lens_x = lens_y = lens_mass = lens_rhalf = NULL;
+	lens_menc = NULL;
+	lens_quad_in = lens_quad_out = NULL;
+	include_quadrupoles = false;
+	n_rgrid = 0;
+	theta = 0;
+}
+
+void LensTree::reset()
+{
+	if (lenses != NULL) {
+		delete[] lenses;
+		delete[] exact_lenses;
+		delete[] tree_lenses;
+		delete[] lens_x;
+		delete[] lens_y;
+		delete[] lens_mass;
+		delete[] lens_rhalf;
+		if (lens_menc != NULL) delete[] lens_menc;
+		if (lens_quad_in != NULL) delete[] lens_quad_in;
+		if (lens_quad_out != NULL) delete[] lens_quad_out;
+		lenses = NULL;
+		lens_menc = NULL;
+		lens_quad_in = lens_quad_out = NULL;
+		exact_lenses = NULL;
+		tree_lenses = NULL;
+		lens_x = lens_y = lens_mass = lens_rhalf = NULL;
+	}
+	nodes.clear();
+	node_menc.clear();
+	node_quad_in.clear();
+	node_quad_out.clear();
+	include_quadrupoles = false;
+	n_rgrid = 0;
+	n_lenses = n_exact_lenses = n_tree_lenses = 0;
+}
+
+bool LensTree::lens_mass_and_extent(LensProfile* lens, double& mass, double& rhalf, double& mfac, double& rfac)
+{
+	// The mass and half-mass radius found here are for the circularized profile; for an elliptical lens, the total mass is
+	// mfac*mass, and the mass enclosed within radius r on the sky is approximately mfac*mass_rsq((r/rfac)^2)
+	if (lens->kapavgptr_rsq_spherical==NULL) return false;
+	if (lens->calculate_total_scaled_mass(mass)==false) {
+		// a subcritical lens (e.g. a low-mass subhalo) has no Einstein radius to start the mass integration from, so start at an intermediate radius
+		if (lens->calculate_total_scaled_mass_from_radius(mass,sqrt(lens->rmin_einstein_radius*lens->rmax_einstein_radius))==false) return false;
+	}
+	if (mass <= 0) return false;
+	if (lens->calculate_half_mass_radius(rhalf,mass)==false) {
+		// if more than half the mass lies within the smallest radius searched, the lens is effectively a point mass
+		if (lens->mass_rsq(SQR(lens->rmin_einstein_radius)) >= mass/2) rhalf = lens->rmin_einstein_radius;
+		else return false;
+	}
+	mfac = 1.0;
+	rfac = 1.0;
+	if ((!lens->ellipticity_gradient) and (lens->ellipticity_mode >= 0) and (lens->ellipticity_mode < 3)) {
+		// the circularized radius corresponds to xi/f_major_axis along the major axis
+		mfac = lens->q*SQR(lens->f_major_axis);
+		rfac = lens->f_major_axis*sqrt(lens->q);
+		rhalf *= lens->f_major_axis; // use the half-mass radius along the major axis, to be conservative in the opening criterion
+	}
+	return true;
+}
+
+bool LensTree::build(LensProfile** lens_list, const int* lens_indx, const int nlens_in, const double theta_in)
+{
+	// Returns false if too few of the lenses have a finite mass for the tree to be worthwhile
+	reset();
+	if (theta_in <= 0) return false;
+	theta = theta_in;
+	n_lenses = nlens_in;
+	lenses = new LensProfile*[n_lenses];
+	exact_lenses = new int[n_lenses];
+	tree_lenses = new int[n_lenses];
+	lens_x = new double[n_lenses];
+	lens_y = new double[n_lenses];
+	lens_mass = new double[n_lenses];
+	lens_rhalf = new double[n_lenses];
+	double *lens_mfac = new double[n_lenses];
+	double *lens_rfac = new double[n_lenses];
+	bool *in_tree = new bool[n_lenses];
+	int i, j, k;
+	for (i=0; i < n_lenses; i++) {
+		lenses[i] = lens_list[lens_indx[i]];
+		lenses[i]->get_center_coords(lens_x[i],lens_y[i]);
+	}
+	// finding the total mass and half-mass radius may require numerical integration, so the lenses are done in parallel
+	#pragma omp parallel for private(i) schedule(dynamic)
+	for (i=0; i < n_lenses; i++) {
+		in_tree[i] = lens_mass_and_extent(lenses[i],lens_mass[i],lens_rhalf[i],lens_mfac[i],lens_rfac[i]);
+	}
+	for (i=0; i < n_lenses; i++) {
+		if (in_tree[i]) tree_lenses[n_tree_lenses++] = i;
+		else exact_lenses[n_exact_lenses++] = i;
+	}
+	delete[] in_tree;
+	if (n_tree_lenses < min_tree_lenses) {
+		delete[] lens_mfac;
+		delete[] lens_rfac;
+		reset();
+		return false;
+	}
+
+	double xmin=1e30, xmax=-1e30, ymin=1e30, ymax=-1e30, rhalf_min=1e30, rhalf_max=0;
+	for (i=0; i < n_tree_lenses; i++) {
+		k = tree_lenses[i];
+		if (lens_x[k] < xmin) xmin = lens_x[k];
+		if (lens_x[k] > xmax) xmax = lens_x[k];
+		if (lens_y[k] < ymin) ymin = lens_y[k];
+		if (lens_y[k] > ymax) ymax = lens_y[k];
+		if (lens_rhalf[k] < rhalf_min) rhalf_min = lens_rhalf[k];
+		if (lens_rhalf[k] > rhalf_max) rhalf_max = lens_rhalf[k];
+	}
+	double size = (xmax-xmin > ymax-ymin) ? xmax-xmin : ymax-ymin;
+	if (size <= 0) size = 1.0;
+	size *= 1.000001; // so that lenses on the upper edges fall inside the root cell
+
+	// The monopole term uses the mass enclosed within the distance to each node, rather than the total mass, since profiles
+	// with shallow outer slopes (e.g. dPIE) can have a significant fraction of their mass beyond that distance. The enclosed
+	// mass fraction of each lens is tabulated over a logarithmic grid in radius, extending from the smallest half-mass radius
+	// (the multipole expansion is never used closer than this) to well beyond the extent of the lens population.
+	double rmax = 1000*((size > rhalf_max) ? size : rhalf_max);
+	dlnr = log(10.0)/rgrid_points_per_decade;
+	lnr_min = log(rhalf_min);
+	n_rgrid = ((int) ((log(rmax)-lnr_min)/dlnr)) + 2;
+	lens_menc = new double[n_lenses*n_rgrid];
+	#pragma omp parallel for private(i,j,k) schedule(dynamic)
+	for (i=0; i < n_tree_lenses; i++) {
+		k = tree_lenses[i];
+		double r, *menc = lens_menc + k*n_rgrid;
+		for (j=0; j < n_rgrid; j++) {
+			r = exp(lnr_min + j*dlnr)/lens_rfac[k];
+			menc[j] = lenses[k]->mass_rsq(r*r)/lens_mass[k];
+			if (menc[j] > 1) menc[j] = 1;
+		}
+		lens_mass[k] *= lens_mfac[k];
+	}
+	delete[] lens_mfac;
+	delete[] lens_rfac;
+
+	// Elliptical members also have a quadrupole moment (about their own centers), which falls off only as fast as the
+	// monopole does for profiles with shallow outer slopes; it cannot be neglected if the expansion is to converge as theta -> 0
+	bool *elliptical = new bool[n_lenses];
+	for (i=0; i < n_tree_lenses; i++) {
+		k = tree_lenses[i];
+		elliptical[k] = ((lenses[k]->q != 1.0) or (lenses[k]->n_fourier_modes > 0) or (lenses[k]->ellipticity_gradient));
+		if (elliptical[k]) include_quadrupoles = true;
+	}
+	if (include_quadrupoles) {
+		lens_quad_in = new complex<double>[n_lenses*n_rgrid];
+		lens_quad_out = new complex<double>[n_lenses*n_rgrid];
+		#pragma omp parallel for private(i,j,k) schedule(dynamic)
+		for (i=0; i < n_tree_lenses; i++) {
+			k = tree_lenses[i];
+			if (elliptical[k]) tabulate_intrinsic_quadrupole(k);
+			else {
+				for (j=0; j < n_rgrid; j++) lens_quad_in[k*n_rgrid+j] = lens_quad_out[k*n_rgrid+j] = 0;
+			}
+		}
+	}
+	delete[] elliptical;
+
+	nodes.reserve(2*n_tree_lenses/leaf_size + 1);
+	node_menc.reserve(nodes.capacity()*n_rgrid);
+	if (include_quadrupoles) {
+		node_quad_in.reserve(nodes.capacity()*n_rgrid);
+		node_quad_out.reserve(nodes.capacity()*n_rgrid);
+	}
+	build_node(0,n_tree_lenses,xmin,ymin,size,0);
+	return true;
+}
+
+void LensTree::tabulate_intrinsic_quadrupole(const int k)
+{
+	// The m=2 Fourier component of kappa on a ring of radius r, A(r) = (1/pi)*int kappa*exp(2i*phi) dphi, is found by the
+	// trapezoid rule (which converges quickly for a smooth periodic integrand); then Q_in(r) = int_0^r A*r'^4 dln(r') and
+	// Q_out(r) = int_r^inf conj(A) dln(r'). The grid is extended to smaller radii so the inner integral starts near r=0.
+	int j, l, n_below = quadrupole_decades_below*rgrid_points_per_decade, n_ext = n_rgrid + n_below;
+	double r, phi, rfourth;
+	complex<double> *a = new complex<double>[n_ext];
+	complex<double> *qin = lens_quad_in + k*n_rgrid;
+	complex<double> *qout = lens_quad_out + k*n_rgrid;
+	complex<double> *eiphi = new complex<double>[quadrupole_nphi];
+	for (l=0; l < quadrupole_nphi; l++) {
+		phi = l*2*M_PI/quadrupole_nphi;
+		eiphi[l] = complex<double>(cos(phi),sin(phi));
+	}
+	for (j=0; j < n_ext; j++) {
+		r = exp(lnr_min + (j-n_below)*dlnr);
+		a[j] = 0;
+		for (l=0; l < quadrupole_nphi; l++) a[j] += lenses[k]->kappa(lens_x[k]+r*real(eiphi[l]),lens_y[k]+r*imag(eiphi[l]))*eiphi[l]*eiphi[l];
+		a[j] *= 2.0/quadrupole_nphi;
+	}
+	complex<double> qsum, qterm, qterm_prev;
+	r = exp(lnr_min - n_below*dlnr);
+	rfourth = SQR(SQR(r));
+	qterm_prev = a[0]*rfourth;
+	qsum = 0.25*qterm_prev; // assumes A is roughly constant inside the innermost radius
+	for (j=1; j < n_ext; j++) {
+		rfourth *= exp(4*dlnr);
+		qterm = a[j]*rfourth;
+		qsum += 0.5*dlnr*(qterm + qterm_prev);
+		qterm_prev = qterm;
+		if (j >= n_below) qin[j-n_below] = qsum;
+	}
+	qsum = 0;
+	qout[n_rgrid-1] = 0; // the outer radius is far enough beyond the lenses that the remaining mass is negligible
+	for (j=n_ext-2; j >= n_below; j--) {
+		qsum += 0.5*dlnr*(conj(a[j]) + conj(a[j+1]));
+		qout[j-n_below] = qsum;
+	}
+	delete[] a;
+	delete[] eiphi;
+}
+
+int LensTree::build_node(const int start, const int end, const double xmin, const double ymin, const double size, const int depth)
+{
+	int i, k, p, quad, n = nodes.size();
+	nodes.push_back(LensTreeNode());
+	LensTreeNode *node = &nodes[n];
+	node->start = start;
+	node->end = end;
+	for (quad=0; quad < 4; quad++) node->child[quad] = -1;
+
+	double mtot=0, xcm=0, ycm=0;
+	for (i=start; i < end; i++) {
+		k = tree_lenses[i];
+		mtot += lens_mass[k];
+		xcm += lens_mass[k]*lens_x[k];
+		ycm += lens_mass[k]*lens_y[k];
+	}
+	xcm /= mtot;
+	ycm /= mtot;
+	node->xcm = xcm;
+	node->ycm = ycm;
+
+	// The multipoles are divided by pi here, so the deflection (in complex form) is simply conj(alpha) = sum_p Q_p/(z-zcm)^(p+1)
+	double rsq, rmax_sq=0, rhalf_max=0;
+	complex<double> dz, dzpow;
+	for (p=0; p <= LensTreeNode::multipole_order; p++) node->multipole[p] = 0;
+	for (i=start; i < end; i++) {
+		k = tree_lenses[i];
+		dz = complex<double>(lens_x[k]-xcm,lens_y[k]-ycm);
+		dzpow = lens_mass[k]/M_PI;
+		for (p=0; p <= LensTreeNode::multipole_order; p++) {
+			node->multipole[p] += dzpow;
+			dzpow *= dz;
+		}
+		rsq = norm(dz);
+		if (rsq > rmax_sq) rmax_sq = rsq;
+		if (lens_rhalf[k] > rhalf_max) rhalf_max = lens_rhalf[k];
+	}
+	node->rcrit_sq = SQR((sqrt(rmax_sq) + rhalf_max)/theta);
+
+	// mass-weighted enclosed mass fraction for the node (only used if the node is far away, so the members' offsets are ignored)
+	int j;
+	node->table_offset = node_menc.size();
+	node_menc.resize(node_menc.size()+n_rgrid,0.0);
+	double *menc = &node_menc[node->table_offset];
+	for (i=start; i < end; i++) {
+		k = tree_lenses[i];
+		for (j=0; j < n_rgrid; j++) menc[j] += lens_mass[k]*lens_menc[k*n_rgrid+j];
+	}
+	for (j=0; j < n_rgrid; j++) menc[j] /= mtot;
+	if (include_quadrupoles) {
+		node_quad_in.resize(node_quad_in.size()+n_rgrid,0.0);
+		node_quad_out.resize(node_quad_out.size()+n_rgrid,0.0);
+		complex<double> *qin = &node_quad_in[node->table_offset];
+		complex<double> *qout = &node_quad_out[node->table_offset];
+		for (i=start; i < end; i++) {
+			k = tree_lenses[i];
+			for (j=0; j < n_rgrid; j++) {
+				qin[j] += lens_quad_in[k*n_rgrid+j];
+				qout[j] += lens_quad_out[k*n_rgrid+j];
+			}
+		}
+	}
+
+	node->leaf = ((end-start <= leaf_size) or (depth >= max_depth));
+	if (node->leaf) return n;
+
+	// sort the lenses into the four quadrants of this cell (counting sort) and build a child node for each nonempty quadrant
+	double halfsize = size/2;
+	double xmid = xmin + halfsize, ymid = ymin + halfsize;
+	int count[4] = {0,0,0,0};
+	int *lens_quad = new int[end-start];
+	int *sorted_lenses = new int[end-start];
+	for (i=start; i < end; i++) {
+		k = tree_lenses[i];
+		quad = ((lens_x[k] >= xmid) ? 1 : 0) + ((lens_y[k] >= ymid) ? 2 : 0);
+		lens_quad[i-start] = quad;
+		count[quad]++;
+	}
+	int quad_start[5];
+	quad_start[0] = start;
+	for (quad=0; quad < 4; quad++) quad_start[quad+1] = quad_start[quad] + count[quad];
+	int fill[4] = {0,0,0,0};
+	for (i=start; i < end; i++) {
+		quad = lens_quad[i-start];
+		sorted_lenses[quad_start[quad]-start+fill[quad]] = tree_lenses[i];
+		fill[quad]++;
+	}
+	for (i=start; i < end; i++) tree_lenses[i] = sorted_lenses[i-start];
+	delete[] lens_quad;
+	delete[] sorted_lenses;
+
+	int child;
+	for (quad=0; quad < 4; quad++) {
+		if (count[quad]==0) continue;
+		child = build_node(quad_start[quad],quad_start[quad+1],(quad & 1) ? xmid : xmin,(quad & 2) ? ymid : ymin,halfsize,depth+1);
+		nodes[n].child[quad] = child; // the node pointer may have been invalidated when the children were added
+	}
+	return n;
+}
+
+void LensTree::add_exact_lens(LensProfile* lens, const double x, const double y, lensvector* def_tot, lensmatrix* hess_tot, double* kap_tot, lensvector& def, lensmatrix& hess)
+{
+	if (kap_tot != NULL) {
+		double kap;
+		lens->kappa_and_potential_derivatives(x,y,kap,def,hess);
+		*kap_tot += kap;
+	}
+	else if ((def_tot != NULL) and (hess_tot != NULL)) lens->potential_derivatives(x,y,def,hess);
+	else if (def_tot != NULL) lens->deflection(x,y,def);
+	else lens->hessian(x,y,hess);
+	if (def_tot != NULL) {
+		(*def_tot)[0] += def[0];
+		(*def_tot)[1] += def[1];
+	}
+	if (hess_tot != NULL) {
+		(*hess_tot)[0][0] += hess[0][0];
+		(*hess_tot)[1][1] += hess[1][1];
+		(*hess_tot)[0][1] += hess[0][1];
+		(*hess_tot)[1][0] += hess[1][0];
+	}
+}
+
+void LensTree::evaluate(const double x, const double y, lensvector* def_tot, lensmatrix* hess_tot, double* kap_tot, lensvector& def, lensmatrix& hess)
+{
+	int i, j, p, quad, offset, n_stack = 0;
+	int stack[3*max_depth+4];
+	double dx, dy, rsq, d, t, fenc, gslope, kap, *menc;
+	bool outside_grid;
+	LensTreeNode *node;
+	complex<double> w, winv, wpow, term, alpha_conj, dalpha;
+	complex<double> quad_in, quad_out, a2, *qin, *qout;
+
+	if (def_tot != NULL) {
+		(*def_tot)[0] = 0;
+		(*def_tot)[1] = 0;
+	}
+	if (hess_tot != NULL) {
+		(*hess_tot)[0][0] = 0;
+		(*hess_tot)[1][1] = 0;
+		(*hess_tot)[0][1] = 0;
+		(*hess_tot)[1][0] = 0;
+	}
+	if (kap_tot != NULL) *kap_tot = 0;
+
+	for (i=0; i < n_exact_lenses; i++) add_exact_lens(lenses[exact_lenses[i]],x,y,def_tot,hess_tot,kap_tot,def,hess);
+	if (!nodes.empty()) stack[n_stack++] = 0;
+	while (n_stack > 0) {
+		node = &nodes[stack[--n_stack]];
+		dx = x - node->xcm;
+		dy = y - node->ycm;
+		rsq = dx*dx + dy*dy;
+		if (rsq > node->rcrit_sq) {
+			// Far away from this node, so use the multipole expansion. In complex form, conj(alpha) = sum_p Q_p/w^(p+1) where
+			// w = z - zcm. The monopole is scaled by the fraction of the node's mass enclosed within the distance d to the node,
+			// f(d), and the members' own quadrupoles add Q_in(d)/w^3 - w*Q_out(d); these are interpolated in log(d). Since they
+			// depend on d, conj(alpha) is not quite analytic: its derivative D = d(conj(alpha))/dz = gamma_1 - i*gamma_2 gives the
+			// shear, while d(conj(alpha))/d(conj(z)) gives the (small) convergence of the node's mass at distance d.
+			offset = node->table_offset;
+			d = sqrt(rsq);
+			t = (log(d) - lnr_min)/dlnr;
+			if (t >= n_rgrid-1) {
+				j = n_rgrid-2;
+				t = 1.0;
+				outside_grid = true;
+			} else {
+				if (t < 0) t = 0;
+				j = (int) t;
+				t -= j;
+				outside_grid = false;
+			}
+			menc = &node_menc[offset+j];
+			if (outside_grid) {
+				fenc = 1.0;
+				gslope = 0;
+			} else {
+				gslope = (menc[1]-menc[0])/dlnr;
+				fenc = menc[0] + t*(menc[1]-menc[0]);
+			}
+
+			w = complex<double>(dx,dy);
+			winv = complex<double>(dx/rsq,-dy/rsq);
+			wpow = winv;
+			alpha_conj = 0;
+			dalpha = 0;
+			for (p=0; p <= LensTreeNode::multipole_order; p++) {
+				term = node->multipole[p]*wpow;
+				if (p==0) term *= fenc;
+				alpha_conj += term;
+				dalpha -= ((double) (p+1))*term*winv;
+				wpow *= winv;
+			}
+			// monopole: d(f)/dz = g*conj(w)/(2*d^2), where g = df/dlog(d)
+			dalpha += 0.5*real(node->multipole[0])*gslope*conj(w)*conj(w)/(rsq*rsq);
+			kap = 0.5*real(node->multipole[0])*gslope/rsq;
+			if (include_quadrupoles) {
+				qin = &node_quad_in[offset+j];
+				qout = &node_quad_out[offset+j];
+				quad_in = qin[0] + t*(qin[1]-qin[0]);
+				quad_out = qout[0] + t*(qout[1]-qout[0]);
+				// m=2 Fourier component of the members' convergence at radius d, from dQ_in/dlog(d) = A*d^4
+				a2 = (outside_grid) ? 0.0 : (qin[1]-qin[0])/(dlnr*rsq*rsq);
+				wpow = winv*winv*winv;
+				alpha_conj += quad_in*wpow - quad_out*w;
+				dalpha += -3.0*quad_in*wpow*winv - quad_out + 0.5*(a2*rsq*conj(w)*wpow + conj(a2));
+				kap += real(a2*conj(w)*conj(w))/rsq;
+			}
+			if (def_tot != NULL) {
+				(*def_tot)[0] += real(alpha_conj);
+				(*def_tot)[1] -= imag(alpha_conj);
+			}
+			if (hess_tot != NULL) {
+				(*hess_tot)[0][0] += kap + real(dalpha);
+				(*hess_tot)[1][1] += kap - real(dalpha);
+				(*hess_tot)[0][1] -= imag(dalpha);
+				(*hess_tot)[1][0] -= imag(dalpha);
+			}
+			if (kap_tot != NULL) *kap_tot += kap;
+		} else if (node->leaf) {
+			for (i=node->start; i < node->end; i++) add_exact_lens(lenses[tree_lenses[i]],x,y,def_tot,hess_tot,kap_tot,def,hess);
+		} else {
+			for (quad=0; quad < 4; quad++) {
+				if (node->child[quad] != -1) stack[n_stack++] = node->child[quad];
+			}
+		}
+	}
+}
+
+void LensTree::deflection(const double x, const double y, lensvector& def_tot, lensvector& def, lensmatrix& hess)
+{
+	evaluate(x,y,&def_tot,NULL,NULL,def,hess);
+}
+
+void LensTree::hessian(const double x, const double y, lensmatrix& hess_tot, lensvector& def, lensmatrix& hess)
+{
+	evaluate(x,y,NULL,&hess_tot,NULL,def,hess);
+}
+
+void LensTree::potential_derivatives(const double x, const double y, lensvector& def_tot, lensmatrix& hess_tot, lensvector& def, lensmatrix& hess)
+{
+	evaluate(x,y,&def_tot,&hess_tot,NULL,def,hess);
+}
+
+void LensTree::kappa_and_potential_derivatives(const double x, const double y, double& kap_tot, lensvector& def_tot, lensmatrix& hess_tot, lensvector& def, lensmatrix& hess)
+{
+	evaluate(x,y,&def_tot,&hess_tot,&kap_tot,def,hess);
+}
+
+LensTree::~LensTree()
+{
+	reset();
+}
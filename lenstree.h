@@ -0,0 +1,86 @@
+#ifndef LENSTREE_H
+#define LENSTREE_H
+
+#include "lensvec.h"
+#include <complex>
+#include <vector>
+
+class LensProfile;
+
+// Barnes-Hut tree for summing the deflections of the lenses in one lens plane, for models with a large population of
+// perturbers (subhalos, line-of-sight halos, cluster members). Lenses with a finite, positive total mass are grouped
+// into a quadtree, and each node stores a truncated multipole expansion of its members' masses about the node's center
+// of mass, along with their combined enclosed mass profile (so the monopole accounts for mass lying beyond the point
+// being evaluated) and the quadrupole arising from the members' own ellipticity. When evaluating the deflection at a point, a node is replaced by its multipole expansion if
+// (node radius + largest half-mass radius of its members) < theta*(distance to the node); otherwise the node is opened
+// and, at the leaves, each lens is evaluated exactly. Lenses without a finite mass (e.g. the macromodel or external
+// shear) are always evaluated exactly. The cost per ray then scales roughly as log(nlens) rather than nlens.
+
+struct LensTreeNode
+{
+	static const int multipole_order = 4;
+	int start, end; // lenses in this node are tree_lenses[start..end-1]
+	int child[4]; // equal to -1 if the corresponding quadrant has no lenses
+	bool leaf; // if true, the lenses in this node are evaluated exactly when it is opened
+	double xcm, ycm; // center of mass
+	double rcrit_sq; // the multipole expansion is used if the squared distance to the center of mass is larger than this
+	int table_offset; // the node's tabulated profiles (as functions of radius) start at node_menc[table_offset], etc.
+	std::complex<double> multipole[multipole_order+1]; // Q_p = sum over members of (m/pi)*(z-zcm)^p, where z = x + iy
+};
+
+class LensTree
+{
+	static const int leaf_size; // nodes with this many lenses or fewer are not subdivided
+	static const int max_depth = 32; // limits subdivision if many lenses are (nearly) coincident
+	static const int min_tree_lenses; // if fewer lenses than this qualify, no tree is built
+	static const int rgrid_points_per_decade;
+	static const int quadrupole_nphi; // number of angles used to find the quadrupole moment of the members on each ring
+	static const int quadrupole_decades_below; // how far below the radial grid the intrinsic quadrupoles are integrated from
+
+	int n_lenses;
+	LensProfile **lenses;
+	int n_exact_lenses;
+	int *exact_lenses; // lenses that are always evaluated exactly
+	int n_tree_lenses;
+	int *tree_lenses; // sorted so the lenses belonging to each node are contiguous
+	double *lens_x, *lens_y, *lens_mass, *lens_rhalf; // indexed by the lens number within the plane
+	double theta;
+	std::vector<LensTreeNode> nodes;
+
+	// enclosed mass fractions, tabulated at radii exp(lnr_min + j*dlnr) for each lens in the tree and each node
+	int n_rgrid;
+	double lnr_min, dlnr;
+	double *lens_menc; // lens_menc[k*n_rgrid+j] for lens k
+	std::vector<double> node_menc;
+
+	// For elliptical lenses, the intrinsic quadrupole of the mass inside radius r, Q_in(r) = (1/pi)*int_{<r} kappa*z^2 d^2z,
+	// and the corresponding moment of the mass outside, Q_out(r) = (1/pi)*int_{>r} kappa/z^2 d^2z (z measured from the lens
+	// center), which produces a shear; both are tabulated on the same radial grid. The node tables are sums over members.
+	bool include_quadrupoles;
+	std::complex<double> *lens_quad_in, *lens_quad_out;
+	std::vector<std::complex<double> > node_quad_in, node_quad_out;
+
+	static bool lens_mass_and_extent(LensProfile* lens, double& mass, double& rhalf, double& mfac, double& rfac);
+	void tabulate_intrinsic_quadrupole(const int k);
+	int build_node(const int start, const int end, const double xmin, const double ymin, const double size, const int depth);
+	void add_exact_lens(LensProfile* lens, const double x, const double y, lensvector* def_tot, lensmatrix* hess_tot, double* kap_tot, lensvector& def, lensmatrix& hess);
+	void evaluate(const double x, const double y, lensvector* def_tot, lensmatrix* hess_tot, double* kap_tot, lensvector& def, lensmatrix& hess);
+
+	public:
+	LensTree();
+	~LensTree();
+	void reset();
+	bool build(LensProfile** lens_list, const int* lens_indx, const int nlens_in, const double theta_in);
+	int get_n_tree_lenses() { return n_tree_lenses; }
+	LensProfile* get_tree_lens(const int i) { return lenses[tree_lenses[i]]; }
+	int get_n_nodes() { return nodes.size(); }
+
+	// In each of the following, the final (lensvector/lensmatrix) arguments are scratch space for evaluating the lenses
+	// that must be treated exactly; they should be thread-specific if the tree is being evaluated in parallel
+	void deflection(const double x, const double y, lensvector& def_tot, lensvector& def, lensmatrix& hess);
+	void hessian(const double x, const double y, lensmatrix& hess_tot, lensvector& def, lensmatrix& hess);
+	void potential_derivatives(const double x, const double y, lensvector& def_tot, lensmatrix& hess_tot, lensvector& def, lensmatrix& hess);
+	void kappa_and_potential_derivatives(const double x, const double y, double& kap_tot, lensvector& def_tot, lensmatrix& hess_tot, lensvector& def, lensmatrix& hess);
+};
+
+#endif // LENSTREE_H
@@ -8,6 +8,9 @@
 #include <exception>
 #include <csignal>
 #include <string>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
 #include "GregsMathHdr.h"
 #include "mcmchdr.h"
 #include "random.h"
@@ -76,6 +79,9 @@ UCMC::UCMC() : Minimize(1.0e-6, 1000), LevenMarq(0.001, 3), Derivative(1.0e-6, 1
 	mpi_group_num = 0;
 	mpi_group_leader = new int[1];
 	mpi_group_leader[0] = 0;
+	checkpoint_interval = 0;
+	resume_from_checkpoint = false;
+	target_ess = 0;
 }
 
 #ifdef USE_MPI
@@ -424,16 +430,45 @@ void UCMC::replaceUpperLimits(double *ain, RandomBasis &gDev)
 
 void UCMC::MetHas(const char *name, int N, const char flag)
 {
-	ofstream out(name);
+	ofstream out;
 	double chisq;
 	double *aNext = matrix <double> (ma);
 	double ans, chisqnext;
 	int mult = 1;
 	int count = 0, total = 0;
 	int l, k;
-	chisq = LOGLIKE(a) + LogPrior(a);
 	MultiNormDev gDev(cvar, ma, 2.4, rand);
 
+	bool resumed = false;
+	long long int out_offset = 0;
+	vector<char> ranstate(gDev.StateSize());
+	if (resume_from_checkpoint)
+	{
+		CheckpointData shared_state, local_state;
+		local_state.Resize(ranstate.size());
+		if (ReadCheckpoint(name, "methas", shared_state, local_state))
+		{
+			shared_state.Get(a,ma);
+			shared_state.Get(chisq);
+			shared_state.Get(mult);
+			shared_state.Get(count);
+			shared_state.Get(total);
+			shared_state.Get(out_offset);
+			local_state.Get(ranstate);
+			if ((!shared_state.Ok()) or (!local_state.Ok())) die("Metropolis-Hastings checkpoint file is corrupted");
+			gDev.LoadState(c_ptr(ranstate));
+			resumed = true;
+		}
+	}
+	if (resumed) {
+		if (truncate(name,out_offset) != 0) warn("could not truncate chain file '%s' to checkpoint",name);
+		out.open(name, ios::app);
+		out.seekp(0, ios::end);
+	} else {
+		out.open(name);
+		chisq = LOGLIKE(a) + LogPrior(a);
+	}
+
 	cout << "Metropolis-Hastings Algorithm Started\n" << "\tpoints = " << "\n\taccept ratio = " << endl;
 	
 	do
@@ -480,8 +515,23 @@ void UCMC::MetHas(const char *name, int N, const char flag)
 			mult++;
 		}
 		total++;
+		if ((checkpoint_interval > 0) and (count < N) and (total % checkpoint_interval == 0))
+		{
+			CheckpointData shared_state, local_state;
+			shared_state.Put(a,ma);
+			shared_state.Put(chisq);
+			shared_state.Put(mult);
+			shared_state.Put(count);
+			shared_state.Put(total);
+			out_offset = out.tellp();
+			shared_state.Put(out_offset);
+			gDev.SaveState(c_ptr(ranstate));
+			local_state.Put(ranstate);
+			WriteCheckpoint(name, "methas", shared_state, local_state);
+		}
 	}
 	while(count < N);
+	DeleteCheckpoint(name);
 
 	del <double> (aNext);
 }
@@ -817,12 +867,308 @@ void quitproc(int sig)
 	exit(0);
 }
 
+const char checkpoint_magic[8] = {'Q','L','C','H','K','P','T','1'};
+const int checkpoint_tag_length = 16;
+
+// The checkpoint consists of the 'shared' state, which is identical on all processes (walker positions, live points, counters),
+// followed by one 'local' block per MPI process (random number generator state and output file offsets). The shared state is
+// written by process 0, while the local blocks are gathered from every process, so all processes can resume exactly.
+void UCMC::WriteCheckpoint(const char *name, const char *sampler, CheckpointData &shared, CheckpointData &local)
+{
+	long long int shared_size = shared.Size();
+	long long int local_size = local.Size();
+	vector<char> local_all;
+#ifdef USE_MPI
+	if (mpi_id==0) local_all.resize(local_size*mpi_np);
+	MPI_Gather(local.Ptr(),local_size,MPI_CHAR,(mpi_id==0) ? c_ptr(local_all) : NULL,local_size,MPI_CHAR,0,MPI_COMM_WORLD);
+#else
+	local_all.assign(local.Ptr(),local.Ptr()+local_size);
+#endif
+	if (mpi_id==0) {
+		char tag[checkpoint_tag_length];
+		for (int i=0; i < checkpoint_tag_length; i++) tag[i] = '\0';
+		strncpy(tag,sampler,checkpoint_tag_length-1);
+
+		string filename = string(name) + ".checkpoint";
+		string tempname = filename + ".tmp";
+		ofstream cpout(tempname.c_str(), ios::binary);
+		cpout.write(checkpoint_magic, sizeof(checkpoint_magic));
+		cpout.write(tag, checkpoint_tag_length);
+		cpout.write((char *) &ma, sizeof(int));
+		cpout.write((char *) &mpi_np, sizeof(int));
+		cpout.write((char *) &shared_size, sizeof(long long int));
+		cpout.write((char *) &local_size, sizeof(long long int));
+		cpout.write(shared.Ptr(), shared_size);
+		cpout.write(c_ptr(local_all), local_size*mpi_np);
+		cpout.close();
+		// write to a temporary file first, so a job killed while writing never leaves a truncated checkpoint behind
+		if ((!cpout) or (rename(tempname.c_str(),filename.c_str()) != 0)) warn("could not write checkpoint file '%s'",filename.c_str());
+	}
+}
+
+bool UCMC::ReadCheckpoint(const char *name, const char *sampler, CheckpointData &shared, CheckpointData &local)
+{
+	long long int shared_size, local_size;
+	int status = 1; // 1 = okay, 0 = no checkpoint found, -1 = checkpoint does not match current run
+	vector<char> local_all;
+	string filename = string(name) + ".checkpoint";
+	if (mpi_id==0) {
+		ifstream cpin(filename.c_str(), ios::binary);
+		if (!cpin.is_open()) status = 0;
+		else {
+			char magic[sizeof(checkpoint_magic)];
+			char tag[checkpoint_tag_length];
+			int ma_in, mpi_np_in;
+			cpin.read(magic, sizeof(checkpoint_magic));
+			cpin.read(tag, checkpoint_tag_length);
+			cpin.read((char *) &ma_in, sizeof(int));
+			cpin.read((char *) &mpi_np_in, sizeof(int));
+			cpin.read((char *) &shared_size, sizeof(long long int));
+			cpin.read((char *) &local_size, sizeof(long long int));
+			tag[checkpoint_tag_length-1] = '\0';
+			if ((!cpin) or (strncmp(magic,checkpoint_magic,sizeof(checkpoint_magic)) != 0) or (string(tag) != string(sampler)) or (ma_in != ma) or (mpi_np_in != mpi_np) or (local_size != (long long int) local.Size())) status = -1;
+			else {
+				shared.Resize(shared_size);
+				local_all.resize(local_size*mpi_np);
+				cpin.read(shared.Ptr(), shared_size);
+				cpin.read(c_ptr(local_all), local_size*mpi_np);
+				if (!cpin) status = -1;
+			}
+		}
+	}
+#ifdef USE_MPI
+	MPI_Bcast(&status,1,MPI_INT,0,MPI_COMM_WORLD);
+#endif
+	if (status==0) {
+		if (mpi_id==0) warn("checkpoint file '%s' not found; starting new chains",filename.c_str());
+		return false;
+	}
+	if (status==-1) die("checkpoint file '%s' does not match the current sampler, number of parameters or number of MPI processes",filename.c_str());
+#ifdef USE_MPI
+	MPI_Bcast(&shared_size,1,MPI_LONG_LONG,0,MPI_COMM_WORLD);
+	if (mpi_id != 0) shared.Resize(shared_size);
+	MPI_Bcast(shared.Ptr(),shared_size,MPI_CHAR,0,MPI_COMM_WORLD);
+	MPI_Scatter((mpi_id==0) ? c_ptr(local_all) : NULL,local.Size(),MPI_CHAR,local.Ptr(),local.Size(),MPI_CHAR,0,MPI_COMM_WORLD);
+#else
+	std::copy(local_all.begin(),local_all.end(),local.Ptr());
+#endif
+	local.Resize(local.Size()); // rewind so the local block can be read back
+	return true;
+}
+
+void UCMC::DeleteCheckpoint(const char *name)
+{
+	if (mpi_id==0) remove((string(name) + ".checkpoint").c_str());
+}
+
+void ChainDiagnostics::Initialize(const int nchains_in, const int nparams_in, const int max_length_in)
+{
+	nchains = nchains_in;
+	nparams = nparams_in;
+	max_length = max_length_in;
+	if (max_length % 2 != 0) max_length++;
+	Reset();
+}
+
+void ChainDiagnostics::Reset()
+{
+	length = 0;
+	stride = 1;
+	skip = 0;
+	history.assign(nchains, vector<vector<double> >(nparams, vector<double>(max_length, 0.0)));
+}
+
+void ChainDiagnostics::AddSweep(const vector<vector<double> > &pts)
+{
+	if (++skip < stride) return;
+	skip = 0;
+	int c, p, k;
+	if (length == max_length) {
+		// thin the history by keeping every other sample (including the most recent one), and sample half as often from now on
+		for (c=0; c < nchains; c++) {
+			for (p=0; p < nparams; p++) {
+				for (k=0; k < max_length/2; k++) history[c][p][k] = history[c][p][2*k+1];
+			}
+		}
+		length = max_length/2;
+		stride *= 2;
+	}
+	for (c=0; c < nchains; c++) {
+		for (p=0; p < nparams; p++) history[c][p][length] = pts[c][p];
+	}
+	length++;
+}
+
+// in-place radix-2 FFT; the size of the arrays must be a power of two
+void ChainDiagnostics::fft(vector<double> &re, vector<double> &im, const bool inverse)
+{
+	int n = re.size();
+	int i, j, k, len;
+	for (i=1, j=0; i < n; i++) {
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			std::swap(re[i],re[j]);
+			std::swap(im[i],im[j]);
+		}
+	}
+	double ang, wr, wi, cr, ci, tr, ti, temp;
+	for (len=2; len <= n; len <<= 1) {
+		ang = (inverse ? 2 : -2)*M_PI/len;
+		wr = cos(ang);
+		wi = sin(ang);
+		for (i=0; i < n; i += len) {
+			cr = 1.0;
+			ci = 0.0;
+			for (k=0; k < len/2; k++) {
+				j = i + k + len/2;
+				tr = re[j]*cr - im[j]*ci;
+				ti = re[j]*ci + im[j]*cr;
+				re[j] = re[i+k] - tr;
+				im[j] = im[i+k] - ti;
+				re[i+k] += tr;
+				im[i+k] += ti;
+				temp = cr*wr - ci*wi;
+				ci = cr*wi + ci*wr;
+				cr = temp;
+			}
+		}
+	}
+}
+
+// biased autocovariance (normalized by n) of x for lags 0,...,n-1, found with a zero-padded FFT
+void ChainDiagnostics::autocovariance(const double *x, const int n, vector<double> &acov)
+{
+	int i, nfft = 1;
+	while (nfft < 2*n) nfft <<= 1;
+	double mean = 0;
+	for (i=0; i < n; i++) mean += x[i];
+	mean /= n;
+	vector<double> re(nfft, 0.0), im(nfft, 0.0);
+	for (i=0; i < n; i++) re[i] = x[i] - mean;
+	fft(re,im,false);
+	for (i=0; i < nfft; i++) {
+		re[i] = re[i]*re[i] + im[i]*im[i];
+		im[i] = 0;
+	}
+	fft(re,im,true);
+	acov.resize(n);
+	for (i=0; i < n; i++) acov[i] = re[i]/nfft/n;
+}
+
+// Returns false if there are not yet enough samples to estimate the diagnostics
+bool ChainDiagnostics::Evaluate(double &split_rhat_max, double &ess_min)
+{
+	int half = length/2; // the first half of the history is discarded as burn-in
+	int n = half/2; // length of each split chain
+	if (n < 10) return false;
+	int m = 2*nchains; // number of split chains
+	int start = length - 2*n;
+	int c, p, s, t;
+	vector<double> means(m), vars(m), acov, rho_sum(n);
+	split_rhat_max = 0;
+	ess_min = 1e30;
+	for (p=0; p < nparams; p++) {
+		for (t=0; t < n; t++) rho_sum[t] = 0;
+		for (c=0; c < nchains; c++) {
+			for (s=0; s < 2; s++) {
+				autocovariance(&history[c][p][start+s*n],n,acov);
+				means[2*c+s] = 0;
+				for (t=0; t < n; t++) means[2*c+s] += history[c][p][start+s*n+t];
+				means[2*c+s] /= n;
+				vars[2*c+s] = acov[0]*n/(n-1.0);
+				for (t=0; t < n; t++) rho_sum[t] += acov[t];
+			}
+		}
+		double W = 0, B = 0, mean_all = 0;
+		for (c=0; c < m; c++) {
+			W += vars[c];
+			mean_all += means[c];
+		}
+		W /= m;
+		mean_all /= m;
+		for (c=0; c < m; c++) B += (means[c]-mean_all)*(means[c]-mean_all);
+		B *= n/(m-1.0);
+		if (W <= 0) {
+			// a parameter that has not moved at all in any chain cannot be considered converged
+			split_rhat_max = 1e30;
+			ess_min = 0;
+			continue;
+		}
+		double var_plus = (n-1.0)*W/n + B/n;
+		double rhat = sqrt(var_plus/W);
+		if (rhat > split_rhat_max) split_rhat_max = rhat;
+
+		// Geyer's initial monotone sequence: sum pairs of autocorrelations while they stay positive, forcing them to decrease
+		double rho_even, rho_odd, pair, pair_prev = 1e30, tau = 0;
+		for (t=0; t+1 < n; t += 2) {
+			rho_even = (t==0) ? 1.0 : 1.0 - (W - rho_sum[t]/m)/var_plus;
+			rho_odd = 1.0 - (W - rho_sum[t+1]/m)/var_plus;
+			pair = rho_even + rho_odd;
+			if (pair < 0) break;
+			if (pair > pair_prev) pair = pair_prev;
+			tau += 2*pair;
+			pair_prev = pair;
+		}
+		tau -= 1.0;
+		if (tau < 1.0/log10(double(m*n))) tau = 1.0/log10(double(m*n));
+		double ess = m*n/tau;
+		if (ess < ess_min) ess_min = ess;
+	}
+	return true;
+}
+
+void ChainDiagnostics::Put(CheckpointData &state)
+{
+	state.Put(nchains);
+	state.Put(nparams);
+	state.Put(max_length);
+	state.Put(length);
+	state.Put(stride);
+	state.Put(skip);
+	for (int c=0; c < nchains; c++) {
+		for (int p=0; p < nparams; p++) state.Put(&history[c][p][0],length);
+	}
+}
+
+bool ChainDiagnostics::Get(CheckpointData &state)
+{
+	// returns false if the saved history is truncated or inconsistent, in which case the checkpoint cannot be resumed
+	int nchains_in=0, nparams_in=0, max_length_in=0;
+	state.Get(nchains_in);
+	state.Get(nparams_in);
+	state.Get(max_length_in);
+	if (!state.Good()) return false;
+	if (nchains_in > 0) {
+		if ((nparams_in <= 0) or (max_length_in <= 0) or (max_length_in % 2 != 0)) return false;
+		int length_in=0, stride_in=0, skip_in=0;
+		state.Get(length_in);
+		state.Get(stride_in);
+		state.Get(skip_in);
+		if ((!state.Good()) or (length_in < 0) or (length_in > max_length_in) or (stride_in < 1) or (skip_in < 0)) return false;
+		Initialize(nchains_in,nparams_in,max_length_in);
+		length = length_in;
+		stride = stride_in;
+		skip = skip_in;
+		for (int c=0; c < nchains; c++) {
+			for (int p=0; p < nparams; p++) state.Get(&history[c][p][0],length);
+		}
+	} else {
+		// no history was kept when the checkpoint was written
+		int dummy;
+		for (int i=0; i < 3; i++) state.Get(dummy);
+	}
+	return state.Good();
+}
+
 void UCMC::TWalk(const char *name, const double div, const int proj, const double din, const double alim, const double alimt, const double tol, const int Threads, double *best_fit_params, bool logfile, double** initial_points, string chain_info, string data_info)
 {
 	int NThreads = (Threads > ma+1) ? Threads : ma + 2;
 	if (NThreads < 5+mpi_ngroups) NThreads = 5 + mpi_ngroups;
 	if (NThreads <= proj) NThreads = proj + 1; // it might be ok for NThreads to be equal to proj, I'm not sure
 	if (mpi_id==0) cout << "Number of chains for T-Walk algorithm: " << NThreads << endl << endl;
+	KEEP_RUNNING = 1;
 	vector<double> loglike(NThreads);
 	vector<double> aNext(ma, 0.0);
 	vector<vector<double> > a0 = vector<vector<double> > (NThreads, vector<double>(ma, 0.0));
@@ -851,6 +1197,11 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 	double logZ, Ravg = 0.0;
 	double Rmax = -1e30;
 	double minloglike = 1e30;
+	bool use_diagnostics = (target_ess > 0);
+	bool diagnostics_ready = false;
+	double split_rhat_max = 0, ess_min = 0;
+	ChainDiagnostics diagnostics;
+	if (use_diagnostics) diagnostics.Initialize(NThreads,ma,2048);
 	ofstream logout;
 #ifdef USE_MPI
 	if (mpi_id==0)
@@ -858,7 +1209,8 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 #endif
 		if (logfile) {
 			string log_filename = string(name) + ".twalk.log";
-			logout.open(log_filename.c_str());
+			if (resume_from_checkpoint) logout.open(log_filename.c_str(), ios::app);
+			else logout.open(log_filename.c_str());
 		}
 #ifdef USE_MPI
 	}
@@ -875,6 +1227,47 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 #endif
 
 	RandomPlane gDev(proj, ma, din, alim, alimt, rand+mpi_group_num);
+	int lastcnt=0;
+
+	bool resumed = false;
+	vector<long long int> chain_offsets(NThreads, 0);
+	if (resume_from_checkpoint)
+	{
+		CheckpointData shared_state, local_state;
+		vector<char> ranstate(gDev.StateSize());
+		local_state.Resize(ranstate.size() + NThreads*sizeof(long long int));
+		if (ReadCheckpoint(name, "twalk", shared_state, local_state))
+		{
+			int nchains;
+			shared_state.Get(nchains);
+			if (nchains != NThreads) die("number of chains in checkpoint (%i) does not match current number of chains (%i)",nchains,NThreads);
+			for (t=0; t < NThreads; t++) shared_state.Get(a0[t]);
+			shared_state.Get(loglike);
+			shared_state.Get(mult);
+			shared_state.Get(count);
+			shared_state.Get(total);
+			shared_state.Get(ttotal);
+			shared_state.Get(Nlength);
+			for (t=0; t < NThreads; t++) shared_state.Get(covT[t]);
+			for (t=0; t < NThreads; t++) shared_state.Get(avgT[t]);
+			shared_state.Get(W,ma);
+			shared_state.Get(avgTot,ma);
+			shared_state.Get(Ravg);
+			shared_state.Get(Rmax);
+			shared_state.Get(minloglike);
+			shared_state.Get(best_fit_params,ma);
+			shared_state.Get(lastcnt);
+#ifdef USE_MPI
+			shared_state.Get(tints);
+#endif
+			bool diagnostics_ok = diagnostics.Get(shared_state);
+			local_state.Get(c_ptr(ranstate),ranstate.size());
+			local_state.Get(chain_offsets);
+			if ((!diagnostics_ok) or (!shared_state.Ok()) or (!local_state.Ok())) die("T-Walk checkpoint file is corrupted");
+			gDev.LoadState(c_ptr(ranstate));
+			resumed = true;
+		}
+	}
 
 	ofstream *out;
 	out = new ofstream[NThreads];
@@ -884,65 +1277,81 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 		s << t;
 		string endstring;
 		s >> endstring;
+		string chain_filename = "";
 #ifdef USE_MPI
 		if (leader) {
 			if (mpi_ngroups > 1) {
 				ps << mpi_group_num;
 				string pstring;
 				ps >> pstring;
-				out[t].open((string(name)+string("_")+endstring+"."+pstring).c_str());
+				chain_filename = string(name)+string("_")+endstring+"."+pstring;
 			}
-			else out[t].open((string(name)+string("_")+endstring).c_str());
+			else chain_filename = string(name)+string("_")+endstring;
 		}
 #else
-		out[t].open((string(name)+string("_")+endstring).c_str());
+		chain_filename = string(name)+string("_")+endstring;
 #endif
+		if (chain_filename != "") {
+			if (resumed) {
+				// discard anything written to the chain after the checkpoint was made, then continue the chain from there
+				if (truncate(chain_filename.c_str(),chain_offsets[t]) != 0) warn("could not truncate chain file '%s' to checkpoint",chain_filename.c_str());
+				out[t].open(chain_filename.c_str(), ios::app);
+				out[t].seekp(0, ios::end);
+			}
+			else out[t].open(chain_filename.c_str());
+		}
 	}
-	if (chain_info != "") out[0] << "# CHAIN_INFO: " << chain_info << endl;
-	if (data_info != "") out[0] << "# DATA_INFO: " << data_info << endl;
-	out[0] << "# Sampler: T-Walk (MCMC) Algorithm, mcmc_chains = " << NThreads << endl;
+	if (!resumed) {
+		if (chain_info != "") out[0] << "# CHAIN_INFO: " << chain_info << endl;
+		if (data_info != "") out[0] << "# DATA_INFO: " << data_info << endl;
+		out[0] << "# Sampler: T-Walk (MCMC) Algorithm, mcmc_chains = " << NThreads << endl;
 
-	for (t=0; t < NThreads; t++)
-	{
-#ifdef USE_MPI
-		if (mpi_group_num == 0)
+		for (t=0; t < NThreads; t++)
 		{
+#ifdef USE_MPI
+			if (mpi_group_num == 0)
+			{
 #endif
-			if (initial_points==NULL) {
-				for (j=0; j < ma; j++) {
-					a0[t][j] = gDev.Doub();
+				if (initial_points==NULL) {
+					for (j=0; j < ma; j++) {
+						a0[t][j] = gDev.Doub();
+					}
+				} else {
+					for (j=0; j < ma; j++) {
+						//if (mpi_id==0) cout << t << " " << j << a0[t][j] << endl;
+						a0[t][j] = (initial_points[t][j] - lowerLimits_initial[j]) / (upperLimits_initial[j] - lowerLimits_initial[j]);
+					}
 				}
-			} else {
+#ifdef USE_MPI
+			}
+			MPI_Bcast (c_ptr(a0[t]), a0[t].size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+			if (mpi_group_num == 0) {
+#endif
 				for (j=0; j < ma; j++) {
-					//if (mpi_id==0) cout << t << " " << j << a0[t][j] << endl;
-					a0[t][j] = (initial_points[t][j] - lowerLimits_initial[j]) / (upperLimits_initial[j] - lowerLimits_initial[j]);
+					atrans[j] = lowerLimits_initial[j] + a0[t][j]*(upperLimits_initial[j] - lowerLimits_initial[j]);
 				}
-			}
+				loglike[t] = LOGLIKE(atrans);
+				//for (j=0; j < ma; j++) cout << atrans[j] << " ";
+				//cout << 2*loglike[t] << endl << flush;
+				
 #ifdef USE_MPI
-		}
-		MPI_Bcast (c_ptr(a0[t]), a0[t].size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
-		if (mpi_group_num == 0) {
-#endif
-			for (j=0; j < ma; j++) {
-				atrans[j] = lowerLimits_initial[j] + a0[t][j]*(upperLimits_initial[j] - lowerLimits_initial[j]);
 			}
-			loglike[t] = LOGLIKE(atrans);
-			//for (j=0; j < ma; j++) cout << atrans[j] << " ";
-			//cout << 2*loglike[t] << endl << flush;
-			
-#ifdef USE_MPI
+#endif
 		}
+#ifdef USE_MPI
+		MPI_Bcast (c_ptr(loglike), loglike.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #endif
 	}
 
 #ifdef USE_MPI
-	MPI_Bcast (c_ptr(loglike), loglike.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
-
 	if (mpi_id==0)
 	{
 #endif
+		if ((logfile) and (resumed)) logout << "Resuming from checkpoint after " << total << " iterations\n\n";
+		if (resumed) cout << "Resuming from checkpoint after " << total << " iterations" << endl;
 		if (logfile) logout << "Metropolis-Hastings/T-Walk Algorithm Started\n\n";
 		cout << "Metropolis-Hastings/T-Walk Algorithm Started\n" << "\tpoints = " << "\n\taccept ratio = " << "\n\tR = "  << endl;
+		if (use_diagnostics) cout << "\tsplit-R = " << endl;
 #ifdef USE_MPI
 	}
 #endif
@@ -953,7 +1362,6 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 	b2 = (1.0 + div)/2.0;
 
 	int id, cnt, ts;
-	int lastcnt=0;
 	double ran, davg, dcov;
 	double Bn, R;
 	do
@@ -1132,6 +1540,7 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 			cont = false;
 			if (total%NThreads == 0) //cnt >= cut*NThreads && 
 			{
+				int Nlength_prev = Nlength;
 				for (ttt=0; ttt < NThreads; ttt++) {
 					for (i=0; i < ma; i++) {
 						davg = (a0[ttt][i]-avgT[ttt][i])/(ttotal+1.0);
@@ -1181,12 +1590,24 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 
 					Ravg += R;
 				}
+
+				if (use_diagnostics) {
+					if (Nlength != Nlength_prev) {
+						diagnostics.Reset(); // the running statistics were just reset, so start the diagnostics over as well
+						diagnostics_ready = false;
+					}
+					diagnostics.AddSweep(a0);
+					if (ttotal % 10 == 0) diagnostics_ready = diagnostics.Evaluate(split_rhat_max,ess_min);
+					// the chains must also pass the split-R test and reach the target effective sample size before stopping
+					if ((!diagnostics_ready) or (split_rhat_max >= tol) or (ess_min < target_ess)) cont = true;
+				}
 			}
 			else cont = true;
 
 			if (logfile) {
 				if ((cnt % 10 == 0) and (cnt != lastcnt)) {
 					logout << "points = " << cnt  << " (" << cnt/double(NThreads) << ")" << " accept ratio=" << (double)cnt/(double)total/(double)mpi_ngroups << " R=" << Ravg/ma << " Rmax=" << Rmax;
+					if (diagnostics_ready) logout << " split_Rmax=" << split_rhat_max << " ESS=" << ess_min;
 #ifdef USE_OPENMP
 					logout << "   avg_loglike_time = " << total_loglike_time / n_loglikes << " total_time = " << total_loglike_time << endl << flush;
 #else
@@ -1195,18 +1616,53 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 					lastcnt = cnt;
 				}
 			}
-			cout << "\033[3A\tpoints = " << cnt << " (" << cnt/double(NThreads) << ")" << "\n\taccept ratio = " << blank << (double)cnt/(double)total/(double)mpi_ngroups << "\n\tR = " << Ravg/ma << " Rmax=" << Rmax;
+			cout << ((use_diagnostics) ? "\033[4A" : "\033[3A") << "\tpoints = " << cnt << " (" << cnt/double(NThreads) << ")" << "\n\taccept ratio = " << blank << (double)cnt/(double)total/(double)mpi_ngroups << "\n\tR = " << Ravg/ma << " Rmax=" << Rmax;
 #ifdef USE_OPENMP
 			cout << "   avg_loglike_time = " << total_loglike_time / n_loglikes << endl << flush;
 #else
 			cout << endl << flush;
 #endif
+			if (use_diagnostics) {
+				if (diagnostics_ready) cout << "\tsplit-R = " << split_rhat_max << " ESS = " << ess_min << " (target " << target_ess << ")" << blank << endl << flush;
+				else cout << "\tsplit-R = (waiting for more samples)" << endl << flush;
+			}
 #ifdef USE_MPI
 		}
 		MPI_Bcast(best_fit_params,ma,MPI_DOUBLE,0,MPI_COMM_WORLD);
 		MPI_Bcast (&cont, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
 		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,MPI_COMM_WORLD);
 #endif
+		if ((checkpoint_interval > 0) and (cont) and ((total % checkpoint_interval == 0) or (!KEEP_RUNNING)))
+		{
+			CheckpointData shared_state, local_state;
+			shared_state.Put(NThreads);
+			for (t=0; t < NThreads; t++) shared_state.Put(a0[t]);
+			shared_state.Put(loglike);
+			shared_state.Put(mult);
+			shared_state.Put(count);
+			shared_state.Put(total);
+			shared_state.Put(ttotal);
+			shared_state.Put(Nlength);
+			for (t=0; t < NThreads; t++) shared_state.Put(covT[t]);
+			for (t=0; t < NThreads; t++) shared_state.Put(avgT[t]);
+			shared_state.Put(W,ma);
+			shared_state.Put(avgTot,ma);
+			shared_state.Put(Ravg);
+			shared_state.Put(Rmax);
+			shared_state.Put(minloglike);
+			shared_state.Put(best_fit_params,ma);
+			shared_state.Put(lastcnt);
+#ifdef USE_MPI
+			shared_state.Put(tints);
+#endif
+			diagnostics.Put(shared_state);
+			vector<char> ranstate(gDev.StateSize());
+			gDev.SaveState(c_ptr(ranstate));
+			local_state.Put(ranstate);
+			for (t=0; t < NThreads; t++) chain_offsets[t] = (out[t].is_open()) ? (long long int) out[t].tellp() : 0;
+			local_state.Put(chain_offsets);
+			WriteCheckpoint(name, "twalk", shared_state, local_state);
+		}
 		signal(SIGABRT, &sighandler);
 		signal(SIGTERM, &sighandler);
 		signal(SIGINT, &sighandler);
@@ -1215,6 +1671,11 @@ void UCMC::TWalk(const char *name, const double div, const int proj, const doubl
 	}
 	while((cont) and (KEEP_RUNNING));
 
+	if (KEEP_RUNNING) DeleteCheckpoint(name); // chains have converged, so there is nothing left to resume
+	if ((use_diagnostics) and (diagnostics_ready) and (mpi_id==0)) {
+		cout << "Final split-R = " << split_rhat_max << ", effective sample size = " << ess_min << " (minimum over parameters)" << endl;
+		if (logfile) logout << "Final split-R = " << split_rhat_max << ", effective sample size = " << ess_min << " (minimum over parameters)" << endl;
+	}
 	cout << "twalk for rank " << mpi_id << " has finished." << endl;
 
 	delete[] W;
@@ -1335,7 +1796,7 @@ void UCMC::McmcAd(const char *name, const int N)
 
 void UCMC::Slicing(const char *name, const int N, const char flag)
 {
-	ofstream out(name);
+	ofstream out;
 	double *aTemp = new double[ma];
 	double w, y, *r = new double[ma], *l = new double[ma];
 	double u, logLike, tempLogLike, Navg = 0.0;
@@ -1352,8 +1813,36 @@ void UCMC::Slicing(const char *name, const int N, const char flag)
 		gDev = new RandomBasis(ma, rand);
 		W = &UCMC::Wu;
 	}
-	
-	logLike = LOGLIKE(a);
+
+	const char *checkpoint_tag = (flag&TRANSFORM) ? "slicing_transform" : "slicing";
+	bool resumed = false;
+	long long int out_offset = 0;
+	vector<char> ranstate(gDev->StateSize());
+	if (resume_from_checkpoint)
+	{
+		CheckpointData shared_state, local_state;
+		local_state.Resize(ranstate.size());
+		if (ReadCheckpoint(name, checkpoint_tag, shared_state, local_state))
+		{
+			shared_state.Get(a,ma);
+			shared_state.Get(logLike);
+			shared_state.Get(count);
+			shared_state.Get(Navg);
+			shared_state.Get(out_offset);
+			local_state.Get(ranstate);
+			if ((!shared_state.Ok()) or (!local_state.Ok())) die("slice sampling checkpoint file is corrupted");
+			gDev->LoadState(c_ptr(ranstate));
+			resumed = true;
+		}
+	}
+	if (resumed) {
+		if (truncate(name,out_offset) != 0) warn("could not truncate chain file '%s' to checkpoint",name);
+		out.open(name, ios::app);
+		out.seekp(0, ios::end);
+	} else {
+		out.open(name);
+		logLike = LOGLIKE(a);
+	}
 	do
 	{
 		start:
@@ -1442,8 +1931,22 @@ void UCMC::Slicing(const char *name, const int N, const char flag)
 		Navg += (total - Navg)/count;
 		cout << "points = " << count << "\nnumber of evals = " << total << "\nnumber averaged:  " << Navg << endl;
 		total = 0;
+		if ((checkpoint_interval > 0) and (count < N) and (count % checkpoint_interval == 0))
+		{
+			CheckpointData shared_state, local_state;
+			shared_state.Put(a,ma);
+			shared_state.Put(logLike);
+			shared_state.Put(count);
+			shared_state.Put(Navg);
+			out_offset = out.tellp();
+			shared_state.Put(out_offset);
+			gDev->SaveState(c_ptr(ranstate));
+			local_state.Put(ranstate);
+			WriteCheckpoint(name, checkpoint_tag, shared_state, local_state);
+		}
 	}
 	while(count < N);
+	DeleteCheckpoint(name);
 	
 	delete gDev;
 	delete[] aTemp;
@@ -2892,6 +3395,18 @@ class Counter
 		{
 			return double(hits)/double(N);
 		}
+		void SaveState(CheckpointData &cp)
+		{
+			cp.Put(count);
+			cp.Put(hits);
+			cp.Put(vals,N);
+		}
+		void LoadState(CheckpointData &cp)
+		{
+			cp.Get(count);
+			cp.Get(hits);
+			cp.Get(vals,N);
+		}
 		~Counter()
 		{
 			delete[] vals;
@@ -2924,10 +3439,10 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 	{
 #endif
 		out.open(name);
-		binout.open((string(name)+string(".temp")).c_str(), ios::binary);
 		if (logfile) {
 			string log_filename = string(name) + ".nest.log";
-			logout.open(log_filename.c_str());
+			if (resume_from_checkpoint) logout.open(log_filename.c_str(), ios::app);
+			else logout.open(log_filename.c_str());
 		}
 #ifdef USE_MPI
 	}
@@ -2939,7 +3454,7 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 	const double enl = 1.0;
 	const int lvl = -1.0;
 
-	double temp, temp1, test, ratio;
+	double temp, temp1, test, ratio = 1.0;
 	double ratio_all_procs;
 	int imin, count = 0;
 	int trystot = 0;
@@ -2949,8 +3464,61 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 	MultiNormDev random(ma, 1.0, rand+mpi_group_num);
 
 	int iterations=0;
+	int overflow = 0;
+	int phase = 1; // phase 1 draws from the whole prior volume; phase 2 draws from ellipsoids enclosing the live points
 	double *ptr1, *ptr2;
+	KEEP_RUNNING = 1;
+
+	bool resumed = false;
+	long long int binout_offset = 0;
+	vector<char> ranstate(random.StateSize());
+	if (resume_from_checkpoint)
+	{
+		CheckpointData shared_state, local_state;
+		local_state.Resize(ranstate.size());
+		if (ReadCheckpoint(name, "nest", shared_state, local_state))
+		{
+			int nlive;
+			shared_state.Get(nlive);
+			if (nlive != N) die("number of live points in checkpoint (%i) does not match current number of live points (%i)",nlive,N);
+			shared_state.Get(phase);
+			for (i = 0; i < N; i++) shared_state.Get(points[i],ma);
+			shared_state.Get(logLikes,N);
+			shared_state.Get(logPriors,N);
+			shared_state.Get(likeMax);
+			shared_state.Get(likeMin);
+			shared_state.Get(imin);
+			shared_state.Get(likeLast);
+			shared_state.Get(slope);
+			shared_state.Get(count);
+			shared_state.Get(iterations);
+			shared_state.Get(trystot);
+			shared_state.Get(ratio);
+			shared_state.Get(ratio_all_procs);
+			shared_state.Get(minloglike);
+			shared_state.Get(best_fit_params,ma);
+			shared_state.Get(overflow);
+			cRec.LoadState(shared_state);
+			shared_state.Get(binout_offset);
+			local_state.Get(ranstate);
+			if ((!shared_state.Ok()) or (!local_state.Ok())) die("nested sampling checkpoint file is corrupted");
+			random.LoadState(c_ptr(ranstate));
+			resumed = true;
+		}
+	}
+	if (mpi_id==0)
+	{
+		string binout_filename = string(name) + string(".temp");
+		if (resumed) {
+			// the samples discarded before the checkpoint was made are kept in the temporary file, so pick up from there
+			if (truncate(binout_filename.c_str(),binout_offset) != 0) warn("could not truncate file '%s' to checkpoint",binout_filename.c_str());
+			binout.open(binout_filename.c_str(), ios::binary | ios::app);
+			binout.seekp(0, ios::end);
+		}
+		else binout.open(binout_filename.c_str(), ios::binary);
+	}
 
+	if ((mpi_id==0) and (resumed)) cout << "Resuming from checkpoint after " << count << " iterations (phase " << phase << ")" << endl;
 	if (mpi_id==0) cout << "Status:  Preparing samples \nProgress:  [\033[20C]" << endl << endl << endl << endl << endl << flush;
 
 #ifdef USE_OPENMP
@@ -2960,50 +3528,53 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 	// divide this up among the processes
 	int icount =0 ;
 	int divisions = (N < 20) ? 1 : N/20;
-	for (i = mpi_group_num; i < N; i += mpi_ngroups)
-	{	
-		ptr1 = points[i];
-		if (initial_points==NULL) {
-			for (j = 0; j < ma; j++)
-			{
-				ptr1[j] = random.Doub();
+	if (!resumed)
+	{
+		for (i = mpi_group_num; i < N; i += mpi_ngroups)
+		{	
+			ptr1 = points[i];
+			if (initial_points==NULL) {
+				for (j = 0; j < ma; j++)
+				{
+					ptr1[j] = random.Doub();
+				}
+				Convert_initial(cpt, ptr1);
+			} else {
+				for (j = 0; j < ma; j++)
+				{
+					cpt[j] = initial_points[i][j];
+				}
+				Convert_reverse_initial(ptr1, cpt);
 			}
-			Convert_initial(cpt, ptr1);
-		} else {
-			for (j = 0; j < ma; j++)
+			logPriors[i] = LogPrior(cpt);
+			logLikes[i] = LOGLIKE(cpt) + logPriors[i];
+
+			if ((logLikes[i]*0.0) or (std::isinf(logLikes[i])))
 			{
-				cpt[j] = initial_points[i][j];
+				i -= mpi_ngroups;
 			}
-			Convert_reverse_initial(ptr1, cpt);
-		}
-		logPriors[i] = LogPrior(cpt);
-		logLikes[i] = LOGLIKE(cpt) + logPriors[i];
-
-		if ((logLikes[i]*0.0) or (std::isinf(logLikes[i])))
-		{
-			i -= mpi_ngroups;
-		}
-		else if ((i % divisions) == 0)
-		{
-			icount++;
-			if (mpi_id==0) {
-				cout << "\033[5AProgress:  [" << flush;
-				for (j=0; j < icount; j++) cout << "=" << flush;
-				cout << "\033[4B" << endl << flush;
+			else if ((i % divisions) == 0)
+			{
+				icount++;
+				if (mpi_id==0) {
+					cout << "\033[5AProgress:  [" << flush;
+					for (j=0; j < icount; j++) cout << "=" << flush;
+					cout << "\033[4B" << endl << flush;
+				}
 			}
 		}
-	}
 #ifdef USE_MPI
-	if (mpi_np > 1) {
-		for (int group_num=0; group_num < mpi_ngroups; group_num++) {
-			for (i=group_num; i < N; i += mpi_ngroups) {
-				id = mpi_group_leader[group_num];
-				MPI_Bcast(logLikes+i,1,MPI_DOUBLE,id,MPI_COMM_WORLD);
-				MPI_Bcast(points[i],ma,MPI_DOUBLE,id,MPI_COMM_WORLD);
+		if (mpi_np > 1) {
+			for (int group_num=0; group_num < mpi_ngroups; group_num++) {
+				for (i=group_num; i < N; i += mpi_ngroups) {
+					id = mpi_group_leader[group_num];
+					MPI_Bcast(logLikes+i,1,MPI_DOUBLE,id,MPI_COMM_WORLD);
+					MPI_Bcast(points[i],ma,MPI_DOUBLE,id,MPI_COMM_WORLD);
+				}
 			}
 		}
-	}
 #endif
+	}
 
 	signal(SIGABRT, &sighandler);
 	signal(SIGTERM, &sighandler);
@@ -3018,24 +3589,28 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 		area *= (upperLimits[j] - lowerLimits[j]);
 	}
 	
-	likeMax = likeMin = logLikes[0];
-	imin = 0;
-	for (i = 0; i < N; i++)
+	if (!resumed)
 	{
-		if (likeMax > logLikes[i])
-		{
-			likeMax = logLikes[i];
-		}
-		else if (likeMin < logLikes[i])
+		likeMax = likeMin = logLikes[0];
+		imin = 0;
+		for (i = 0; i < N; i++)
 		{
-			likeMin = logLikes[i];
-			imin = i;
+			if (likeMax > logLikes[i])
+			{
+				likeMax = logLikes[i];
+			}
+			else if (likeMin < logLikes[i])
+			{
+				likeMin = logLikes[i];
+				imin = i;
+			}
 		}
+		likeLast = likeMin;
 	}
 	
 	ptr1 = points[imin];
-	likeLast = likeMin;
 	if (mpi_id==0) {
+		if ((logfile) and (resumed)) logout << "Resuming from checkpoint after " << count << " iterations (phase " << phase << ")" << endl;
 		if (!logfile) {
 			cout << "\n\033[7AStatus:  Nested Sampling Started" << endl << flush;
 			cout << "\033[K\tpoints = \033[K" << "\n\tinv slope = " << "\n\tneg loglike = " << "\n\taccept ratio = " << endl << endl << flush;
@@ -3048,7 +3623,42 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 	total_time0 = omp_get_wtime();
 #endif
 	bool first_interrupt=true;
-	do
+
+	bool interrupt_checkpoint_saved = false;
+	auto save_checkpoint = [&]()
+	{
+		CheckpointData shared_state, local_state;
+		shared_state.Put(N);
+		shared_state.Put(phase);
+		for (i = 0; i < N; i++) shared_state.Put(points[i],ma);
+		shared_state.Put(logLikes,N);
+		shared_state.Put(logPriors,N);
+		shared_state.Put(likeMax);
+		shared_state.Put(likeMin);
+		shared_state.Put(imin);
+		shared_state.Put(likeLast);
+		shared_state.Put(slope);
+		shared_state.Put(count);
+		shared_state.Put(iterations);
+		shared_state.Put(trystot);
+		shared_state.Put(ratio);
+		shared_state.Put(ratio_all_procs);
+		shared_state.Put(minloglike);
+		shared_state.Put(best_fit_params,ma);
+		shared_state.Put(overflow);
+		cRec.SaveState(shared_state);
+		if (mpi_id==0) {
+			binout.flush(); // the dead points up to this offset must be on disk in case the job is killed outright
+			binout_offset = binout.tellp();
+		}
+		shared_state.Put(binout_offset);
+		random.SaveState(c_ptr(ranstate));
+		local_state.Put(ranstate);
+		WriteCheckpoint(name, "nest", shared_state, local_state);
+		if (!KEEP_RUNNING) interrupt_checkpoint_saved = true;
+	};
+
+	while ((phase == 1) and (ratio > 1.0/senfac) and (KEEP_RUNNING))
 	{
 		if (mpi_id==0) {
 			Convert(cpt, points[imin]);
@@ -3163,17 +3773,20 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 #ifdef USE_MPI
 		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,MPI_COMM_WORLD);
 #endif
+		if ((checkpoint_interval > 0) and ((count % checkpoint_interval == 0) or (!KEEP_RUNNING))) save_checkpoint();
 	}
-	while(ratio > 1.0/senfac && KEEP_RUNNING);
 
-	group = new Points(points, ma, N, exp(-double(count+1)/N)*senfac, lvl, enl, &random, 0x00);
+	if (phase == 1) {
+		group = new Points(points, ma, N, exp(-double(count+1)/N)*senfac, lvl, enl, &random, 0x00);
+		phase = 2;
+	}
+	else group = NULL; // resumed in phase 2, where the ellipsoids are rebuilt from the live points every iteration
 	
 	if (mpi_id==0) {
 		if (logfile) logout << "Status:  MultNest Sampling Started" << endl;
 		else cout << "\033[6AStatus:  MultNest Sampling Started\r\033[5B" << blank << endl;
 	}
 
-	int overflow = 0;
 	do
 	{
 		Convert(cpt, points[imin]);
@@ -3186,7 +3799,7 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 		likeOld = likeMin;
 		ptr2 = new double[ma];
 		
-		if (group->F() > 1.1 || true)
+		if ((group == NULL) || group->F() > 1.1 || true)
 		{
 			char flag = (ratio < 0.5 ? 0x00 : 0x00);
 			double cor = (ratio < 0.5 ? 1.0 : 1.0);
@@ -3319,6 +3932,7 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 #ifdef USE_MPI
 		MPI_Bcast(&KEEP_RUNNING,1,MPI_INT,0,MPI_COMM_WORLD);
 #endif
+		if ((checkpoint_interval > 0) and (test < 1.0/tol) and (!interrupt_checkpoint_saved) and ((count % checkpoint_interval == 0) or (!KEEP_RUNNING))) save_checkpoint();
 	}
 	while(test < 1.0/tol && KEEP_RUNNING);
 	
@@ -3451,7 +4065,11 @@ void UCMC::MonoSample(const char *name, const int N, double &lnZ, double *best_f
 		}
 	}
 	
-	if (system((string("rm -f ") + string(name) + string(".temp")).c_str()) != 0) warn("could not delete temporary files for nested sampling output");
+	if ((KEEP_RUNNING) or (checkpoint_interval==0)) {
+		// if the run was interrupted, the temporary file is needed to resume from the last checkpoint
+		if (system((string("rm -f ") + string(name) + string(".temp")).c_str()) != 0) warn("could not delete temporary files for nested sampling output");
+	}
+	if (KEEP_RUNNING) DeleteCheckpoint(name);
 	
 	signal(SIGABRT, SIG_DFL);
 	signal(SIGTERM, SIG_DFL);
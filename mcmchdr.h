@@ -3,6 +3,7 @@
 #include "random.h"
 #include "mathexpr.h"
 #include <vector>
+#include <algorithm>
 
 #ifdef USE_MPI
 #include "mpi.h"
@@ -30,8 +31,8 @@ inline typename T::iterator::pointer c_ptr(T &it){return &(*it.begin());}
 
 inline vector<vector<double> > calcCov(const vector<vector<double> > &pts)
 {
-	static size_t dim = pts[0].size();
-	static size_t N = pts.size();
+	size_t dim = pts[0].size();
+	size_t N = pts.size();
 
 	vector<vector<double> > covar(dim, vector<double>(dim, 0.0));
 	vector<double> avg(dim, 0.0);
@@ -62,7 +63,7 @@ inline vector<vector<double> > calcCov(const vector<vector<double> > &pts)
 
 inline vector<vector<double> > calcIndent (const vector<vector<double> > &pts)
 {
-	static size_t dim = pts[0].size();
+	size_t dim = pts[0].size();
 			  
 	vector<vector<double> > covar(dim, vector<double>(dim, 0.0));
 	vector<double> hi(dim, 1.0), low(dim, 0.0);
@@ -92,6 +93,64 @@ inline vector<vector<double> > calcIndent (const vector<vector<double> > &pts)
 	return covar;
 }
 
+// Byte buffer used to save and restore sampler state for checkpointing; values are read back in the order they were written
+class CheckpointData
+{
+	private:
+		vector<char> data;
+		size_t pos;
+		bool ok;
+
+	public:
+		CheckpointData() : pos(0), ok(true) {}
+		template <typename T> void Put(const T *vals, const size_t n)
+		{
+			const char *ptr = (const char *) vals;
+			data.insert(data.end(), ptr, ptr + n*sizeof(T));
+		}
+		template <typename T> void Put(const T &val) {Put(&val,1);}
+		template <typename T> void Put(const vector<T> &vals) {if (!vals.empty()) Put(&vals[0],vals.size());}
+		template <typename T> void Get(T *vals, const size_t n)
+		{
+			if (pos + n*sizeof(T) > data.size()) { ok = false; return; }
+			char *ptr = (char *) vals;
+			std::copy(data.begin()+pos, data.begin()+pos+n*sizeof(T), ptr);
+			pos += n*sizeof(T);
+		}
+		template <typename T> void Get(T &val) {Get(&val,1);}
+		template <typename T> void Get(vector<T> &vals) {if (!vals.empty()) Get(&vals[0],vals.size());}
+		void Resize(const size_t n) {data.resize(n); pos = 0;}
+		size_t Size() const {return data.size();}
+		char *Ptr() {return (data.empty()) ? NULL : &data[0];}
+		bool Ok() const {return (ok and (pos == data.size()));}
+		bool Good() const {return ok;} // true if no read has run past the end of the data so far
+};
+
+// Keeps a thinned history of each chain's position (one sample per sweep) so that convergence can be monitored while the
+// sampler runs. Once the history fills up, every other sample is discarded and the sampling stride doubles, so memory stays
+// bounded no matter how long the chains run. The diagnostics use the most recent half of the history (the first half is
+// treated as burn-in); split-R is computed by splitting each chain in two, and the effective sample size uses FFT-based
+// autocorrelations combined over chains with Geyer's initial monotone sequence estimator.
+class ChainDiagnostics
+{
+	private:
+		int nchains, nparams, max_length;
+		int length, stride, skip;
+		vector<vector<vector<double> > > history; // history[chain][param][sample]
+
+		static void fft(vector<double> &re, vector<double> &im, const bool inverse);
+		static void autocovariance(const double *x, const int n, vector<double> &acov);
+
+	public:
+		ChainDiagnostics() : nchains(0), nparams(0), max_length(0), length(0), stride(1), skip(0) {}
+		void Initialize(const int nchains_in, const int nparams_in, const int max_length_in);
+		void Reset();
+		void AddSweep(const vector<vector<double> > &pts);
+		bool Evaluate(double &split_rhat_max, double &ess_min);
+		void Put(CheckpointData &state);
+		bool Get(CheckpointData &state);
+};
+
 class UCMC : public Minimize, private LevenMarq, private Derivative
 {
 	private:
@@ -107,6 +166,12 @@ class UCMC : public Minimize, private LevenMarq, private Derivative
 		unsigned long long int rand;
 		int mpi_np, mpi_id, mpi_ngroups, mpi_group_num;
 		int *mpi_group_leader;
+		int checkpoint_interval; // number of iterations between checkpoints (zero means no checkpoints are written)
+		bool resume_from_checkpoint;
+		double target_ess; // if nonzero, T-Walk also requires this effective sample size (and split-R below tolerance) before stopping
+		void WriteCheckpoint(const char *name, const char *sampler, CheckpointData &shared, CheckpointData &local);
+		bool ReadCheckpoint(const char *name, const char *sampler, CheckpointData &shared, CheckpointData &local);
+		void DeleteCheckpoint(const char *name);
 		
 	public:
 		UCMC();
@@ -153,6 +218,8 @@ class UCMC : public Minimize, private LevenMarq, private Derivative
 		int Count(double, double, int, char*, int);
 		double OutputParam(int i){return a[i];}
 		void SetRan(int n){rand = n;};
+		void SetCheckpoint(const int interval, const bool resume) {checkpoint_interval = interval; resume_from_checkpoint = resume;}
+		void SetStoppingRule(const double target_ess_in) {target_ess = target_ess_in;}
 		double (UCMC::*LogLikePtr)(double *);
 		void (UCMC::*DerivedParamPtr)(double *, double *);
 		void SetNDerivedParams(const int);
@@ -156,6 +156,14 @@ void SPLE_Lens::set_model_specific_integration_pointers()
 	}
 }
 
+bool SPLE_Lens::param_derivative_scaling(const int paramnum, double& dlogdef_dparam)
+{
+	// kappa (and hence the deflection) scales as b^alpha
+	if ((paramnum != 0) or (b==0)) return false;
+	dlogdef_dparam = alpha/b;
+	return true;
+}
+
 double SPLE_Lens::kappa_rsq(const double rsq)
 {
 	return ((2-alpha) * pow(b*b/(s*s+rsq), alpha/2) / 2);
@@ -635,6 +643,14 @@ void dPIE_Lens::set_model_specific_integration_pointers()
 	}
 }
 
+bool dPIE_Lens::param_derivative_scaling(const int paramnum, double& dlogdef_dparam)
+{
+	// the deflection is proportional to b, which scales as sigma0^2 (pmode=1) or mtot (pmode=2) if a, s are fixed
+	if ((paramnum != 0) or (*(param[0])==0)) return false;
+	dlogdef_dparam = ((parameter_mode==1) ? 2.0 : 1.0) / (*(param[0]));
+	return true;
+}
+
 double dPIE_Lens::kappa_rsq(const double rsq)
 {
 	return (0.5 * b * (pow(s*s+rsq, -0.5) - pow(a*a+rsq,-0.5)));
@@ -956,6 +972,14 @@ void NFW::set_model_specific_integration_pointers()
 	potptr_rsq_spherical = static_cast<double (LensProfile::*)(const double)> (&NFW::potential_spherical_rsq);
 }
 
+bool NFW::param_derivative_scaling(const int paramnum, double& dlogdef_dparam)
+{
+	// only ks is a pure normalization; in the other parameter modes, m200 changes rs as well
+	if ((parameter_mode != 0) or (paramnum != 0) or (ks==0)) return false;
+	dlogdef_dparam = 1.0/ks;
+	return true;
+}
+
 void NFW::set_ks_c200_from_m200_rs()
 {
 	double rvir_kpc;
@@ -1991,6 +2015,13 @@ void Hernquist::set_model_specific_integration_pointers()
 	potptr_rsq_spherical = static_cast<double (LensProfile::*)(const double)> (&Hernquist::potential_spherical_rsq);
 }
 
+bool Hernquist::param_derivative_scaling(const int paramnum, double& dlogdef_dparam)
+{
+	if ((paramnum != 0) or (ks==0)) return false;
+	dlogdef_dparam = 1.0/ks;
+	return true;
+}
+
 double Hernquist::kappa_rsq(const double rsq)
 {
 	double xsq = rsq/(rs*rs);
@@ -2105,6 +2136,13 @@ void ExpDisk::set_model_specific_integration_pointers()
 	kapavgptr_rsq_spherical = static_cast<double (LensProfile::*)(const double)> (&ExpDisk::kapavg_spherical_rsq);
 }
 
+bool ExpDisk::param_derivative_scaling(const int paramnum, double& dlogdef_dparam)
+{
+	if ((paramnum != 0) or (k0==0)) return false;
+	dlogdef_dparam = 1.0/k0;
+	return true;
+}
+
 double ExpDisk::kappa_rsq(const double rsq)
 {
 	return (k0*exp(-sqrt(rsq)/R_d)/q);
@@ -2256,6 +2294,39 @@ void Shear::set_model_specific_integration_pointers()
 	potptr_rsq_spherical = NULL;
 }
 
+void Shear::param_derivatives(const int paramnum, const int npts, const lensvector* pts, lensvector* ddef, lensmatrix* dhess)
+{
+	// The deflection and hessian are linear in (shear1, shear2), so the derivatives w.r.t. the shear parameters are simple
+	if (paramnum > 1) {
+		LensProfile::param_derivatives(paramnum,npts,pts,ddef,dhess);
+		return;
+	}
+	double dshear1, dshear2; // derivatives of shear1, shear2 w.r.t. the parameter
+	if (use_shear_component_params) {
+		dshear1 = (paramnum==0) ? 1.0 : 0.0;
+		dshear2 = (paramnum==0) ? 0.0 : 1.0;
+	} else if (paramnum==0) {
+		dshear1 = cos(2*theta_eff);
+		dshear2 = sin(2*theta_eff);
+	} else {
+		dshear1 = -2*degrees_to_radians(1.0)*shear2; // angle parameter is in degrees
+		dshear2 = 2*degrees_to_radians(1.0)*shear1;
+	}
+	double x, y;
+	for (int i=0; i < npts; i++) {
+		x = pts[i][0] - x_center;
+		y = pts[i][1] - y_center;
+		ddef[i][0] = x*dshear1 + y*dshear2;
+		ddef[i][1] = -y*dshear1 + x*dshear2;
+		if (dhess != NULL) {
+			dhess[i][0][0] = dshear1;
+			dhess[i][1][1] = -dshear1;
+			dhess[i][0][1] = dshear2;
+			dhess[i][1][0] = dshear2;
+		}
+	}
+}
+
 double Shear::potential(double x, double y)
 {
 	x -= x_center;
@@ -2442,6 +2513,13 @@ void Multipole::set_model_specific_integration_pointers()
 	if (m==0) kapavgptr_rsq_spherical = static_cast<double (LensProfile::*)(const double)> (&Multipole::deflection_m0_spherical_r);
 }
 
+bool Multipole::param_derivative_scaling(const int paramnum, double& dlogdef_dparam)
+{
+	if ((paramnum != 0) or (A_n==0)) return false;
+	dlogdef_dparam = 1.0/A_n;
+	return true;
+}
+
 double Multipole::kappa(double x, double y)
 {
 	x -= x_center;
@@ -2780,6 +2858,20 @@ void PointMass::set_model_specific_integration_pointers()
 	potptr_rsq_spherical = static_cast<double (LensProfile::*)(const double)> (&PointMass::potential_spherical_rsq);
 }
 
+bool PointMass::param_derivative_scaling(const int paramnum, double& dlogdef_dparam)
+{
+	// the deflection scales as b^2, or equivalently as mtot
+	if (paramnum != 0) return false;
+	if (parameter_mode==1) {
+		if (mtot==0) return false;
+		dlogdef_dparam = 1.0/mtot;
+	} else {
+		if (b==0) return false;
+		dlogdef_dparam = 2.0/b;
+	}
+	return true;
+}
+
 double PointMass::potential(double x, double y)
 {
 	x -= x_center;
@@ -3892,6 +3984,13 @@ void MassSheet::set_model_specific_integration_pointers()
 	potptr_rsq_spherical = static_cast<double (LensProfile::*)(const double)> (&MassSheet::potential_spherical_rsq);
 }
 
+bool MassSheet::param_derivative_scaling(const int paramnum, double& dlogdef_dparam)
+{
+	if ((paramnum != 0) or (kext==0)) return false;
+	dlogdef_dparam = 1.0/kext;
+	return true;
+}
+
 double MassSheet::potential(double x, double y)
 {
 	x -= x_center;
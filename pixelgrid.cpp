@@ -47,6 +47,7 @@ int SourcePixel::nthreads = 0;
 int SourcePixel::max_levels = 2;
 int *SourcePixel::imin, *SourcePixel::imax, *SourcePixel::jmin, *SourcePixel::jmax;
 TriRectangleOverlap *SourcePixel::trirec = NULL;
+vector<SourcePixel*> *SourcePixel::overlap_cells = NULL;
 InterpolationCells *SourcePixel::nearest_interpolation_cells = NULL;
 lensvector **SourcePixel::interpolation_pts[3];
 //int *SourcePixel::n_interpolation_pts = NULL;
@@ -318,6 +319,7 @@ void SourcePixel::allocate_multithreaded_variables(const int& threads, const boo
 	}
 	nthreads = threads;
 	trirec = new TriRectangleOverlap[nthreads];
+	overlap_cells = new vector<SourcePixel*>[nthreads];
 	imin = new int[nthreads];
 	imax = new int[nthreads];
 	jmin = new int[nthreads];
@@ -342,6 +344,7 @@ void SourcePixel::deallocate_multithreaded_variables()
 {
 	if (trirec != NULL) {
 		delete[] trirec;
+		delete[] overlap_cells;
 		delete[] imin;
 		delete[] imax;
 		delete[] jmin;
@@ -362,6 +365,7 @@ void SourcePixel::deallocate_multithreaded_variables()
 		delete[] twist_status_threads;
 
 		trirec = NULL;
+		overlap_cells = NULL;
 		imin = NULL;
 		imax = NULL;
 		jmin = NULL;
@@ -383,6 +387,7 @@ SourcePixelGrid::SourcePixelGrid(QLens* lens_in) : ModelParams()
 	lens = lens_in;
 	cell = NULL;
 	levels = 0;
+	subcell_pools = new SourcePixelPool[(nthreads > 0) ? nthreads : 1];
 
 	/*
 	int threads = 1;
@@ -403,15 +408,8 @@ void SourcePixelGrid::create_pixel_grid(QLens* lens_in, double x_min, double x_m
 	parent_grid = this;
 	lens = lens_in;
 
-	if (cell != NULL) {
-		int i,j;
-		for (i=0; i < u_N; i++) {
-			for (j=0; j < w_N; j++) delete cell[i][j];
-			delete[] cell[i];
-		}
-		delete[] cell;
-		cell = NULL;
-	}
+	delete_firstlevel_cells();
+	reset_subcell_pools();
 
 	npixels_x = usplit0;
 	npixels_y = wsplit0;
@@ -476,15 +474,8 @@ void SourcePixelGrid::create_pixel_grid(QLens* lens_in, string pixel_data_filero
 	parent_grid = this;
 	lens = lens_in;
 
-	if (cell != NULL) {
-		int i,j;
-		for (i=0; i < u_N; i++) {
-			for (j=0; j < w_N; j++) delete cell[i][j];
-			delete[] cell[i];
-		}
-		delete[] cell;
-		cell = NULL;
-	}
+	delete_firstlevel_cells();
+	reset_subcell_pools();
 
 	min_cell_area = minarea_in;
 	string info_filename = pixel_data_fileroot + ".info";
@@ -760,6 +751,12 @@ void SourcePixelGrid::copy_source_pixel_grid(SourcePixelGrid* input_pixel_grid)
 
 SourcePixel::SourcePixel(QLens* lens_in, lensvector** xij, const int& i, const int& j, const int& level_in, SourcePixelGrid* parent_ptr)
 {
+	initialize(lens_in,xij,i,j,level_in,parent_ptr);
+}
+
+void SourcePixel::initialize(QLens* lens_in, lensvector** xij, const int& i, const int& j, const int& level_in, SourcePixelGrid* parent_ptr)
+{
+	// cells taken from a subcell pool may have been used before, so everything is reset here
 	parent_grid = parent_ptr;
 	u_N = 1;
 	w_N = 1;
@@ -771,6 +768,9 @@ SourcePixel::SourcePixel(QLens* lens_in, lensvector** xij, const int& i, const i
 	active_pixel = false;
 	surface_brightness = 0;
 	lens = lens_in;
+	overlaps.clear();
+	weighted_overlaps.clear();
+	overlap_pixel_n.clear();
 
 	corner_pt[0] = xij[i][j];
 	corner_pt[1] = xij[i][j+1];
@@ -1232,12 +1232,17 @@ void SourcePixel::split_cells(const int usplit, const int wsplit, const int& thr
 		}
 	}
 
-	cell = new SourcePixel**[u_N];
+	// the subcells are taken from this thread's pool as one contiguous block (with i as the slower index)
+	SourcePixelPool& pool = parent_grid->subcell_pools[thread];
+	SourcePixel *subcells = pool.cells.allocate(u_N*w_N);
+	SourcePixel **subcell_ptrs = pool.cell_ptrs.allocate(u_N*w_N);
+	cell = pool.cell_rows.allocate(u_N);
 	for (i=0; i < u_N; i++)
 	{
-		cell[i] = new SourcePixel*[w_N];
+		cell[i] = subcell_ptrs + i*w_N;
 		for (j=0; j < w_N; j++) {
-			cell[i][j] = new SourcePixel(lens,xvals_threads[thread],i,j,level+1,parent_grid);
+			cell[i][j] = subcells + i*w_N + j;
+			cell[i][j]->initialize(lens,xvals_threads[thread],i,j,level+1,parent_grid);
 			cell[i][j]->total_magnification = 0;
 			if (lens->n_image_prior) cell[i][j]->n_images = 0;
 		}
@@ -1257,11 +1262,16 @@ void SourcePixel::unsplit()
 		for (j=0; j < w_N; j++) {
 			if (cell[i][j]->cell != NULL) cell[i][j]->unsplit();
 			surface_brightness += cell[i][j]->surface_brightness;
-			delete cell[i][j];
 		}
-		delete[] cell[i];
 	}
-	delete[] cell;
+	// the subcells belong to the grid's subcell pools, so they are handed back for reuse (unsplitting is done serially, so the
+	// first pool is used regardless of which thread split the cell; all the pools are reset together)
+	if (level > 0) {
+		SourcePixelPool& pool = parent_grid->subcell_pools[0];
+		pool.cells.release(cell[0][0],u_N*w_N);
+		pool.cell_ptrs.release(cell[0],u_N*w_N);
+		pool.cell_rows.release(cell,u_N);
+	}
 	parent_grid->number_of_pixels -= (u_N*w_N - 1);
 	cell = NULL;
 	surface_brightness /= (u_N*w_N);
@@ -1305,47 +1315,64 @@ double SourcePixelGrid::find_triangle_weighted_invmag(lensvector& pt1, lensvecto
 	jmin[thread]=0; jmax[thread]=w_N-1;
 	if (bisection_search_overlap(pt1,pt2,pt3,thread)==false) return false; 
 
+	find_overlap_candidate_cells(thread);
+	trirec[thread].add_overlap_areas(pt1,pt2,pt3);
+
 	total_overlap = 0;
 	double total_weighted_invmag = 0;
 	double overlap;
-	int i,j;
-	lensvector *cornerpt;
-	for (j=jmin[thread]; j <= jmax[thread]; j++) {
-		for (i=imin[thread]; i <= imax[thread]; i++) {
-			if (cell[i][j]->cell != NULL) cell[i][j]->find_triangle_weighted_invmag_subcell(pt1,pt2,pt3,total_overlap,total_weighted_invmag,thread); // put in recursion later
-			else {
-				//cout << "before: winvmag=" << total_weighted_invmag << endl;
-				cornerpt = cell[i][j]->corner_pt;
-				overlap = trirec[thread].find_overlap_area(pt1,pt2,pt3,cornerpt[0][0],cornerpt[2][0],cornerpt[0][1],cornerpt[1][1]);
-				if (overlap != 0) {
-					total_overlap += overlap;
-					if (cell[i][j]->total_magnification != 0) total_weighted_invmag += overlap*(1.0/cell[i][j]->total_magnification);
-				}
-				//if (overlap != 0) cout << "overlap=" << overlap << " mag=" << cell[i][j]->total_magnification << " wtf=" << (1.0/cell[i][j]->total_magnification) << " winvmag=" << total_weighted_invmag << endl;
-			}
+	SourcePixel *cellptr;
+	for (int k=0; k < trirec[thread].get_n_rectangles(); k++) {
+		overlap = trirec[thread].get_overlap_area(k);
+		if (overlap != 0) {
+			cellptr = overlap_cells[thread][k];
+			total_overlap += overlap;
+			if (cellptr->total_magnification != 0) total_weighted_invmag += overlap*(1.0/cellptr->total_magnification);
 		}
 	}
 	if (total_weighted_invmag*0.0 != 0.0) die("FUCK");
 	return total_weighted_invmag;
 }
 
-void SourcePixel::find_triangle_weighted_invmag_subcell(lensvector& pt1, lensvector& pt2, lensvector& pt3, double& total_overlap, double& total_weighted_invmag, const int& thread)
+void SourcePixelGrid::find_overlap_candidate_cells(const int& thread)
 {
-	int i,j;
-	double overlap;
-	lensvector *cornerpt;
-	for (j=0; j < w_N; j++) {
-		for (i=0; i < u_N; i++) {
-			if (cell[i][j]->cell != NULL) cell[i][j]->find_triangle_weighted_invmag_subcell(pt1,pt2,pt3,total_overlap,total_weighted_invmag,thread);
-			else {
-				cornerpt = cell[i][j]->corner_pt;
-				overlap = trirec[thread].find_overlap_area(pt1,pt2,pt3,cornerpt[0][0],cornerpt[2][0],cornerpt[0][1],cornerpt[1][1]);
-				if (overlap != 0) {
-					total_overlap += overlap;
-					if (cell[i][j]->total_magnification != 0) total_weighted_invmag += overlap*(1.0/cell[i][j]->total_magnification);
-				}
+	// Stores the unsplit cells within the window found by the bisection search (along with their rectangles, so the overlaps
+	// with the image pixel's triangles can then be found for all of them at once)
+	overlap_cells[thread].clear();
+	trirec[thread].clear_rectangles();
+	for (int j=jmin[thread]; j <= jmax[thread]; j++) {
+		for (int i=imin[thread]; i <= imax[thread]; i++) {
+			cell[i][j]->add_overlap_candidate_cells(thread);
+		}
+	}
+}
+
+void SourcePixel::add_overlap_candidate_cells(const int& thread)
+{
+	if (cell != NULL) {
+		for (int j=0; j < w_N; j++) {
+			for (int i=0; i < u_N; i++) {
+				cell[i][j]->add_overlap_candidate_cells(thread);
 			}
 		}
+	} else {
+		overlap_cells[thread].push_back(this);
+		trirec[thread].add_rectangle(corner_pt[0][0],corner_pt[2][0],corner_pt[0][1],corner_pt[1][1]);
+	}
+}
+
+void SourcePixel::add_image_pixel_overlaps(lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, const int& thread)
+{
+	// adds the overlaps of the image pixel (mapped to the source plane as two triangles) with the stored rectangles
+	if (twist_status==0) {
+		trirec[thread].add_overlap_areas(*input_corner_pts[0],*input_corner_pts[1],*input_corner_pts[2]);
+		trirec[thread].add_overlap_areas(*input_corner_pts[1],*input_corner_pts[3],*input_corner_pts[2]);
+	} else if (twist_status==1) {
+		trirec[thread].add_overlap_areas(*input_corner_pts[0],*input_corner_pts[2],*twist_pt);
+		trirec[thread].add_overlap_areas(*input_corner_pts[1],*input_corner_pts[3],*twist_pt);
+	} else {
+		trirec[thread].add_overlap_areas(*input_corner_pts[0],*input_corner_pts[1],*twist_pt);
+		trirec[thread].add_overlap_areas(*twist_pt,*input_corner_pts[3],*input_corner_pts[2]);
 	}
 }
 
@@ -2229,14 +2256,20 @@ void SourcePixel::subcell_assign_source_mapping_flags_overlap(lensvector **input
 void SourcePixelGrid::calculate_Lmatrix_overlap(const int &img_index, const int image_pixel_i, const int image_pixel_j, int& index, lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, const int& thread)
 {
 	double overlap, total_overlap=0;
-	int i,j,k;
+	int i;
 	int Lmatrix_index_initial = index;
 	SourcePixel *subcell;
+	vector<SourcePixel*>& mapped_cells = image_pixel_grid->mapped_cartesian_srcpixels[image_pixel_i][image_pixel_j];
 
-	for (i=0; i < image_pixel_grid->mapped_cartesian_srcpixels[image_pixel_i][image_pixel_j].size(); i++) {
-		subcell = image_pixel_grid->mapped_cartesian_srcpixels[image_pixel_i][image_pixel_j][i];
-		lens->Lmatrix_index_rows[img_index].push_back(subcell->active_index);
-		overlap = subcell->find_rectangle_overlap(input_corner_pts,twist_pt,twist_status,thread,image_pixel_i,image_pixel_j);
+	trirec[thread].clear_rectangles();
+	for (i=0; i < mapped_cells.size(); i++) {
+		subcell = mapped_cells[i];
+		trirec[thread].add_rectangle(subcell->corner_pt[0][0],subcell->corner_pt[2][0],subcell->corner_pt[0][1],subcell->corner_pt[1][1]);
+	}
+	add_image_pixel_overlaps(input_corner_pts,twist_pt,twist_status,thread);
+	for (i=0; i < mapped_cells.size(); i++) {
+		lens->Lmatrix_index_rows[img_index].push_back(mapped_cells[i]->active_index);
+		overlap = trirec[thread].get_overlap_area(i);
 		lens->Lmatrix_rows[img_index].push_back(overlap);
 		index++;
 		total_overlap += overlap;
@@ -2253,19 +2286,16 @@ double SourcePixelGrid::find_lensed_surface_brightness_overlap(lensvector **inpu
 	jmin[thread]=0; jmax[thread]=w_N-1;
 	if (bisection_search_overlap(input_corner_pts,thread)==false) return false;
 
+	find_overlap_candidate_cells(thread);
+	add_image_pixel_overlaps(input_corner_pts,twist_pt,twist_status,thread);
+
 	double total_overlap = 0;
 	double total_weighted_surface_brightness = 0;
 	double overlap;
-	int i,j;
-	for (j=jmin[thread]; j <= jmax[thread]; j++) {
-		for (i=imin[thread]; i <= imax[thread]; i++) {
-			if (cell[i][j]->cell != NULL) cell[i][j]->find_lensed_surface_brightness_subcell_overlap(input_corner_pts,twist_pt,twist_status,thread,overlap,total_overlap,total_weighted_surface_brightness);
-			else {
-				overlap = cell[i][j]->find_rectangle_overlap(input_corner_pts,twist_pt,twist_status,thread,0,0);
-				total_overlap += overlap;
-				total_weighted_surface_brightness += overlap*cell[i][j]->surface_brightness;
-			}
-		}
+	for (int k=0; k < trirec[thread].get_n_rectangles(); k++) {
+		overlap = trirec[thread].get_overlap_area(k);
+		total_overlap += overlap;
+		total_weighted_surface_brightness += overlap*overlap_cells[thread][k]->surface_brightness;
 	}
 	double lensed_surface_brightness;
 	if (total_overlap==0) lensed_surface_brightness = 0;
@@ -2273,229 +2303,49 @@ double SourcePixelGrid::find_lensed_surface_brightness_overlap(lensvector **inpu
 	return lensed_surface_brightness;
 }
 
-void SourcePixel::find_lensed_surface_brightness_subcell_overlap(lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, const int& thread, double& overlap, double& total_overlap, double& total_weighted_surface_brightness)
-{
-	int i,j;
-	for (j=0; j < w_N; j++) {
-		for (i=0; i < u_N; i++) {
-			if (cell[i][j]->cell != NULL) cell[i][j]->find_lensed_surface_brightness_subcell_overlap(input_corner_pts,twist_pt,twist_status,thread,overlap,total_overlap,total_weighted_surface_brightness);
-			else {
-				overlap = cell[i][j]->find_rectangle_overlap(input_corner_pts,twist_pt,twist_status,thread,0,0);
-				total_overlap += overlap;
-				total_weighted_surface_brightness += overlap*cell[i][j]->surface_brightness;
-			}
-		}
-	}
-}
-
-bool SourcePixelGrid::bisection_search_interpolate(lensvector &input_center_pt, const int& thread)
+SourcePixel* SourcePixelGrid::find_containing_cell(lensvector &input_pt)
 {
-	int i, imid, jmid;
-	bool inside;
-	bool inside_corner[4];
-	int n_inside;
-	double xmin[4], xmax[4], ymin[4], ymax[4];
-
-	for (;;) {
-		n_inside=0;
-		for (i=0; i < 4; i++) inside_corner[i] = false;
-		imid = (imax[thread] + imin[thread])/2;
-		jmid = (jmax[thread] + jmin[thread])/2;
-		xmin[0] = cell[imin[thread]][jmin[thread]]->corner_pt[0][0];
-		ymin[0] = cell[imin[thread]][jmin[thread]]->corner_pt[0][1];
-		xmax[0] = cell[imid][jmid]->corner_pt[3][0];
-		ymax[0] = cell[imid][jmid]->corner_pt[3][1];
-
-		xmin[1] = cell[imin[thread]][jmid+1]->corner_pt[0][0];
-		ymin[1] = cell[imin[thread]][jmid+1]->corner_pt[0][1];
-		xmax[1] = cell[imid][jmax[thread]]->corner_pt[3][0];
-		ymax[1] = cell[imid][jmax[thread]]->corner_pt[3][1];
-
-		xmin[2] = cell[imid+1][jmin[thread]]->corner_pt[0][0];
-		ymin[2] = cell[imid+1][jmin[thread]]->corner_pt[0][1];
-		xmax[2] = cell[imax[thread]][jmid]->corner_pt[3][0];
-		ymax[2] = cell[imax[thread]][jmid]->corner_pt[3][1];
-
-		xmin[3] = cell[imid+1][jmid+1]->corner_pt[0][0];
-		ymin[3] = cell[imid+1][jmid+1]->corner_pt[0][1];
-		xmax[3] = cell[imax[thread]][jmax[thread]]->corner_pt[3][0];
-		ymax[3] = cell[imax[thread]][jmax[thread]]->corner_pt[3][1];
-
-		for (i=0; i < 4; i++) {
-			if ((input_center_pt[0] >= xmin[i]) and (input_center_pt[0] < xmax[i]) and (input_center_pt[1] >= ymin[i]) and (input_center_pt[1] < ymax[i])) {
-				inside_corner[i] = true;
-				n_inside++;
-			}
-		}
-		if (n_inside==0) return false;
-		if (n_inside > 1) die("should not be inside more than one rectangle");
-		else {
-			if (inside_corner[0]) { imax[thread]=imid; jmax[thread]=jmid; }
-			else if (inside_corner[1]) { imax[thread]=imid; jmin[thread]=jmid; }
-			else if (inside_corner[2]) { imin[thread]=imid; jmax[thread]=jmid; }
-			else if (inside_corner[3]) { imin[thread]=imid; jmin[thread]=jmid; }
-		}
-		if ((imax[thread] - imin[thread] <= 1) or (jmax[thread] - jmin[thread] <= 1)) break;
+	// The first-level cells form a uniform grid, so the containing cell is found directly from the coordinates (then checked
+	// against the cell boundaries, which may differ by roundoff); from there we descend through the subcells, so the cost
+	// scales with the number of levels rather than the number of cells. Returns NULL if the point is outside the grid.
+	if ((input_pt[0] < cell[0][0]->corner_pt[0][0]) or (input_pt[0] >= cell[u_N-1][0]->corner_pt[2][0]) or (input_pt[1] < cell[0][0]->corner_pt[0][1]) or (input_pt[1] >= cell[0][w_N-1]->corner_pt[1][1])) return NULL;
+	int i, j;
+	i = (int) (u_N*(input_pt[0]-srcgrid_xmin)/(srcgrid_xmax-srcgrid_xmin));
+	j = (int) (w_N*(input_pt[1]-srcgrid_ymin)/(srcgrid_ymax-srcgrid_ymin));
+	if (i < 0) i = 0;
+	else if (i >= u_N) i = u_N-1;
+	if (j < 0) j = 0;
+	else if (j >= w_N) j = w_N-1;
+	while ((i > 0) and (input_pt[0] < cell[i][j]->corner_pt[0][0])) i--;
+	while ((i < u_N-1) and (input_pt[0] >= cell[i][j]->corner_pt[2][0])) i++;
+	while ((j > 0) and (input_pt[1] < cell[i][j]->corner_pt[0][1])) j--;
+	while ((j < w_N-1) and (input_pt[1] >= cell[i][j]->corner_pt[1][1])) j++;
+
+	SourcePixel *cellptr = cell[i][j];
+	while (cellptr->cell != NULL) {
+		for (i=cellptr->u_N-1; i > 0; i--) if (input_pt[0] >= cellptr->cell[i][0]->corner_pt[0][0]) break;
+		for (j=cellptr->w_N-1; j > 0; j--) if (input_pt[1] >= cellptr->cell[0][j]->corner_pt[0][1]) break;
+		cellptr = cellptr->cell[i][j];
 	}
-	return true;
+	return cellptr;
 }
 
 bool SourcePixelGrid::assign_source_mapping_flags_interpolate(lensvector &input_center_pt, vector<SourcePixel*>& mapped_cartesian_srcpixels, const int& thread, const int& image_pixel_i, const int& image_pixel_j)
 {
-	bool image_pixel_maps_to_source_grid = false;
 	// when splitting image pixels, there could be multiple entries in the Lmatrix array that belong to the same source pixel; you might save computational time if these can be consolidated (by adding them together). Try this out later
-	imin[thread]=0; imax[thread]=u_N-1;
-	jmin[thread]=0; jmax[thread]=w_N-1;
-	if (bisection_search_interpolate(input_center_pt,thread)==true) {
-		int i,j,side;
-		SourcePixel* cellptr;
-		int oldsize = mapped_cartesian_srcpixels.size();
-		for (j=jmin[thread]; j <= jmax[thread]; j++) {
-			for (i=imin[thread]; i <= imax[thread]; i++) {
-				if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
-					if (cell[i][j]->cell != NULL) image_pixel_maps_to_source_grid = cell[i][j]->subcell_assign_source_mapping_flags_interpolate(input_center_pt,mapped_cartesian_srcpixels,thread);
-					else {
-						cell[i][j]->maps_to_image_pixel = true;
-						mapped_cartesian_srcpixels.push_back(cell[i][j]);
-						if (!image_pixel_maps_to_source_grid) image_pixel_maps_to_source_grid = true;
-						if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-							if (cell[i][j]->neighbor[0]->cell != NULL) {
-								side=0;
-								cellptr = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-								cellptr->maps_to_image_pixel = true;
-								mapped_cartesian_srcpixels.push_back(cellptr);
-								//cout << "Adding to maps " << image_pixel_i << " " << image_pixel_j << endl;
-							}
-							else {
-								cell[i][j]->neighbor[0]->maps_to_image_pixel = true;
-								mapped_cartesian_srcpixels.push_back(cell[i][j]->neighbor[0]);
-								//cout << "Adding to maps " << image_pixel_i << " " << image_pixel_j << endl;
-							}
-						} else {
-							if (cell[i][j]->neighbor[1]->cell != NULL) {
-								side=1;
-								cellptr = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-								cellptr->maps_to_image_pixel = true;
-								mapped_cartesian_srcpixels.push_back(cellptr);
-								//cout << "Adding to maps " << image_pixel_i << " " << image_pixel_j << endl;
-							}
-							else {
-								cell[i][j]->neighbor[1]->maps_to_image_pixel = true;
-								mapped_cartesian_srcpixels.push_back(cell[i][j]->neighbor[1]);
-								//cout << "Adding to maps " << image_pixel_i << " " << image_pixel_j << endl;
-							}
-						}
-						if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-							if (cell[i][j]->neighbor[2]->cell != NULL) {
-								side=2;
-								cellptr = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-								cellptr->maps_to_image_pixel = true;
-								mapped_cartesian_srcpixels.push_back(cellptr);
-								//cout << "Adding to maps " << image_pixel_i << " " << image_pixel_j << endl;
-							}
-							else {
-								cell[i][j]->neighbor[2]->maps_to_image_pixel = true;
-								mapped_cartesian_srcpixels.push_back(cell[i][j]->neighbor[2]);
-								//cout << "Adding to maps " << image_pixel_i << " " << image_pixel_j << endl;
-							}
-						} else {
-							if (cell[i][j]->neighbor[3]->cell != NULL) {
-								side=3;
-								cellptr = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-								cellptr->maps_to_image_pixel = true;
-								mapped_cartesian_srcpixels.push_back(cellptr);
-								//cout << "Adding to maps " << image_pixel_i << " " << image_pixel_j << endl;
-							}
-							else {
-								cell[i][j]->neighbor[3]->maps_to_image_pixel = true;
-								mapped_cartesian_srcpixels.push_back(cell[i][j]->neighbor[3]);
-								//cout << "Adding to maps " << image_pixel_i << " " << image_pixel_j << endl;
-							}
-						}
-					}
-					break;
-				}
-			}
-		}
-		if ((mapped_cartesian_srcpixels.size() - oldsize) != 3) die("Did not assign enough interpolation cells!");
-	} else {
+	SourcePixel *cellptr = find_containing_cell(input_center_pt);
+	if (cellptr==NULL) {
 		mapped_cartesian_srcpixels.push_back(NULL);
 		mapped_cartesian_srcpixels.push_back(NULL);
 		mapped_cartesian_srcpixels.push_back(NULL);
+		return false;
 	}
-	//if ((image_pixel_i==34) and (image_pixel_j==1)) {
-		//if (!image_pixel_maps_to_source_grid) cout << "subpixel didn't map!!!" << endl;
-		//cout << "SIZE: " << mapped_cartesian_srcpixels.size() << endl;
-		//for (int i=0; i < mapped_cartesian_srcpixels.size(); i++) cout << "cell " << i << ": " << mapped_cartesian_srcpixels[i]->active_index << endl;
-	//}
-	return image_pixel_maps_to_source_grid;
-}
-
-bool SourcePixel::subcell_assign_source_mapping_flags_interpolate(lensvector &input_center_pt, vector<SourcePixel*>& mapped_cartesian_srcpixels, const int& thread)
-{
-	bool image_pixel_maps_to_source_grid = false;
-	int i,j,side;
-	SourcePixel* cellptr;
-	for (j=0; j < w_N; j++) {
-		for (i=0; i < u_N; i++) {
-			if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
-				if (cell[i][j]->cell != NULL) image_pixel_maps_to_source_grid = cell[i][j]->subcell_assign_source_mapping_flags_interpolate(input_center_pt,mapped_cartesian_srcpixels,thread);
-				else {
-					cell[i][j]->maps_to_image_pixel = true;
-					mapped_cartesian_srcpixels.push_back(cell[i][j]);
-					if (!image_pixel_maps_to_source_grid) image_pixel_maps_to_source_grid = true;
-					if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-						if (cell[i][j]->neighbor[0]->cell != NULL) {
-							side=0;
-							cellptr = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_cartesian_srcpixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[0]->maps_to_image_pixel = true;
-							mapped_cartesian_srcpixels.push_back(cell[i][j]->neighbor[0]);
-						}
-					} else {
-						if (cell[i][j]->neighbor[1]->cell != NULL) {
-							side=1;
-							cellptr = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_cartesian_srcpixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[1]->maps_to_image_pixel = true;
-							mapped_cartesian_srcpixels.push_back(cell[i][j]->neighbor[1]);
-						}
-					}
-					if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-						if (cell[i][j]->neighbor[2]->cell != NULL) {
-							side=2;
-							cellptr = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_cartesian_srcpixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[2]->maps_to_image_pixel = true;
-							mapped_cartesian_srcpixels.push_back(cell[i][j]->neighbor[2]);
-						}
-					} else {
-						if (cell[i][j]->neighbor[3]->cell != NULL) {
-							side=3;
-							cellptr = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-							cellptr->maps_to_image_pixel = true;
-							mapped_cartesian_srcpixels.push_back(cellptr);
-						}
-						else {
-							cell[i][j]->neighbor[3]->maps_to_image_pixel = true;
-							mapped_cartesian_srcpixels.push_back(cell[i][j]->neighbor[3]);
-						}
-					}
-				}
-				break;
-			}
-		}
+	cellptr->find_interpolation_cells(input_center_pt,thread);
+	for (int i=0; i < 3; i++) {
+		nearest_interpolation_cells[thread].pixel[i]->maps_to_image_pixel = true;
+		mapped_cartesian_srcpixels.push_back(nearest_interpolation_cells[thread].pixel[i]);
 	}
-	return image_pixel_maps_to_source_grid;
+	return true;
 }
 
 void SourcePixelGrid::calculate_Lmatrix_interpolate(const int img_index, vector<SourcePixel*>& mapped_cartesian_srcpixels, int& index, lensvector &input_center_pt, const int& ii, const double weight, const int& thread)
@@ -2530,61 +2380,16 @@ double SourcePixelGrid::find_lensed_surface_brightness_interpolate(lensvector &i
 {
 	lensvector *pts[3];
 	double *sb[3];
-	int indx=0;
-	nearest_interpolation_cells[thread].found_containing_cell = false;
-	for (int i=0; i < 3; i++) nearest_interpolation_cells[thread].pixel[i] = NULL;
-
-	imin[thread]=0; imax[thread]=u_N-1;
-	jmin[thread]=0; jmax[thread]=w_N-1;
-	if (bisection_search_interpolate(input_center_pt,thread)==false) return false;
-
-	bool image_pixel_maps_to_source_grid = false;
-	int i,j,side;
-	for (j=jmin[thread]; j <= jmax[thread]; j++) {
-		for (i=imin[thread]; i <= imax[thread]; i++) {
-			if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
-				if (cell[i][j]->cell != NULL) cell[i][j]->find_interpolation_cells(input_center_pt,thread);
-				else {
-					nearest_interpolation_cells[thread].found_containing_cell = true;
-					nearest_interpolation_cells[thread].pixel[0] = cell[i][j];
-					if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-						if (cell[i][j]->neighbor[0]->cell != NULL) {
-							side=0;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0];
-					} else {
-						if (cell[i][j]->neighbor[1]->cell != NULL) {
-							side=1;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1];
-					}
-					if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-						if (cell[i][j]->neighbor[2]->cell != NULL) {
-							side=2;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2];
-					} else {
-						if (cell[i][j]->neighbor[3]->cell != NULL) {
-							side=3;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3];
-					}
-				}
-				break;
-			}
-		}
-	}
+	SourcePixel *cellptr = find_containing_cell(input_center_pt);
+	if (cellptr==NULL) return false;
+	cellptr->find_interpolation_cells(input_center_pt,thread);
+	int i;
 
 	for (i=0; i < 3; i++) {
 		pts[i] = &nearest_interpolation_cells[thread].pixel[i]->center_pt;
 		sb[i] = &nearest_interpolation_cells[thread].pixel[i]->surface_brightness;
 	}
 
-	if (nearest_interpolation_cells[thread].found_containing_cell==false) die("could not find containing cell");
 	double d, total_sb = 0;
 	d = ((*pts[0])[0]-(*pts[1])[0])*((*pts[1])[1]-(*pts[2])[1]) - ((*pts[1])[0]-(*pts[2])[0])*((*pts[0])[1]-(*pts[1])[1]);
 	total_sb += (*sb[0])*(input_center_pt[0]*((*pts[1])[1]-(*pts[2])[1]) + input_center_pt[1]*((*pts[2])[0]-(*pts[1])[0]) + (*pts[1])[0]*(*pts[2])[1] - (*pts[1])[1]*(*pts[2])[0]);
@@ -2596,44 +2401,35 @@ double SourcePixelGrid::find_lensed_surface_brightness_interpolate(lensvector &i
 
 void SourcePixel::find_interpolation_cells(lensvector &input_center_pt, const int& thread)
 {
-	int i,j,side;
-	for (j=0; j < w_N; j++) {
-		for (i=0; i < u_N; i++) {
-			if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
-				if (cell[i][j]->cell != NULL) cell[i][j]->find_interpolation_cells(input_center_pt,thread);
-				else {
-					nearest_interpolation_cells[thread].found_containing_cell = true;
-					nearest_interpolation_cells[thread].pixel[0] = cell[i][j];
-					if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-						if (cell[i][j]->neighbor[0]->cell != NULL) {
-							side=0;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0];
-					} else {
-						if (cell[i][j]->neighbor[1]->cell != NULL) {
-							side=1;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1];
-					}
-					if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-						if (cell[i][j]->neighbor[2]->cell != NULL) {
-							side=2;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2];
-					} else {
-						if (cell[i][j]->neighbor[3]->cell != NULL) {
-							side=3;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3];
-					}
-				}
-				break;
-			}
+	// This is called for the (unsplit) cell containing the point; it finds the neighboring cells that are nearest to the point
+	// along x and along y, which together with this cell are used for interpolation
+	int side;
+	nearest_interpolation_cells[thread].pixel[0] = this;
+	if (((input_center_pt[0] > center_pt[0]) and (neighbor[0] != NULL)) or (neighbor[1] == NULL)) {
+		if (neighbor[0]->cell != NULL) {
+			side=0;
+			nearest_interpolation_cells[thread].pixel[1] = neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
 		}
+		else nearest_interpolation_cells[thread].pixel[1] = neighbor[0];
+	} else {
+		if (neighbor[1]->cell != NULL) {
+			side=1;
+			nearest_interpolation_cells[thread].pixel[1] = neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
+		}
+		else nearest_interpolation_cells[thread].pixel[1] = neighbor[1];
+	}
+	if (((input_center_pt[1] > center_pt[1]) and (neighbor[2] != NULL)) or (neighbor[3] == NULL)) {
+		if (neighbor[2]->cell != NULL) {
+			side=2;
+			nearest_interpolation_cells[thread].pixel[2] = neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
+		}
+		else nearest_interpolation_cells[thread].pixel[2] = neighbor[2];
+	} else {
+		if (neighbor[3]->cell != NULL) {
+			side=3;
+			nearest_interpolation_cells[thread].pixel[2] = neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
+		}
+		else nearest_interpolation_cells[thread].pixel[2] = neighbor[3];
 	}
 }
 
@@ -2761,54 +2557,10 @@ double SourcePixelGrid::find_local_inverse_magnification_interpolate(lensvector
 {
 	lensvector *pts[3];
 	double *mag[3];
-	int indx=0;
-	nearest_interpolation_cells[thread].found_containing_cell = false;
-	for (int i=0; i < 3; i++) nearest_interpolation_cells[thread].pixel[i] = NULL;
-
-	imin[thread]=0; imax[thread]=u_N-1;
-	jmin[thread]=0; jmax[thread]=w_N-1;
-	if (bisection_search_interpolate(input_center_pt,thread)==false) return false;
-
-	bool image_pixel_maps_to_source_grid = false;
-	int i,j,side;
-	for (j=jmin[thread]; j <= jmax[thread]; j++) {
-		for (i=imin[thread]; i <= imax[thread]; i++) {
-			if ((input_center_pt[0] >= cell[i][j]->corner_pt[0][0]) and (input_center_pt[0] < cell[i][j]->corner_pt[2][0]) and (input_center_pt[1] >= cell[i][j]->corner_pt[0][1]) and (input_center_pt[1] < cell[i][j]->corner_pt[3][1])) {
-				if (cell[i][j]->cell != NULL) cell[i][j]->find_interpolation_cells(input_center_pt,thread);
-				else {
-					nearest_interpolation_cells[thread].found_containing_cell = true;
-					nearest_interpolation_cells[thread].pixel[0] = cell[i][j];
-					if (((input_center_pt[0] > cell[i][j]->center_pt[0]) and (cell[i][j]->neighbor[0] != NULL)) or (cell[i][j]->neighbor[1] == NULL)) {
-						if (cell[i][j]->neighbor[0]->cell != NULL) {
-							side=0;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[0];
-					} else {
-						if (cell[i][j]->neighbor[1]->cell != NULL) {
-							side=1;
-							nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[1] = cell[i][j]->neighbor[1];
-					}
-					if (((input_center_pt[1] > cell[i][j]->center_pt[1]) and (cell[i][j]->neighbor[2] != NULL)) or (cell[i][j]->neighbor[3] == NULL)) {
-						if (cell[i][j]->neighbor[2]->cell != NULL) {
-							side=2;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[2];
-					} else {
-						if (cell[i][j]->neighbor[3]->cell != NULL) {
-							side=3;
-							nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3]->find_nearest_neighbor_cell(input_center_pt,side);
-						}
-						else nearest_interpolation_cells[thread].pixel[2] = cell[i][j]->neighbor[3];
-					}
-				}
-				break;
-			}
-		}
-	}
+	SourcePixel *cellptr = find_containing_cell(input_center_pt);
+	if (cellptr==NULL) return false;
+	cellptr->find_interpolation_cells(input_center_pt,thread);
+	int i;
 
 	double total_invmag = 0;
 	//double lev;
@@ -2845,7 +2597,6 @@ double SourcePixelGrid::find_local_inverse_magnification_interpolate(lensvector
 		//cout << "LEVEL for pixel " << i << ": " << lev << endl;
 	}
 
-	if (nearest_interpolation_cells[thread].found_containing_cell==false) die("could not find containing cell");
 	double d;
 	// we interpolate in the inverse magnification since this is less likely to blow up
 	//cout << 1.0/(*mag[0]) << " " << 1.0/(*mag[1]) << " " << 1.0/(*mag[2]) << endl;
@@ -3625,21 +3376,15 @@ void SourcePixel::assign_active_indices(int& source_pixel_i)
 	if (unsplit_cell) unsplit();
 }
 
-SourcePixel::~SourcePixel()
+SourcePixelGrid::~SourcePixelGrid()
 {
-	if (cell != NULL) {
-		int i,j;
-		for (i=0; i < u_N; i++) {
-			for (j=0; j < w_N; j++) delete cell[i][j];
-			delete[] cell[i];
-		}
-		delete[] cell;
-		cell = NULL;
-	}
+	delete_firstlevel_cells();
+	delete[] subcell_pools;
 }
 
-SourcePixelGrid::~SourcePixelGrid()
+void SourcePixelGrid::delete_firstlevel_cells()
 {
+	// only the first-level cells are allocated individually; their subcells live in the subcell pools
 	if (cell != NULL) {
 		int i,j;
 		for (i=0; i < u_N; i++) {
@@ -3651,16 +3396,14 @@ SourcePixelGrid::~SourcePixelGrid()
 	}
 }
 
+void SourcePixelGrid::reset_subcell_pools()
+{
+	for (int i=0; i < ((nthreads > 0) ? nthreads : 1); i++) subcell_pools[i].reset();
+}
+
 void SourcePixel::clear()
 {
 	if (cell == NULL) return;
-
-	int i,j;
-	for (i=0; i < u_N; i++) {
-		for (j=0; j < w_N; j++) delete cell[i][j];
-		delete[] cell[i];
-	}
-	delete[] cell;
 	cell = NULL;
 	u_N=1; w_N=1;
 }
@@ -3669,14 +3412,6 @@ void SourcePixel::clear_subgrids()
 {
 	if (level>0) {
 		if (cell == NULL) return;
-		int i,j;
-		for (i=0; i < u_N; i++) {
-			for (j=0; j < w_N; j++) {
-				delete cell[i][j];
-			}
-			delete[] cell[i];
-		}
-		delete[] cell;
 		cell = NULL;
 		parent_grid->number_of_pixels -= (u_N*w_N - 1);
 		u_N=1; w_N=1;
@@ -3687,6 +3422,8 @@ void SourcePixel::clear_subgrids()
 				if (cell[i][j]->cell != NULL) cell[i][j]->clear_subgrids();
 			}
 		}
+		// none of the subcells are in use anymore, so their storage can be recycled
+		parent_grid->reset_subcell_pools();
 	}
 }
 
@@ -8136,16 +7873,16 @@ bool ImagePixelData::fit_isophote(const double xi0, const double xistep, const i
 
 	int sampling_mode; // Sampling modes: 0 = interpolation; 1 = pixel_integration; 2 = either 0/1 based on how big xi is; 3 = use sbprofile
 	double sampling_noise;
-	int it, jmax;
+	int it, jmax = 0;
 	int npts, npts_sample, next_npts, prev_npts, ngrad;
 	double minchisq;
 	bool already_switched = false;
-	bool failed_isophote_fit;
+	bool failed_isophote_fit = false;
 	bool using_prev_sbgrad;
 	bool do_parameter_search;
 	bool tried_parameter_search;
 	double rms_resid, rms_resid_min;
-	double xc_minres, yc_minres, epsilon_minres, theta_minres, sbgrad_minres, rms_sbgrad_rel_minres, maxamp_minres;
+	double xc_minres = xc_i, yc_minres = yc_i, epsilon_minres = 1-qi, theta_minres = theta_i, sbgrad_minres = 0, rms_sbgrad_rel_minres = 0, maxamp_minres = 0;
 	double maxamp_min;
 	int it_minres;
 	int xi_it, xi_i, xi_i_prev;
@@ -8236,38 +7973,89 @@ bool ImagePixelData::fit_isophote(const double xi0, const double xistep, const i
 				int parameter_search_nn = 100;
 				double epstep = (epmax-epmin)/(parameter_search_nn-1);
 				double thstep = (thmax-thmin)/(parameter_search_nn-1);
-				int ii,jj;
+				int n_search = parameter_search_nn*parameter_search_nn;
+				double *epvals = new double[parameter_search_nn];
+				double *thvals = new double[parameter_search_nn];
+				for (i=0, ep=epmin; i < parameter_search_nn; i++, ep += epstep) epvals[i] = ep;
+				for (i=0, th=thmin; i < parameter_search_nn; i++, th += thstep) thvals[i] = th;
 				double residmin = 1e30;
+				int n_minres = -1, npts_last = 0;
 
-				for (ii=0, ep=epmin; ii < parameter_search_nn; ii++, ep += epstep) {
-					for (jj=0, th=thmin; jj < parameter_search_nn; jj++, th += thstep) {
-						sample_ellipse(false,xi,xistep,ep,th,xc,yc,npts,npts_sample,emode,sampling_mode,mean_pixel_noise,sbvals,NULL,sbprofile,true,sb_residual,sb_weights,smatrix,lowest_harmonic,2+n_harmonics_it,use_polar_higher_harmonics);
+				// The grid points are independent, so they are split among threads, each with its own sampling buffers and matrices.
+				// Ties go to whichever grid point comes first, so the result does not depend on the number of threads.
+				#pragma omp parallel
+				{
+					double *sb_residual_search = new double[npts_max];
+					double *sb_weights_search = new double[npts_max];
+					double *sbvals_search = new double[npts_max];
+					double *Dvec_search = new double[nmax_amp];
+					double *amp_search = new double[nmax_amp];
+					double **smatrix_search = new double*[nmax_amp];
+					double **Smatrix_search = new double*[nmax_amp];
+					for (int l=0; l < nmax_amp; l++) {
+						smatrix_search[l] = new double[npts_max];
+						Smatrix_search[l] = new double[nmax_amp];
+					}
+					int ii, jj, l, m, npts_search, n_minres_thread = -1;
+					int npts_sample_search = npts_sample, sampling_mode_search = sampling_mode;
+					double hterm_search, rms_resid_search, residmin_thread = 1e30;
+
+					#pragma omp for schedule(dynamic)
+					for (int n=0; n < n_search; n++) {
+						ii = n / parameter_search_nn;
+						jj = n % parameter_search_nn;
+						sample_ellipse(false,xi,xistep,epvals[ii],thvals[jj],xc,yc,npts_search,npts_sample_search,emode,sampling_mode_search,mean_pixel_noise,sbvals_search,NULL,sbprofile,true,sb_residual_search,sb_weights_search,smatrix_search,lowest_harmonic,2+n_harmonics_it,use_polar_higher_harmonics);
+						if (n==n_search-1) npts_last = npts_search;
 
 						// now generate Dvec and Smatrix (s_transpose * s), then do inversion to get amplitudes A.
-						fill_matrices(npts,nmax_amp_it,sb_residual,sb_weights,smatrix,Dvec,Smatrix,1.0);
-						bool chol_status;
-						chol_status = Cholesky_dcmp(Smatrix,nmax_amp_it);
-						if (!chol_status) {
+						fill_matrices(npts_search,nmax_amp_it,sb_residual_search,sb_weights_search,smatrix_search,Dvec_search,Smatrix_search,1.0);
+						if (!Cholesky_dcmp(Smatrix_search,nmax_amp_it)) {
 							//warn("amplitude matrix is not positive-definite");
 							continue;
 						}
-						Cholesky_solve(Smatrix,Dvec,amp,nmax_amp_it);
+						Cholesky_solve(Smatrix_search,Dvec_search,amp_search,nmax_amp_it);
 
-						rms_resid = 0;
-						for (i=0; i < npts; i++) {
-							hterm = sb_residual[i];
-							for (j=n_ellipse_amps; j < nmax_amp_it; j++) hterm -= amp[j]*smatrix[j][i];
-							rms_resid += hterm*hterm;
+						rms_resid_search = 0;
+						for (l=0; l < npts_search; l++) {
+							hterm_search = sb_residual_search[l];
+							for (m=n_ellipse_amps; m < nmax_amp_it; m++) hterm_search -= amp_search[m]*smatrix_search[m][l];
+							rms_resid_search += hterm_search*hterm_search;
 						}
-						rms_resid = sqrt(rms_resid/npts);
+						rms_resid_search = sqrt(rms_resid_search/npts_search);
 
-						if (rms_resid < residmin) {
-							epsilon = ep;
-							theta = th;
-							residmin = rms_resid;
+						if (rms_resid_search < residmin_thread) {
+							residmin_thread = rms_resid_search;
+							n_minres_thread = n;
 						}
 					}
+					#pragma omp critical
+					{
+						if ((residmin_thread < residmin) or ((residmin_thread==residmin) and (n_minres_thread >= 0) and (n_minres_thread < n_minres))) {
+							residmin = residmin_thread;
+							n_minres = n_minres_thread;
+						}
+					}
+
+					delete[] sb_residual_search;
+					delete[] sb_weights_search;
+					delete[] sbvals_search;
+					delete[] Dvec_search;
+					delete[] amp_search;
+					for (l=0; l < nmax_amp; l++) {
+						delete[] smatrix_search[l];
+						delete[] Smatrix_search[l];
+					}
+					delete[] smatrix_search;
+					delete[] Smatrix_search;
 				}
+				if (n_minres >= 0) {
+					epsilon = epvals[n_minres / parameter_search_nn];
+					theta = thvals[n_minres % parameter_search_nn];
+				}
+				npts = npts_last; // as if the grid points had been sampled one after the other
+				delete[] epvals;
+				delete[] thvals;
+
 				if (residmin==1e30) {
 					warn("Cholesky decomposition failed during parameter search; repeating previous isophote parameters");
 					failed_isophote_fit = true;
@@ -8673,7 +8461,8 @@ bool ImagePixelData::fit_isophote(const double xi0, const double xistep, const i
 			fill_matrices(npts,nmax_amp_it,NULL,sb_weights,smatrix,NULL,Smatrix,sampling_noise);
 			if (!Cholesky_dcmp(Smatrix,nmax_amp_it)) {
 				warn("unexpected failure of Cholesky decomposition; isofit failed");
-				return false;
+				abort_isofit = true;
+				break;
 			} else {
 				Cholesky_fac_inverse(Smatrix,nmax_amp_it); // Now the lower triangle of Smatrix gives L_inv
 
@@ -8913,6 +8702,7 @@ bool ImagePixelData::fit_isophote(const double xi0, const double xistep, const i
 	delete[] sbgrad_weights_prev;
 	delete[] Dvec;
 	delete[] amp;
+	delete[] amp_minres;
 	delete[] amperrs;
 	for (i=0; i < nmax_amp; i++) {
 		delete[] smatrix[i];
@@ -9076,15 +8866,27 @@ double ImagePixelData::sample_ellipse(const bool show_warnings, const double xi,
 	npts = 0;
 	bool out_of_bounds = false;
 	int wtf=0;
-	for (i=0, eta=0; i < npts_sample; i++, eta += eta_step) {
+	// The sampling points are independent, so their positions and surface brightness (and harmonic terms below) are found in parallel.
+	// The accepted points are then numbered in order, so the results do not depend on the number of threads.
+	double *etavals = new double[npts_sample];
+	double *xpvals = new double[npts_sample];
+	double *ypvals = new double[npts_sample];
+	double *sample_sb = new double[npts_sample];
+	int *sample_index = new int[npts_sample]; // position in the list of accepted points; -1 if out of bounds, -2 if masked
+	for (i=0, eta=0; i < npts_sample; i++, eta += eta_step) etavals[i] = eta;
+
+	#pragma omp parallel for private(i,ii,jj,x,y,xp,yp,idoub,jdoub,tt,uu,sb) schedule(static) if (!plot_ellipse)
+	for (i=0; i < npts_sample; i++) {
 		if (sbvals != NULL) sbvals[i] = NAN; // if it doesn't get changed, then we know that point wasn't assign an SB
 		if (emode==0) {
-			xp = xi*cos(eta);
-			yp = xi*q*sin(eta);
+			xp = xi*cos(etavals[i]);
+			yp = xi*q*sin(etavals[i]);
 		} else {
-			xp = xi*cos(eta)/sqrtq;
-			yp = xi*sin(eta)*sqrtq;
+			xp = xi*cos(etavals[i])/sqrtq;
+			yp = xi*sin(etavals[i])*sqrtq;
 		}
+		xpvals[i] = xp;
+		ypvals[i] = yp;
 
 		x = xc + xp*costh - yp*sinth;
 		y = yc + xp*sinth + yp*costh;
@@ -9093,21 +8895,20 @@ double ImagePixelData::sample_ellipse(const bool show_warnings, const double xi,
 		idoub = ((x - pixel_xcvals[0]) / xstep);
 		jdoub = ((y - pixel_ycvals[0]) / ystep);
 		if ((idoub < 0) or (idoub > (npixels_x-1))) {
-			out_of_bounds = true;
-			if (sector_integration) sector_in_bounds[i] = false;
+			sample_index[i] = -1;
 			continue;
 		}
 		if ((jdoub < 0) or (jdoub > (npixels_y-1))) {
-			out_of_bounds = true;
-			if (sector_integration) sector_in_bounds[i] = false;
+			sample_index[i] = -1;
 			continue;
 		}
 		ii = (int) idoub;
 		jj = (int) jdoub;
 		if ((!in_mask[0][ii][jj]) or (!in_mask[0][ii+1][jj]) or (!in_mask[0][ii][jj+1]) or (!in_mask[0][ii+1][jj+1])) {
-			if (sector_integration) sector_in_bounds[i] = false;
+			sample_index[i] = -2;
 			continue;
 		}
+		sample_index[i] = 0;
 
 		if (!sector_integration) {
 			tt = (x - pixel_xcvals[ii]) / xstep;
@@ -9120,44 +8921,64 @@ double ImagePixelData::sample_ellipse(const bool show_warnings, const double xi,
 			else sb = (1-tt)*(1-uu)*surface_brightness[ii][jj] + tt*(1-uu)*surface_brightness[ii+1][jj] + (1-tt)*uu*surface_brightness[ii][jj+1] + tt*uu*surface_brightness[ii+1][jj+1];
 			//if (plot_ellipse) secout << x << " " << y << endl;
 			if ((show_warnings) and (sb*0.0 != 0.0)) {
-				cout << "ii=" << ii << " jj=" << jj << endl;
-				cout << "SB[ii][jj]=" << surface_brightness[ii][jj] << endl;
-				cout << "SB[ii+1][jj]=" << surface_brightness[ii+1][jj] << endl;
-				cout << "SB[ii][jj+1]=" << surface_brightness[ii][jj+1] << endl;
-				cout << "SB[ii+1][jj+1]=" << surface_brightness[ii+1][jj+1] << endl;
-				die("got surface brightness = NAN in data image");
+				#pragma omp critical
+				{
+					cout << "ii=" << ii << " jj=" << jj << endl;
+					cout << "SB[ii][jj]=" << surface_brightness[ii][jj] << endl;
+					cout << "SB[ii+1][jj]=" << surface_brightness[ii+1][jj] << endl;
+					cout << "SB[ii][jj+1]=" << surface_brightness[ii][jj+1] << endl;
+					cout << "SB[ii+1][jj+1]=" << surface_brightness[ii+1][jj+1] << endl;
+					die("got surface brightness = NAN in data image");
+				}
 			}
-
-			sb_avg += sb;
+			sample_sb[i] = sb;
 			if (sbvals != NULL) sbvals[i] = sb;
 			if (sbgrad_wgts != NULL) sbgrad_wgts[i] = SQR(mean_pixel_noise)/4.0; // the same number of pixels is always used in interpolation mode, so weights should all be same
 		}
-		if (fill_matrices) {
-			if (!sector_integration) {
-				sb_residual[npts] = sb;
+	}
+
+	for (i=0; i < npts_sample; i++) {
+		if (sample_index[i] < 0) {
+			if (sample_index[i]==-1) out_of_bounds = true;
+			if (sector_integration) sector_in_bounds[i] = false;
+			continue;
+		}
+		if (!sector_integration) {
+			sb_avg += sample_sb[i];
+			if (fill_matrices) {
+				sb_residual[npts] = sample_sb[i];
 				sb_weights[npts] = 4.0/SQR(mean_pixel_noise); // the same number of pixels is always used in interpolation mode, so weights should all be same
 			}
+		}
+		sample_index[i] = npts++;
+	}
+
+	if (fill_matrices) {
+		#pragma omp parallel for private(i,j,k,xp,yp,phi) schedule(static)
+		for (i=0; i < npts_sample; i++) {
+			if (sample_index[i] < 0) continue;
+			xp = xpvals[i];
+			yp = ypvals[i];
 			for (j=0, k=ni; j < n_amps; j += 2, k++) {
 				if ((use_polar_higher_harmonics) and (k > 2)) {
 					phi = atan(yp/xp);
 					if (xp < 0) phi += M_PI;
 					else if (yp < 0) phi += M_2PI;
 
-					smatrix[j][npts] = cos(k*phi);
-					//if (k==4) {
-						//cout << (cos(k*phi)) << " " << amp << endl;
-					//}
-					smatrix[j+1][npts] = sin(k*phi);
+					smatrix[j][sample_index[i]] = cos(k*phi);
+					smatrix[j+1][sample_index[i]] = sin(k*phi);
 				} else {
-					smatrix[j][npts] = cos(k*eta);
-					smatrix[j+1][npts] = sin(k*eta);
+					smatrix[j][sample_index[i]] = cos(k*etavals[i]);
+					smatrix[j+1][sample_index[i]] = sin(k*etavals[i]);
 				}
 			}
-			if (k != nf+1) die("RUHROH");
-		
 		}
-		npts++;
 	}
+	delete[] etavals;
+	delete[] xpvals;
+	delete[] ypvals;
+	delete[] sample_sb;
+	delete[] sample_index;
 	if (plot_ellipse) {
 		// print initial point again just to close the curve
 		if (emode==0) xp = xi;
@@ -9197,8 +9018,15 @@ double ImagePixelData::sample_ellipse(const bool show_warnings, const double xi,
 		double eta_i, eta_f, eta_width;
 		eta_i = -eta_step/2; // since first sampling point is at y=0, the sector begins at negative eta
 		eta_f = M_2PI-eta_step/2; // since first sampling point is at y=0, the sector begins at negative eta
-		for (ii=imin; ii < imax; ii++) {
-			for (jj=jmin; jj < jmax; jj++) {
+		// Finding the sector of each pixel in the bounding box is the expensive part, so it is done in parallel; the pixels are then
+		// added to their sectors in the same order as before, so the sector sums do not depend on the number of threads
+		int nii = imax-imin, njj = jmax-jmin;
+		if ((nii <= 0) or (njj <= 0)) nii = njj = 0;
+		int *pixel_sector = new int[nii*njj];
+		#pragma omp parallel for private(ii,jj,x,y,xp,yp,xisqval,eta) schedule(static)
+		for (ii=imin; ii < imin+nii; ii++) {
+			for (jj=jmin; jj < jmin+njj; jj++) {
+				pixel_sector[(ii-imin)*njj+(jj-jmin)] = -1;
 				if (!in_mask[0][ii][jj]) continue;
 				x = pixel_xcvals[ii] - xc;
 				y = pixel_ycvals[jj] - yc;
@@ -9211,8 +9039,13 @@ double ImagePixelData::sample_ellipse(const bool show_warnings, const double xi,
 				if (xp < 0) eta += M_PI;
 				else if (yp < 0) eta += M_2PI;
 				if (eta > eta_f) eta -= M_2PI;
-				i = (int) ((eta - eta_i) / eta_step);
-				if (sector_in_bounds[i]) {
+				pixel_sector[(ii-imin)*njj+(jj-jmin)] = (int) ((eta - eta_i) / eta_step);
+			}
+		}
+		for (ii=imin; ii < imin+nii; ii++) {
+			for (jj=jmin; jj < jmin+njj; jj++) {
+				i = pixel_sector[(ii-imin)*njj+(jj-jmin)];
+				if ((i >= 0) and (sector_in_bounds[i])) {
 					//cout << "In sector " << i << ": sb=" << surface_brightness[ii][jj] << " ij: " << ii << " " << jj << " comp to " << iivals[i] << " " << jjvals[i] << endl;
 					if (use_biweight_avg) sector_sbvals[i][npixels_in_sector[i]] = surface_brightness[ii][jj];
 					else sb_sector[i] += surface_brightness[ii][jj];
@@ -9223,6 +9056,7 @@ double ImagePixelData::sample_ellipse(const bool show_warnings, const double xi,
 				}
 			}
 		}
+		delete[] pixel_sector;
 
 		int j;
 		for (i=0, j=0; i < npts_sample; i++) {
@@ -9833,6 +9667,13 @@ void ImagePixelGrid::setup_pixel_arrays()
 	twist_status = new int*[x_N];
 
 	int i,j,k;
+	// surface brightness arrays are stored contiguously (row i starts at [0]+i*y_N) so they can be handed out as flat buffers
+	surface_brightness[0] = new double[xy_N];
+	foreground_surface_brightness[0] = new double[xy_N];
+	for (i=1; i < x_N; i++) {
+		surface_brightness[i] = surface_brightness[0] + i*y_N;
+		foreground_surface_brightness[i] = foreground_surface_brightness[0] + i*y_N;
+	}
 	for (i=0; i <= x_N; i++) {
 		corner_pts[i] = new lensvector[y_N+1];
 		corner_sourcepts[i] = new lensvector[y_N+1];
@@ -9844,8 +9685,6 @@ void ImagePixelGrid::setup_pixel_arrays()
 		pixel_in_mask[i] = new bool[y_N];
 		pixel_index[i] = new int[y_N];
 		pixel_index_fgmask[i] = new int[y_N];
-		surface_brightness[i] = new double[y_N];
-		foreground_surface_brightness[i] = new double[y_N];
 		noise_map[i] = new double[y_N];
 		source_plane_triangle1_area[i] = new double[y_N];
 		source_plane_triangle2_area[i] = new double[y_N];
@@ -10078,7 +9917,7 @@ void ImagePixelGrid::setup_ray_tracing_arrays(const bool verbal)
 			}
 		}
 	}
-	int nsplit = (lens->split_high_mag_imgpixels) ? 1 : lens->default_imgpixel_nsplit;
+	int nsplit = ((lens->split_high_mag_imgpixels) or (lens->adaptive_imgpixel_split)) ? 1 : lens->default_imgpixel_nsplit;
 	int emask_nsplit = (lens->split_high_mag_imgpixels) ? 1 : lens->emask_imgpixel_nsplit;
 	set_nsplits(nsplit,emask_nsplit,lens->split_imgpixels);
 
@@ -10092,8 +9931,8 @@ void ImagePixelGrid::setup_ray_tracing_arrays(const bool verbal)
 
 	//if ((lens->split_imgpixels) and (!lens->split_high_mag_imgpixels)) { 
 	if (lens->split_imgpixels) { 
-		// if split_high_mag_imgpixels is on, this part will be deferred until after the ray-traced pixel areas have been
-		// calculated (to get magnifications to use as criterion on whether to split or nit)
+		// if split_high_mag_imgpixels or adaptive_imgpixel_split is on, this part is redone after the ray-traced pixel areas
+		// have been calculated (to get magnifications or error estimates to use as criterion on whether to split or not)
 		setup_subpixel_ray_tracing_arrays(verbal);
 	}
 }
@@ -10189,45 +10028,52 @@ inline bool ImagePixelGrid::test_if_between(const double& p, const double& a, co
 
 void ImagePixelGrid::calculate_sourcepts_and_areas(const bool raytrace_pixel_centers, const bool verbal)
 {
+	ImagePixelGrid *grid = this;
+	calculate_sourcepts_and_areas(&grid,1,raytrace_pixel_centers,verbal);
+}
+
+inline void find_mpi_range(const long int ntot, const int group_id, const int group_np, int& start, int& end)
+{
+	int chunk = ntot / group_np;
+	start = group_id*chunk;
+	if (group_id == group_np-1) chunk += (ntot % group_np); // assign the remainder elements to the last mpi process
+	end = start + chunk;
+}
+
+// Ray-traces one or more image pixel grids (e.g. one for each source plane). Since the planes do not depend on each other, the
+// rays for all the grids are laid end to end and handed out in the same parallel loop, so the threads stay busy across planes
+// instead of waiting for each grid in turn.
+void ImagePixelGrid::calculate_sourcepts_and_areas(ImagePixelGrid **grids, const int n_grids, const bool raytrace_pixel_centers, const bool verbal)
+{
+	QLens *lens = grids[0]->lens;
 #ifdef USE_MPI
 	MPI_Comm sub_comm;
 	MPI_Comm_create(*(lens->group_comm), *(lens->mpi_group), &sub_comm);
 #endif
 
-	//long int ntot_cells_check = 0;
-	//long int ntot_corners_check = 0;
-	//for (i=0; i < x_N+1; i++) {
-		//for (j=0; j < y_N+1; j++) {
-			//if ((i < x_N) and (j < y_N) and (lens->image_pixel_data->in_mask[i][j])) ntot_cells_check++;
-			//if (((i < x_N) and (j < y_N) and (lens->image_pixel_data->in_mask[i][j])) or ((j < y_N) and (i > 0) and (lens->image_pixel_data->in_mask[i-1][j])) or ((i < x_N) and (j > 0) and (lens->image_pixel_data->in_mask[i][j-1])) or ((i > 0) and (j > 0) and (lens->image_pixel_data->in_mask[i-1][j-1]))) {
-			////if ((i < x_N) and (j < y_N) and (lens->image_pixel_data->extended_mask[i][j])) ntot_cells_check++;
-			////if (((i < x_N) and (j < y_N) and (lens->image_pixel_data->extended_mask[i][j])) or ((j < y_N) and (i > 0) and (lens->image_pixel_data->extended_mask[i-1][j])) or ((i < x_N) and (j > 0) and (lens->image_pixel_data->extended_mask[i][j-1])) or ((i > 0) and (j > 0) and (lens->image_pixel_data->extended_mask[i-1][j-1]))) {
-				//ntot_corners_check++;
-			//}
-		//}
-	//}
-	//if (ntot_cells_check != ntot_cells) die("ntot_cells does not equal the value assigned when image grid created");
-	//if (ntot_corners_check != ntot_corners) die("ntot_corners does not equal the value assigned when image grid created");
-
-	int i,j,k,n,n_cell,n_corner,n_yp;
-
-	int mpi_chunk, mpi_start, mpi_end;
-	mpi_chunk = ntot_corners / lens->group_np;
-	mpi_start = lens->group_id*mpi_chunk;
-	if (lens->group_id == lens->group_np-1) mpi_chunk += (ntot_corners % lens->group_np); // assign the remainder elements to the last mpi process
-	mpi_end = mpi_start + mpi_chunk;
-
-	int mpi_chunk2, mpi_start2, mpi_end2;
-	mpi_chunk2 = ntot_cells / lens->group_np;
-	mpi_start2 = lens->group_id*mpi_chunk2;
-	if (lens->group_id == lens->group_np-1) mpi_chunk2 += (ntot_cells % lens->group_np); // assign the remainder elements to the last mpi process
-	mpi_end2 = mpi_start2 + mpi_chunk2;
-
-	int mpi_chunk4, mpi_start4, mpi_end4;
-	mpi_chunk4 = ntot_cells_emask / lens->group_np;
-	mpi_start4 = lens->group_id*mpi_chunk4;
-	if (lens->group_id == lens->group_np-1) mpi_chunk4 += (ntot_cells_emask % lens->group_np); // assign the remainder elements to the last mpi process
-	mpi_end4 = mpi_start4 + mpi_chunk4;
+	int g,i,j,k,n,m,n_cell,n_subcell;
+	bool trace_centers = ((!lens->split_imgpixels) or (raytrace_pixel_centers) or (lens->adaptive_imgpixel_split)); // adaptive splitting needs the center rays for its error estimates
+
+	int *corner_start = new int[n_grids];
+	int *cell_start = new int[n_grids];
+	int *center_start = new int[n_grids];
+	int *subcell_start = new int[n_grids];
+	int *corner_offset = new int[n_grids+1]; // ray index at which each grid's corners begin
+	int *cell_offset = new int[n_grids+1];
+	int *center_offset = new int[n_grids+1];
+	int *subcell_offset = new int[n_grids+1];
+	int end;
+	corner_offset[0] = cell_offset[0] = center_offset[0] = 0;
+	for (g=0; g < n_grids; g++) {
+		find_mpi_range(grids[g]->ntot_corners,lens->group_id,lens->group_np,corner_start[g],end);
+		corner_offset[g+1] = corner_offset[g] + end - corner_start[g];
+		find_mpi_range(grids[g]->ntot_cells,lens->group_id,lens->group_np,cell_start[g],end);
+		cell_offset[g+1] = cell_offset[g] + end - cell_start[g];
+		find_mpi_range(grids[g]->ntot_cells_emask,lens->group_id,lens->group_np,center_start[g],end);
+		center_offset[g+1] = center_offset[g] + ((trace_centers) ? end - center_start[g] : 0);
+	}
+	int n_corner_rays = corner_offset[n_grids];
+	int n_rays = n_corner_rays + center_offset[n_grids];
 
 	#pragma omp parallel
 	{
@@ -10237,121 +10083,199 @@ void ImagePixelGrid::calculate_sourcepts_and_areas(const bool raytrace_pixel_cen
 #else
 		thread = 0;
 #endif
-		lensvector d1,d2,d3,d4;
-		//int ii,jj;
-		#pragma omp for private(n,i,j) schedule(dynamic)
-		for (n=mpi_start; n < mpi_end; n++) {
-			//j = n / (x_N+1);
-			//i = n % (x_N+1);
-			j = masked_pixel_corner_j[n];
-			i = masked_pixel_corner_i[n];
-			//cout << i << " " << j << " " << n << " " << ntot_corners << " " << mpi_end << endl;
-			lens->find_sourcept(corner_pts[i][j],defx_corners[n],defy_corners[n],thread,imggrid_zfactors,imggrid_betafactors);
+		ImagePixelGrid *grid;
+		#pragma omp for private(m,g,n,i,j,grid) schedule(dynamic)
+		for (m=0; m < n_rays; m++) {
+			if (m < n_corner_rays) {
+				for (g=0; m >= corner_offset[g+1]; g++) ;
+				grid = grids[g];
+				n = corner_start[g] + m - corner_offset[g];
+				j = grid->masked_pixel_corner_j[n];
+				i = grid->masked_pixel_corner_i[n];
+				lens->find_sourcept(grid->corner_pts[i][j],grid->defx_corners[n],grid->defy_corners[n],thread,grid->imggrid_zfactors,grid->imggrid_betafactors);
+			} else {
+				for (g=0; m-n_corner_rays >= center_offset[g+1]; g++) ;
+				grid = grids[g];
+				n = center_start[g] + m - n_corner_rays - center_offset[g];
+				j = grid->emask_pixels_j[n];
+				i = grid->emask_pixels_i[n];
+				lens->find_sourcept(grid->center_pts[i][j],grid->defx_centers[n],grid->defy_centers[n],thread,grid->imggrid_zfactors,grid->imggrid_betafactors);
+			}
 		}
 #ifdef USE_MPI
 		#pragma omp master
 		{
 			if (lens->group_np > 1) {
-				int id, chunk, start;
-				for (id=0; id < lens->group_np; id++) {
-					chunk = ntot_corners / lens->group_np;
-					start = id*chunk;
-					if (id == lens->group_np-1) chunk += (ntot_corners % lens->group_np); // assign the remainder elements to the last mpi process
-					MPI_Bcast(defx_corners+start,chunk,MPI_DOUBLE,id,sub_comm);
-					MPI_Bcast(defy_corners+start,chunk,MPI_DOUBLE,id,sub_comm);
+				int id, start, id_end;
+				for (g=0; g < n_grids; g++) {
+					for (id=0; id < lens->group_np; id++) {
+						find_mpi_range(grids[g]->ntot_corners,id,lens->group_np,start,id_end);
+						MPI_Bcast(grids[g]->defx_corners+start,id_end-start,MPI_DOUBLE,id,sub_comm);
+						MPI_Bcast(grids[g]->defy_corners+start,id_end-start,MPI_DOUBLE,id,sub_comm);
+					}
 				}
 			}
 		}
 		#pragma omp barrier
 #endif
-		#pragma omp for private(n_cell,i,j,n,n_yp) schedule(dynamic)
-		for (n_cell=mpi_start2; n_cell < mpi_end2; n_cell++) {
-			j = masked_pixels_j[n_cell];
-			i = masked_pixels_i[n_cell];
-
-			//n = j*(x_N+1)+i;
-			//n_yp = (j+1)*(x_N+1)+i;
-			n = masked_pixel_corner[n_cell];
-			n_yp = masked_pixel_corner_up[n_cell];
-			d1[0] = defx_corners[n] - defx_corners[n+1];
-			d1[1] = defy_corners[n] - defy_corners[n+1];
-			d2[0] = defx_corners[n_yp] - defx_corners[n];
-			d2[1] = defy_corners[n_yp] - defy_corners[n];
-			d3[0] = defx_corners[n_yp+1] - defx_corners[n_yp];
-			d3[1] = defy_corners[n_yp+1] - defy_corners[n_yp];
-			d4[0] = defx_corners[n+1] - defx_corners[n_yp+1];
-			d4[1] = defy_corners[n+1] - defy_corners[n_yp+1];
-
-			twiststat[n_cell] = 0;
-			double xa,ya,xb,yb,xc,yc,xd,yd,slope1,slope2;
-			xa=defx_corners[n];
-			ya=defy_corners[n];
-			xb=defx_corners[n_yp];
-			yb=defy_corners[n_yp];
-			xc=defx_corners[n_yp+1];
-			yc=defy_corners[n_yp+1];
-			xd=defx_corners[n+1];
-			yd=defy_corners[n+1];
-			slope1 = (yb-ya)/(xb-xa);
-			slope2 = (yc-yd)/(xc-xd);
-			twistx[n_cell] = (yd-ya+xa*slope1-xd*slope2)/(slope1-slope2);
-			twisty[n_cell] = (twistx[n_cell]-xa)*slope1+ya;
-			if ((test_if_between(twistx[n_cell],xa,xb)) and (test_if_between(twisty[n_cell],ya,yb)) and (test_if_between(twistx[n_cell],xc,xd)) and (test_if_between(twisty[n_cell],yc,yd))) {
-				twiststat[n_cell] = 1;
-				d2[0] = twistx[n_cell] - defx_corners[n];
-				d2[1] = twisty[n_cell] - defy_corners[n];
-				d4[0] = twistx[n_cell] - defx_corners[n_yp+1];
-				d4[1] = twisty[n_cell] - defy_corners[n_yp+1];
-			} else {
-				slope1 = (yd-ya)/(xd-xa);
-				slope2 = (yc-yb)/(xc-xb);
-				twistx[n_cell] = (yb-ya+xa*slope1-xb*slope2)/(slope1-slope2);
-				twisty[n_cell] = (twistx[n_cell]-xa)*slope1+ya;
-				if ((test_if_between(twistx[n_cell],xa,xd)) and (test_if_between(twisty[n_cell],ya,yd)) and (test_if_between(twistx[n_cell],xb,xc)) and (test_if_between(twisty[n_cell],yb,yc))) {
-					twiststat[n_cell] = 2;
-					d1[0] = defx_corners[n] - twistx[n_cell];
-					d1[1] = defy_corners[n] - twisty[n_cell];
-					d3[0] = defx_corners[n_yp+1] - twistx[n_cell];
-					d3[1] = defy_corners[n_yp+1] - twisty[n_cell];
+		#pragma omp for private(m,g,n_cell) schedule(dynamic)
+		for (m=0; m < cell_offset[n_grids]; m++) {
+			for (g=0; m >= cell_offset[g+1]; g++) ;
+			n_cell = cell_start[g] + m - cell_offset[g];
+			grids[g]->find_srcplane_twist_and_area(n_cell);
+		}
+	}
+
+#ifdef USE_MPI
+	if (lens->group_np > 1) {
+		int id, start, id_end, start2, id_end2;
+		for (g=0; g < n_grids; g++) {
+			ImagePixelGrid *grid = grids[g];
+			for (id=0; id < lens->group_np; id++) {
+				find_mpi_range(grid->ntot_cells,id,lens->group_np,start,id_end);
+				if (trace_centers) {
+					find_mpi_range(grid->ntot_cells_emask,id,lens->group_np,start2,id_end2);
+					MPI_Bcast(grid->defx_centers+start2,id_end2-start2,MPI_DOUBLE,id,sub_comm);
+					MPI_Bcast(grid->defy_centers+start2,id_end2-start2,MPI_DOUBLE,id,sub_comm);
 				}
+				MPI_Bcast(grid->area_tri1+start,id_end-start,MPI_DOUBLE,id,sub_comm);
+				MPI_Bcast(grid->area_tri2+start,id_end-start,MPI_DOUBLE,id,sub_comm);
+				MPI_Bcast(grid->twistx+start,id_end-start,MPI_DOUBLE,id,sub_comm);
+				MPI_Bcast(grid->twisty+start,id_end-start,MPI_DOUBLE,id,sub_comm);
+				MPI_Bcast(grid->twiststat+start,id_end-start,MPI_INT,id,sub_comm);
 			}
-
-			area_tri1[n_cell] = 0.5*abs(d1 ^ d2);
-			area_tri2[n_cell] = 0.5*abs(d3 ^ d4);
 		}
+	}
+#endif
+	subcell_offset[0] = 0;
+	for (g=0; g < n_grids; g++) {
+		grids[g]->store_sourcepts_and_areas(trace_centers,verbal);
+		find_mpi_range(grids[g]->ntot_subpixels,lens->group_id,lens->group_np,subcell_start[g],end);
+		subcell_offset[g+1] = subcell_offset[g] + end - subcell_start[g];
+	}
 
-		if ((!lens->split_imgpixels) or (raytrace_pixel_centers)) {
-			#pragma omp for private(n_cell,i,j,n,n_yp) schedule(dynamic)
-			for (n_cell=mpi_start4; n_cell < mpi_end4; n_cell++) {
-				j = emask_pixels_j[n_cell];
-				i = emask_pixels_i[n_cell];
-				lens->find_sourcept(center_pts[i][j],defx_centers[n_cell],defy_centers[n_cell],thread,imggrid_zfactors,imggrid_betafactors);
+	if (lens->split_imgpixels) {
+		#pragma omp parallel
+		{
+			int thread;
+#ifdef USE_OPENMP
+			thread = omp_get_thread_num();
+#else
+			thread = 0;
+#endif
+			ImagePixelGrid *grid;
+			#pragma omp for private(m,g,i,j,k,n_subcell,grid) schedule(dynamic)
+			for (m=0; m < subcell_offset[n_grids]; m++) {
+				for (g=0; m >= subcell_offset[g+1]; g++) ;
+				grid = grids[g];
+				n_subcell = subcell_start[g] + m - subcell_offset[g];
+				j = grid->extended_mask_subcell_j[n_subcell];
+				i = grid->extended_mask_subcell_i[n_subcell];
+				k = grid->extended_mask_subcell_index[n_subcell];
+				lens->find_sourcept(grid->subpixel_center_pts[i][j][k],grid->defx_subpixel_centers[n_subcell],grid->defy_subpixel_centers[n_subcell],thread,grid->imggrid_zfactors,grid->imggrid_betafactors);
 			}
 		}
 	}
-
 #ifdef USE_MPI
-	if (lens->group_np > 1) {
-		int id, chunk, start;
-		int id2, chunk2, start2;
-		for (id=0; id < lens->group_np; id++) {
-			chunk = ntot_cells / lens->group_np;
-			start = id*chunk;
-			if (id == lens->group_np-1) chunk += (ntot_cells % lens->group_np); // assign the remainder elements to the last mpi process
-			if ((!lens->split_imgpixels) or (raytrace_pixel_centers)) {
-				chunk2 = ntot_cells_emask / lens->group_np;
-				start2 = id*chunk2;
-				MPI_Bcast(defx_centers+start2,chunk2,MPI_DOUBLE,id,sub_comm);
-				MPI_Bcast(defy_centers+start2,chunk2,MPI_DOUBLE,id,sub_comm);
+	if ((lens->group_np > 1) and (lens->split_imgpixels)) {
+		int id, start, id_end;
+		for (g=0; g < n_grids; g++) {
+			for (id=0; id < lens->group_np; id++) {
+				find_mpi_range(grids[g]->ntot_subpixels,id,lens->group_np,start,id_end);
+				MPI_Bcast(grids[g]->defx_subpixel_centers+start,id_end-start,MPI_DOUBLE,id,sub_comm);
+				MPI_Bcast(grids[g]->defy_subpixel_centers+start,id_end-start,MPI_DOUBLE,id,sub_comm);
 			}
-			MPI_Bcast(area_tri1+start,chunk,MPI_DOUBLE,id,sub_comm);
-			MPI_Bcast(area_tri2+start,chunk,MPI_DOUBLE,id,sub_comm);
-			MPI_Bcast(twistx+start,chunk,MPI_DOUBLE,id,sub_comm);
-			MPI_Bcast(twisty+start,chunk,MPI_DOUBLE,id,sub_comm);
-			MPI_Bcast(twiststat+start,chunk,MPI_INT,id,sub_comm);
 		}
 	}
+	MPI_Comm_free(&sub_comm);
 #endif
+	if (lens->split_imgpixels) {
+		for (g=0; g < n_grids; g++) {
+			ImagePixelGrid *grid = grids[g];
+			for (n=0; n < grid->ntot_subpixels; n++) {
+				j = grid->extended_mask_subcell_j[n];
+				i = grid->extended_mask_subcell_i[n];
+				k = grid->extended_mask_subcell_index[n];
+				grid->subpixel_center_sourcepts[i][j][k][0] = grid->defx_subpixel_centers[n];
+				grid->subpixel_center_sourcepts[i][j][k][1] = grid->defy_subpixel_centers[n];
+			}
+		}
+	}
+	delete[] corner_start;
+	delete[] cell_start;
+	delete[] center_start;
+	delete[] subcell_start;
+	delete[] corner_offset;
+	delete[] cell_offset;
+	delete[] center_offset;
+	delete[] subcell_offset;
+}
+
+void ImagePixelGrid::find_srcplane_twist_and_area(const int n_cell)
+{
+	lensvector d1,d2,d3,d4;
+	int n = masked_pixel_corner[n_cell];
+	int n_yp = masked_pixel_corner_up[n_cell];
+	d1[0] = defx_corners[n] - defx_corners[n+1];
+	d1[1] = defy_corners[n] - defy_corners[n+1];
+	d2[0] = defx_corners[n_yp] - defx_corners[n];
+	d2[1] = defy_corners[n_yp] - defy_corners[n];
+	d3[0] = defx_corners[n_yp+1] - defx_corners[n_yp];
+	d3[1] = defy_corners[n_yp+1] - defy_corners[n_yp];
+	d4[0] = defx_corners[n+1] - defx_corners[n_yp+1];
+	d4[1] = defy_corners[n+1] - defy_corners[n_yp+1];
+
+	twiststat[n_cell] = 0;
+	double xa,ya,xb,yb,xc,yc,xd,yd,slope1,slope2;
+	xa=defx_corners[n];
+	ya=defy_corners[n];
+	xb=defx_corners[n_yp];
+	yb=defy_corners[n_yp];
+	xc=defx_corners[n_yp+1];
+	yc=defy_corners[n_yp+1];
+	xd=defx_corners[n+1];
+	yd=defy_corners[n+1];
+	slope1 = (yb-ya)/(xb-xa);
+	slope2 = (yc-yd)/(xc-xd);
+	twistx[n_cell] = (yd-ya+xa*slope1-xd*slope2)/(slope1-slope2);
+	twisty[n_cell] = (twistx[n_cell]-xa)*slope1+ya;
+	if ((test_if_between(twistx[n_cell],xa,xb)) and (test_if_between(twisty[n_cell],ya,yb)) and (test_if_between(twistx[n_cell],xc,xd)) and (test_if_between(twisty[n_cell],yc,yd))) {
+		twiststat[n_cell] = 1;
+		d2[0] = twistx[n_cell] - defx_corners[n];
+		d2[1] = twisty[n_cell] - defy_corners[n];
+		d4[0] = twistx[n_cell] - defx_corners[n_yp+1];
+		d4[1] = twisty[n_cell] - defy_corners[n_yp+1];
+	} else {
+		slope1 = (yd-ya)/(xd-xa);
+		slope2 = (yc-yb)/(xc-xb);
+		twistx[n_cell] = (yb-ya+xa*slope1-xb*slope2)/(slope1-slope2);
+		twisty[n_cell] = (twistx[n_cell]-xa)*slope1+ya;
+		if ((test_if_between(twistx[n_cell],xa,xd)) and (test_if_between(twisty[n_cell],ya,yd)) and (test_if_between(twistx[n_cell],xb,xc)) and (test_if_between(twisty[n_cell],yb,yc))) {
+			twiststat[n_cell] = 2;
+			d1[0] = defx_corners[n] - twistx[n_cell];
+			d1[1] = defy_corners[n] - twisty[n_cell];
+			d3[0] = defx_corners[n_yp+1] - twistx[n_cell];
+			d3[1] = defy_corners[n_yp+1] - twisty[n_cell];
+		}
+	}
+
+	area_tri1[n_cell] = 0.5*abs(d1 ^ d2);
+	area_tri2[n_cell] = 0.5*abs(d3 ^ d4);
+}
+
+// copies the ray-traced points and source plane areas into the pixel arrays, then decides which pixels to split (if any)
+void ImagePixelGrid::store_sourcepts_and_areas(const bool trace_centers, const bool verbal)
+{
+	int i,j,n;
+	if (trace_centers) {
+		for (n=0; n < ntot_cells_emask; n++) {
+			//n_cell = j*x_N+i;
+			j = emask_pixels_j[n];
+			i = emask_pixels_i[n];
+			center_sourcepts[i][j][0] = defx_centers[n];
+			center_sourcepts[i][j][1] = defy_centers[n];
+		}
+	}
 	src_xmin = 1e30; src_xmax = -1e30;
 	src_ymin = 1e30; src_ymax = -1e30;
 	for (n=0; n < ntot_corners; n++) {
@@ -10412,70 +10336,85 @@ void ImagePixelGrid::calculate_sourcepts_and_areas(const bool raytrace_pixel_cen
 			}
 		}
 	}
-	if ((lens->split_imgpixels) and (lens->split_high_mag_imgpixels)) setup_subpixel_ray_tracing_arrays(verbal);
-
-	int mpi_chunk3, mpi_start3, mpi_end3;
-	mpi_chunk3 = ntot_subpixels / lens->group_np;
-	mpi_start3 = lens->group_id*mpi_chunk3;
-	if (lens->group_id == lens->group_np-1) mpi_chunk3 += (ntot_subpixels % lens->group_np); // assign the remainder elements to the last mpi process
-	mpi_end3 = mpi_start3 + mpi_chunk3;
+	if ((lens->split_imgpixels) and (lens->adaptive_imgpixel_split)) set_adaptive_nsplits();
+	if ((lens->split_imgpixels) and ((lens->split_high_mag_imgpixels) or (lens->adaptive_imgpixel_split))) setup_subpixel_ray_tracing_arrays(verbal);
+}
 
-	if (lens->split_imgpixels) {
-		int n_subcell;
-		#pragma omp parallel
-		{
-			int thread;
-#ifdef USE_OPENMP
-			thread = omp_get_thread_num();
-#else
-			thread = 0;
-#endif
+void ImagePixelGrid::set_adaptive_nsplits()
+{
+	// Chooses the number of splittings for each pixel in the mask, so that the error in the pixel's ray-traced surface
+	// brightness (the average over its nsplit*nsplit subpixels) falls below imgpixel_split_tolerance times the pixel noise,
+	// with default_imgpixel_nsplit as the maximum. For a single ray through the pixel center, the error is approximately
+	// (S_corners - S_center)/3, where S_corners is the mean lensed surface brightness at the four corners; since the error
+	// falls off as 1/nsplit^2, the required splitting follows directly from this estimate. S is found from the lensed
+	// analytic profiles unless the source is pixellated; otherwise the discrete Laplacian of the data is used instead (which
+	// gives the same estimate), ignoring differences that are within two standard deviations of the noise. Pixels whose
+	// image in the source plane is folded over (i.e. the pixel straddles a critical curve) always get the maximum splitting.
+	const int nsplit_max = lens->default_imgpixel_nsplit;
+	int i,j,k,n,ii,jj,nsplit,subcell_index;
+	double u0,w0;
 
-			#pragma omp for private(i,j,k,n_subcell) schedule(dynamic)
-			for (n_subcell=mpi_start3; n_subcell < mpi_end3; n_subcell++) {
-				j = extended_mask_subcell_j[n_subcell];
-				i = extended_mask_subcell_i[n_subcell];
-				k = extended_mask_subcell_index[n_subcell];
-				lens->find_sourcept(subpixel_center_pts[i][j][k],defx_subpixel_centers[n_subcell],defy_subpixel_centers[n_subcell],thread,imggrid_zfactors,imggrid_betafactors);
-				//if (defx_subpixel_centers[n_subcell]*0.0 != 0.0) die("nonsense value for deflection (x=%g y=%g defx=%g defy=%g)",subpixel_center_pts[i][j][k][0],subpixel_center_pts[i][j][k][1],defx_subpixel_centers[n_subcell],defy_subpixel_centers[n_subcell]);
-			}
-		}
-	}
-#ifdef USE_MPI
-	if ((lens->group_np > 1) and (lens->split_imgpixels)) {
-		int id, chunk, start;
-		for (id=0; id < lens->group_np; id++) {
-			chunk = ntot_subpixels / lens->group_np;
-			start = id*chunk;
-			if (id == lens->group_np-1) chunk += (ntot_subpixels % lens->group_np); // assign the remainder elements to the last mpi process
-			MPI_Bcast(defx_subpixel_centers+start,chunk,MPI_DOUBLE,id,sub_comm);
-			MPI_Bcast(defy_subpixel_centers+start,chunk,MPI_DOUBLE,id,sub_comm);
-		}
-	}
-	MPI_Comm_free(&sub_comm);
-#endif
-	if ((!lens->split_imgpixels) or (raytrace_pixel_centers)) {
-		for (n=0; n < ntot_cells_emask; n++) {
-			//n_cell = j*x_N+i;
-			j = emask_pixels_j[n];
-			i = emask_pixels_i[n];
-			center_sourcepts[i][j][0] = defx_centers[n];
-			center_sourcepts[i][j][1] = defy_centers[n];
+	int n_lensed_profiles = 0;
+	int *lensed_profiles = new int[lens->n_sb];
+	if ((source_fit_mode != Cartesian_Source) and (source_fit_mode != Delaunay_Source)) {
+		for (k=0; k < lens->n_sb; k++) {
+			if ((lens->sb_list[k]->is_lensed) and (lens->sbprofile_redshift_idx[k]==src_redshift_index)) lensed_profiles[n_lensed_profiles++] = k;
 		}
 	}
-	if (lens->split_imgpixels) {
-		for (n=0; n < ntot_subpixels; n++) {
-			j = extended_mask_subcell_j[n];
-			i = extended_mask_subcell_i[n];
-			k = extended_mask_subcell_index[n];
-			//cout << "CHECKING2: " << defy_subpixel_centers[n] << " " << subpixel_center_sourcepts[i][j][k][1] << endl;
-			//if (subpixel_center_sourcepts[i][j][k][0] != defx_subpixel_centers[n]) cout << "wrong defx: " << defx_subpixel_centers[n] << " " << subpixel_center_sourcepts[i][j][k][0] << endl;
-			//if (subpixel_center_sourcepts[i][j][k][1] != defy_subpixel_centers[n]) cout << "wrong defy: " << defx_subpixel_centers[n] << " " << subpixel_center_sourcepts[i][j][k][1] << endl;
-			subpixel_center_sourcepts[i][j][k][0] = defx_subpixel_centers[n];
-			subpixel_center_sourcepts[i][j][k][1] = defy_subpixel_centers[n];
-			//cout << "SRCPT: " << subpixel_center_sourcepts[i][j][k][0] << " " << subpixel_center_sourcepts[i][j][k][1] << endl;
+	bool use_data = ((n_lensed_profiles==0) and (lens->image_pixel_data != NULL));
+
+	#pragma omp parallel
+	{
+		double xvals[5], yvals[5], sb[5], sbtot[5];
+		double err, noise, tol, lap;
+		#pragma omp for private(i,j,k,n,ii,jj,nsplit,subcell_index,u0,w0) schedule(dynamic)
+		for (n=0; n < ntot_cells; n++) {
+			j = masked_pixels_j[n];
+			i = masked_pixels_i[n];
+			if ((mask != NULL) and (!mask[i][j])) continue;
+			noise = (lens->use_noise_map) ? noise_map[i][j] : lens->background_pixel_noise;
+			tol = (noise > 0) ? lens->imgpixel_split_tolerance*noise : lens->imgpixel_split_tolerance;
+			if ((twist_status[i][j] != 0) or (tol <= 0)) {
+				nsplit = nsplit_max;
+			} else if (n_lensed_profiles > 0) {
+				xvals[0] = corner_sourcepts[i][j][0]; yvals[0] = corner_sourcepts[i][j][1];
+				xvals[1] = corner_sourcepts[i+1][j][0]; yvals[1] = corner_sourcepts[i+1][j][1];
+				xvals[2] = corner_sourcepts[i][j+1][0]; yvals[2] = corner_sourcepts[i][j+1][1];
+				xvals[3] = corner_sourcepts[i+1][j+1][0]; yvals[3] = corner_sourcepts[i+1][j+1][1];
+				xvals[4] = center_sourcepts[i][j][0]; yvals[4] = center_sourcepts[i][j][1];
+				for (ii=0; ii < 5; ii++) sbtot[ii] = 0;
+				for (k=0; k < n_lensed_profiles; k++) {
+					lens->sb_list[lensed_profiles[k]]->surface_brightness_batch(5,xvals,yvals,sb);
+					for (ii=0; ii < 5; ii++) sbtot[ii] += sb[ii];
+				}
+				err = abs(0.25*(sbtot[0]+sbtot[1]+sbtot[2]+sbtot[3]) - sbtot[4])/3;
+				nsplit = (int) ceil(sqrt(err/tol));
+			} else if ((use_data) and (i > 0) and (i < x_N-1) and (j > 0) and (j < y_N-1)) {
+				double **sbdata = lens->image_pixel_data->surface_brightness;
+				lap = abs(sbdata[i-1][j] + sbdata[i+1][j] + sbdata[i][j-1] + sbdata[i][j+1] - 4*sbdata[i][j]);
+				err = lap - 2*sqrt(20.0)*noise; // the Laplacian of pure noise has a dispersion of sqrt(20) times the pixel noise
+				err = (err > 0) ? err/24 : 0;
+				nsplit = (int) ceil(sqrt(err/tol));
+			} else {
+				nsplit = nsplit_max;
+			}
+			if (nsplit < 1) nsplit = 1;
+			else if (nsplit > nsplit_max) nsplit = nsplit_max;
+
+			nsplits[i][j] = nsplit;
+			subcell_index = 0;
+			for (ii=0; ii < nsplit; ii++) {
+				for (jj=0; jj < nsplit; jj++) {
+					u0 = ((double) (1+2*ii))/(2*nsplit);
+					w0 = ((double) (1+2*jj))/(2*nsplit);
+					subpixel_center_pts[i][j][subcell_index][0] = (1-u0)*corner_pts[i][j][0] + u0*corner_pts[i+1][j][0];
+					subpixel_center_pts[i][j][subcell_index][1] = (1-w0)*corner_pts[i][j][1] + w0*corner_pts[i][j+1][1];
+					subcell_index++;
+				}
+			}
 		}
 	}
+	delete[] lensed_profiles;
 }
 
 void ImagePixelGrid::ray_trace_pixels()
@@ -10488,22 +10427,35 @@ void ImagePixelGrid::ray_trace_pixels()
 
 void ImagePixelGrid::redo_lensing_calculations(const bool verbal)
 {
+	ImagePixelGrid *grid = this;
+	redo_lensing_calculations(&grid,1,verbal);
+}
+
+void ImagePixelGrid::redo_lensing_calculations(ImagePixelGrid **grids, const int n_grids, const bool verbal)
+{
+	if (n_grids==0) return;
+	QLens *lens = grids[0]->lens;
 #ifdef USE_OPENMP
 	double wtime0, wtime;
 	if (lens->show_wtime) {
 		wtime0 = omp_get_wtime();
 	}
 #endif
-	if ((source_fit_mode==Cartesian_Source) or (source_fit_mode==Delaunay_Source)) n_active_pixels = 0;
+	for (int g=0; g < n_grids; g++) {
+		if ((grids[g]->source_fit_mode==Cartesian_Source) or (grids[g]->source_fit_mode==Delaunay_Source)) grids[g]->n_active_pixels = 0;
+	}
 	//delete_ray_tracing_arrays();
 	//setup_pixel_arrays();
 	//setup_ray_tracing_arrays();
-	calculate_sourcepts_and_areas(true,verbal);
+	calculate_sourcepts_and_areas(grids,n_grids,true,verbal);
 
 #ifdef USE_OPENMP
 	if (lens->show_wtime) {
 		wtime = omp_get_wtime() - wtime0;
-		if (lens->mpi_id==0) cout << "Wall time for ray-tracing image pixel grid: " << wtime << endl;
+		if (lens->mpi_id==0) {
+			if (n_grids==1) cout << "Wall time for ray-tracing image pixel grid: " << wtime << endl;
+			else cout << "Wall time for ray-tracing " << n_grids << " image pixel grids: " << wtime << endl;
+		}
 	}
 #endif
 }
@@ -10802,7 +10754,7 @@ bool ImagePixelGrid::set_fit_window(ImagePixelData& pixel_data, const bool raytr
 
 	if (lens) {
 		setup_ray_tracing_arrays();
-		if ((raytrace) or (lens->split_high_mag_imgpixels)) calculate_sourcepts_and_areas(true);
+		if ((raytrace) or (lens->split_high_mag_imgpixels) or (lens->adaptive_imgpixel_split)) calculate_sourcepts_and_areas(true);
 	}
 	return true;
 }
@@ -11700,7 +11652,6 @@ void ImagePixelGrid::assign_image_mapping_flags(const bool delaunay)
 void ImagePixelGrid::find_surface_brightness(const bool foreground_only, const bool lensed_sources_only)
 {
 	bool supersampling = lens->psf_supersampling;
-	double noise;
 #ifdef USE_OPENMP
 	double wtime0, wtime;
 	if (lens->show_wtime) {
@@ -11728,30 +11679,29 @@ void ImagePixelGrid::find_surface_brightness(const bool foreground_only, const b
 		if ((foreground_only) and (!at_least_one_foreground_src)) return;
 
 		if ((source_fit_mode == Cartesian_Source) and (ray_tracing_method == Area_Overlap)) {
-			lensvector **corners = new lensvector*[4];
-			for (j=0; j < y_N; j++) {
-				for (i=0; i < x_N; i++) {
-					//surface_brightness[i][j] = 0;
-					corners[0] = &corner_sourcepts[i][j];
-					corners[1] = &corner_sourcepts[i][j+1];
-					corners[2] = &corner_sourcepts[i+1][j];
-					corners[3] = &corner_sourcepts[i+1][j+1];
-					if (!foreground_only) surface_brightness[i][j] = cartesian_srcgrid->find_lensed_surface_brightness_overlap(corners,&twist_pts[i][j],twist_status[i][j],0);
-					if ((at_least_one_foreground_src) and (!lensed_sources_only) and (src_redshift_index==0)) {
-						for (int k=0; k < lens->n_sb; k++) {
-							if (!lens->sb_list[k]->is_lensed) {
-								if (!lens->sb_list[k]->zoom_subgridding) {
-									surface_brightness[i][j] += lens->sb_list[k]->surface_brightness(center_pts[i][j][0],center_pts[i][j][1]);
-								} else {
-									noise = (lens->use_noise_map) ? noise_map[i][j] : lens->background_pixel_noise;
-									surface_brightness[i][j] += lens->sb_list[k]->surface_brightness_zoom(center_pts[i][j],corner_pts[i][j],corner_pts[i+1][j],corner_pts[i][j+1],corner_pts[i+1][j+1],noise);
-								}
-							}
+			if (!foreground_only) {
+				#pragma omp parallel
+				{
+					int thread;
+#ifdef USE_OPENMP
+					thread = omp_get_thread_num();
+#else
+					thread = 0;
+#endif
+					lensvector *corners[4];
+					#pragma omp for private(i,j,corners) schedule(dynamic)
+					for (j=0; j < y_N; j++) {
+						for (i=0; i < x_N; i++) {
+							corners[0] = &corner_sourcepts[i][j];
+							corners[1] = &corner_sourcepts[i][j+1];
+							corners[2] = &corner_sourcepts[i+1][j];
+							corners[3] = &corner_sourcepts[i+1][j+1];
+							surface_brightness[i][j] = cartesian_srcgrid->find_lensed_surface_brightness_overlap(corners,&twist_pts[i][j],twist_status[i][j],thread);
 						}
 					}
 				}
 			}
-			delete[] corners;
+			if ((at_least_one_foreground_src) and (!lensed_sources_only) and (src_redshift_index==0)) add_sbprofile_surface_brightness(false,true);
 		} else { // use interpolation to get surface brightness
 			if ((lens->split_imgpixels) and (!lens->raytrace_using_pixel_centers)) {
 				#pragma omp parallel
@@ -11771,7 +11721,7 @@ void ImagePixelGrid::find_surface_brightness(const bool foreground_only, const b
 					int nsubpix, subcell_index;
 					lensvector *center_srcpt, *center_pt;
 					//#pragma omp for private(i,j,ii,jj,nsplit,u0,w0,sb) schedule(dynamic)
-					#pragma omp for private(i,j,nsubpix,subcell_index,center_pt,center_srcpt,subpixel_xlength,subpixel_ylength,corner1,corner2,corner3,corner4,sb,noise) schedule(dynamic)
+					#pragma omp for private(i,j,nsubpix,subcell_index,center_pt,center_srcpt,subpixel_xlength,subpixel_ylength,corner1,corner2,corner3,corner4,sb) schedule(dynamic)
 					for (j=0; j < y_N; j++) {
 						for (i=0; i < x_N; i++) {
 							//surface_brightness[i][j] = 0;
@@ -11806,21 +11756,9 @@ void ImagePixelGrid::find_surface_brightness(const bool foreground_only, const b
 								}
 							}
 						}
-						if ((at_least_one_foreground_src) and (!lensed_sources_only) and (src_redshift_index==0)) {
-							for (int k=0; k < lens->n_sb; k++) {
-								if (!lens->sb_list[k]->is_lensed) {
-									if (!lens->sb_list[k]->zoom_subgridding) {
-										surface_brightness[i][j] += lens->sb_list[k]->surface_brightness(center_pts[i][j][0],center_pts[i][j][1]);
-									} else {
-										noise = (lens->use_noise_map) ? noise_map[i][j] : lens->background_pixel_noise;
-										surface_brightness[i][j] += lens->sb_list[k]->surface_brightness_zoom(center_pts[i][j],corner_pts[i][j],corner_pts[i+1][j],corner_pts[i][j+1],corner_pts[i+1][j+1],noise);
-									}
-								}
-							}
-						}
 					}
-
 				}
+				if ((at_least_one_foreground_src) and (!lensed_sources_only) and (src_redshift_index==0)) add_sbprofile_surface_brightness(false,true);
 			}
 		}
 	}
@@ -11832,111 +11770,197 @@ void ImagePixelGrid::find_surface_brightness(const bool foreground_only, const b
 			at_least_one_lensed_src = true;
 		}
 	}
+	bool include_unlensed = ((!lensed_sources_only) and (src_redshift_index==0));
 	if (lens->split_imgpixels) {
-		#pragma omp parallel
-		{
-			int thread;
+		// if the subpixel surface brightness was already found from the pixellated source above, the profiles are added to it
+		bool add_to_subpixel_sb = (((source_fit_mode == Cartesian_Source) or (source_fit_mode == Delaunay_Source)) and ((source_fit_mode != Cartesian_Source) or (ray_tracing_method != Area_Overlap)) and (!lens->raytrace_using_pixel_centers));
+		add_sbprofile_surface_brightness_subpixels(!foreground_only,include_unlensed,add_to_subpixel_sb);
+	} else {
+		add_sbprofile_surface_brightness(!foreground_only,include_unlensed);
+	}
 #ifdef USE_OPENMP
-			thread = omp_get_thread_num();
-#else
-			thread = 0;
+	if (lens->show_wtime) {
+		wtime = omp_get_wtime() - wtime0;
+		if (lens->mpi_id==0) cout << "Wall time for ray-tracing image surface brightness values: " << wtime << endl;
+	}
 #endif
-			double sb,sbtot;
-			lensvector corner1, corner2, corner3, corner4;
-			double subpixel_xlength, subpixel_ylength;
+}
 
-			int nsubpix,subcell_index;
-			lensvector *center_srcpt, *center_pt;
-			#pragma omp for private(i,j,sb,subcell_index,nsubpix,subpixel_xlength,subpixel_ylength,center_pt,center_srcpt,corner1,corner2,corner3,corner4,noise) schedule(dynamic)
-			for (j=0; j < y_N; j++) {
-				for (i=0; i < x_N; i++) {
-					if ((pixel_in_mask == NULL) or (pixel_in_mask[i][j])) {
-						sbtot=0;
+void ImagePixelGrid::add_sbprofile_surface_brightness(const bool include_lensed, const bool include_unlensed)
+{
+	// Adds the surface brightness of the analytic profiles at the pixel centers (traced to the source plane for lensed
+	// profiles at this grid's source redshift). The pixels in each row are evaluated with one batched call per profile,
+	// and the rows are divided among the threads.
+	int i,j,k;
+	bool any_profiles = false;
+	for (k=0; k < lens->n_sb; k++) {
+		if ((include_lensed) and (lens->sb_list[k]->is_lensed) and (lens->sbprofile_redshift_idx[k]==src_redshift_index)) any_profiles = true;
+		else if ((include_unlensed) and (!lens->sb_list[k]->is_lensed)) any_profiles = true;
+	}
+	if (!any_profiles) return;
+
+	#pragma omp parallel
+	{
+		double *xvals = new double[x_N];
+		double *yvals = new double[x_N];
+		double *sbvals = new double[x_N];
+		double noise;
+		bool lensed;
+		SB_Profile *sbprofile;
+		#pragma omp for private(i,j,k,noise,lensed,sbprofile) schedule(dynamic)
+		for (j=0; j < y_N; j++) {
+			for (k=0; k < lens->n_sb; k++) {
+				sbprofile = lens->sb_list[k];
+				if ((sbprofile->is_lensed) and (lens->sbprofile_redshift_idx[k]==src_redshift_index)) {
+					if (!include_lensed) continue;
+					lensed = true;
+				} else if (!sbprofile->is_lensed) {
+					if (!include_unlensed) continue;
+					lensed = false;
+				} else continue;
+				if (sbprofile->zoom_subgridding) {
+					for (i=0; i < x_N; i++) {
+						noise = (lens->use_noise_map) ? noise_map[i][j] : lens->background_pixel_noise;
+						if (lensed) surface_brightness[i][j] += sbprofile->surface_brightness_zoom(center_sourcepts[i][j],corner_sourcepts[i][j],corner_sourcepts[i+1][j],corner_sourcepts[i][j+1],corner_sourcepts[i+1][j+1],noise);
+						else surface_brightness[i][j] += sbprofile->surface_brightness_zoom(center_pts[i][j],corner_pts[i][j],corner_pts[i+1][j],corner_pts[i][j+1],corner_pts[i+1][j+1],noise);
+					}
+				} else {
+					if (lensed) {
+						for (i=0; i < x_N; i++) {
+							xvals[i] = center_sourcepts[i][j][0];
+							yvals[i] = center_sourcepts[i][j][1];
+						}
+					} else {
+						for (i=0; i < x_N; i++) {
+							xvals[i] = center_pts[i][j][0];
+							yvals[i] = center_pts[i][j][1];
+						}
+					}
+					sbprofile->surface_brightness_batch(x_N,xvals,yvals,sbvals);
+					for (i=0; i < x_N; i++) surface_brightness[i][j] += sbvals[i];
+				}
+			}
+		}
+		delete[] xvals;
+		delete[] yvals;
+		delete[] sbvals;
+	}
+}
+
+void ImagePixelGrid::add_sbprofile_surface_brightness_subpixels(const bool include_lensed, const bool include_unlensed, const bool add_to_subpixel_sb)
+{
+	// Same as add_sbprofile_surface_brightness, but averaging over the split subpixels of each pixel within the mask; all
+	// the subpixels in a row are evaluated with one batched call per profile. If PSF supersampling is on, the subpixel
+	// surface brightness (summed over the profiles) is also stored.
+	bool supersampling = lens->psf_supersampling;
+	int i,j,k;
+	bool any_profiles = false;
+	for (k=0; k < lens->n_sb; k++) {
+		if ((include_lensed) and (lens->sb_list[k]->is_lensed) and (lens->sbprofile_redshift_idx[k]==src_redshift_index)) any_profiles = true;
+		else if ((include_unlensed) and (!lens->sb_list[k]->is_lensed)) any_profiles = true;
+	}
+	if (!any_profiles) return;
+
+	#pragma omp parallel
+	{
+		int n, npts, max_npts = 0, nsubpix, subcell_index;
+		double *xvals = NULL, *yvals = NULL, *sbvals = NULL, *sbsum = NULL;
+		double sbtot, noise, subpixel_xlength, subpixel_ylength;
+		lensvector corner1, corner2, corner3, corner4;
+		lensvector *center_srcpt, *center_pt;
+		bool lensed;
+		SB_Profile *sbprofile;
+		#pragma omp for private(i,j,k) schedule(dynamic)
+		for (j=0; j < y_N; j++) {
+			npts = 0;
+			for (i=0; i < x_N; i++) {
+				if ((pixel_in_mask == NULL) or (pixel_in_mask[i][j])) npts += INTSQR(nsplits[i][j]);
+			}
+			if (npts==0) continue;
+			if (npts > max_npts) {
+				if (max_npts > 0) {
+					delete[] xvals;
+					delete[] yvals;
+					delete[] sbvals;
+					delete[] sbsum;
+				}
+				max_npts = npts;
+				xvals = new double[max_npts];
+				yvals = new double[max_npts];
+				sbvals = new double[max_npts];
+				sbsum = new double[max_npts];
+			}
+			for (n=0; n < npts; n++) sbsum[n] = 0;
+
+			for (k=0; k < lens->n_sb; k++) {
+				sbprofile = lens->sb_list[k];
+				if ((sbprofile->is_lensed) and (lens->sbprofile_redshift_idx[k]==src_redshift_index)) {
+					if (!include_lensed) continue;
+					lensed = true;
+				} else if (!sbprofile->is_lensed) {
+					if (!include_unlensed) continue;
+					lensed = false;
+				} else continue;
+				n = 0;
+				if ((!lensed) and (sbprofile->zoom_subgridding)) {
+					for (i=0; i < x_N; i++) {
+						if ((pixel_in_mask != NULL) and (!pixel_in_mask[i][j])) continue;
 						nsubpix = INTSQR(nsplits[i][j]);
-						center_srcpt = subpixel_center_sourcepts[i][j];
 						center_pt = subpixel_center_pts[i][j];
+						subpixel_xlength = pixel_xlength/nsplits[i][j];
+						subpixel_ylength = pixel_ylength/nsplits[i][j];
+						noise = (lens->use_noise_map) ? noise_map[i][j] : lens->background_pixel_noise;
 						for (subcell_index=0; subcell_index < nsubpix; subcell_index++) {
-							for (int k=0; k < lens->n_sb; k++) {
-								if ((lens->sb_list[k]->is_lensed) and (lens->sbprofile_redshift_idx[k]==src_redshift_index)) {
-									if (!foreground_only) {
-										sb = lens->sb_list[k]->surface_brightness(center_srcpt[subcell_index][0],center_srcpt[subcell_index][1]);
-									}
-								} else if ((!lensed_sources_only) and (!lens->sb_list[k]->is_lensed) and (src_redshift_index==0)) { // this is ugly. Should just generate a list (near the beginning of this function) of which sources will be used!
-									if (!lens->sb_list[k]->zoom_subgridding) {
-										//cout << " center pt: " << center_pt[subcell_index][0] << " " << center_pt[subcell_index][1] << " (should be near " << center_pts[i][j][0] << " " << center_pts[i][j][1] << ")" << endl;
-										sb = lens->sb_list[k]->surface_brightness(center_pt[subcell_index][0],center_pt[subcell_index][1]);
-									}
-									else {
-										subpixel_xlength = pixel_xlength/nsplits[i][j];
-										subpixel_ylength = pixel_ylength/nsplits[i][j];
-										corner1[0] = center_pt[subcell_index][0] - subpixel_xlength/2;
-										corner1[1] = center_pt[subcell_index][1] - subpixel_ylength/2;
-										corner2[0] = center_pt[subcell_index][0] + subpixel_xlength/2;
-										corner2[1] = center_pt[subcell_index][1] - subpixel_ylength/2;
-										corner3[0] = center_pt[subcell_index][0] - subpixel_xlength/2;
-										corner3[1] = center_pt[subcell_index][1] + subpixel_ylength/2;
-										corner4[0] = center_pt[subcell_index][0] + subpixel_xlength/2;
-										corner4[1] = center_pt[subcell_index][1] + subpixel_ylength/2;
-										noise = (lens->use_noise_map) ? noise_map[i][j] : lens->background_pixel_noise;
-										sb = lens->sb_list[k]->surface_brightness_zoom(center_pt[subcell_index],corner1,corner2,corner3,corner4,noise);
-									}
-								} else {
-									sb=0;
-								}
-								if (sb != 0) {
-									if (supersampling) subpixel_surface_brightness[i][j][subcell_index] = sb;
-									sbtot += sb;
-								}
-							}
+							corner1[0] = center_pt[subcell_index][0] - subpixel_xlength/2;
+							corner1[1] = center_pt[subcell_index][1] - subpixel_ylength/2;
+							corner2[0] = center_pt[subcell_index][0] + subpixel_xlength/2;
+							corner2[1] = center_pt[subcell_index][1] - subpixel_ylength/2;
+							corner3[0] = center_pt[subcell_index][0] - subpixel_xlength/2;
+							corner3[1] = center_pt[subcell_index][1] + subpixel_ylength/2;
+							corner4[0] = center_pt[subcell_index][0] + subpixel_xlength/2;
+							corner4[1] = center_pt[subcell_index][1] + subpixel_ylength/2;
+							sbsum[n++] += sbprofile->surface_brightness_zoom(center_pt[subcell_index],corner1,corner2,corner3,corner4,noise);
+						}
+					}
+				} else {
+					for (i=0; i < x_N; i++) {
+						if ((pixel_in_mask != NULL) and (!pixel_in_mask[i][j])) continue;
+						nsubpix = INTSQR(nsplits[i][j]);
+						center_srcpt = (lensed) ? subpixel_center_sourcepts[i][j] : subpixel_center_pts[i][j];
+						for (subcell_index=0; subcell_index < nsubpix; subcell_index++) {
+							xvals[n] = center_srcpt[subcell_index][0];
+							yvals[n] = center_srcpt[subcell_index][1];
+							n++;
 						}
-						surface_brightness[i][j] += sbtot / nsubpix;
 					}
+					sbprofile->surface_brightness_batch(npts,xvals,yvals,sbvals);
+					for (n=0; n < npts; n++) sbsum[n] += sbvals[n];
 				}
 			}
-		}
-	} else {
-		#pragma omp parallel
-		{
-			int thread;
-#ifdef USE_OPENMP
-			thread = omp_get_thread_num();
-#else
-			thread = 0;
-#endif
-			#pragma omp for private(i,j,noise) schedule(dynamic)
-			for (j=0; j < y_N; j++) {
-				for (i=0; i < x_N; i++) {
-					for (int k=0; k < lens->n_sb; k++) {
-						if ((lens->sb_list[k]->is_lensed) and (lens->sbprofile_redshift_idx[k]==src_redshift_index)) { // this is ugly. Should just generate a list (near the beginning of this function) of which sources will be used!
-							if (!foreground_only) {
-								if (!lens->sb_list[k]->zoom_subgridding) surface_brightness[i][j] += lens->sb_list[k]->surface_brightness(center_sourcepts[i][j][0],center_sourcepts[i][j][1]);
-								else {
-									noise = (lens->use_noise_map) ? noise_map[i][j] : lens->background_pixel_noise;
-									surface_brightness[i][j] += lens->sb_list[k]->surface_brightness_zoom(center_sourcepts[i][j],corner_sourcepts[i][j],corner_sourcepts[i+1][j],corner_sourcepts[i][j+1],corner_sourcepts[i+1][j+1],noise);
-								}
-							}
-						}
-						else if ((!lensed_sources_only) and (!lens->sb_list[k]->is_lensed) and (src_redshift_index==0)) { // this is ugly. Should just generate a list (near the beginning of this function) of which sources will be used!
-							if (!lens->sb_list[k]->zoom_subgridding) {
-								surface_brightness[i][j] += lens->sb_list[k]->surface_brightness(center_pts[i][j][0],center_pts[i][j][1]);
-							}
-							else {
-								noise = (lens->use_noise_map) ? noise_map[i][j] : lens->background_pixel_noise;
-								surface_brightness[i][j] += lens->sb_list[k]->surface_brightness_zoom(center_pts[i][j],corner_pts[i][j],corner_pts[i+1][j],corner_pts[i][j+1],corner_pts[i+1][j+1],noise);
 
-							}
-						}
+			n = 0;
+			for (i=0; i < x_N; i++) {
+				if ((pixel_in_mask != NULL) and (!pixel_in_mask[i][j])) continue;
+				nsubpix = INTSQR(nsplits[i][j]);
+				sbtot = 0;
+				for (subcell_index=0; subcell_index < nsubpix; subcell_index++) {
+					sbtot += sbsum[n];
+					if (supersampling) {
+						if (add_to_subpixel_sb) subpixel_surface_brightness[i][j][subcell_index] += sbsum[n];
+						else subpixel_surface_brightness[i][j][subcell_index] = sbsum[n];
 					}
+					n++;
 				}
+				surface_brightness[i][j] += sbtot / nsubpix;
 			}
 		}
+		if (max_npts > 0) {
+			delete[] xvals;
+			delete[] yvals;
+			delete[] sbvals;
+			delete[] sbsum;
+		}
 	}
-#ifdef USE_OPENMP
-	if (lens->show_wtime) {
-		wtime = omp_get_wtime() - wtime0;
-		if (lens->mpi_id==0) cout << "Wall time for ray-tracing image surface brightness values: " << wtime << endl;
-	}
-#endif
 }
 
 
@@ -12703,8 +12727,6 @@ ImagePixelGrid::~ImagePixelGrid()
 		delete[] pixel_index_fgmask[i];
 		delete[] mapped_cartesian_srcpixels[i];
 		delete[] mapped_delaunay_srcpixels[i];
-		delete[] foreground_surface_brightness[i];
-		delete[] surface_brightness[i];
 		delete[] noise_map[i];
 		delete[] source_plane_triangle1_area[i];
 		delete[] source_plane_triangle2_area[i];
@@ -12739,6 +12761,8 @@ ImagePixelGrid::~ImagePixelGrid()
 	delete[] subpixel_index;
 	delete[] mapped_cartesian_srcpixels;
 	delete[] mapped_delaunay_srcpixels;
+	delete[] foreground_surface_brightness[0];
+	delete[] surface_brightness[0];
 	delete[] foreground_surface_brightness;
 	delete[] surface_brightness;
 	delete[] noise_map;
@@ -13501,15 +13525,40 @@ void QLens::PSF_convolution_Lmatrix(const int zsrc_i, bool verbal)
 		MPI_Comm_create(*group_comm, *mpi_group, &sub_comm);
 	}
 #endif
-	if (psf_supersampling) die("PSF supersampling has not been implemented with sparse Lmatrix");
 	if (use_input_psf_matrix) {
-		if (psf_matrix == NULL) return;
+		if ((!psf_supersampling) and (psf_matrix == NULL)) return;
+		if ((psf_supersampling) and (supersampled_psf_matrix == NULL)) { average_supersampled_Lmatrix(zsrc_i); return; }
+	}
+	else if (generate_PSF_matrix(image_pixel_grid->pixel_xlength,image_pixel_grid->pixel_ylength,psf_supersampling)==false) {
+		if (psf_supersampling) average_supersampled_Lmatrix(zsrc_i); // no PSF to convolve, but the subpixel rows must still be binned
+		return;
 	}
-	else if (generate_PSF_matrix(image_pixel_grid->pixel_xlength,image_pixel_grid->pixel_ylength,psf_supersampling)==false) return;
 	if ((mpi_id==0) and (verbal)) cout << "Beginning PSF convolution (sparse)...\n";
-	double nx_half, ny_half;
-	nx_half = psf_npixels_x/2;
-	ny_half = psf_npixels_y/2;
+
+	// With supersampling, the rows of the Lmatrix correspond to image subpixels; each subpixel of a given image pixel is convolved
+	// with the supersampled PSF, and the results are averaged (binned down) so that the convolved Lmatrix has one row per image pixel
+	double **psf;
+	int psf_nx, psf_ny, nsplit, nsubpix;
+	int **pix_index;
+	if (!psf_supersampling) {
+		psf = psf_matrix;
+		psf_nx = psf_npixels_x;
+		psf_ny = psf_npixels_y;
+		nsplit = 1;
+		pix_index = image_pixel_grid->pixel_index;
+	} else {
+		psf = supersampled_psf_matrix;
+		psf_nx = supersampled_psf_npixels_x;
+		psf_ny = supersampled_psf_npixels_y;
+		nsplit = default_imgpixel_nsplit;
+		pix_index = image_pixel_grid->subpixel_index;
+	}
+	nsubpix = nsplit*nsplit;
+	int nx_half, ny_half, max_nx, max_ny;
+	nx_half = psf_nx/2;
+	ny_half = psf_ny/2;
+	max_nx = image_pixel_grid->x_N*nsplit;
+	max_ny = image_pixel_grid->y_N*nsplit;
 
 	int *Lmatrix_psf_row_nn = new int[image_npixels];
 	vector<double> *Lmatrix_psf_rows = new vector<double>[image_npixels];
@@ -13534,41 +13583,48 @@ void QLens::PSF_convolution_Lmatrix(const int zsrc_i, bool verbal)
 			wtime0 = omp_get_wtime();
 		}
 #endif
-		int psf_k, psf_l;
-		int img_index1, img_index2, src_index, col_index;
-		int index;
-		bool new_entry;
 		int Lmatrix_psf_nn_part=0;
-		#pragma omp parallel for private(m,k,l,i,j,img_index1,img_index2,src_index,col_index,psf_k,psf_l,index,new_entry) schedule(static) reduction(+:Lmatrix_psf_nn_part)
-		for (img_index1=mpi_start; img_index1 < mpi_end; img_index1++)
-		{ // this loops over columns of the PSF blurring matrix
-			int col_i=0;
-			Lmatrix_psf_row_nn[img_index1] = 0;
-			k = image_pixel_grid->active_image_pixel_i[img_index1];
-			l = image_pixel_grid->active_image_pixel_j[img_index1];
-			for (psf_k=0; psf_k < psf_npixels_x; psf_k++) {
-				i = k + nx_half - psf_k; // Note, 'k' is the index for the convolved image, so we have k = i - nx_half + psf_k
-				if ((i >= 0) and (i < image_pixel_grid->x_N)) {
-					for (psf_l=0; psf_l < psf_npixels_y; psf_l++) {
-						j = l + ny_half - psf_l; // Note, 'l' is the index for the convolved image, so we have l = j - ny_half + psf_l
-						if ((j >= 0) and (j < image_pixel_grid->y_N)) {
-							if (image_pixel_grid->maps_to_source_pixel[i][j]) {
-								img_index2 = image_pixel_grid->pixel_index[i][j];
-
-								for (index=image_pixel_location_Lmatrix[img_index2]; index < image_pixel_location_Lmatrix[img_index2+1]; index++) {
-									if (Lmatrix[index] != 0) {
-										src_index = Lmatrix_index[index];
-										new_entry = true;
-										for (m=0; m < Lmatrix_psf_row_nn[img_index1]; m++) {
-											if (Lmatrix_psf_index_rows[img_index1][m]==src_index) { col_index=m; new_entry=false; }
-										}
-										if (new_entry) {
-											Lmatrix_psf_rows[img_index1].push_back(psf_matrix[psf_k][psf_l]*Lmatrix[index]);
-											Lmatrix_psf_index_rows[img_index1].push_back(src_index);
-											Lmatrix_psf_row_nn[img_index1]++;
-											col_i++;
-										} else {
-											Lmatrix_psf_rows[img_index1][col_index] += psf_matrix[psf_k][psf_l]*Lmatrix[index];
+		#pragma omp parallel reduction(+:Lmatrix_psf_nn_part)
+		{
+			int psf_k, psf_l, sub_k, sub_l, ii, jj;
+			int img_index1, img_index2, src_index, index, col;
+			double psfval;
+			// position of each source amplitude within the row being built (or -1), so repeated entries are merged without searching the row
+			int *col_position = new int[source_n_amps];
+			for (col=0; col < source_n_amps; col++) col_position[col] = -1;
+			#pragma omp for private(k,l,i,j) schedule(static)
+			for (img_index1=mpi_start; img_index1 < mpi_end; img_index1++)
+			{ // this loops over columns of the PSF blurring matrix
+				Lmatrix_psf_row_nn[img_index1] = 0;
+				for (sub_k=0; sub_k < nsplit; sub_k++) {
+					k = image_pixel_grid->active_image_pixel_i[img_index1]*nsplit + sub_k;
+					for (sub_l=0; sub_l < nsplit; sub_l++) {
+						l = image_pixel_grid->active_image_pixel_j[img_index1]*nsplit + sub_l;
+						for (psf_k=0; psf_k < psf_nx; psf_k++) {
+							ii = k + nx_half - psf_k; // Note, 'k' is the index for the convolved image, so we have k = ii - nx_half + psf_k
+							if ((ii >= 0) and (ii < max_nx)) {
+								i = (psf_supersampling) ? image_pixel_grid->image_pixel_i_from_subcell_ii[ii] : ii;
+								for (psf_l=0; psf_l < psf_ny; psf_l++) {
+									jj = l + ny_half - psf_l; // Note, 'l' is the index for the convolved image, so we have l = jj - ny_half + psf_l
+									if ((jj >= 0) and (jj < max_ny)) {
+										j = (psf_supersampling) ? image_pixel_grid->image_pixel_j_from_subcell_jj[jj] : jj;
+										if (image_pixel_grid->maps_to_source_pixel[i][j]) {
+											img_index2 = pix_index[ii][jj];
+											psfval = psf[psf_k][psf_l];
+											if (nsubpix > 1) psfval /= nsubpix;
+
+											for (index=image_pixel_location_Lmatrix[img_index2]; index < image_pixel_location_Lmatrix[img_index2+1]; index++) {
+												if (Lmatrix[index] != 0) {
+													src_index = Lmatrix_index[index];
+													if (col_position[src_index] < 0) {
+														col_position[src_index] = Lmatrix_psf_row_nn[img_index1]++;
+														Lmatrix_psf_rows[img_index1].push_back(psfval*Lmatrix[index]);
+														Lmatrix_psf_index_rows[img_index1].push_back(src_index);
+													} else {
+														Lmatrix_psf_rows[img_index1][col_position[src_index]] += psfval*Lmatrix[index];
+													}
+												}
+											}
 										}
 									}
 								}
@@ -13576,8 +13632,10 @@ void QLens::PSF_convolution_Lmatrix(const int zsrc_i, bool verbal)
 						}
 					}
 				}
+				for (col=0; col < Lmatrix_psf_row_nn[img_index1]; col++) col_position[Lmatrix_psf_index_rows[img_index1][col]] = -1;
+				Lmatrix_psf_nn_part += Lmatrix_psf_row_nn[img_index1];
 			}
-			Lmatrix_psf_nn_part += col_i;
+			delete[] col_position;
 		}
 
 #ifdef USE_MPI
@@ -14532,6 +14590,64 @@ void QLens::average_supersampled_dense_Lmatrix(const int zsrc_i)
 	}
 }
 
+void QLens::average_supersampled_Lmatrix(const int zsrc_i)
+{
+	// bins the rows of the sparse supersampled Lmatrix (one per image subpixel) down to one row per image pixel. The subpixels
+	// belonging to each active image pixel are stored contiguously (see assign_pixel_mappings), so they are combined row by row
+	int nsubpix = default_imgpixel_nsplit*default_imgpixel_nsplit;
+	if (image_n_subpixels != image_npixels*nsubpix) die("number of supersampled Lmatrix rows (%i) does not match number of image pixels times nsubpix (%i)",image_n_subpixels,image_npixels*nsubpix);
+	int *Lmatrix_avg_row_nn = new int[image_npixels];
+	vector<double> *Lmatrix_avg_rows = new vector<double>[image_npixels];
+	vector<int> *Lmatrix_avg_index_rows = new vector<int>[image_npixels];
+	int *col_position = new int[source_n_amps];
+	int img_index, subpix_index, index, src_index, col;
+	int Lmatrix_avg_nn = 0;
+	for (col=0; col < source_n_amps; col++) col_position[col] = -1;
+	for (img_index=0; img_index < image_npixels; img_index++) {
+		Lmatrix_avg_row_nn[img_index] = 0;
+		for (subpix_index=img_index*nsubpix; subpix_index < (img_index+1)*nsubpix; subpix_index++) {
+			for (index=image_pixel_location_Lmatrix[subpix_index]; index < image_pixel_location_Lmatrix[subpix_index+1]; index++) {
+				src_index = Lmatrix_index[index];
+				if (col_position[src_index] < 0) {
+					col_position[src_index] = Lmatrix_avg_row_nn[img_index]++;
+					Lmatrix_avg_rows[img_index].push_back(Lmatrix[index]/nsubpix);
+					Lmatrix_avg_index_rows[img_index].push_back(src_index);
+				} else {
+					Lmatrix_avg_rows[img_index][col_position[src_index]] += Lmatrix[index]/nsubpix;
+				}
+			}
+		}
+		for (col=0; col < Lmatrix_avg_row_nn[img_index]; col++) col_position[Lmatrix_avg_index_rows[img_index][col]] = -1;
+		Lmatrix_avg_nn += Lmatrix_avg_row_nn[img_index];
+	}
+
+	int *image_pixel_location_Lmatrix_avg = new int[image_npixels+1];
+	double *Lmatrix_avg = new double[Lmatrix_avg_nn];
+	int *Lmatrix_index_avg = new int[Lmatrix_avg_nn];
+	image_pixel_location_Lmatrix_avg[0] = 0;
+	for (img_index=0; img_index < image_npixels; img_index++) {
+		image_pixel_location_Lmatrix_avg[img_index+1] = image_pixel_location_Lmatrix_avg[img_index] + Lmatrix_avg_row_nn[img_index];
+		index = image_pixel_location_Lmatrix_avg[img_index];
+		for (col=0; col < Lmatrix_avg_row_nn[img_index]; col++) {
+			Lmatrix_avg[index+col] = Lmatrix_avg_rows[img_index][col];
+			Lmatrix_index_avg[index+col] = Lmatrix_avg_index_rows[img_index][col];
+		}
+	}
+
+	delete[] Lmatrix;
+	delete[] Lmatrix_index;
+	delete[] image_pixel_location_Lmatrix;
+	Lmatrix = Lmatrix_avg;
+	Lmatrix_index = Lmatrix_index_avg;
+	image_pixel_location_Lmatrix = image_pixel_location_Lmatrix_avg;
+	Lmatrix_n_elements = Lmatrix_avg_nn;
+
+	delete[] col_position;
+	delete[] Lmatrix_avg_row_nn;
+	delete[] Lmatrix_avg_rows;
+	delete[] Lmatrix_avg_index_rows;
+}
+
 #define DSWAP(a,b) dtemp=(a);(a)=(b);(b)=dtemp;
 void QLens::fourier_transform(double* data, const int ndim, int* nn, const int isign)
 {
@@ -14754,6 +14870,324 @@ double QLens::interpolate_PSF_matrix(const double x, const double y, const bool
 	return psfint;
 }
 
+bool QLens::load_noise_corr_kernel(const string filename)
+{
+	// The file gives the kernel dimensions (nx ny), followed by the correlation values in the same order as the surface brightness files
+	ifstream kernel_file(filename.c_str());
+	if (!kernel_file.is_open()) return false;
+	int i,j,nx,ny;
+	if (!(kernel_file >> nx >> ny) or (nx <= 0) or (ny <= 0)) return false;
+	double **kernel = new double*[nx];
+	for (i=0; i < nx; i++) kernel[i] = new double[ny];
+	bool read_ok = true;
+	for (i=0; i < nx; i++) {
+		for (j=0; j < ny; j++) {
+			if (!(kernel_file >> kernel[i][j])) read_ok = false;
+		}
+	}
+	double central_value = kernel[nx/2][ny/2];
+	if ((!read_ok) or (central_value <= 0)) {
+		for (i=0; i < nx; i++) delete[] kernel[i];
+		delete[] kernel;
+		return false;
+	}
+	for (i=0; i < nx; i++) {
+		for (j=0; j < ny; j++) kernel[i][j] /= central_value; // the pixel variances are given separately, so the kernel is a correlation (not covariance) function
+	}
+	delete_noise_corr_kernel();
+	noise_corr_kernel = kernel;
+	noise_corr_npixels_x = nx;
+	noise_corr_npixels_y = ny;
+	delete_whitening_kernel();
+	return true;
+}
+
+void QLens::delete_noise_corr_kernel()
+{
+	if (noise_corr_kernel != NULL) {
+		for (int i=0; i < noise_corr_npixels_x; i++) delete[] noise_corr_kernel[i];
+		delete[] noise_corr_kernel;
+		noise_corr_kernel = NULL;
+	}
+	noise_corr_npixels_x = noise_corr_npixels_y = 0;
+}
+
+void QLens::delete_whitening_kernel()
+{
+	if (whitening_kernel != NULL) {
+		for (int i=0; i < whitening_kernel_npixels_x; i++) delete[] whitening_kernel[i];
+		delete[] whitening_kernel;
+		whitening_kernel = NULL;
+	}
+	whitening_kernel_npixels_x = whitening_kernel_npixels_y = 0;
+}
+
+bool QLens::generate_noise_whitening_kernel(const bool verbal)
+{
+	// For stationary noise, the inverse correlation matrix is diagonal in Fourier space, so Xi^(-1/2) is a convolution whose transform is
+	// P(k)^(-1/2), where P(k) is the power spectrum of the correlation kernel. The whitening kernel is found by FFT and then truncated,
+	// which keeps it compact so that whitening the Lmatrix preserves its sparsity (the same way the PSF convolution does).
+	delete_whitening_kernel();
+	if ((whitening_threshold <= 0) or (whitening_threshold >= 1)) {
+		warn("whitening_threshold must be greater than 0 and less than 1");
+		return false;
+	}
+	int i,j,k,ii,jj;
+	int corr_nx_half, corr_ny_half;
+	if (noise_corr_kernel != NULL) {
+		corr_nx_half = noise_corr_npixels_x/2;
+		corr_ny_half = noise_corr_npixels_y/2;
+	} else if (noise_corr_length > 0) {
+		corr_nx_half = ((int) (noise_corr_length*sqrt(-2*log(whitening_threshold)))) + 1;
+		corr_ny_half = corr_nx_half;
+	} else {
+		warn("noise correlation kernel has not been loaded and noise_corr_length has not been set");
+		return false;
+	}
+	int nfft = 64; // must be a power of 2 for the native FFT; padding reduces the wrap-around in the inverse transform
+	while ((nfft < 4*(2*corr_nx_half+1)) or (nfft < 4*(2*corr_ny_half+1))) nfft *= 2;
+	int ntot = nfft*nfft;
+	double *zvec = new double[2*ntot];
+	for (k=0; k < 2*ntot; k++) zvec[k] = 0;
+
+	double corrval;
+	for (i=-corr_nx_half; i <= corr_nx_half; i++) {
+		for (j=-corr_ny_half; j <= corr_ny_half; j++) {
+			if (noise_corr_kernel != NULL) {
+				if ((corr_nx_half+i >= noise_corr_npixels_x) or (corr_ny_half+j >= noise_corr_npixels_y)) continue; // kernel has an even number of pixels along this axis
+				corrval = noise_corr_kernel[corr_nx_half+i][corr_ny_half+j];
+			} else {
+				corrval = exp(-0.5*(i*i+j*j)/SQR(noise_corr_length));
+			}
+			ii = (i < 0) ? i + nfft : i;
+			jj = (j < 0) ? j + nfft : j;
+			zvec[2*(jj*nfft+ii)] = corrval;
+		}
+	}
+	int nnvec[2];
+	nnvec[0] = nfft;
+	nnvec[1] = nfft;
+	fourier_transform(zvec,2,nnvec,1);
+
+	// only the real part is kept, which corresponds to the symmetrized correlation kernel
+	double power, power_max = 0, logdet = 0;
+	for (k=0; k < ntot; k++) {
+		if (zvec[2*k] > power_max) power_max = zvec[2*k];
+	}
+	if (power_max <= 0) {
+		warn("noise correlation kernel has no positive power; cannot generate whitening kernel");
+		delete[] zvec;
+		return false;
+	}
+	double power_min = whitening_threshold*power_max;
+	for (k=0; k < ntot; k++) {
+		power = zvec[2*k];
+		if (power < power_min) power = power_min; // floor the power so that truncation of the kernel doesn't give a non-positive-definite covariance
+		logdet += log(power);
+		zvec[2*k] = 1.0/sqrt(power);
+		zvec[2*k+1] = 0;
+	}
+	noise_corr_logdet_per_pixel = logdet/ntot;
+	fourier_transform(zvec,2,nnvec,-1);
+	for (k=0; k < ntot; k++) zvec[2*k] /= ntot;
+
+	double wmin = whitening_threshold*fabs(zvec[0]);
+	int wk_nx_half=0, wk_ny_half=0;
+	for (i=0; i < nfft; i++) {
+		for (j=0; j < nfft; j++) {
+			if (fabs(zvec[2*(j*nfft+i)]) >= wmin) {
+				ii = (i > nfft/2) ? nfft-i : i;
+				jj = (j > nfft/2) ? nfft-j : j;
+				if (ii > wk_nx_half) wk_nx_half = ii;
+				if (jj > wk_ny_half) wk_ny_half = jj;
+			}
+		}
+	}
+	if (wk_nx_half >= nfft/2) wk_nx_half = nfft/2-1;
+	if (wk_ny_half >= nfft/2) wk_ny_half = nfft/2-1;
+	whitening_kernel_npixels_x = 2*wk_nx_half+1;
+	whitening_kernel_npixels_y = 2*wk_ny_half+1;
+	whitening_kernel = new double*[whitening_kernel_npixels_x];
+	for (i=-wk_nx_half; i <= wk_nx_half; i++) {
+		whitening_kernel[wk_nx_half+i] = new double[whitening_kernel_npixels_y];
+		ii = (i < 0) ? i + nfft : i;
+		for (j=-wk_ny_half; j <= wk_ny_half; j++) {
+			jj = (j < 0) ? j + nfft : j;
+			whitening_kernel[wk_nx_half+i][wk_ny_half+j] = zvec[2*(jj*nfft+ii)];
+		}
+	}
+	delete[] zvec;
+	if ((mpi_id==0) and (verbal)) cout << "Noise whitening kernel: " << whitening_kernel_npixels_x << "x" << whitening_kernel_npixels_y << " pixels, log(det(corr))/npixels = " << noise_corr_logdet_per_pixel << endl;
+	return true;
+}
+
+bool QLens::use_noise_whitening()
+{
+	if (!correlated_noise) return false;
+	if (whitening_kernel != NULL) return true;
+	return generate_noise_whitening_kernel(false);
+}
+
+void QLens::whiten_image_pixel_vector(const int zsrc_i, double *vec, double *white_vec)
+{
+	// Returns W*S^(-1)*vec over the active image pixels, where W is the whitening kernel and S = diag(pixel noise)
+	ImagePixelGrid *image_pixel_grid = image_pixel_grids[zsrc_i];
+	double cov_inverse_bg;
+	if (background_pixel_noise==0) cov_inverse_bg = 1;
+	else cov_inverse_bg = 1.0/SQR(background_pixel_noise);
+	int wk_nx = whitening_kernel_npixels_x, wk_ny = whitening_kernel_npixels_y;
+	int nx_half = wk_nx/2, ny_half = wk_ny/2;
+	int img_index;
+	double *scaled_vec = new double[image_npixels];
+	for (img_index=0; img_index < image_npixels; img_index++) {
+		scaled_vec[img_index] = vec[img_index]*sqrt((use_noise_map) ? imgpixel_covinv_vector[img_index] : cov_inverse_bg);
+	}
+
+	#pragma omp parallel for schedule(static)
+	for (img_index=0; img_index < image_npixels; img_index++) {
+		int i,j,k,l,wk,wl;
+		double wval = 0;
+		k = image_pixel_grid->active_image_pixel_i[img_index];
+		l = image_pixel_grid->active_image_pixel_j[img_index];
+		for (wk=0; wk < wk_nx; wk++) {
+			i = k + nx_half - wk;
+			if ((i < 0) or (i >= image_pixel_grid->x_N)) continue;
+			for (wl=0; wl < wk_ny; wl++) {
+				j = l + ny_half - wl;
+				if ((j < 0) or (j >= image_pixel_grid->y_N)) continue;
+				if (image_pixel_grid->maps_to_source_pixel[i][j]) wval += whitening_kernel[wk][wl]*scaled_vec[image_pixel_grid->pixel_index[i][j]];
+			}
+		}
+		white_vec[img_index] = wval;
+	}
+	delete[] scaled_vec;
+}
+
+void QLens::whiten_Lmatrix(const int zsrc_i, double*& Lw, int*& Lw_index, int*& Lw_location, int& Lw_nn)
+{
+	// Generates W*S^(-1)*L in the same row-compressed format as the Lmatrix, so that F = (WS^(-1)L)^T (WS^(-1)L) = L^T C^(-1) L
+	ImagePixelGrid *image_pixel_grid = image_pixel_grids[zsrc_i];
+	double cov_inverse_bg;
+	if (background_pixel_noise==0) cov_inverse_bg = 1;
+	else cov_inverse_bg = 1.0/SQR(background_pixel_noise);
+	int wk_nx = whitening_kernel_npixels_x, wk_ny = whitening_kernel_npixels_y;
+	int nx_half = wk_nx/2, ny_half = wk_ny/2;
+	int img_index;
+	double *sqrt_covinv = new double[image_npixels];
+	for (img_index=0; img_index < image_npixels; img_index++) {
+		sqrt_covinv[img_index] = sqrt((use_noise_map) ? imgpixel_covinv_vector[img_index] : cov_inverse_bg);
+	}
+
+	int *Lw_row_nn = new int[image_npixels];
+	vector<double> *Lw_rows = new vector<double>[image_npixels];
+	vector<int> *Lw_index_rows = new vector<int>[image_npixels];
+
+	#pragma omp parallel
+	{
+		int i,j,k,l,wk,wl,img_index2,index,src_index,col;
+		double wval;
+		int *col_position = new int[source_n_amps];
+		for (col=0; col < source_n_amps; col++) col_position[col] = -1;
+		#pragma omp for schedule(static)
+		for (img_index=0; img_index < image_npixels; img_index++) {
+			Lw_row_nn[img_index] = 0;
+			k = image_pixel_grid->active_image_pixel_i[img_index];
+			l = image_pixel_grid->active_image_pixel_j[img_index];
+			for (wk=0; wk < wk_nx; wk++) {
+				i = k + nx_half - wk;
+				if ((i < 0) or (i >= image_pixel_grid->x_N)) continue;
+				for (wl=0; wl < wk_ny; wl++) {
+					j = l + ny_half - wl;
+					if ((j < 0) or (j >= image_pixel_grid->y_N)) continue;
+					if (image_pixel_grid->maps_to_source_pixel[i][j]) {
+						img_index2 = image_pixel_grid->pixel_index[i][j];
+						wval = whitening_kernel[wk][wl]*sqrt_covinv[img_index2];
+						for (index=image_pixel_location_Lmatrix[img_index2]; index < image_pixel_location_Lmatrix[img_index2+1]; index++) {
+							if (Lmatrix[index] != 0) {
+								src_index = Lmatrix_index[index];
+								if (col_position[src_index] < 0) {
+									col_position[src_index] = Lw_row_nn[img_index]++;
+									Lw_rows[img_index].push_back(wval*Lmatrix[index]);
+									Lw_index_rows[img_index].push_back(src_index);
+								} else {
+									Lw_rows[img_index][col_position[src_index]] += wval*Lmatrix[index];
+								}
+							}
+						}
+					}
+				}
+			}
+			for (col=0; col < Lw_row_nn[img_index]; col++) col_position[Lw_index_rows[img_index][col]] = -1;
+		}
+		delete[] col_position;
+	}
+
+	Lw_location = new int[image_npixels+1];
+	Lw_location[0] = 0;
+	for (img_index=0; img_index < image_npixels; img_index++) Lw_location[img_index+1] = Lw_location[img_index] + Lw_row_nn[img_index];
+	Lw_nn = Lw_location[image_npixels];
+	Lw = new double[Lw_nn];
+	Lw_index = new int[Lw_nn];
+	#pragma omp parallel for schedule(static)
+	for (img_index=0; img_index < image_npixels; img_index++) {
+		int col, index = Lw_location[img_index];
+		for (col=0; col < Lw_row_nn[img_index]; col++, index++) {
+			Lw[index] = Lw_rows[img_index][col];
+			Lw_index[index] = Lw_index_rows[img_index][col];
+		}
+	}
+
+	delete[] sqrt_covinv;
+	delete[] Lw_row_nn;
+	delete[] Lw_rows;
+	delete[] Lw_index_rows;
+}
+
+void QLens::whiten_Lmatrix_dense(const int zsrc_i, dmatrix& Lw)
+{
+	// Dense version of whiten_Lmatrix; each column of the dense Lmatrix is whitened as an image pixel vector
+	Lw.input(image_npixels,source_n_amps);
+	double *col_vec = new double[image_npixels];
+	double *white_col_vec = new double[image_npixels];
+	int i,j;
+	for (j=0; j < source_n_amps; j++) {
+		for (i=0; i < image_npixels; i++) col_vec[i] = Lmatrix_dense[i][j];
+		whiten_image_pixel_vector(zsrc_i,col_vec,white_col_vec);
+		for (i=0; i < image_npixels; i++) Lw[i][j] = white_col_vec[i];
+	}
+	delete[] col_vec;
+	delete[] white_col_vec;
+}
+
+double QLens::correlated_noise_chisq(double **scaled_residual, bool **included, const int nx, const int ny)
+{
+	// Here the residuals have already been divided by the pixel noise, so the chi-square is the squared norm of the whitened residuals
+	int wk_nx = whitening_kernel_npixels_x, wk_ny = whitening_kernel_npixels_y;
+	int nx_half = wk_nx/2, ny_half = wk_ny/2;
+	int k;
+	double chisq = 0;
+	#pragma omp parallel for schedule(static) reduction(+:chisq)
+	for (k=0; k < nx; k++) {
+		int i,j,l,wk,wl;
+		double wval;
+		for (l=0; l < ny; l++) {
+			if (!included[k][l]) continue;
+			wval = 0;
+			for (wk=0; wk < wk_nx; wk++) {
+				i = k + nx_half - wk;
+				if ((i < 0) or (i >= nx)) continue;
+				for (wl=0; wl < wk_ny; wl++) {
+					j = l + ny_half - wl;
+					if ((j < 0) or (j >= ny)) continue;
+					if (included[i][j]) wval += whitening_kernel[wk][wl]*scaled_residual[i][j];
+				}
+			}
+			chisq += wval*wval;
+		}
+	}
+	return chisq;
+}
+
 void QLens::generate_supersampled_PSF_matrix(const bool downsample, const int downsample_fac)
 {
 	int i,j;
@@ -14851,6 +15285,7 @@ bool QLens::create_regularization_matrix(const int zsrc_i, const bool allow_lum_
 {
 	RegularizationMethod reg_method = regularization_method;
 	if ((use_lum_weighted_regularization) and (!allow_lum_weighting)) reg_method = Curvature;
+	Rmatrix_reg_method = reg_method;
 	if (Rmatrix != NULL) { delete[] Rmatrix; Rmatrix = NULL; }
 	if (Rmatrix_index != NULL) { delete[] Rmatrix_index; Rmatrix_index = NULL; }
 	if (allow_lum_weighting) calculate_lumreg_srcpixel_weights(zsrc_i,use_sbweights);
@@ -15073,27 +15508,59 @@ void QLens::create_lensing_matrices_from_Lmatrix(const int zsrc_i, const bool de
 
 	int pix_i, pix_j, img_index_fgmask;
 	double sbcov;
-	//double *Lmatrix_eff;
-	//Lmatrix_eff = new double[Lmatrix_n_elements];
-	for (i=0; i < image_npixels; i++) {
-		if (use_noise_map) cov_inverse = imgpixel_covinv_vector[i];
-		pix_i = image_pixel_grid->active_image_pixel_i[i];
-		pix_j = image_pixel_grid->active_image_pixel_j[i];
-		img_index_fgmask = image_pixel_grid->pixel_index_fgmask[pix_i][pix_j];
-		sbcov = image_surface_brightness[i] - sbprofile_surface_brightness[img_index_fgmask];
-		if (((!include_imgfluxes_in_inversion) and (!include_srcflux_in_inversion)) and (n_ptsrc > 0)) sbcov -= point_image_surface_brightness[i];
-		sbcov *= cov_inverse;
-		for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
-			//Dvector[Lmatrix_index[j]] += Lmatrix[j]*(image_surface_brightness[i] - sbprofile_surface_brightness[i])/cov_inverse;
-			//Dvector[Lmatrix_index[j]] += Lmatrix[j]*(image_surface_brightness[i] - image_pixel_grid->foreground_surface_brightness[pix_i][pix_j])/cov_inverse;
-			Dvector[Lmatrix_index[j]] += Lmatrix[j]*sbcov;
-			//Lmatrix_eff[j] = Lmatrix[j]*sqrt(cov_inverse);
+	// With correlated noise, the whitened Lmatrix (W*S^(-1)*L) temporarily replaces the Lmatrix while the Fmatrix is constructed
+	bool whiten = use_noise_whitening();
+	double *Lmatrix_unwhitened;
+	int *Lmatrix_index_unwhitened, *image_pixel_location_Lmatrix_unwhitened;
+	int Lmatrix_n_elements_unwhitened;
+	if (whiten) {
+		double *sb_vec = new double[image_npixels];
+		double *white_sb_vec = new double[image_npixels];
+		for (i=0; i < image_npixels; i++) {
+			pix_i = image_pixel_grid->active_image_pixel_i[i];
+			pix_j = image_pixel_grid->active_image_pixel_j[i];
+			img_index_fgmask = image_pixel_grid->pixel_index_fgmask[pix_i][pix_j];
+			sb_vec[i] = image_surface_brightness[i] - sbprofile_surface_brightness[img_index_fgmask];
+			if (((!include_imgfluxes_in_inversion) and (!include_srcflux_in_inversion)) and (n_ptsrc > 0)) sb_vec[i] -= point_image_surface_brightness[i];
+		}
+		whiten_image_pixel_vector(zsrc_i,sb_vec,white_sb_vec);
+
+		Lmatrix_unwhitened = Lmatrix;
+		Lmatrix_index_unwhitened = Lmatrix_index;
+		image_pixel_location_Lmatrix_unwhitened = image_pixel_location_Lmatrix;
+		Lmatrix_n_elements_unwhitened = Lmatrix_n_elements;
+		whiten_Lmatrix(zsrc_i,Lmatrix,Lmatrix_index,image_pixel_location_Lmatrix,Lmatrix_n_elements);
+		if ((mpi_id==0) and (verbal)) cout << "Whitened Lmatrix has " << Lmatrix_n_elements << " elements (unwhitened: " << Lmatrix_n_elements_unwhitened << ")\n";
+		for (i=0; i < image_npixels; i++) {
+			for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
+				Dvector[Lmatrix_index[j]] += Lmatrix[j]*white_sb_vec[i];
+			}
 		}
-	}
-	for (i=0; i < image_npixels; i++) {
-		if (use_noise_map) cov_inverse = imgpixel_covinv_vector[i];
-		for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
-			Lmatrix[j] *= sqrt(cov_inverse);
+		delete[] sb_vec;
+		delete[] white_sb_vec;
+	} else {
+		//double *Lmatrix_eff;
+		//Lmatrix_eff = new double[Lmatrix_n_elements];
+		for (i=0; i < image_npixels; i++) {
+			if (use_noise_map) cov_inverse = imgpixel_covinv_vector[i];
+			pix_i = image_pixel_grid->active_image_pixel_i[i];
+			pix_j = image_pixel_grid->active_image_pixel_j[i];
+			img_index_fgmask = image_pixel_grid->pixel_index_fgmask[pix_i][pix_j];
+			sbcov = image_surface_brightness[i] - sbprofile_surface_brightness[img_index_fgmask];
+			if (((!include_imgfluxes_in_inversion) and (!include_srcflux_in_inversion)) and (n_ptsrc > 0)) sbcov -= point_image_surface_brightness[i];
+			sbcov *= cov_inverse;
+			for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
+				//Dvector[Lmatrix_index[j]] += Lmatrix[j]*(image_surface_brightness[i] - sbprofile_surface_brightness[i])/cov_inverse;
+				//Dvector[Lmatrix_index[j]] += Lmatrix[j]*(image_surface_brightness[i] - image_pixel_grid->foreground_surface_brightness[pix_i][pix_j])/cov_inverse;
+				Dvector[Lmatrix_index[j]] += Lmatrix[j]*sbcov;
+				//Lmatrix_eff[j] = Lmatrix[j]*sqrt(cov_inverse);
+			}
+		}
+		for (i=0; i < image_npixels; i++) {
+			if (use_noise_map) cov_inverse = imgpixel_covinv_vector[i];
+			for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
+				Lmatrix[j] *= sqrt(cov_inverse);
+			}
 		}
 	}
 
@@ -15382,10 +15849,20 @@ void QLens::create_lensing_matrices_from_Lmatrix(const int zsrc_i, const bool de
 			wtime0 = omp_get_wtime();
 		}
 #endif
-	for (i=0; i < image_npixels; i++) {
-		if (use_noise_map) cov_inverse = imgpixel_covinv_vector[i];
-		for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
-			Lmatrix[j] /= sqrt(cov_inverse);
+	if (whiten) {
+		delete[] Lmatrix;
+		delete[] Lmatrix_index;
+		delete[] image_pixel_location_Lmatrix;
+		Lmatrix = Lmatrix_unwhitened;
+		Lmatrix_index = Lmatrix_index_unwhitened;
+		image_pixel_location_Lmatrix = image_pixel_location_Lmatrix_unwhitened;
+		Lmatrix_n_elements = Lmatrix_n_elements_unwhitened;
+	} else {
+		for (i=0; i < image_npixels; i++) {
+			if (use_noise_map) cov_inverse = imgpixel_covinv_vector[i];
+			for (j=image_pixel_location_Lmatrix[i]; j < image_pixel_location_Lmatrix[i+1]; j++) {
+				Lmatrix[j] /= sqrt(cov_inverse);
+			}
 		}
 	}
 
@@ -15608,6 +16085,33 @@ void QLens::create_lensing_matrices_from_Lmatrix_dense(const int zsrc_i, const b
 
 	int i,j,l,n;
 
+	// With correlated noise, the whitened Lmatrix and data (which already include the noise scaling) are used in place of the originals
+	bool whiten = use_noise_whitening();
+	bool noise_map = ((use_noise_map) and (!whiten));
+	dmatrix Lmatrix_white;
+	double *white_sb_vec = NULL;
+	double **Lmat = Lmatrix_dense.pointer();
+	if (whiten) {
+		cov_inverse = 1;
+		int pix_i, pix_j, img_index_fgmask;
+		double *sb_vec = new double[image_npixels];
+		white_sb_vec = new double[image_npixels];
+		for (j=0; j < image_npixels; j++) {
+			pix_i = image_pixel_grid->active_image_pixel_i[j];
+			pix_j = image_pixel_grid->active_image_pixel_j[j];
+			img_index_fgmask = image_pixel_grid->pixel_index_fgmask[pix_i][pix_j];
+			if ((zero_sb_extended_mask_prior) and (include_extended_mask_in_inversion) and (image_pixel_data->extended_mask[assigned_mask[zsrc_i]][pix_i][pix_j]) and (!image_pixel_data->in_mask[assigned_mask[zsrc_i]][pix_i][pix_j])) sb_vec[j] = 0;
+			else {
+				sb_vec[j] = image_surface_brightness[j] - sbprofile_surface_brightness[img_index_fgmask];
+				if (((!include_imgfluxes_in_inversion) and (!include_srcflux_in_inversion)) and (n_ptsrc > 0)) sb_vec[j] -= point_image_surface_brightness[j];
+			}
+		}
+		whiten_image_pixel_vector(zsrc_i,sb_vec,white_sb_vec);
+		whiten_Lmatrix_dense(zsrc_i,Lmatrix_white);
+		Lmat = Lmatrix_white.pointer();
+		delete[] sb_vec;
+	}
+
 	bool new_entry;
 	Dvector = new double[source_n_amps];
 	for (i=0; i < source_n_amps; i++) Dvector[i] = 0;
@@ -15650,23 +16154,24 @@ void QLens::create_lensing_matrices_from_Lmatrix_dense(const int zsrc_i, const b
 		for (i=0; i < source_n_amps; i++) {
 			row = i*image_npixels;
 			for (j=0; j < image_npixels; j++) {
-				if (use_noise_map) covinv = imgpixel_covinv_vector[j];
+				if (noise_map) covinv = imgpixel_covinv_vector[j];
 				pix_i = image_pixel_grid->active_image_pixel_i[j];
 				pix_j = image_pixel_grid->active_image_pixel_j[j];
 				img_index_fgmask = image_pixel_grid->pixel_index_fgmask[pix_i][pix_j];
 				//Dvector[i] += Lmatrix_dense[j][i]*(image_surface_brightness[j] - sbprofile_surface_brightness[j])/cov_inverse;
 				//Dvector[i] += Lmatrix_dense[j][i]*(image_surface_brightness[j] - image_pixel_grid->foreground_surface_brightness[pix_i][pix_j])/cov_inverse;
-				if ((zero_sb_extended_mask_prior) and (include_extended_mask_in_inversion) and (image_pixel_data->extended_mask[assigned_mask[zsrc_i]][pix_i][pix_j]) and (!image_pixel_data->in_mask[assigned_mask[zsrc_i]][pix_i][pix_j])) ; 
+				if (whiten) Dvector[i] += Lmat[j][i]*white_sb_vec[j];
+				else if ((zero_sb_extended_mask_prior) and (include_extended_mask_in_inversion) and (image_pixel_data->extended_mask[assigned_mask[zsrc_i]][pix_i][pix_j]) and (!image_pixel_data->in_mask[assigned_mask[zsrc_i]][pix_i][pix_j])) ; 
 				else {
 					sb_adj = image_surface_brightness[j] - sbprofile_surface_brightness[img_index_fgmask];
 					if (((!include_imgfluxes_in_inversion) and (!include_srcflux_in_inversion)) and (n_ptsrc > 0)) sb_adj -= point_image_surface_brightness[j];
-					Dvector[i] += Lmatrix_dense[j][i]*sb_adj*covinv;
+					Dvector[i] += Lmat[j][i]*sb_adj*covinv;
 					//if (sbprofile_surface_brightness[img_index_fgmask]*0.0 != 0.0) die("FUCK");
 				}
 #ifdef USE_MKL
-				Ltrans_stacked[row+j] = Lmatrix_dense[j][i]*sqrt(covinv); // hack to get the cov_inverse in there
+				Ltrans_stacked[row+j] = (whiten) ? Lmat[j][i] : Lmat[j][i]*sqrt(covinv); // hack to get the cov_inverse in there
 #else
-				Ltrans[i][j] = Lmatrix_dense[j][i];
+				Ltrans[i][j] = Lmat[j][i];
 #endif
 			}
 		}
@@ -15696,7 +16201,7 @@ void QLens::create_lensing_matrices_from_Lmatrix_dense(const int zsrc_i, const b
 			lmatptr1 = Ltrans[i];
 			lmatptr2 = Ltrans[j];
 			(*fpmatptr) = 0;
-			if (use_noise_map) {
+			if (noise_map) {
 				covinvptr = imgpixel_covinv_vector;
 				for (l=0; l < image_npixels; l++) {
 					(*fpmatptr) += (*(lmatptr1++))*(*(lmatptr2++))*(*(covinvptr++));
@@ -15733,6 +16238,7 @@ void QLens::create_lensing_matrices_from_Lmatrix_dense(const int zsrc_i, const b
 	delete[] i_n;
 	delete[] j_n;
 #endif
+	if (white_sb_vec != NULL) delete[] white_sb_vec;
 }
 
 
@@ -15877,6 +16383,7 @@ bool QLens::optimize_regularization_parameter(const int zsrc_i, const bool dense
 	if (dense_Fmatrix) chisqreg = &QLens::chisq_regparam_dense;
 	else chisqreg = &QLens::chisq_regparam;
 	logreg_min = brents_min_method(chisqreg,optimize_regparam_minlog,optimize_regparam_maxlog,optimize_regparam_tol,verbal);
+	RegularizationMethod logreg_min_method = Rmatrix_reg_method; // the previous optimum is only used as a warm start for the same method
 	//(this->*chisqreg)(log((*regparam_ptr))/ln10); // used for testing purposes
 	(*regparam_ptr) = pow(10,logreg_min);
 	if ((verbal) and (mpi_id==0)) cout << "regparam after optimizing: " << (*regparam_ptr) << endl;
@@ -15911,7 +16418,11 @@ bool QLens::optimize_regularization_parameter(const int zsrc_i, const bool dense
 				wtime_opt0 = omp_get_wtime();
 			}
 #endif
-			logreg_min = brents_min_method(chisqreg,optimize_regparam_minlog,optimize_regparam_maxlog,optimize_regparam_tol,verbal);
+			// the luminosity weighting usually shifts the optimal regparam only modestly, so start from a narrow bracket around the previous
+			// optimum; but if the regularization method just changed (e.g. from curvature to a covariance kernel), the optimum is unrelated
+			if (Rmatrix_reg_method==logreg_min_method) logreg_min = brents_min_method_warm(chisqreg,logreg_min,optimize_regparam_minlog,optimize_regparam_maxlog,optimize_regparam_tol,verbal);
+			else logreg_min = brents_min_method(chisqreg,optimize_regparam_minlog,optimize_regparam_maxlog,optimize_regparam_tol,verbal);
+			logreg_min_method = Rmatrix_reg_method;
 			//(this->*chisqreg)(log(regparam_lhi)/ln10); // used for testing purposes
 			(*regparam_ptr) = pow(10,logreg_min);
 			if ((verbal) and (mpi_id==0)) cout << "regparam after optimizing with luminosity-weighted regularization: " << (*regparam_ptr) << endl;
@@ -15921,11 +16432,14 @@ bool QLens::optimize_regularization_parameter(const int zsrc_i, const bool dense
 			if (verbal) if (mpi_id==0) cout << "loglike=" << regopt_chisqmin << endl;
 		}
 
+		double loglike_prev = regopt_chisqmin;
 		for (int j=0; j < lumreg_max_it; j++) {
 			if (create_regularization_matrix(zsrc_i,true)==false) return false; // must re-generate covariance matrix with updated correlation lengths (from new pixel sb-weights)
 			if (use_covariance_matrix) generate_Gmatrix();
 			regopt_chisqmin = 1e30;
-			logreg_min = brents_min_method(chisqreg,optimize_regparam_minlog,optimize_regparam_maxlog,optimize_regparam_tol,verbal);
+			if (Rmatrix_reg_method==logreg_min_method) logreg_min = brents_min_method_warm(chisqreg,logreg_min,optimize_regparam_minlog,optimize_regparam_maxlog,optimize_regparam_tol,verbal);
+			else logreg_min = brents_min_method(chisqreg,optimize_regparam_minlog,optimize_regparam_maxlog,optimize_regparam_tol,verbal);
+			logreg_min_method = Rmatrix_reg_method;
 			//(this->*chisqreg)(log(regparam_lhi)/ln10); // used for testing purposes
 			(*regparam_ptr) = pow(10,logreg_min);
 			if ((verbal) and (mpi_id==0)) cout << "regparam after optimizing with luminosity-weighted regularization: " << (*regparam_ptr) << endl;
@@ -15933,6 +16447,8 @@ bool QLens::optimize_regularization_parameter(const int zsrc_i, const bool dense
 			else Fmatrix_log_determinant = regopt_logdet;
 			for (i=0; i < source_n_amps; i++) source_pixel_vector[i] = source_pixel_vector_minchisq[i];
 			if (verbal) if (mpi_id==0) cout << "lumreg_it=" << j << " loglike=" << regopt_chisqmin << endl;
+			if (abs(regopt_chisqmin-loglike_prev) < chisqtol_lumreg) break; // the source (and hence the luminosity weights) have stopped changing
+			loglike_prev = regopt_chisqmin;
 		}
 
 #ifdef USE_OPENMP
@@ -15983,6 +16499,7 @@ void QLens::setup_regparam_optimization(const int zsrc_i, const bool dense_Fmatr
 	ImagePixelGrid *image_pixel_grid;
 	image_pixel_grid = image_pixel_grids[zsrc_i];
 	img_minus_sbprofile = new double[image_npixels];
+	regopt_zsrc_i = zsrc_i;
 	int i, pix_i, pix_j, img_index_fgmask;
 	if (image_pixel_grid->active_image_pixel_i==NULL) die("did not allocate memory to active_image_pixel_i array");
 	for (i=0; i < image_npixels; i++) {
@@ -16491,6 +17008,8 @@ double QLens::chisq_regparam(const double logreg)
 	else die("can only use MUMPS or UMFPACK for sparse inversions with optimize_regparam on");
 
 	double temp_img, Ed_times_two=0,Es_times_two=0;
+	bool whiten = use_noise_whitening();
+	double *residual = (whiten) ? new double[image_npixels] : NULL;
 
 	#pragma omp parallel for private(temp_img,i,j,cov_inverse) schedule(static) reduction(+:Ed_times_two)
 	for (i=0; i < image_npixels; i++) {
@@ -16502,7 +17021,13 @@ double QLens::chisq_regparam(const double logreg)
 		}
 
 		// NOTE: this chisq does not include foreground mask pixels that lie outside the primary mask, since those pixels don't contribute to determining the regularization
-		Ed_times_two += SQR(temp_img - img_minus_sbprofile[i])*cov_inverse;
+		if (whiten) residual[i] = temp_img - img_minus_sbprofile[i];
+		else Ed_times_two += SQR(temp_img - img_minus_sbprofile[i])*cov_inverse;
+	}
+	if (whiten) {
+		whiten_image_pixel_vector(regopt_zsrc_i,residual,residual); // whitening is not done in place, so reuse the input after copying
+		for (i=0; i < image_npixels; i++) Ed_times_two += SQR(residual[i]);
+		delete[] residual;
 	}
 	for (i=0; i < source_npixels; i++) {
 		Es_times_two += Rmatrix[i]*SQR(source_pixel_vector[i]);
@@ -16615,6 +17140,8 @@ double QLens::chisq_regparam_dense(const double logreg)
 	}
 
 	double temp_img, Ed_times_two=0,Es_times_two=0;
+	bool whiten = use_noise_whitening();
+	double *residual = (whiten) ? new double[image_npixels] : NULL;
 	double *Lmatptr;
 	double *tempsrcptr = source_pixel_vector;
 	double *tempsrc_end = source_pixel_vector + source_n_amps;
@@ -16640,7 +17167,13 @@ double QLens::chisq_regparam_dense(const double logreg)
 			}
 		}
 		// NOTE: this chisq does not include foreground mask pixels that lie outside the primary mask, since those pixels don't contribute to determining the regularization
-		Ed_times_two += SQR(temp_img - img_minus_sbprofile[i])*cov_inverse;
+		if (whiten) residual[i] = temp_img - img_minus_sbprofile[i];
+		else Ed_times_two += SQR(temp_img - img_minus_sbprofile[i])*cov_inverse;
+	}
+	if (whiten) {
+		whiten_image_pixel_vector(regopt_zsrc_i,residual,residual);
+		for (i=0; i < image_npixels; i++) Ed_times_two += SQR(residual[i]);
+		delete[] residual;
 	}
 
 /*
@@ -16846,6 +17379,25 @@ double QLens::chisq_regparam_lumreg_dense()
 }
 */
 
+double QLens::brents_min_method_warm(double (QLens::*func)(const double), const double guess, const double ax, const double bx, const double tol, const bool verbal)
+{
+	// Brent's method starting from a narrow bracket around a previous optimum of log(regparam). If the minimum lands on an edge
+	// of the narrow bracket that is not also an edge of the full range (ax,bx), it was not bracketed, so the full range is searched
+	const double halfwidth = 1.0;
+	double a = dmax(ax,guess-halfwidth);
+	double b = dmin(bx,guess+halfwidth);
+	if (b-a < 4*tol) return brents_min_method(func,ax,bx,tol,verbal);
+	double x = brents_min_method(func,a,b,tol,verbal);
+	double tol2 = 2.0*(tol*abs(x) + 1.0e-10);
+	if (((a > ax) and (x-a < tol2)) or ((b < bx) and (b-x < tol2))) {
+		if ((verbal) and (mpi_id==0)) cout << "regparam minimum not bracketed near previous optimum; searching full range" << endl;
+		x = brents_min_method(func,ax,bx,tol,verbal);
+	} else if ((verbal) and (mpi_id==0)) {
+		cout << "regparam optimized within (" << a << "," << b << ") around previous log(regparam)=" << guess << endl;
+	}
+	return x;
+}
+
 double QLens::brents_min_method(double (QLens::*func)(const double), const double ax, const double bx, const double tol, const bool verbal)
 {
 	// (NOTE: I've found that with optimizing the regularization, it always seems to converge even if we ONLY do parabolic
@@ -17419,7 +17971,9 @@ void QLens::invert_lens_mapping_CG_method(const int zsrc_i, bool verbal)
 	cg_method.set_MPI_comm(&sub_comm);
 #endif
 	for (int i=0; i < source_n_amps; i++) temp[i] = 0;
-	if ((regularization_method != None) and (source_npixels > 0))
+	// the exact determinant is found during the CG iterations themselves, which requires at least n iterations; with the stochastic
+	// estimator, the solve only has to converge and the determinant is estimated afterwards
+	if ((regularization_method != None) and (source_npixels > 0) and (cg_logdet_nprobes==0))
 		cg_method.set_determinant_mode(true);
 	else cg_method.set_determinant_mode(false);
 #ifdef USE_OPENMP
@@ -17437,14 +17991,30 @@ void QLens::invert_lens_mapping_CG_method(const int zsrc_i, bool verbal)
 	}
 
 	if ((regularization_method != None) and (source_npixels > 0)) {
-		cg_method.get_log_determinant(Fmatrix_log_determinant);
-		if ((mpi_id==0) and (verbal)) cout << "log determinant = " << Fmatrix_log_determinant << endl;
+		double logdet_err;
+		if (cg_logdet_nprobes > 0) {
+			cg_method.set_stochastic_logdet(cg_logdet_nprobes,cg_logdet_lanczos_steps,cg_logdet_tol);
+			Fmatrix_log_determinant = cg_method.calculate_log_determinant();
+			cg_method.get_log_determinant_error(logdet_err);
+			if ((mpi_id==0) and (verbal)) cout << "log determinant = " << Fmatrix_log_determinant << " +/- " << logdet_err << " (" << cg_logdet_nprobes << " probes)" << endl;
+		} else {
+			cg_method.get_log_determinant(Fmatrix_log_determinant);
+			if ((mpi_id==0) and (verbal)) cout << "log determinant = " << Fmatrix_log_determinant << endl;
+		}
 		CG_sparse cg_det(Rmatrix,Rmatrix_index,3e-4,100000,inversion_nthreads,group_np,group_id);
 #ifdef USE_MPI
 		cg_det.set_MPI_comm(&sub_comm);
 #endif
+		cg_det.set_stochastic_logdet(cg_logdet_nprobes,cg_logdet_lanczos_steps,cg_logdet_tol);
 		Rmatrix_log_determinant = cg_det.calculate_log_determinant();
-		if ((mpi_id==0) and (verbal)) cout << "Rmatrix log determinant = " << Rmatrix_log_determinant << endl;
+		if ((mpi_id==0) and (verbal)) {
+			cout << "Rmatrix log determinant = " << Rmatrix_log_determinant;
+			if (cg_logdet_nprobes > 0) {
+				cg_det.get_log_determinant_error(logdet_err);
+				cout << " +/- " << logdet_err;
+			}
+			cout << endl;
+		}
 	}
 
 #ifdef USE_OPENMP
@@ -18368,16 +18938,17 @@ void QLens::calculate_foreground_pixel_surface_brightness(const int zsrc_i, cons
 		thread = 0;
 #endif
 
-		int ii, jj, nsplit;
+		int ii, jj, nsplit, nsubpix, max_nsubpix = 0;
 		double u0, w0, sb;
 		//double U0, W0, U1, W1;
-		lensvector center_pt, center_srcpt;
+		lensvector center_pt;
 		lensvector corner1, corner2, corner3, corner4;
-		lensvector corner1_src, corner2_src, corner3_src, corner4_src;
 		double subpixel_xlength, subpixel_ylength;
 		double noise;
 		int subcell_index;
-		#pragma omp for private(img_index,i,j,ii,jj,nsplit,u0,w0,sb,subpixel_xlength,subpixel_ylength,center_pt,center_srcpt,corner1,corner2,corner3,corner4,corner1_src,corner2_src,corner3_src,corner4_src,subcell_index,noise) schedule(dynamic)
+		// the subpixel centers (and their source points) are gathered so each profile can be evaluated in one batched call per pixel
+		double *xvals = NULL, *yvals = NULL, *srcxvals = NULL, *srcyvals = NULL, *sbvals = NULL;
+		#pragma omp for private(img_index,i,j,ii,jj,nsplit,nsubpix,u0,w0,sb,subpixel_xlength,subpixel_ylength,center_pt,corner1,corner2,corner3,corner4,subcell_index,noise) schedule(dynamic)
 		for (img_index=0; img_index < image_npixels_fgmask; img_index++) {
 			sbprofile_surface_brightness[img_index] = 0;
 
@@ -18399,63 +18970,84 @@ void QLens::calculate_foreground_pixel_surface_brightness(const int zsrc_i, cons
 					} 
 				}
 			}
+			nsubpix = nsplit*nsplit;
+			if (nsubpix > max_nsubpix) {
+				if (max_nsubpix > 0) {
+					delete[] xvals;
+					delete[] yvals;
+					delete[] srcxvals;
+					delete[] srcyvals;
+					delete[] sbvals;
+				}
+				max_nsubpix = nsubpix;
+				xvals = new double[max_nsubpix];
+				yvals = new double[max_nsubpix];
+				srcxvals = new double[max_nsubpix];
+				srcyvals = new double[max_nsubpix];
+				sbvals = new double[max_nsubpix];
+			}
 
 			subpixel_xlength = image_pixel_grid->pixel_xlength/nsplit;
 			subpixel_ylength = image_pixel_grid->pixel_ylength/nsplit;
 			subcell_index = 0;
 			for (ii=0; ii < nsplit; ii++) {
 				u0 = ((double) (1+2*ii))/(2*nsplit);
-				//center_pt[0] = u0*image_pixel_grid->corner_pts[i][j][0] + (1-u0)*image_pixel_grid->corner_pts[i+1][j][0];
-				center_pt[0] = (1-u0)*image_pixel_grid->corner_pts[i][j][0] + u0*image_pixel_grid->corner_pts[i+1][j][0];
 				for (jj=0; jj < nsplit; jj++) {
 					w0 = ((double) (1+2*jj))/(2*nsplit);
-					//center_pt[1] = w0*image_pixel_grid->corner_pts[i][j][1] + (1-w0)*image_pixel_grid->corner_pts[i][j+1][1];
-					center_pt[1] = (1-w0)*image_pixel_grid->corner_pts[i][j][1] + w0*image_pixel_grid->corner_pts[i][j+1][1];
-					//center_pt = image_pixel_grid->subpixel_center_pts[i][j][subcell_index]; 
-					//cout << "CHECK: " << image_pixel_grid->subpixel_center_pts[i][j][subcell_index][0] << " " << center_pt[0] << " and " << image_pixel_grid->subpixel_center_pts[i][j][subcell_index][1] << " " << center_pt[1] << endl;
-					for (int k=0; k < n_sb; k++) {
-						if ((at_least_one_foreground_src) and (!sb_list[k]->is_lensed) and ((source_fit_mode != Shapelet_Source) or (sb_list[k]->sbtype != SHAPELET))) {
-							if (!sb_list[k]->zoom_subgridding) {
-								sb += sb_list[k]->surface_brightness(center_pt[0],center_pt[1]);
-							}
-							else {
-								corner1[0] = center_pt[0] - subpixel_xlength/2;
-								corner1[1] = center_pt[1] - subpixel_ylength/2;
-								corner2[0] = center_pt[0] + subpixel_xlength/2;
-								corner2[1] = center_pt[1] - subpixel_ylength/2;
-								corner3[0] = center_pt[0] - subpixel_xlength/2;
-								corner3[1] = center_pt[1] + subpixel_ylength/2;
-								corner4[0] = center_pt[0] + subpixel_xlength/2;
-								corner4[1] = center_pt[1] + subpixel_ylength/2;
-								noise = (use_noise_map) ? image_pixel_grid->noise_map[i][j] : background_pixel_noise;
-								sb += sb_list[k]->surface_brightness_zoom(center_pt,corner1,corner2,corner3,corner4,noise);
-							}
+					xvals[subcell_index] = (1-u0)*image_pixel_grid->corner_pts[i][j][0] + u0*image_pixel_grid->corner_pts[i+1][j][0];
+					yvals[subcell_index] = (1-w0)*image_pixel_grid->corner_pts[i][j][1] + w0*image_pixel_grid->corner_pts[i][j+1][1];
+					subcell_index++;
+				}
+			}
+			for (k=0; k < n_sb; k++) {
+				if ((at_least_one_foreground_src) and (!sb_list[k]->is_lensed) and ((source_fit_mode != Shapelet_Source) or (sb_list[k]->sbtype != SHAPELET))) {
+					if (!sb_list[k]->zoom_subgridding) {
+						sb_list[k]->surface_brightness_batch(nsubpix,xvals,yvals,sbvals);
+						for (subcell_index=0; subcell_index < nsubpix; subcell_index++) sb += sbvals[subcell_index];
+					}
+					else {
+						noise = (use_noise_map) ? image_pixel_grid->noise_map[i][j] : background_pixel_noise;
+						for (subcell_index=0; subcell_index < nsubpix; subcell_index++) {
+							center_pt[0] = xvals[subcell_index];
+							center_pt[1] = yvals[subcell_index];
+							corner1[0] = center_pt[0] - subpixel_xlength/2;
+							corner1[1] = center_pt[1] - subpixel_ylength/2;
+							corner2[0] = center_pt[0] + subpixel_xlength/2;
+							corner2[1] = center_pt[1] - subpixel_ylength/2;
+							corner3[0] = center_pt[0] - subpixel_xlength/2;
+							corner3[1] = center_pt[1] + subpixel_ylength/2;
+							corner4[0] = center_pt[0] + subpixel_xlength/2;
+							corner4[1] = center_pt[1] + subpixel_ylength/2;
+							sb += sb_list[k]->surface_brightness_zoom(center_pt,corner1,corner2,corner3,corner4,noise);
 						}
-						else if ((allow_lensed_nonshapelet_sources) and (sb_list[k]->is_lensed) and ((zsrc_i<0) or (sbprofile_redshift_idx[k]==zsrc_i)) and (sb_list[k]->sbtype != SHAPELET) and (image_pixel_data->foreground_mask[i][j])) { // if source mode is shapelet and sbprofile is shapelet, will include in inversion
-							//center_srcpt = image_pixel_grid->subpixel_center_sourcepts[i][j][subcell_index];
-							//center_srcpt = image_pixel_grid->subpixel_center_sourcepts[i][j][subcell_index];
-							//find_sourcept(center_pt,center_srcpt,thread,reference_zfactors,default_zsrc_beta_factors);
-							//sb += sb_list[k]->surface_brightness(center_srcpt[0],center_srcpt[1]);
-							if (split_imgpixels) sb += sb_list[k]->surface_brightness(image_pixel_grid->subpixel_center_sourcepts[i][j][subcell_index][0],image_pixel_grid->subpixel_center_sourcepts[i][j][subcell_index][1]);
-							else sb += sb_list[k]->surface_brightness(image_pixel_grid->center_sourcepts[i][j][0],image_pixel_grid->center_sourcepts[i][j][1]);
-							//if (!sb_list[k]->zoom_subgridding) sb += sb_list[k]->surface_brightness(center_srcpt[0],center_srcpt[1]);
-							//else {
-								//corner1[0] = center_srcpt[0] - subpixel_xlength/2;
-								//corner1[1] = center_srcpt[1] - subpixel_ylength/2;
-								//corner2[0] = center_srcpt[0] + subpixel_xlength/2;
-								//corner2[1] = center_srcpt[1] - subpixel_ylength/2;
-								//corner3[0] = center_srcpt[0] - subpixel_xlength/2;
-								//corner3[1] = center_srcpt[1] + subpixel_ylength/2;
-								//corner4[0] = center_srcpt[0] + subpixel_xlength/2;
-								//corner4[1] = center_srcpt[1] + subpixel_ylength/2;
-								//sb += sb_list[k]->surface_brightness_zoom(center_srcpt,corner1,corner2,corner3,corner4,noise_map[i][j]);
-							//}
+					}
+				}
+				else if ((allow_lensed_nonshapelet_sources) and (sb_list[k]->is_lensed) and ((zsrc_i<0) or (sbprofile_redshift_idx[k]==zsrc_i)) and (sb_list[k]->sbtype != SHAPELET) and (image_pixel_data->foreground_mask[i][j])) { // if source mode is shapelet and sbprofile is shapelet, will include in inversion
+					if (split_imgpixels) {
+						// source points are only available for the pixel's own subpixels (fewer than nsubpix if the splitting was
+						// increased above), so the lensed profile is averaged over those
+						int nsubpix_src = INTSQR(image_pixel_grid->nsplits[i][j]);
+						double sbsum = 0;
+						for (subcell_index=0; subcell_index < nsubpix_src; subcell_index++) {
+							srcxvals[subcell_index] = image_pixel_grid->subpixel_center_sourcepts[i][j][subcell_index][0];
+							srcyvals[subcell_index] = image_pixel_grid->subpixel_center_sourcepts[i][j][subcell_index][1];
 						}
+						sb_list[k]->surface_brightness_batch(nsubpix_src,srcxvals,srcyvals,sbvals);
+						for (subcell_index=0; subcell_index < nsubpix_src; subcell_index++) sbsum += sbvals[subcell_index];
+						sb += sbsum*nsubpix/nsubpix_src;
+					} else {
+						sb += nsubpix*sb_list[k]->surface_brightness(image_pixel_grid->center_sourcepts[i][j][0],image_pixel_grid->center_sourcepts[i][j][1]);
 					}
-					subcell_index++;
 				}
 			}
-			sbprofile_surface_brightness[img_index] += sb / (nsplit*nsplit);
+			sbprofile_surface_brightness[img_index] += sb / nsubpix;
+		}
+		if (max_nsubpix > 0) {
+			delete[] xvals;
+			delete[] yvals;
+			delete[] srcxvals;
+			delete[] srcyvals;
+			delete[] sbvals;
 		}
 	}
 #ifdef USE_OPENMP
@@ -8,6 +8,7 @@
 #include "egrad.h" // contains IsophoteData structure used for recording isophote fits
 #include "trirectangle.h"
 #include "delaunay.h"
+#include "kmeans.h"
 #include <vector>
 #include <iostream>
 
@@ -17,10 +18,58 @@ class SourcePixelGrid;
 struct ImagePixelData;
 
 struct InterpolationCells {
-	bool found_containing_cell;
 	SourcePixel *pixel[3];
 };
 
+template <typename T>
+class BlockPool
+{
+	// Hands out contiguous runs of objects from large blocks. Runs that are no longer needed can be handed back with release(),
+	// and are reused by later allocations of the same length. Calling reset() makes the blocks available again without
+	// freeing them, so a structure that is torn down and rebuilt repeatedly reuses the same memory.
+	static const int default_block_size = 1024;
+	std::vector<T*> blocks;
+	std::vector<int> block_sizes;
+	std::vector<T*> free_runs;
+	std::vector<int> free_run_sizes;
+	size_t current_block;
+	int n_used;
+
+	BlockPool(const BlockPool&);
+	BlockPool& operator=(const BlockPool&);
+
+	public:
+	BlockPool() { current_block = 0; n_used = 0; }
+	T* allocate(const int n)
+	{
+		for (size_t i=free_runs.size(); i > 0; i--) {
+			if (free_run_sizes[i-1]==n) {
+				T* ptr = free_runs[i-1];
+				free_runs[i-1] = free_runs.back(); free_runs.pop_back();
+				free_run_sizes[i-1] = free_run_sizes.back(); free_run_sizes.pop_back();
+				return ptr;
+			}
+		}
+		while (current_block < blocks.size()) {
+			if (n_used + n <= block_sizes[current_block]) {
+				T* ptr = blocks[current_block] + n_used;
+				n_used += n;
+				return ptr;
+			}
+			current_block++;
+			n_used = 0;
+		}
+		int size = (n > default_block_size) ? n : default_block_size;
+		blocks.push_back(new T[size]);
+		block_sizes.push_back(size);
+		n_used = n;
+		return blocks[current_block];
+	}
+	void release(T* ptr, const int n) { free_runs.push_back(ptr); free_run_sizes.push_back(n); }
+	void reset() { current_block = 0; n_used = 0; free_runs.clear(); free_run_sizes.clear(); }
+	~BlockPool() { for (size_t i=0; i < blocks.size(); i++) delete[] blocks[i]; }
+};
+
 struct PtsWgts {
 	int indx;
 	double wgt;
@@ -67,6 +116,7 @@ class SourcePixel
 
 	static int max_levels;
 	static TriRectangleOverlap *trirec;
+	static vector<SourcePixel*> *overlap_cells; // unsplit cells whose rectangles are stored in trirec for batched overlap calculations
 	static int nthreads;
 	static int *imin, *imax, *jmin, *jmax; // defines "window" within which we will check all the cells for overlap
 	static InterpolationCells *nearest_interpolation_cells;
@@ -77,6 +127,7 @@ class SourcePixel
 	static lensvector **twistpts_threads;
 	static int **twist_status_threads;
 
+	void initialize(QLens* lens_in, lensvector** xij, const int& i, const int& j, const int& level_in, SourcePixelGrid* parent_ptr);
 	void split_cells(const int usplit, const int wsplit, const int& thread);
 	void unsplit();
 	void split_subcells(const int splitlevel, const int thread);
@@ -103,11 +154,10 @@ class SourcePixel
 	void generate_hmatrices();
 
 	void subcell_assign_source_mapping_flags_overlap(lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, vector<SourcePixel*>& mapped_cartesian_srcpixels, const int& thread, bool& image_pixel_maps_to_source_grid);
-	void find_lensed_surface_brightness_subcell_overlap(lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, const int& thread, double& overlap, double& total_overlap, double& total_weighted_surface_brightness);
+	void add_overlap_candidate_cells(const int& thread);
+	static void add_image_pixel_overlaps(lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, const int& thread);
 
-	bool subcell_assign_source_mapping_flags_interpolate(lensvector &input_center_pt, vector<SourcePixel*>& mapped_cartesian_srcpixels, const int& thread);
 	void calculate_Lmatrix_interpolate(const int img_index, vector<SourcePixel*>& mapped_cartesian_srcpixels, int& Lmatrix_index, lensvector &input_center_pts, const int& ii, const double weight, const int& thread);
-	void find_triangle_weighted_invmag_subcell(lensvector& pt1, lensvector& pt2, lensvector& pt3, double& total_overlap, double& total_weighted_invmag, const int& thread);
 
 	void find_interpolation_cells(lensvector &input_center_pt, const int& thread);
 	SourcePixel* find_nearest_neighbor_cell(lensvector &input_center_pt, const int& side);
@@ -135,7 +185,16 @@ class SourcePixel
 	void set_image_pixel_grid(ImagePixelGrid* image_pixel_ptr) { image_pixel_grid = image_pixel_ptr; }
 	void plot_corner_coordinates(std::ofstream &gridout);
 	void clear(void);
-	~SourcePixel();
+};
+
+struct SourcePixelPool
+{
+	// storage for the subcells created by splitting (and the pointer arrays that index them); each thread has its own pool,
+	// so cells can be split in parallel without contending for the allocator
+	BlockPool<SourcePixel> cells;
+	BlockPool<SourcePixel*> cell_ptrs;
+	BlockPool<SourcePixel**> cell_rows;
+	void reset() { cells.reset(); cell_ptrs.reset(); cell_rows.reset(); }
 };
 
 class SourcePixelGrid : public SourcePixel, public ModelParams
@@ -155,6 +214,10 @@ class SourcePixelGrid : public SourcePixel, public ModelParams
 	double min_cell_area;
 	int levels; // keeps track of the total number of grid cell levels
 	bool regrid;
+	SourcePixelPool *subcell_pools; // one per thread
+
+	void delete_firstlevel_cells();
+	void reset_subcell_pools();
 
 	void assign_firstlevel_neighbors(void);
 	void assign_all_neighbors(void);
@@ -184,10 +247,11 @@ class SourcePixelGrid : public SourcePixel, public ModelParams
 	bool assign_source_mapping_flags_overlap(lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, vector<SourcePixel*>& mapped_cartesian_srcpixels, const int& thread);
 	void calculate_Lmatrix_overlap(const int &img_index, const int image_pixel_i, const int image_pixel_j, int& Lmatrix_index, lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, const int& thread);
 	double find_lensed_surface_brightness_overlap(lensvector **input_corner_pts, lensvector *twist_pt, int& twist_status, const int& thread);
+	void find_overlap_candidate_cells(const int& thread);
 
 	bool bisection_search_overlap(lensvector **input_corner_pts, const int& thread);
 	bool bisection_search_overlap(lensvector &a, lensvector &b, lensvector &c, const int& thread);
-	bool bisection_search_interpolate(lensvector &input_center_pt, const int& thread);
+	SourcePixel* find_containing_cell(lensvector &input_pt);
 	bool assign_source_mapping_flags_interpolate(lensvector &input_center_pt, vector<SourcePixel*>& mapped_cartesian_srcpixels, const int& thread, const int& image_pixel_i, const int& image_pixel_j);
 	void calculate_Lmatrix_interpolate(const int img_index, vector<SourcePixel*>& mapped_cartesian_srcpixels, int& Lmatrix_index, lensvector &input_center_pts, const int& ii, const double weight, const int& thread);
 	double find_lensed_surface_brightness_interpolate(lensvector &input_center_pt, const int& thread);
@@ -279,6 +343,7 @@ class DelaunayGrid : public ModelParams, public Sort
 	double distreg_xcenter, distreg_ycenter, distreg_e1, distreg_e2; // for position-weighted regularization
 	double mag_weight_sc, mag_weight_index; // magnification-weighted regularization
 	double alpha_clus, beta_clus;
+	KMeans2D srcpt_clustering; // retains the centroids from the last clustering, so they can be used to warm-start the next one
 
 	void setup_parameters(const bool initial_setup);
 
@@ -461,6 +526,10 @@ class ImagePixelGrid : public Sort
 	void setup_subpixel_ray_tracing_arrays(const bool verbal = false);
 	void delete_ray_tracing_arrays();
 	void calculate_sourcepts_and_areas(const bool raytrace_pixel_centers = false, const bool verbal = false);
+	static void calculate_sourcepts_and_areas(ImagePixelGrid **grids, const int n_grids, const bool raytrace_pixel_centers, const bool verbal);
+	void find_srcplane_twist_and_area(const int n_cell);
+	void store_sourcepts_and_areas(const bool trace_centers, const bool verbal);
+	void set_adaptive_nsplits();
 	void ray_trace_pixels();
 	void set_nsplits(const int default_nsplit, const int emask_nsplit, const bool split_pixels);
 	void setup_noise_map(QLens* lens_in);
@@ -469,6 +538,7 @@ class ImagePixelGrid : public Sort
 
 	~ImagePixelGrid();
 	void redo_lensing_calculations(const bool verbal = false);
+	static void redo_lensing_calculations(ImagePixelGrid **grids, const int n_grids, const bool verbal = false); // ray-traces the grids for several source planes together
 	void redo_lensing_calculations_corners();
 	void assign_mask_pixels(double srcgrid_xmin, double srcgrid_xmax, double srcgrid_ymin, double srcgrid_ymax, int& count, ImagePixelData* data_in);
 
@@ -483,9 +553,16 @@ class ImagePixelGrid : public Sort
 	void set_lens(QLens* lensptr) { lens = lensptr; }
 	void set_cartesian_srcgrid(SourcePixelGrid* source_pixel_ptr) { cartesian_srcgrid = source_pixel_ptr; }
 	void set_delaunay_srcgrid(DelaunayGrid* delaunayptr) { delaunay_srcgrid = delaunayptr; }
+	int get_x_N() { return x_N; }
+	int get_y_N() { return y_N; }
+	double* surface_brightness_block() { return surface_brightness[0]; } // contiguous x_N*y_N block; element [i][j] is at i*y_N+j
+	double* foreground_surface_brightness_block() { return foreground_surface_brightness[0]; }
+	bool pixel_in_fit_mask(const int i, const int j) { return pixel_in_mask[i][j]; }
 	void find_optimal_sourcegrid_npixels(double srcgrid_xmin, double srcgrid_xmax, double srcgrid_ymin, double srcgrid_ymax, int& nsrcpixel_x, int& nsrcpixel_y, int& n_expected_active_pixels);
 	void find_optimal_firstlevel_sourcegrid_npixels(double srcgrid_xmin, double srcgrid_xmax, double srcgrid_ymin, double srcgrid_ymax, int& nsrcpixel_x, int& nsrcpixel_y, int& n_expected_active_pixels);
 	void find_surface_brightness(const bool foreground_only = false, const bool lensed_sources_only = false);
+	void add_sbprofile_surface_brightness(const bool include_lensed, const bool include_unlensed);
+	void add_sbprofile_surface_brightness_subpixels(const bool include_lensed, const bool include_unlensed, const bool add_to_subpixel_sb);
 	double plot_surface_brightness(string outfile_root, bool plot_residual = false, bool normalize_residuals = false, bool show_noise_thresh = false, bool plot_log = false);
 	void plot_sourcepts(string outfile_root, const bool show_subpixels = false);
 	void output_fits_file(string fits_filename, bool plot_residual = false);
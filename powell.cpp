@@ -91,7 +91,7 @@ void Powell::minimize(double* pp, double** ximat)
 		{
 			for (int j=0; j < n; j++) xi[j] = ximat[j][i];
 			fptt = fret;
-			fret = linemin();
+			fret = line_minimize();
 			if (fptt-fret > del) {
 				del = fptt - fret;
 				ibig = i + 1;
@@ -125,7 +125,7 @@ void Powell::minimize(double* pp, double** ximat)
 			double t = 2.0*(fp-2.0*fret+fptt)*tmp*tmp - del*tmp2*tmp2;
 			if (t < 0.0)
 			{
-				fret = linemin();
+				fret = line_minimize();
 				for (int j=0; j < n; j++) {
 					ximat[j][ibig-1] = ximat[j][n-1];
 					ximat[j][n-1] = xi[j];
@@ -291,3 +291,146 @@ double Powell::linemin()
 }
 
 
+
+void Powell::powell_set_mpi_groups(const int ngroups, const int group_num, int *group_leader)
+{
+	// trial points in linemin_parallel are divided between the MPI groups, where each group evaluates its own points
+	// (with the processes in each group working together on each evaluation)
+	powell_mpi_ngroups = ngroups;
+	powell_mpi_group_num = group_num;
+	if (powell_mpi_group_leader != NULL) delete[] powell_mpi_group_leader;
+	powell_mpi_group_leader = NULL;
+	if (group_leader != NULL) {
+		powell_mpi_group_leader = new int[ngroups];
+		for (int i=0; i < ngroups; i++) powell_mpi_group_leader[i] = group_leader[i];
+	}
+}
+
+void Powell::f1dim_batch(const double* x, double* fx, const int npts)
+{
+	int i;
+	for (i=0; i < npts; i++) {
+		if (i % powell_mpi_ngroups == powell_mpi_group_num) fx[i] = f1dim(x[i]);
+		else fx[i] = 0;
+	}
+#ifdef USE_MPI
+	if ((powell_mpi_ngroups > 1) and (powell_mpi_group_leader != NULL)) {
+		for (i=0; i < npts; i++) MPI_Bcast(fx+i,1,MPI_DOUBLE,powell_mpi_group_leader[i % powell_mpi_ngroups],MPI_COMM_WORLD);
+		int keep_running = (powell_exit_status) ? 1 : 0, all_running;
+		MPI_Allreduce(&keep_running,&all_running,1,MPI_INT,MPI_MIN,MPI_COMM_WORLD);
+		if (all_running==0) powell_exit_status = false;
+	}
+#endif
+}
+
+double Powell::linemin_parallel()
+{
+	// Line minimization in which the trial points are evaluated in batches of npts (one per MPI group). The minimum is first
+	// bracketed by sampling points on both sides of the origin at geometrically increasing distances; the bracket is then
+	// narrowed by evaluating npts points inside it at a time: the minimum of the parabola through the bracket and its best point,
+	// plus evenly spaced points, so the bracket shrinks by at least a factor ~2/(npts+1) per batch.
+	const double GOLD=1.618034, GLIMIT=100.0, TINY=1.0e-25;
+	int i,j,m,nx,iter;
+	int npts = powell_mpi_ngroups;
+	double *xs = new double[npts+3];
+	double *fs = new double[npts+3];
+	double *xtrial = new double[npts];
+	double *ftrial = new double[npts];
+	double a,b,x,fa,fb,fx,fx_old,dx,xtemp,ftemp,tol1;
+	double xend,fend,xnb,fnb,r,q,u;
+
+	nx = 0;
+	xs[nx] = 0; fs[nx] = fret; nx++; // fret is the function value at the current point p
+	for (i=0; i < npts; i++) xtrial[i] = ((i%2==0) ? 1.0 : -1.0) * pow(GOLD,i/2);
+	f1dim_batch(xtrial,ftrial,npts);
+	for (i=0; i < npts; i++) {
+		xs[nx] = xtrial[i]; fs[nx] = ftrial[i]; nx++;
+	}
+	for (;;) {
+		for (i=1; i < nx; i++) {
+			xtemp = xs[i]; ftemp = fs[i];
+			for (j=i; (j > 0) and (xs[j-1] > xtemp); j--) { xs[j] = xs[j-1]; fs[j] = fs[j-1]; }
+			xs[j] = xtemp; fs[j] = ftemp;
+		}
+		for (i=1, m=0; i < nx; i++) if (fs[i] < fs[m]) m = i;
+		if ((m > 0) and (m < nx-1)) break; // minimum is bracketed
+		if ((powell_exit_status==false) or (abs(xs[m]) > GLIMIT)) break; // can't find a bracket, so take the endpoint as the minimum
+		// extend the search outward from the endpoint, keeping only the endpoint and its neighbor
+		if (m==0) {
+			xend = xs[0]; fend = fs[0];
+			xnb = xs[1]; fnb = fs[1];
+		} else {
+			xend = xs[nx-1]; fend = fs[nx-1];
+			xnb = xs[nx-2]; fnb = fs[nx-2];
+		}
+		dx = xend - xnb;
+		x = xend;
+		for (i=0; i < npts; i++) {
+			dx *= GOLD;
+			x += dx;
+			xtrial[i] = x;
+		}
+		nx = 0;
+		xs[nx] = xnb; fs[nx] = fnb; nx++;
+		xs[nx] = xend; fs[nx] = fend; nx++;
+		f1dim_batch(xtrial,ftrial,npts);
+		for (i=0; i < npts; i++) {
+			xs[nx] = xtrial[i]; fs[nx] = ftrial[i]; nx++;
+		}
+	}
+	x = xs[m]; fx = fs[m];
+	if ((m > 0) and (m < nx-1)) {
+		a = xs[m-1]; fa = fs[m-1];
+		b = xs[m+1]; fb = fs[m+1];
+		fx_old = 1e30;
+		for (iter=0; iter < ITMAX; iter++) {
+			if (powell_exit_status==false) break;
+			tol1 = tol*abs(x) + ZEPS;
+			if ((2.0*abs(fx-fx_old) <= ftol*(abs(fx) + abs(fx_old) + TINY)) or (b-a <= 2*tol1)) break;
+			for (i=0; i < npts; i++) xtrial[i] = a + (i+1)*(b-a)/(npts+1);
+			// replace the evenly spaced point closest to the minimum of the parabola through (a,x,b) by the minimum itself
+			r = (x-a)*(fx-fb);
+			q = (x-b)*(fx-fa);
+			u = 2.0*(q-r);
+			if (abs(u) > TINY) {
+				u = x - ((x-b)*q-(x-a)*r)/u;
+				if ((u > a) and (u < b) and (abs(u-x) > tol1)) {
+					for (i=1, j=0; i < npts; i++) if (abs(xtrial[i]-u) < abs(xtrial[j]-u)) j = i;
+					xtrial[j] = u;
+					for (i=1; i < npts; i++) {
+						xtemp = xtrial[i];
+						for (j=i; (j > 0) and (xtrial[j-1] > xtemp); j--) xtrial[j] = xtrial[j-1];
+						xtrial[j] = xtemp;
+					}
+				}
+			}
+			f1dim_batch(xtrial,ftrial,npts);
+			nx = 0;
+			xs[nx] = a; fs[nx] = fa; nx++;
+			for (i=0; i < npts; i++) {
+				if ((x > xs[nx-1]) and (x < xtrial[i])) { xs[nx] = x; fs[nx] = fx; nx++; }
+				xs[nx] = xtrial[i]; fs[nx] = ftrial[i]; nx++;
+			}
+			if ((x > xs[nx-1]) and (x < b)) { xs[nx] = x; fs[nx] = fx; nx++; }
+			xs[nx] = b; fs[nx] = fb; nx++;
+			for (i=1, m=0; i < nx; i++) if (fs[i] < fs[m]) m = i;
+			if ((m==0) or (m==nx-1)) break; // shouldn't happen since the bracket ends have higher function values
+			if (fs[m] < fx) fx_old = fx; // as in minimize(), fx_old is only updated when a lower function value is found
+			a = xs[m-1]; fa = fs[m-1];
+			b = xs[m+1]; fb = fs[m+1];
+			x = xs[m]; fx = fs[m];
+		}
+	}
+	fmin = fx;
+	xmin = x;
+	for (j=0; j < n; j++)
+	{
+		xi[j] *= xmin;
+		p[j] += xi[j];
+	}
+	delete[] xs;
+	delete[] fs;
+	delete[] xtrial;
+	delete[] ftrial;
+	return fmin;
+}
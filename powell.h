@@ -5,6 +5,10 @@
 #include <iostream>
 #include <csignal>
 
+#ifdef USE_MPI
+#include "mpi.h"
+#endif
+
 class Powell
 {
 	private:
@@ -24,17 +28,22 @@ class Powell
 	double ax,bx,cx,fa,fb,fc;
 	inline void shft3(double &a, double &b, double &c, const double d) { a=b; b=c; c=d; }
 	bool powell_exit_status;
+	bool parallel_powell; // if true, line minimizations evaluate several trial points at once (see linemin_parallel)
+	int powell_mpi_ngroups, powell_mpi_group_num;
+	int *powell_mpi_group_leader;
 
 	public:
-	Powell() { ftol = 3.0e-8; }
-	Powell(double (Powell::*funcc)(double*), const double ftoll=3.0e-8) : ftol(ftoll) { func = funcc; }
+	Powell() { ftol = 3.0e-8; parallel_powell = false; powell_mpi_ngroups = 1; powell_mpi_group_num = 0; powell_mpi_group_leader = NULL; }
+	Powell(double (Powell::*funcc)(double*), const double ftoll=3.0e-8) : ftol(ftoll) { func = funcc; parallel_powell = false; powell_mpi_ngroups = 1; powell_mpi_group_num = 0; powell_mpi_group_leader = NULL; }
 	void initialize_powell(double (Powell::*funcc)(double*), const double ftoll)
 	{
 		func = funcc;
 		ftol = ftoll;
 	}
 	void set_precision(const double ftoll) { ftol = ftoll; }
-	~Powell() { func = NULL; }
+	void powell_set_parallel(const bool parallel) { parallel_powell = parallel; }
+	void powell_set_mpi_groups(const int ngroups, const int group_num, int *group_leader);
+	~Powell() { func = NULL; if (powell_mpi_group_leader != NULL) delete[] powell_mpi_group_leader; }
 
 	void powell_minimize(double* pp, const int nn);
 	void powell_minimize(double* pp, const int nn, double* initial_stepsizes);
@@ -45,6 +54,9 @@ class Powell
 	void bracket(const double a, const double b);
 	double minimize(void);
 	double linemin();
+	double linemin_parallel();
+	double line_minimize() { return ((parallel_powell) and (powell_mpi_ngroups > 1)) ? linemin_parallel() : linemin(); }
+	void f1dim_batch(const double* x, double* fx, const int npts);
 };
 
 #endif // POWELL_H
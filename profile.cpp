@@ -330,48 +330,15 @@ void LensProfile::copy_source_data_to_lens(const SB_Profile* sb_in)
 
 void LensProfile::copy_integration_tables(const LensProfile* lens_in)
 {
-	// It's a total waste of time to make copies of the integration tables. You should change it so the integration tables are static, or perhaps move them out of LensProfile, so it doesn't have to copy them for each lens every time a fit is run.
+	// The quadrature nodes and weights are shared between all lens objects (see gauss.cpp), so nothing gets copied here except
+	// the tolerances; only the scratch space for the adaptive quadrature is allocated for the new lens
 	if (ellipticity_mode == -1) return; // non-elliptical lenses do not require doing numerical integrations
 	if (lens_in->points==NULL) die("Integration tables were not initialized for current lens");
 	integral_tolerance = lens_in->integral_tolerance;
-	numberOfPoints = lens_in->numberOfPoints;
-	weights = new double[numberOfPoints];
-	points = new double[numberOfPoints];
-	double *wptr, *pptr;
-	wptr = lens_in->weights;
-	pptr = lens_in->points;
-	int i,j,l;
-	for (i=0; i < numberOfPoints; i++) {
-		weights[i] = *(wptr++);
-		points[i] = *(pptr++);
-	}
+	SetGaussLegendre(lens_in->numberOfPoints);
 	SetGaussPatterson(integral_tolerance,integration_warnings);
-
-	cc_tolerance = integral_tolerance;
+	SetClenshawCurtis(lens_in->cc_nlevels,integral_tolerance,false,integration_warnings);
 	cc_tolerance_outer = integral_tolerance; // doesn't get used in qlens (as of yet) since there are no nested integrals
-	include_endpoints = false;
-	cc_nlevels = lens_in->cc_nlevels;
-	cc_N = lens_in->cc_N;
-
-	cc_lvals = new int [cc_nlevels];
-	cc_points = new double[cc_N];
-	cc_weights = new double*[cc_nlevels];
-	l=1;
-	for (i=0; i < cc_nlevels; i++)
-	{
-		cc_lvals[i] = l;
-		cc_weights[i] = new double[l+1];
-		wptr = lens_in->cc_weights[i];
-		for (j=0; j < (l+1); j++) {
-			cc_weights[i][j] = *(wptr++);
-		}
-		l *= 2;
-	}
-	pptr = lens_in->cc_points;
-	for (i=0; i < cc_N; i++)
-	{
-		cc_points[i] = *(pptr++);
-	}
 }
 
 void LensProfile::set_nparams_and_anchordata(const int &n_params_in, const bool resize)
@@ -1223,14 +1190,21 @@ double LensProfile::average_log_slope_3d(const double rmin, const double rmax)
 
 bool LensProfile::calculate_total_scaled_mass(double& total_mass)
 {
-	double u, mass_u, mass_u_prev;
 	double re_major_axis, re_average;
-	static const double mtol = 1e-5;
-	static const int nmax = 34;
 	get_einstein_radius(re_major_axis, re_average, 1.0);
 	if (re_major_axis==0) return false;
 	if (this->kapavgptr_rsq_spherical==NULL) return false;
-	u = 1.0/(re_average*re_average);
+	return calculate_total_scaled_mass_from_radius(total_mass,re_average);
+}
+
+bool LensProfile::calculate_total_scaled_mass_from_radius(double& total_mass, const double r_start)
+{
+	// the enclosed mass is found at successively larger radii, starting from r_start, until it converges
+	double u, mass_u, mass_u_prev;
+	static const double mtol = 1e-5;
+	static const int nmax = 34;
+	if (this->kapavgptr_rsq_spherical==NULL) return false;
+	u = 1.0/(r_start*r_start);
 	mass_u = mass_inverse_rsq(u);
 	int n = 0;
 	do {
@@ -1933,6 +1907,101 @@ void LensProfile::deflection_and_hessian_together(const double x, const double y
 
 }
 
+void LensProfile::param_derivatives(const int paramnum, const int npts, const lensvector* pts, lensvector* ddef, lensmatrix* dhess)
+{
+	// Finds the derivatives of the deflection (and the hessian, if dhess is not NULL) at each of the given points with respect to
+	// parameter 'paramnum', in the units used for fit parameters (i.e. angles in degrees). Derivatives with respect to the center
+	// coordinates, or to a normalization parameter that the deflection scales with, are found analytically; otherwise the parameter
+	// is perturbed and the derivatives are found by central differences.
+	int i;
+	double dlogdef_dparam;
+	if ((param[paramnum]==&x_center) or (param[paramnum]==&y_center)) {
+		center_param_derivatives((param[paramnum]==&x_center) ? 0 : 1,npts,pts,ddef,dhess);
+	} else if ((n_fourier_modes==0) and (param_derivative_scaling(paramnum,dlogdef_dparam))) {
+		for (i=0; i < npts; i++) {
+			if (dhess != NULL) {
+				potential_derivatives(pts[i][0],pts[i][1],ddef[i],dhess[i]);
+				dhess[i] = dlogdef_dparam*dhess[i];
+			} else {
+				deflection(pts[i][0],pts[i][1],ddef[i]);
+			}
+			ddef[i] *= dlogdef_dparam;
+		}
+	} else {
+		numerical_param_derivatives(paramnum,npts,pts,ddef,dhess);
+	}
+}
+
+void LensProfile::center_param_derivatives(const int coord, const int npts, const lensvector* pts, lensvector* ddef, lensmatrix* dhess)
+{
+	// the deflection depends only on the position relative to the center, so d(alpha)/d(x_center) = -d(alpha)/dx, etc.
+	static const double increment = 1e-5;
+	lensmatrix hess, hess_hi, hess_lo;
+	for (int i=0; i < npts; i++) {
+		hessian(pts[i][0],pts[i][1],hess);
+		ddef[i][0] = -hess[0][coord];
+		ddef[i][1] = -hess[1][coord];
+		if (dhess != NULL) {
+			if (coord==0) {
+				hessian(pts[i][0]+increment,pts[i][1],hess_hi);
+				hessian(pts[i][0]-increment,pts[i][1],hess_lo);
+			} else {
+				hessian(pts[i][0],pts[i][1]+increment,hess_hi);
+				hessian(pts[i][0],pts[i][1]-increment,hess_lo);
+			}
+			dhess[i] = (0.5/increment)*(hess_lo - hess_hi);
+		}
+	}
+}
+
+bool LensProfile::param_derivative_scaling(const int, double&)
+{
+	// Models whose deflection is proportional to a power of one of their parameters (e.g. a normalization) overload this
+	// to return d(log alpha)/d(param) for that parameter, so its derivatives can be found without perturbing the lens.
+	return false;
+}
+
+void LensProfile::numerical_param_derivatives(const int paramnum, const int npts, const lensvector* pts, lensvector* ddef, lensmatrix* dhess)
+{
+	static const double increment = 1e-4;
+	int i;
+	double p0 = *(param[paramnum]);
+	double step = increment*stepsizes[paramnum];
+	if (step <= 0) step = (p0==0) ? increment : increment*abs(p0);
+	double dp = (angle_param[paramnum]) ? degrees_to_radians(step) : step;
+	lensvector def;
+	lensmatrix hess;
+
+	*(param[paramnum]) = p0 + dp;
+	update_after_param_change(paramnum);
+	for (i=0; i < npts; i++) {
+		if (dhess != NULL) potential_derivatives(pts[i][0],pts[i][1],ddef[i],dhess[i]);
+		else deflection(pts[i][0],pts[i][1],ddef[i]);
+	}
+	*(param[paramnum]) = p0 - dp;
+	update_after_param_change(paramnum);
+	for (i=0; i < npts; i++) {
+		if (dhess != NULL) {
+			potential_derivatives(pts[i][0],pts[i][1],def,hess);
+			dhess[i] = (0.5/step)*(dhess[i] - hess);
+		} else {
+			deflection(pts[i][0],pts[i][1],def);
+		}
+		ddef[i] -= def;
+		ddef[i] /= (2*step);
+	}
+	*(param[paramnum]) = p0;
+	update_after_param_change(paramnum);
+}
+
+void LensProfile::update_after_param_change(const int paramnum)
+{
+	if (angle_param[paramnum]) update_angle_meta_params();
+	update_meta_parameters();
+	set_integration_pointers();
+	set_model_specific_integration_pointers();
+}
+
 void LensProfile::add_fourier_mode(const int m_in, const double amp_in, const double amp2_in, const bool vary1, const bool vary2)
 {
 	n_fourier_modes++;
@@ -2368,11 +2437,12 @@ void LensProfile::deflection_numerical(const double x, const double y, lensvecto
 	bool converged;
 	if (!ellipticity_gradient) {
 		//cout << "NOT DOING EGRAD" << endl;
-		LensIntegral lens_integral(this,x,y,q);
-		def[0] = x*lens_integral.j_integral(0,converged);
-		warn_if_not_converged(converged,x,y);
-		def[1] = y*lens_integral.j_integral(1,converged);
+		LensIntegral lens_integral(this,x,y,q,2);
+		double jint[2];
+		lens_integral.j_integral_mult(jint,converged);
 		warn_if_not_converged(converged,x,y);
+		def[0] = x*jint[0];
+		def[1] = y*jint[1];
 		//cout << "j0=" << (def[0]/x) << " j1=" << (def[1]/y) << endl;
 	} else {
 		//cout << "DOING EGRAD" << endl;
@@ -2427,18 +2497,14 @@ void LensProfile::hessian_numerical(const double x, const double y, lensmatrix&
 
 	bool converged;
 	if (!ellipticity_gradient) {
-		LensIntegral lens_integral(this,x,y,q);
-		double jint0, jint1;
-		jint0 = lens_integral.j_integral(0,converged);
-		warn_if_not_converged(converged,x,y);
-		jint1 = lens_integral.j_integral(1,converged);
-		warn_if_not_converged(converged,x,y);
-		hess[0][0] = 2*x*x*lens_integral.k_integral(0,converged) + jint0;
-		warn_if_not_converged(converged,x,y);
-		hess[1][1] = 2*y*y*lens_integral.k_integral(2,converged) + jint1;
-		warn_if_not_converged(converged,x,y);
-		hess[0][1] = 2*x*y*lens_integral.k_integral(1,converged);
+		LensIntegral lens_integral(this,x,y,q,5);
+		double jkint[5];
+		lens_integral.jk_integral_mult(jkint,converged); // J0, J1, K0, K1, K2
 		warn_if_not_converged(converged,x,y);
+		double jint0 = jkint[0], jint1 = jkint[1];
+		hess[0][0] = 2*x*x*jkint[2] + jint0;
+		hess[1][1] = 2*y*y*jkint[4] + jint1;
+		hess[0][1] = 2*x*y*jkint[3];
 		//double hess00 = lens_integral.k_integral(0,converged);
 		//double hess01 = lens_integral.k_integral(1,converged);
 		//double hess11 = lens_integral.k_integral(2,converged);
@@ -2531,27 +2597,21 @@ void LensProfile::hessian_numerical(const double x, const double y, lensmatrix&
 
 void LensProfile::deflection_and_hessian_numerical(const double x, const double y, lensvector& def, lensmatrix& hess)
 {
-	// You should make it save the kappa and kappa' values evaluated during J0 and K0 so it doesn't have to evaluate them again for
-	// J1, K1 and K2 (unless higher order quadrature is required for convergence, in which case extra evaluations must be done). This
-	// will save a significant amount of time, but might take some doing to implement
+	// The J0, J1 and K0, K1, K2 integrals are all evaluated at the same quadrature nodes, so kappa and kappa' are only evaluated once per node
 
 	bool converged;
-	LensIntegral lens_integral(this,x,y,q);
 	if (!ellipticity_gradient) {
 		//cout << "NOT DOING EGRAD" << endl;
-		double jint0, jint1;
-		jint0 = lens_integral.j_integral(0,converged);
-		warn_if_not_converged(converged,x,y);
-		jint1 = lens_integral.j_integral(1,converged);
+		LensIntegral lens_integral(this,x,y,q,5);
+		double jkint[5];
+		lens_integral.jk_integral_mult(jkint,converged); // J0, J1, K0, K1, K2
 		warn_if_not_converged(converged,x,y);
+		double jint0 = jkint[0], jint1 = jkint[1];
 		def[0] = x*jint0;
 		def[1] = y*jint1;
-		hess[0][0] = 2*x*x*lens_integral.k_integral(0,converged) + jint0;
-		warn_if_not_converged(converged,x,y);
-		hess[1][1] = 2*y*y*lens_integral.k_integral(2,converged) + jint1;
-		warn_if_not_converged(converged,x,y);
-		hess[0][1] = 2*x*y*lens_integral.k_integral(1,converged);
-		warn_if_not_converged(converged,x,y);
+		hess[0][0] = 2*x*x*jkint[2] + jint0;
+		hess[1][1] = 2*y*y*jkint[4] + jint1;
+		hess[0][1] = 2*x*y*jkint[3];
 		//double hess00 = lens_integral.k_integral(0,converged);
 		//double hess01 = lens_integral.k_integral(1,converged);
 		//double hess11 = lens_integral.k_integral(2,converged);
@@ -2763,6 +2823,51 @@ double LensIntegral::k_integral(const int nval_in, bool &converged)
 	return ans;
 }
 
+void LensIntegral::j_integral_mult(double *jint, bool &converged)
+{
+	// returns J0 and J1 in jint[0], jint[1]
+	if (n_mult < 2) die("n_mult must be at least 2 to use j_integral_mult");
+	if (profile->integral_method == Romberg_Integration) {
+		bool converged1;
+		jint[0] = j_integral(0,converged);
+		jint[1] = j_integral(1,converged1);
+		if (!converged1) converged = false;
+		return;
+	}
+	jk_integrals_mult(&LensIntegral::j_integrand_mult,jint,2,converged);
+}
+
+void LensIntegral::jk_integral_mult(double *jkint, bool &converged)
+{
+	// returns J0, J1 in jkint[0], jkint[1] and K0, K1, K2 in jkint[2], jkint[3], jkint[4]
+	if (n_mult < 5) die("n_mult must be at least 5 to use jk_integral_mult");
+	if (profile->integral_method == Romberg_Integration) {
+		bool converged_n;
+		converged = true;
+		for (int i=0; i < 2; i++) {
+			jkint[i] = j_integral(i,converged_n);
+			if (!converged_n) converged = false;
+		}
+		for (int i=0; i < 3; i++) {
+			jkint[2+i] = k_integral(i,converged_n);
+			if (!converged_n) converged = false;
+		}
+		return;
+	}
+	jk_integrals_mult(&LensIntegral::jk_integrand_mult,jkint,5,converged);
+}
+
+void LensIntegral::jk_integrals_mult(void (LensIntegral::*func)(const double, double*), double *results, const int n_funcs, bool &converged)
+{
+	converged = true; // will change if convergence not achieved
+	if (profile->integral_method == Gaussian_Quadrature) GaussIntegrate(func,0,1,results,n_funcs);
+	else if (profile->integral_method == Gauss_Patterson_Quadrature) PattersonIntegrate(func,0,1,results,n_funcs,converged);
+	else if (profile->integral_method == Fejer_Quadrature) FejerIntegrate(func,0,1,results,n_funcs,converged);
+	else die("unknown integral method");
+	double fac = sqrt(1-epsilon);
+	for (int i=0; i < n_funcs; i++) results[i] *= fac;
+}
+
 // i,j,k integrals are in form similar to Keeton (2001), but generalized to allow for different
 // definitions of the elliptical radius. I have also made the substitution
 // u=w*w (easier for Gaussian quadrature; makes kappa singularity more manageable)
@@ -2789,6 +2894,28 @@ double LensIntegral::k_integrand_prime(const double w)
 	return fsqinv*(2*w*u*profile->kappa_rsq_deriv(u*(xsqval + ysqval/qfac)*fsqinv) / pow(qfac, nval_plus_half));
 }
 
+// The integrands for different n only differ by powers of qfac, so all of them can share the same kappa evaluation
+void LensIntegral::j_integrand_mult(const double w, double* jint)
+{
+	u = w*w;
+	qfac = 1 - epsilon*u;
+	jint[0] = 2*w*profile->kappa_rsq(u*(xsqval + ysqval/qfac)*fsqinv) / sqrt(qfac);
+	jint[1] = jint[0] / qfac;
+}
+
+void LensIntegral::jk_integrand_mult(const double w, double* jkint)
+{
+	u = w*w;
+	qfac = 1 - epsilon*u;
+	double rsq = u*(xsqval + ysqval/qfac)*fsqinv;
+	double sqrtqfac = sqrt(qfac);
+	jkint[0] = 2*w*profile->kappa_rsq(rsq) / sqrtqfac;
+	jkint[1] = jkint[0] / qfac;
+	jkint[2] = fsqinv*(2*w*u*profile->kappa_rsq_deriv(rsq) / sqrtqfac);
+	jkint[3] = jkint[2] / qfac;
+	jkint[4] = jkint[3] / qfac;
+}
+
 /*
 // This version of i_integrand might still be useful in cases where we have no formula for the spherical deflection, since it only requires kappa_rsq_deriv. Keep in mind for later!
 double LensIntegral::i_integrand_v2(const double xi)
@@ -62,6 +62,7 @@ class LensProfile : public Romberg, public GaussLegendre, public GaussPatterson,
 	friend class SPLE;
 	friend class dPIE;
 	friend class ImagePixelGrid;
+	friend class LensTree;
 
 	// the following private declarations are specific to LensProfile and not derived classes
 	private:
@@ -157,6 +158,9 @@ class LensProfile : public Romberg, public GaussLegendre, public GaussPatterson,
 	void hessian_spherical_default(const double, const double, lensmatrix&);
 	void deflection_and_hessian_together(const double x, const double y, lensvector &def, lensmatrix& hess);
 	void deflection_and_hessian_numerical(const double x, const double y, lensvector& def, lensmatrix& hess);
+	virtual bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
+	void numerical_param_derivatives(const int paramnum, const int npts, const lensvector* pts, lensvector* ddef, lensmatrix* dhess);
+	void update_after_param_change(const int paramnum);
 	void warn_if_not_converged(const bool& converged, const double &x, const double &y);
 
 	double rmin_einstein_radius; // initial bracket used to find Einstein radius
@@ -355,6 +359,7 @@ class LensProfile : public Romberg, public GaussLegendre, public GaussPatterson,
 	double average_log_slope(const double rmin, const double rmax);
 	double average_log_slope_3d(const double rmin, const double rmax);
 	virtual bool calculate_total_scaled_mass(double& total_mass);
+	bool calculate_total_scaled_mass_from_radius(double& total_mass, const double r_start);
 	virtual double calculate_scaled_density_3d(const double r, const double tolerance, bool &converged);
 	virtual double calculate_scaled_mass_3d(const double r);
 
@@ -374,6 +379,8 @@ class LensProfile : public Romberg, public GaussLegendre, public GaussPatterson,
 	virtual double kappa(double x, double y);
 	virtual void deflection(double x, double y, lensvector& def);
 	virtual void hessian(double x, double y, lensmatrix& hess); // the Hessian matrix of the lensing potential (*not* the arrival time surface)
+	virtual void param_derivatives(const int paramnum, const int npts, const lensvector* pts, lensvector* ddef, lensmatrix* dhess = NULL); // derivatives of deflection (and hessian) w.r.t. a parameter
+	void center_param_derivatives(const int coord, const int npts, const lensvector* pts, lensvector* ddef, lensmatrix* dhess = NULL);
 	double kappa_from_fourier_modes(const double x, const double y);
 	void add_deflection_from_fourier_modes(const double x, const double y, lensvector& def);
 	void add_hessian_from_fourier_modes(const double x, const double y, lensmatrix& hess);
@@ -454,8 +461,10 @@ struct LensIntegral : public Romberg
 			pat_points = profile->pat_points;
 			pat_weights = profile->pat_weights;
 			if (n_mult > 0) {
+				// the function values are stored in one contiguous block, so only two allocations are needed per LensIntegral
 				pat_funcs_mult = new double*[511];
-				for (int i=0; i < 511; i++) pat_funcs_mult[i] = new double[n_mult];
+				pat_funcs_mult[0] = new double[511*n_mult];
+				for (int i=1; i < 511; i++) pat_funcs_mult[i] = pat_funcs_mult[i-1] + n_mult;
 			} else {
 				pat_funcs = new double[511];
 			}
@@ -465,7 +474,8 @@ struct LensIntegral : public Romberg
 			cc_weights = profile->cc_weights;
 			if (n_mult > 0) {
 				cc_funcs_mult = new double*[profile->cc_N];
-				for (int i=0; i < profile->cc_N; i++) cc_funcs_mult[i] = new double[n_mult];
+				cc_funcs_mult[0] = new double[profile->cc_N*n_mult];
+				for (int i=1; i < profile->cc_N; i++) cc_funcs_mult[i] = cc_funcs_mult[i-1] + n_mult;
 			} else {
 				cc_funcs = new double[profile->cc_N];
 			}
@@ -474,14 +484,14 @@ struct LensIntegral : public Romberg
 	~LensIntegral() {
 		if (profile->integral_method==Gauss_Patterson_Quadrature) {
 			if (n_mult > 0) {
-				for (int i=0; i < 511; i++) delete[] pat_funcs_mult[i];
+				delete[] pat_funcs_mult[0];
 				delete[] pat_funcs_mult;
 			} else {
 				delete[] pat_funcs;
 			}
 		} else if (profile->integral_method==Fejer_Quadrature) {
 			if (n_mult > 0) {
-				for (int i=0; i < profile->cc_N; i++) delete[] cc_funcs_mult[i];
+				delete[] cc_funcs_mult[0];
 				delete[] cc_funcs_mult;
 			} else {
 				delete[] cc_funcs;
@@ -507,6 +517,13 @@ struct LensIntegral : public Romberg
 	double j_integral(const int nval, bool &converged);
 	double k_integral(const int nval, bool &converged);
 
+	// These evaluate the J and/or K integrals for all n-values at once, so kappa (and kappa') only get evaluated once per node
+	void j_integrand_mult(const double w, double* jint);
+	void jk_integrand_mult(const double w, double* jkint);
+	void jk_integrals_mult(void (LensIntegral::*func)(const double, double*), double *results, const int n_funcs, bool &converged);
+	void j_integral_mult(double *jint, bool &converged);
+	void jk_integral_mult(double *jkint, bool &converged);
+
 	double i_integrand_egrad(const double w);
 	//double j_integrand_egrad(const double w);
 	//double k_integrand_egrad(const double w);
@@ -563,6 +580,7 @@ class SPLE_Lens : public LensProfile
 
 	void setup_lens_properties(const int parameter_mode_in = 0, const int subclass = 0);
 	void set_model_specific_integration_pointers();
+	bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
 
 	public:
 	SPLE_Lens(const int parameter_mode_in = 0)
@@ -614,6 +632,7 @@ class dPIE_Lens : public LensProfile
 
 	void setup_lens_properties(const int parameter_mode_in = 0, const int subclass = 0);
 	void set_model_specific_integration_pointers();
+	bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
 
 	public:
 	bool calculate_tidal_radius;
@@ -664,6 +683,7 @@ class NFW : public LensProfile
 
 	void setup_lens_properties(const int parameter_mode = 0, const int subclass = 0);
 	void set_model_specific_integration_pointers();
+	bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
 	void set_ks_rs_from_m200_c200();
 	void set_ks_c200_from_m200_rs();
 
@@ -788,6 +808,7 @@ class Hernquist : public LensProfile
 
 	void setup_lens_properties(const int parameter_mode = 0, const int subclass = 0);
 	void set_model_specific_integration_pointers();
+	bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
 
 	public:
 	Hernquist()
@@ -817,6 +838,7 @@ class ExpDisk : public LensProfile
 	double kapavg_spherical_rsq(const double rsq);
 	void setup_lens_properties(const int parameter_mode = 0, const int subclass = 0);
 	void set_model_specific_integration_pointers();
+	bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
 
 	public:
 	ExpDisk()
@@ -874,6 +896,7 @@ class Shear : public LensProfile
 	void potential_derivatives(double x, double y, double& kap, lensvector& def, lensmatrix& hess);
 	void deflection(double, double, lensvector&);
 	void hessian(double, double, lensmatrix&);
+	void param_derivatives(const int paramnum, const int npts, const lensvector* pts, lensvector* ddef, lensmatrix* dhess = NULL);
 	void potential_derivatives(double x, double y, lensvector& def, lensmatrix& hess);
 	void kappa_and_potential_derivatives(double x, double y, double& kap, lensvector& def, lensmatrix& hess)
 	{
@@ -897,6 +920,7 @@ class Multipole : public LensProfile
 	double kappa_rsq_deriv(const double rsq);
 	void setup_lens_properties(const int parameter_mode = 0, const int subclass = 0);
 	void set_model_specific_integration_pointers();
+	bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
 
 	public:
 
@@ -940,6 +964,7 @@ class PointMass : public LensProfile
 	double potential_spherical_rsq(const double rsq);
 	void setup_lens_properties(const int parameter_mode = 0, const int subclass = 0);
 	void set_model_specific_integration_pointers();
+	bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
 
 	public:
 	PointMass()
@@ -1198,6 +1223,7 @@ class MassSheet : public LensProfile
 	double potential_spherical_rsq(const double rsq);
 	void setup_lens_properties(const int parameter_mode = 0, const int subclass = 0);
 	void set_model_specific_integration_pointers();
+	bool param_derivative_scaling(const int paramnum, double& dlogdef_dparam);
 
 	public:
 	MassSheet()
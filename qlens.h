@@ -11,6 +11,8 @@
 #include "lensvec.h"
 #include "vector.h"
 #include "powell.h"
+#include "lbfgs.h"
+#include "lenstree.h"
 #include "simplex.h"
 #include "mcmchdr.h"
 #include "cosmo.h"
@@ -147,6 +149,13 @@ class PointSource : public ModelParams
 	void print(bool include_time_delays = false, bool show_labels = true) { print_to_file(include_time_delays,show_labels,NULL,NULL); }
 	void print_to_file(bool include_time_delays, bool show_labels, std::ofstream* srcfile, std::ofstream* imgfile);
 	void reset_images() { n_images = 0; images.clear(); }
+
+	// used by the Python wrapper
+	lensvector get_pos() const { return pos; }
+	double get_zsrc() const { return zsrc; }
+	double get_srcflux() const { return srcflux; }
+	int get_n_images() const { return n_images; }
+	const std::vector<image>& get_images() const { return images; }
 };
 
 class Grid : public Brent
@@ -188,7 +197,7 @@ class Grid : public Brent
 
 	// all functions in class Grid are contained in imgsrch.cpp
 	bool image_test(const int& thread);
-	void add_image_to_list(const lensvector& imgpos);
+	static void add_image_to_list(const lensvector& imgpos);
 
 	bool run_newton(lensvector& xroot, const int& thread);
 	inside_cell test_if_inside_sourceplane_cell(lensvector* point, const int& thread);
@@ -247,11 +256,11 @@ class Grid : public Brent
 	void assign_all_neighbors();
 	void assign_level_neighbors(int neighbor_level);
 
-	bool LineSearch(lensvector& xold, double fold, lensvector& g, lensvector& p, lensvector& x, double& f, double stpmax, bool &check, const int& thread);
-	bool NewtonsMethod(lensvector& x, bool &check, const int& thread);
-	void SolveLinearEqs(lensmatrix&, lensvector&);
-	bool redundancy(const lensvector&, double &);
-	double max_component(const lensvector&);
+	static bool LineSearch(lensvector& xold, double fold, lensvector& g, lensvector& p, lensvector& x, double& f, double stpmax, bool &check, const int& thread);
+	static bool NewtonsMethod(lensvector& x, bool &check, const int& thread);
+	static void SolveLinearEqs(lensmatrix&, lensvector&);
+	static bool redundancy(const lensvector&, double &);
+	static double max_component(const lensvector&);
 
 	static const int max_iterations, max_step_length;
 	static lensvector *fvec;
@@ -278,7 +287,10 @@ public:
 	static int nfound;
 	static double image_pos_accuracy;
 	image* tree_search();
+	static bool add_image_from_seed(lensvector& xroot, const int& thread);
+	static image* image_list() { return images; }
 	static void set_lens(QLens* lensptr) { lens = lensptr; }
+	static void set_zfactors(double* zfactor_in, double** betafactor_in) { grid_zfactors = zfactor_in; grid_betafactors = betafactor_in; }
 	void subgrid_around_galaxies(lensvector* galaxy_centers, const int& ngal, double* subgrid_radius, double* min_galsubgrid_cellsize, const int& n_cc_splittings, bool* subgrid);
 	void subgrid_around_galaxies_iteration(lensvector* galaxy_centers, const int& ngal, double* subgrid_radius, double* min_galsubgrid_cellsize, const int& n_cc_split, bool cc_neighbor_splitting, bool *subgrid);
 
@@ -300,18 +312,38 @@ public:
 struct WeakLensingData
 {
 	int n_sources;
+	int n_allocated; // the arrays grow geometrically as sources are added, so adding N sources one at a time costs O(N)
 	string *id;
 	lensvector *pos;
 	double *reduced_shear1;
 	double *reduced_shear2;
 	double *sigma_shear1, *sigma_shear2;
 	double *zsrc;
-	WeakLensingData() { n_sources = 0; }
+
+	// The kappa ratios (zfactors) for each source and lens redshift are cached between chi-square evaluations, and are only
+	// recalculated if the data, lens redshifts, reference source redshift or cosmological distances change (see QLens::update_weak_lensing_zfactors)
+	double *zfactors; // stored as zfactors[i*n_zfactor_planes + j] for source i, lens redshift j
+	int n_zfactor_planes;
+	bool zfactors_valid;
+	int zfactor_distance_table_id;
+	double zfactor_reference_zsrc;
+	double *zfactor_lens_redshifts;
+
+	static const char binary_file_tag[4];
+	static const int binary_file_version;
+
+	WeakLensingData() { n_sources = 0; n_allocated = 0; zfactors = NULL; zfactor_lens_redshifts = NULL; n_zfactor_planes = 0; zfactors_valid = false; }
 	void input(const int &nn);
 	void input(const WeakLensingData& wl_in);
+	void reserve(const int nn);
 	void add_source(const string id_in, lensvector& pos_in, const double g1_in, const double g2_in, const double g1_err_in, const double g2_err_in, const double zsrc_in);
 	void print_list(bool use_sci);
 	void write_to_file(string filename);
+	bool write_to_binary_file(string filename);
+	bool read_binary_file(std::ifstream& infile);
+	static bool is_binary_file(string filename);
+	double* source_zfactors(const int i) { return zfactors + i*n_zfactor_planes; }
+	void clear_zfactors();
 	void clear();
 	~WeakLensingData();
 };
@@ -345,7 +377,7 @@ void dumper_multinest(int &nSamples, int &nlive, int &nPar, double **physLive, d
 
 // There is too much inheritance going on here. Nearly all of these can be changed to simply objects that are created within the QLens
 // class; it's more transparent to do so, and more object-oriented.
-class QLens : public Brent, public Sort, public Powell, public Simplex, public UCMC
+class QLens : public Brent, public Sort, public Powell, public Simplex, public LBFGS, public UCMC
 {
 	private:
 	// These are arrays of dummy variables used for lensing calculations, arranged so that each thread gets its own set of dummy variables.
@@ -372,8 +404,18 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 #endif
 	static int nthreads;
 	int inversion_nthreads;
+	int cg_logdet_nprobes; // if nonzero, the CG inversion method estimates log-determinants by stochastic Lanczos quadrature with this many probes
+	int cg_logdet_lanczos_steps; // maximum number of Lanczos iterations per probe
+	double cg_logdet_tol; // Lanczos iterations stop once a probe's quadrature changes by less than this fraction
 	int simplex_nmax, simplex_nmax_anneal;
 	bool simplex_show_bestfit;
+	bool use_parallel_minimizer; // divide trial points of simplex/Powell minimization between MPI groups
+	int chisqscan_nrefine; // number of times 'fit plot_chisq1d/2d' subdivides cells lying within chisqscan_dchisq of the minimum
+	double chisqscan_dchisq;
+	bool chisqscan_profile; // if on, chi-square scans minimize over the remaining free parameters at each point
+	bool *chisqscan_param_fixed; // the following are only used while a profiled chi-square scan is running
+	double *chisqscan_fullparams;
+	double (QLens::*chisqscan_loglikeptr)(double*);
 	double simplex_temp_initial, simplex_temp_final, simplex_cooling_factor, simplex_minchisq, simplex_minchisq_anneal;
 	int n_livepts; // for nested sampling
 	bool multinest_constant_eff_mode;
@@ -381,7 +423,9 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	int polychord_nrepeats;
 	int mcmc_threads;
 	double mcmc_tolerance; // for Metropolis-Hastings
+	double mcmc_target_ess; // if nonzero, T-Walk runs until the effective sample size reaches this value (in addition to meeting mcmc_tolerance)
 	bool mcmc_logfile;
+	int mcmc_checkpoint_interval; // number of iterations between checkpoints for the T-Walk and nested samplers (zero = no checkpoints)
 	bool open_chisq_logfile;
 	bool psf_convolution_mpi;
 	bool fft_convolution;
@@ -504,6 +548,7 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	//bool optimize_regparam_lhi;
 	double optimize_regparam_tol, optimize_regparam_minlog, optimize_regparam_maxlog;
 	double regopt_chisqmin, regopt_logdet;
+	int regopt_zsrc_i;
 	int max_regopt_iterations;
 
 	// the following parameters are used for luminosity- or distance-weighted regularization
@@ -547,6 +592,7 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	ImageData *image_data;
 	WeakLensingData weak_lensing_data;
 	double chisq_tolerance;
+	double chisqtol_lumreg; // if nonzero, luminosity-weighted regularization iterations stop once -2*log(evidence) changes by less than this (default=0, off)
 	int lumreg_max_it;
 	int n_repeats;
 	bool display_chisq_status;
@@ -559,6 +605,7 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	bool include_parity_in_chisq;
 	bool imgplane_chisq;
 	bool calculate_parameter_errors;
+	bool fisher_analytic_gradient; // if on, the Fisher matrix is found from analytic loglike gradients where they are available
 	bool adaptive_subgrid;
 	bool use_average_magnification_for_subgridding;
 	bool redo_lensing_calculations_before_inversion;
@@ -573,6 +620,8 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	bool clustering_random_initialization;
 	bool weight_initial_centroids;
 	bool use_dualtree_kmeans;
+	bool use_native_kmeans; // use built-in k-means (kmeans.cpp) rather than mlpack
+	bool kmeans_warm_start; // start clustering from the centroids found in the previous likelihood evaluation, if available
 	int n_src_clusters;
 	int n_cluster_iterations;
 	double delaunay_high_sn_sbfrac;
@@ -587,6 +636,8 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	double sim_err_shear; // actually error in reduced shear (for weak lensing data)
 	bool split_imgpixels;
 	bool split_high_mag_imgpixels;
+	bool adaptive_imgpixel_split; // if on, each pixel in the mask is split just enough to bring its integration error below imgpixel_split_tolerance
+	double imgpixel_split_tolerance; // in units of the pixel noise (or absolute, if the pixel noise is zero)
 	bool delaunay_from_pixel_centers;
 	bool raytrace_using_pixel_centers;
 	bool psf_supersampling;
@@ -648,7 +699,7 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	string fit_output_dir;
 	bool auto_fit_output_dir;
 	enum TerminalType { TEXT, POSTSCRIPT, PDF } terminal; // keeps track of the file format for plotting
-	enum FitMethod { POWELL, SIMPLEX, NESTED_SAMPLING, TWALK, POLYCHORD, MULTINEST } fitmethod;
+	enum FitMethod { POWELL, SIMPLEX, NESTED_SAMPLING, TWALK, POLYCHORD, MULTINEST, QUASI_NEWTON } fitmethod;
 	RegularizationMethod regularization_method;
 	enum InversionMethod { CG_Method, MUMPS, UMFPACK, DENSE, DENSE_FMATRIX } inversion_method;
 	RayTracingMethod ray_tracing_method;
@@ -675,6 +726,10 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	double newton_magnification_threshold;
 	bool reject_himag_images;
 	bool reject_images_found_outside_cell;
+	bool warm_start_image_search; // if on, point images are found by refining those from the previous chi-square evaluation when possible
+	int warm_start_refresh_interval; // forces a full grid search after this many consecutive warm-started evaluations for a given source
+	std::vector<std::vector<image>> warm_start_images;
+	std::vector<int> n_warm_start_evals;
 
 	// private functions are all contained in the file lens.cpp
 	bool subgrid_around_perturbers; // if on, will always subgrid around perturbers (with pjaffe profile) when new grid is created
@@ -694,6 +749,20 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	double perturbation_radius_equation_nosub(const double r);
 
 	bool multithread_perturber_deflections; // provides speedup for large number of perturbers
+	double perturber_tree_theta; // opening angle for tree-based summation of perturber deflections (tree is not used if zero)
+	LensTree **perturber_trees; // one for each lens redshift (NULL if a plane has too few perturbers to bother)
+	int n_perturber_trees;
+	bool perturber_trees_valid;
+	std::vector<double> perturber_tree_model_state; // lens and cosmology parameters the trees were built with
+	void build_perturber_trees();
+	void get_perturber_tree_model_state(std::vector<double>& state);
+	void check_perturber_trees();
+	void clear_perturber_trees();
+	LensTree** get_perturber_trees() {
+		if (perturber_tree_theta <= 0) return NULL;
+		if (!perturber_trees_valid) build_perturber_trees();
+		return perturber_trees;
+	}
 	// needed for calculating the subhalo perturbation radius and scale for perturber subgridding
 	bool use_perturber_flags;
 	int perturber_lens_number;
@@ -780,6 +849,7 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	int *Fmatrix_index;
 	bool use_noise_map;
 	bool dense_Rmatrix;
+	RegularizationMethod Rmatrix_reg_method; // method used to generate the current Rmatrix (curvature is used before luminosity weighting starts)
 	bool find_covmatrix_inverse; // set by user (default=false); if true, finds Rmatrix explicitly (usually more computationally intensive)
 	bool use_covariance_matrix; // internal bool; set to true if using covariance kernel reg. and if find_covmatrix_inverse is false
 	double covmatrix_epsilon; // fudge factor in covariance matrix diagonal to aid inversion
@@ -821,6 +891,7 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 
 	//void add_lum_weighted_reg_term(const bool dense_Fmatrix, const bool use_matrix_copies);
 	double brents_min_method(double (QLens::*func)(const double), const double ax, const double bx, const double tol, const bool verbal);
+	double brents_min_method_warm(double (QLens::*func)(const double), const double guess, const double ax, const double bx, const double tol, const bool verbal);
 	void create_regularization_matrix_shapelet(const int zsrc_i=-1);
 	void generate_Rmatrix_shapelet_gradient(const int zsrc_i=-1);
 	void generate_Rmatrix_shapelet_curvature(const int zsrc_i=-1);
@@ -888,6 +959,16 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	double psf_threshold, psf_ptsrc_threshold;
 	int psf_ptsrc_nsplit; // allows for subpixel PSF
 
+	// stationary correlated pixel noise, with covariance C = S*Xi*S where S = diag(pixel noise) and Xi is the correlation kernel
+	bool correlated_noise;
+	double noise_corr_length; // width (in pixels) of Gaussian correlation kernel, used if no kernel has been loaded
+	double **noise_corr_kernel; // correlation kernel loaded from file (central value is normalized to 1)
+	int noise_corr_npixels_x, noise_corr_npixels_y;
+	double **whitening_kernel; // truncated convolution kernel for Xi^(-1/2), generated from the power spectrum of the correlation kernel
+	int whitening_kernel_npixels_x, whitening_kernel_npixels_y;
+	double whitening_threshold;
+	double noise_corr_logdet_per_pixel; // log(det(Xi))/npixels, from the mean log power spectrum
+
 	double Fmatrix_log_determinant, Rmatrix_log_determinant;
 	double Gmatrix_log_determinant;
 	void initialize_pixel_matrices(const int zsrc_i, bool verbal=false);
@@ -902,6 +983,7 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	void PSF_convolution_pixel_vector(const int zsrc_i, const bool foreground = false, const bool verbal = false, const bool use_fft = false);
 	void average_supersampled_image_surface_brightness(const int zsrc_i=-1);
 	void average_supersampled_dense_Lmatrix(const int zsrc_i=-1);
+	void average_supersampled_Lmatrix(const int zsrc_i=-1);
 	void cleanup_FFT_convolution_arrays();
 	void copy_FFT_convolution_arrays(QLens* lens_in);
 	void fourier_transform(double* data, const int ndim, int* nn, const int isign);
@@ -909,6 +991,15 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	bool generate_PSF_matrix(const double pixel_xlength, const double pixel_ylength, const bool supersampling);
 	bool spline_PSF_matrix(const double xstep, const double ystep);
 	double interpolate_PSF_matrix(const double x, const double y, const bool supersampled);
+	bool load_noise_corr_kernel(const string filename);
+	void delete_noise_corr_kernel();
+	void delete_whitening_kernel();
+	bool generate_noise_whitening_kernel(const bool verbal = false);
+	bool use_noise_whitening();
+	void whiten_image_pixel_vector(const int zsrc_i, double *vec, double *white_vec);
+	void whiten_Lmatrix(const int zsrc_i, double*& Lw, int*& Lw_index, int*& Lw_location, int& Lw_nn);
+	void whiten_Lmatrix_dense(const int zsrc_i, dmatrix& Lw);
+	double correlated_noise_chisq(double **scaled_residual, bool **included, const int nx, const int ny);
 
 	bool create_regularization_matrix(const int zsrc_i, const bool include_lum_weighting = false, const bool use_sbweights = false, const bool verbal = false);
 	void generate_Rmatrix_from_gmatrices(const int zsrc_i=-1, const bool interpolate = false);
@@ -1089,6 +1180,8 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	// the following functions are contained in imgsrch.cpp
 	private:
 	void find_images();
+	bool find_images_from_seeds(const lensvector &source_in, const std::vector<image>& seeds, double *zfacs, double **betafacs);
+	void convert_time_delays_to_days();
 
 	public:
 	bool plot_recursive_grid(const char filename[]);
@@ -1224,11 +1317,12 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	public:
 	double chi_square_fit_simplex();
 	double chi_square_fit_powell();
+	double chi_square_fit_lbfgs();
 	void output_fit_results(dvector& stepsizes, const double chisq_bestfit, const int chisq_evals);
-	void nested_sampling();
+	void nested_sampling(const bool resume_previous = false);
 	void polychord(const bool resume_previous, const bool skip_run);
 	void multinest(const bool resume_previous, const bool skip_run);
-	void chi_square_twalk();
+	void chi_square_twalk(const bool resume_previous = false);
 	bool add_dparams_to_chain(string file_ext);
 	bool adopt_bestfit_point_from_chain();
 	bool adopt_point_from_chain(const unsigned long point_num);
@@ -1243,6 +1337,8 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 
 	void plot_chisq_2d(const int param1, const int param2, const int n1, const double i1, const double f1, const int n2, const double i2, const double f2);
 	void plot_chisq_1d(const int param, const int n, const double i, const double f, string filename);
+	void evaluate_chisq_scan_points(const int npts, const int nscan, const int *scan_params, const double *scan_vals, double *point_params, double *chisqvals);
+	double chisq_scan_profile_loglike(double* free_params);
 	double chisq_single_evaluation(bool init_fitmodel, bool show_total_wtime, bool showdiag, bool show_status, bool show_lensinfo = false);
 	bool setup_fit_parameters(const bool ignore_limits = false);
 	bool setup_limits();
@@ -1273,6 +1369,10 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	double loglike_point_source(double* params);
 	bool calculate_fisher_matrix(const dvector &params, const dvector &stepsizes);
 	double loglike_deriv(const dvector &params, const int index, const double step);
+	bool fitmodel_loglike_gradient(double* params, double* grad);
+	bool fitmodel_loglike_gradient_analytic(double* params, double* grad);
+	dvector loglike_gradient_params, loglike_gradient; // most recent gradient found by DLogLike, and the point where it was evaluated
+	double DLogLike(double* params, const int i);
 	void output_bestfit_model();
 	bool adopt_model(dvector &fitparams);
 
@@ -1320,13 +1420,16 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	void print_lensing_info_at_point(const double x, const double y);
 
 	double chisq_pos_source_plane();
+	bool chisq_pos_source_plane_gradient(double& chisq, double* dchisq);
 	double chisq_pos_image_plane();
+	image* find_ptsrc_images_for_chisq(const int i, const int group_num, bool& grid_created, int& n_images);
 	double chisq_pos_image_plane_diagnostic(const bool verbose, const bool output_residuals_to_file, double& rms_imgpos_err, int& n_matched_images, const string output_filename = "fit_chivals.dat");
 
 	double chisq_flux();
 	double chisq_time_delays();
 	double chisq_time_delays_from_model_imgs();
 	double chisq_weak_lensing();
+	void update_weak_lensing_zfactors();
 	bool output_weak_lensing_chivals(string filename);
 	void find_analytic_srcflux(double *bestfit_flux);
 	void find_analytic_srcpos(lensvector *beta_i);
@@ -1390,7 +1493,7 @@ class QLens : public Brent, public Sort, public Powell, public Simplex, public U
 	void set_fitmethod(FitMethod fitmethod_in)
 	{
 		fitmethod = fitmethod_in;
-		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX)) {
+		if ((fitmethod==POWELL) or (fitmethod==SIMPLEX) or (fitmethod==QUASI_NEWTON)) {
 			for (int i=0; i < nlens; i++) lens_list[i]->set_include_limits(false);
 			for (int i=0; i < n_ptsrc; i++) ptsrc_list[i]->set_include_limits(false);
 			for (int i=0; i < n_sb; i++) sb_list[i]->set_include_limits(false);
@@ -53,11 +53,11 @@ PYBIND11_MODULE(qlens, m) {
 
         ;
 
-    py::class_<Alpha, LensProfile, std::unique_ptr<Alpha, py::nodelete>>(m, "Alpha")
-        .def(py::init<>([](){return new Alpha();}))
-        .def(py::init<const Alpha*>())
+    py::class_<SPLE_Lens, LensProfile, std::unique_ptr<SPLE_Lens, py::nodelete>>(m, "Alpha")
+        .def(py::init<>([](){return new SPLE_Lens();}))
+        .def(py::init<const SPLE_Lens*>())
         .def(py::init([](py::dict dict) {
-                                return new Alpha(
+                                return new SPLE_Lens(
                                         py::cast<double>(dict["b"]),
                                         py::cast<double>(dict["alpha"]),
                                         py::cast<double>(dict["s"]),
@@ -67,7 +67,7 @@ PYBIND11_MODULE(qlens, m) {
                                         py::cast<double>(dict["yc"])
                                 );
                         }))
-        .def("initialize", [](Alpha &current, py::dict dict){
+        .def("initialize", [](SPLE_Lens &current, py::dict dict){
                 try {
                         double b = py::cast<double>(dict["b"]);
                         double alpha = py::cast<double>(dict["alpha"]);
@@ -108,9 +108,9 @@ PYBIND11_MODULE(qlens, m) {
         })
         ;
 
-    py::class_<PseudoJaffe, LensProfile, std::unique_ptr<PseudoJaffe, py::nodelete>>(m, "PseudoJaffe")
-        .def(py::init<>([](){return new PseudoJaffe();}))
-        .def(py::init<const PseudoJaffe*>());
+    py::class_<dPIE_Lens, LensProfile, std::unique_ptr<dPIE_Lens, py::nodelete>>(m, "PseudoJaffe")
+        .def(py::init<>([](){return new dPIE_Lens();}))
+        .def(py::init<const dPIE_Lens*>());
 
     py::class_<NFW, LensProfile, std::unique_ptr<NFW, py::nodelete>>(m, "NFW")
         .def(py::init<>([](){return new NFW();}))
@@ -204,7 +204,7 @@ PYBIND11_MODULE(qlens, m) {
                 py::arg("flux")=-1, py::arg("show_labels")=false
                 )
         // .def("get_imageset", &Lens_Wrap::get_imageset)
-        .def("get_imageset", [](Lens_Wrap &curr, ImageSet &imgset, double src_x=0.5, double src_y=0.1, bool verbal=false) {
+        .def("get_imageset", [](Lens_Wrap &curr, PointSource &imgset, double src_x=0.5, double src_y=0.1, bool verbal=false) {
                 curr.get_imageset(src_x, src_y, imgset, verbal);
         },  py::arg("imgset"), py::arg("src_x") = 0.5, py::arg("src_y") = 0.1, py::arg("verbal")=false)        
         .def("get_fit_imagesets", &Lens_Wrap::get_fit_imagesets, 
@@ -216,6 +216,8 @@ PYBIND11_MODULE(qlens, m) {
                         curr.chi_square_fit_simplex();
                 } else if (fitmethod=="powell") {
                         curr.chi_square_fit_powell();
+                } else if (fitmethod=="lbfgs") {
+                        curr.chi_square_fit_lbfgs();
                 } else if (fitmethod=="nest") {
                         curr.nested_sampling();
                 } else if (fitmethod=="multinest") {
@@ -225,7 +227,7 @@ PYBIND11_MODULE(qlens, m) {
                 } else if (fitmethod=="twalk") {
                         curr.chi_square_twalk();
                 } else {
-                        throw std::runtime_error("Available fitmethodeters: simplex (default), powell, twalk");
+                        throw std::runtime_error("Available fitmethodeters: simplex (default), powell, lbfgs, twalk");
                 }
         })
         .def("use_bestfit", &Lens_Wrap::use_bestfit)
@@ -235,6 +237,19 @@ PYBIND11_MODULE(qlens, m) {
 		  .def("fit_chisq",&Lens_Wrap::chisq_single_evaluation, py::arg("showdiag") = false, py::arg("show_status") = true)
         .def("set_sourcepts_auto", &Lens_Wrap::set_analytic_sourcepts)
         .def("fitmodel", &Lens_Wrap::print_fit_model)
+        .def("deflection", &Lens_Wrap::deflection_batch, "Deflection (alpha_x, alpha_y) at arrays of image-plane points", py::arg("x"), py::arg("y"))
+        .def("sourcept", &Lens_Wrap::sourcept_batch, "Ray-traced source positions (beta_x, beta_y) at arrays of image-plane points", py::arg("x"), py::arg("y"))
+        .def("hessian", &Lens_Wrap::hessian_batch, "Hessian components (hxx, hyy, hxy) at arrays of image-plane points", py::arg("x"), py::arg("y"))
+        .def("kappa", &Lens_Wrap::kappa_batch, py::arg("x"), py::arg("y"))
+        .def("potential", &Lens_Wrap::potential_batch, py::arg("x"), py::arg("y"))
+        .def("magnification", &Lens_Wrap::magnification_batch, py::arg("x"), py::arg("y"))
+        .def("time_delay", &Lens_Wrap::time_delay_batch, "Fermat potential in days for a source at (src_x, src_y)",
+                py::arg("x"), py::arg("y"), py::arg("src_x"), py::arg("src_y"))
+        .def("surface_brightness", &Lens_Wrap::surface_brightness_batch, "Image-plane surface brightness of the source objects", py::arg("x"), py::arg("y"))
+        .def("image_sb", &Lens_Wrap::image_sb_view, "Zero-copy view of the model image surface brightness (invalidated when the image grid is rebuilt)",
+                py::arg("zsrc_i") = 0)
+        .def("image_foreground_sb", &Lens_Wrap::image_foreground_sb_view, py::arg("zsrc_i") = 0)
+        .def("image_residuals", &Lens_Wrap::image_residuals, "Data minus model surface brightness inside the fit mask", py::arg("zsrc_i") = 0)
         .def_readonly("sorted_critical_curve", &Lens_Wrap::sorted_critical_curve)
         .def_readonly("nlens", &Lens_Wrap::nlens)
 		  .def_property("zsrc", &Lens_Wrap::get_source_redshift, &Lens_Wrap::set_source_redshift)
@@ -247,7 +262,7 @@ PYBIND11_MODULE(qlens, m) {
 		  .def_readwrite("flux_chisq", &Lens_Wrap::include_flux_chisq)
 		  .def_readwrite("chisqtol", &Lens_Wrap::chisq_tolerance)
 		  .def_readwrite("central_image", &Lens_Wrap::include_central_image)
-		  .def_readwrite("sourcepts_fit", &Lens_Wrap::sourcepts_fit)
+		  .def_property_readonly("sourcepts_fit", &Lens_Wrap::get_sourcepts)
 		  .def_readwrite("n_livepts", &Lens_Wrap::n_livepts)
 		  .def_property("sci_notation", &Lens_Wrap::get_sci_notation, &Lens_Wrap::set_sci_notation)
 		  .def_property("fit_label", &Lens_Wrap::get_fit_label, &Lens_Wrap::set_fit_label)
@@ -283,20 +298,20 @@ PYBIND11_MODULE(qlens, m) {
         .def("pos", [](lensvector &lens){ return std::make_tuple(lens.v[0], lens.v[1]); })
         ;
 
-    py::class_<ImageSet>(m, "ImageSet")
-        .def(py::init<>([](){ return new ImageSet(); }))
+    py::class_<PointSource>(m, "ImageSet")
+        .def(py::init<>([](){ return new PointSource(); }))
         // .def()
         // .def("print", &ImageSet::print)
          //.def("print", [](&ImageSet curr, bool include_time_delays = false, bool show_labels = true, ofstream* srcfile = NULL, ofstream* imgfile = NULL){
                  //curr.print(include_time_delays, show_labels, srcfile, imgfile);
         //}, 
-         .def("print", &ImageSet::print,
-                 py::arg("include_time_delays") = false, py::arg("include_time_delays") = true)
-        .def_readonly("n_images", &ImageSet::n_images)
-        .def_readonly("zsrc", &ImageSet::zsrc)
-        .def_readonly("srcflux", &ImageSet::srcflux)
-        .def_readonly("src", &ImageSet::src)
-        .def_readonly("images", &ImageSet::images)
+         .def("print", &PointSource::print,
+                 py::arg("include_time_delays") = false, py::arg("show_labels") = true)
+        .def_property_readonly("n_images", &PointSource::get_n_images)
+        .def_property_readonly("zsrc", &PointSource::get_zsrc)
+        .def_property_readonly("srcflux", &PointSource::get_srcflux)
+        .def_property_readonly("src", &PointSource::get_pos)
+        .def_property_readonly("images", &PointSource::get_images)
         ;
 
     py::class_<ImageDataSet>(m, "ImageDataSet")
@@ -42,15 +42,15 @@ CC   := $(CCOMP) $(OPTS) $(UMFOPTS) $(FLAGS) $(CMUMPS) $(INC)
 CC_NO_OPT   := $(CCOMP) $(OPTS_NO_OPT) $(UMFOPTS) $(FLAGS) $(CMUMPS) $(INC) 
 CL   := $(CCOMP) $(OPTS) $(UMFOPTS) $(FLAGS)
 
-objects = profile.o sbprofile.o models.o qlens.o commands.o lens.o imgsrch.o pixelgrid.o \
+objects = profile.o sbprofile.o egrad.o models.o qlens.o commands.o params.o modelparams.o lenscalc.o lens.o imgsrch.o pixelgrid.o \
 				cg.o mcmchdr.o errors.o brent.o sort.o gauss.o romberg.o spline.o \
 				trirectangle.o GregsMathHdr.o hyp_2F1.o cosmo.o \
-				simplex.o powell.o mcmceval.o
+				simplex.o powell.o lbfgs.o mcmceval.o kmeans.o lenstree.o
 
-wrapper_objects = profile.o mcmceval.o commands.o lens.o imgsrch.o pixelgrid.o cg.o mcmchdr.o \
-				models.o sbprofile.o errors.o brent.o sort.o gauss.o \
+wrapper_objects = profile.o mcmceval.o commands.o params.o modelparams.o lenscalc.o lens.o imgsrch.o pixelgrid.o cg.o mcmchdr.o \
+				models.o sbprofile.o egrad.o errors.o brent.o sort.o gauss.o \
 				romberg.o spline.o trirectangle.o GregsMathHdr.o hyp_2F1.o cosmo.o \
-				simplex.o powell.o 
+				simplex.o powell.o lbfgs.o kmeans.o lenstree.o
 
 mkdist_objects = mkdist.o
 mkdist_shared_objects = GregsMathHdr.o errors.o mcmceval.o
@@ -84,6 +84,15 @@ commands.o: commands.cpp qlens.h lensvec.h profile.h
 lens.o: lens.cpp profile.h sbprofile.h qlens.h pixelgrid.h lensvec.h matrix.h simplex.h powell.h mcmchdr.h cosmo.h
 	$(CC) -c lens.cpp
 
+params.o: params.cpp params.h 
+	$(CC) -c params.cpp
+
+modelparams.o: modelparams.cpp modelparams.h 
+	$(CC) -c modelparams.cpp
+
+lenscalc.o: lenscalc.cpp qlens.h lensvec.h lenstree.h
+	$(CC) -c lenscalc.cpp
+
 imgsrch.o: imgsrch.cpp qlens.h lensvec.h
 	$(CC) -c imgsrch.cpp
 
@@ -96,6 +105,9 @@ cg.o: cg.cpp cg.h
 mcmchdr.o: mcmchdr.cpp mcmchdr.h GregsMathHdr.h random.h
 	$(CC) -c mcmchdr.cpp
 
+egrad.o: egrad.cpp egrad.h 
+	$(CC) -c egrad.cpp
+
 profile.o: profile.h profile.cpp lensvec.h
 	$(CC) -c profile.cpp
 
@@ -108,6 +120,12 @@ sbprofile.o: sbprofile.h sbprofile.cpp
 errors.o: errors.cpp errors.h
 	$(CC) -c errors.cpp
 
+kmeans.o: kmeans.h kmeans.cpp
+	$(CC) -c kmeans.cpp
+
+lenstree.o: lenstree.h lenstree.cpp profile.h lensvec.h
+	$(CC) -c lenstree.cpp
+
 brent.o: brent.h brent.cpp
 	$(CC) -c brent.cpp
 
@@ -117,6 +135,9 @@ simplex.o: simplex.h rand.h simplex.cpp
 powell.o: powell.h powell.cpp
 	$(CC) -c powell.cpp
 
+lbfgs.o: lbfgs.h lbfgs.cpp
+	$(CC) -c lbfgs.cpp
+
 sort.o: sort.h sort.cpp
 	$(CC) -c sort.cpp
 
@@ -2,11 +2,14 @@
 #include "pixelgrid.h"
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h>
 #include <vector>
 #include "profile.h"
 
 namespace py = pybind11;
 
+typedef py::array_t<double, py::array::c_style | py::array::forcecast> dblarray;
+
 class Lens_Wrap: public QLens {
 public:
 #ifdef USE_MPI
@@ -140,21 +143,21 @@ public:
     }
 
     std::string imgdata_load_file(const std::string &name_) { 
-        if (load_image_data(name_)==false) throw runtime_error("Unable to read data");
+        if (load_point_image_data(name_)==false) throw std::runtime_error("Unable to read data");
         update_parameter_list();
         return name_;
     }
 
     void imgdata_display() {
-        if (n_sourcepts_fit==0) throw runtime_error("no image data has been loaded");
+        if (n_ptsrc==0) throw std::runtime_error("no image data has been loaded");
         print_image_data(true);
     }
 
     void imgdata_write_file(const std::string &name_) {
         try{
-            write_image_data(name_);
+            write_point_image_data(name_);
         } catch(...) {
-            throw runtime_error("Unable to write to: " + name_);
+            throw std::runtime_error("Unable to write to: " + name_);
         }
     }
 
@@ -162,21 +165,21 @@ public:
         // No argument, clear all
         if (lower==-1) { clear_image_data(); return true; }
 
-        if (upper > n_sourcepts_fit) {throw runtime_error("Specified max image dataset number exceeds number of data sets in list");}
+        if (upper > n_ptsrc) {throw std::runtime_error("Specified max image dataset number exceeds number of data sets in list");}
         
         // Clear a range
         bool is_range_ok = upper > lower;
         if (is_range_ok && lower > -1 && upper != -1) {
-            for (int i=upper; i >= lower; i--) remove_image_data(i);
+            for (int i=upper; i >= lower; i--) remove_point_source(i);
             return true;
         }
 
         // User did not use the proper format
-        throw runtime_error("Specify proper range or leave empty to clear all data.");
+        throw std::runtime_error("Specify proper range or leave empty to clear all data.");
     }
 
     void imgdata_add(double x, double y) {
-        if(x<=-1 || y<=-1) { throw runtime_error("Please specify a proper coodinate"); }
+        if(x<=-1 || y<=-1) { throw std::runtime_error("Please specify a proper coodinate"); }
 
         lensvector src;
         src[0] = x;
@@ -184,6 +187,18 @@ public:
         if(add_simulated_image_data(src)) update_parameter_list();
     }
 
+    std::vector<lensvector> get_sourcepts() {
+        std::vector<lensvector> srcpts(n_ptsrc);
+        for (int i=0; i < n_ptsrc; i++) srcpts[i] = ptsrc_list[i]->get_pos();
+        return srcpts;
+    }
+
+    void use_bestfit() {
+        if (adopt_model(bestfitparams)==false) throw std::runtime_error("could not adopt best-fit model");
+    }
+
+    bool get_analytic_bestfit_src() { return use_analytic_bestfit_src; }
+
     void lens_display() {
         print_lens_list(false);
     }
@@ -207,11 +222,166 @@ public:
             2. If an argument matches with lens parameter
         */
         // TODO: Verify with Quinn on where in commands.cpp gets the updated and then adapt here.
-        if (loc == -1) throw runtime_error("Please specify the lens to update.");
+        if (loc == -1) throw std::runtime_error("Please specify the lens to update.");
         // if (kwargs) {
             
         // }
     }
+    // Batched evaluation on NumPy coordinate arrays. x and y must have the same shape; the results have that shape too.
+    // The GIL is released while the lens calculations run (multithreaded with OpenMP if enabled).
+    py::tuple deflection_batch(const dblarray &x, const dblarray &y) {
+        check_coordinate_arrays(x,y);
+        dblarray defx = new_array_like(x), defy = new_array_like(x);
+        const double *xp = x.data(), *yp = y.data();
+        double *dxp = defx.mutable_data(), *dyp = defy.mutable_data();
+        run_batch(x.size(), [&](const long i, const int thread) {
+            deflection(xp[i],yp[i],dxp[i],dyp[i],thread,reference_zfactors,default_zsrc_beta_factors);
+        });
+        return py::make_tuple(defx,defy);
+    }
+
+    py::tuple sourcept_batch(const dblarray &x, const dblarray &y) {
+        check_coordinate_arrays(x,y);
+        dblarray srcx = new_array_like(x), srcy = new_array_like(x);
+        const double *xp = x.data(), *yp = y.data();
+        double *sxp = srcx.mutable_data(), *syp = srcy.mutable_data();
+        run_batch(x.size(), [&](const long i, const int thread) {
+            lensvector pt(xp[i],yp[i]);
+            find_sourcept(pt,sxp[i],syp[i],thread,reference_zfactors,default_zsrc_beta_factors);
+        });
+        return py::make_tuple(srcx,srcy);
+    }
+
+    py::tuple hessian_batch(const dblarray &x, const dblarray &y) {
+        check_coordinate_arrays(x,y);
+        dblarray hxx = new_array_like(x), hyy = new_array_like(x), hxy = new_array_like(x);
+        const double *xp = x.data(), *yp = y.data();
+        double *hxxp = hxx.mutable_data(), *hyyp = hyy.mutable_data(), *hxyp = hxy.mutable_data();
+        run_batch(x.size(), [&](const long i, const int thread) {
+            lensmatrix hess;
+            hessian(xp[i],yp[i],hess,thread,reference_zfactors,default_zsrc_beta_factors);
+            hxxp[i] = hess[0][0];
+            hyyp[i] = hess[1][1];
+            hxyp[i] = hess[0][1];
+        });
+        return py::make_tuple(hxx,hyy,hxy);
+    }
+
+    dblarray kappa_batch(const dblarray &x, const dblarray &y) {
+        check_coordinate_arrays(x,y);
+        dblarray kap = new_array_like(x);
+        const double *xp = x.data(), *yp = y.data();
+        double *kp = kap.mutable_data();
+        run_batch(x.size(), [&](const long i, const int thread) {
+            if (n_lens_redshifts==1) kp[i] = kappa(xp[i],yp[i],reference_zfactors,default_zsrc_beta_factors);
+            else {
+                // QLens::kappa uses the thread-0 scratch matrix for multiplane lensing, so go through the hessian here instead
+                lensmatrix hess;
+                hessian(xp[i],yp[i],hess,thread,reference_zfactors,default_zsrc_beta_factors);
+                kp[i] = (hess[0][0] + hess[1][1])/2;
+            }
+        });
+        return kap;
+    }
+
+    dblarray potential_batch(const dblarray &x, const dblarray &y) {
+        check_coordinate_arrays(x,y);
+        dblarray pot = new_array_like(x);
+        const double *xp = x.data(), *yp = y.data();
+        double *pp = pot.mutable_data();
+        run_batch(x.size(), [&](const long i, const int thread) {
+            pp[i] = potential(xp[i],yp[i],reference_zfactors,default_zsrc_beta_factors);
+        });
+        return pot;
+    }
+
+    dblarray magnification_batch(const dblarray &x, const dblarray &y) {
+        check_coordinate_arrays(x,y);
+        dblarray mag = new_array_like(x);
+        const double *xp = x.data(), *yp = y.data();
+        double *mp = mag.mutable_data();
+        run_batch(x.size(), [&](const long i, const int thread) {
+            lensvector pt(xp[i],yp[i]);
+            mp[i] = magnification(pt,thread,reference_zfactors,default_zsrc_beta_factors);
+        });
+        return mag;
+    }
+
+    // Fermat potential for the source at (src_x,src_y), converted to days (same normalization as the time delays from findimg)
+    dblarray time_delay_batch(const dblarray &x, const dblarray &y, const double src_x, const double src_y) {
+        check_coordinate_arrays(x,y);
+        dblarray td = new_array_like(x);
+        const double *xp = x.data(), *yp = y.data();
+        double *tp = td.mutable_data();
+        double td_factor = cosmo.time_delay_factor_arcsec(lens_redshift,reference_source_redshift);
+        run_batch(x.size(), [&](const long i, const int thread) {
+            tp[i] = td_factor*(0.5*(SQR(xp[i]-src_x)+SQR(yp[i]-src_y)) - potential(xp[i],yp[i],reference_zfactors,default_zsrc_beta_factors));
+        });
+        return td;
+    }
+
+    // Image-plane surface brightness of the source objects (lensed profiles are evaluated at the ray-traced points)
+    dblarray surface_brightness_batch(const dblarray &x, const dblarray &y) {
+        check_coordinate_arrays(x,y);
+        if (n_sb==0) throw std::runtime_error("no source objects have been created");
+        dblarray sb = new_array_like(x);
+        const double *xp = x.data(), *yp = y.data();
+        double *sbp = sb.mutable_data();
+        run_batch(x.size(), [&](const long i, const int thread) {
+            lensvector pt(xp[i],yp[i]), srcpt;
+            int k, zsrc_i, traced_zsrc_i = -1;
+            sbp[i] = 0;
+            for (k=0; k < n_sb; k++) {
+                if (!sb_list[k]->is_lensed) {
+                    sbp[i] += sb_list[k]->surface_brightness(xp[i],yp[i]);
+                } else {
+                    zsrc_i = sbprofile_redshift_idx[k];
+                    if (zsrc_i != traced_zsrc_i) {
+                        find_sourcept(pt,srcpt,thread,extended_src_zfactors[zsrc_i],extended_src_beta_factors[zsrc_i]);
+                        traced_zsrc_i = zsrc_i;
+                    }
+                    sbp[i] += sb_list[k]->surface_brightness(srcpt[0],srcpt[1]);
+                }
+            }
+        });
+        return sb;
+    }
+
+    // Zero-copy views of the model surface brightness stored in an image pixel grid, with shape (npixels_y, npixels_x).
+    // The view shares memory with the grid, so it is only valid until the grid is rebuilt or deleted.
+    py::array image_sb_view(const int zsrc_i = 0) {
+        ImagePixelGrid *grid = get_image_pixel_grid(zsrc_i);
+        return grid_block_view(grid,grid->surface_brightness_block());
+    }
+
+    py::array image_foreground_sb_view(const int zsrc_i = 0) {
+        ImagePixelGrid *grid = get_image_pixel_grid(zsrc_i);
+        return grid_block_view(grid,grid->foreground_surface_brightness_block());
+    }
+
+    // Residuals (data minus model) inside the fit mask; the grid does not store these, so a new array is returned
+    dblarray image_residuals(const int zsrc_i = 0) {
+        ImagePixelGrid *grid = get_image_pixel_grid(zsrc_i);
+        if (image_pixel_data == NULL) throw std::runtime_error("no image pixel data has been loaded");
+        int nx = grid->get_x_N(), ny = grid->get_y_N();
+        if ((image_pixel_data->npixels_x != nx) or (image_pixel_data->npixels_y != ny)) throw std::runtime_error("image pixel grid dimensions do not match the pixel data");
+        dblarray resid(std::vector<ssize_t>{ny,nx});
+        double *rp = resid.mutable_data();
+        const double *model = grid->surface_brightness_block();
+        double **data = image_pixel_data->surface_brightness;
+        {
+            py::gil_scoped_release release;
+            int i,j;
+            for (j=0; j < ny; j++) {
+                for (i=0; i < nx; i++) {
+                    if (grid->pixel_in_fit_mask(i,j)) rp[j*nx+i] = data[i][j] - model[i*ny+j];
+                    else rp[j*nx+i] = 0;
+                }
+            }
+        }
+        return resid;
+    }
+
     ~Lens_Wrap()
 	 {
 		Grid::deallocate_multithreaded_variables();
@@ -226,6 +396,45 @@ public:
 		//delete[] onegroup;
 #endif
 	 }
-        
+
 private:
+    void check_coordinate_arrays(const dblarray &x, const dblarray &y) {
+        if (x.ndim() != y.ndim()) throw std::runtime_error("x and y coordinate arrays must have the same shape");
+        for (int i=0; i < x.ndim(); i++) {
+            if (x.shape(i) != y.shape(i)) throw std::runtime_error("x and y coordinate arrays must have the same shape");
+        }
+        if (nlens==0) throw std::runtime_error("no lenses have been created");
+    }
+
+    dblarray new_array_like(const dblarray &x) {
+        return dblarray(std::vector<ssize_t>(x.shape(),x.shape()+x.ndim()));
+    }
+
+    template <typename F>
+    void run_batch(const long n, F func) {
+        py::gil_scoped_release release;
+        #pragma omp parallel
+        {
+            int thread;
+#ifdef USE_OPENMP
+            thread = omp_get_thread_num();
+#else
+            thread = 0;
+#endif
+            #pragma omp for schedule(dynamic,64)
+            for (long i=0; i < n; i++) func(i,thread);
+        }
+    }
+
+    ImagePixelGrid* get_image_pixel_grid(const int zsrc_i) {
+        if ((image_pixel_grids == NULL) or (zsrc_i < 0) or (zsrc_i >= n_extended_src_redshifts) or (image_pixel_grids[zsrc_i] == NULL)) throw std::runtime_error("image pixel grid has not been created for this source redshift");
+        return image_pixel_grids[zsrc_i];
+    }
+
+    py::array grid_block_view(ImagePixelGrid *grid, double *block) {
+        ssize_t nx = grid->get_x_N(), ny = grid->get_y_N();
+        // the grid is stored x-major, so rows of the (ny,nx) view are strided by ny doubles
+        return py::array_t<double>(std::vector<ssize_t>{ny,nx}, std::vector<ssize_t>{(ssize_t) sizeof(double), ny*((ssize_t) sizeof(double))}, block, py::cast(this, py::return_value_policy::reference));
+    }
 };
+
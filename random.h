@@ -2,6 +2,7 @@
 #define RANDOM_H
 #include <iostream>
 #include <cstdio>
+#include <cstring>
 #include <cmath>
 #include "GregsMathHdr.h"
 #include <vector>
@@ -336,6 +337,38 @@ class Ran
 		}
 		inline double Doub(){return 5.42101086242752217E-20 * int64();}
 		inline unsigned int int32(){return (unsigned int)int64();}
+		void GetState(unsigned long long int *state) const {state[0] = u; state[1] = v; state[2] = w;}
+		void SetState(const unsigned long long int *state) {u = state[0]; v = state[1]; w = state[2];}
+
+	protected:
+		// generator state plus a random basis (num x num) and its current vector, used by the random basis classes so a
+		// sampler can be checkpointed and resumed exactly
+		int BasisStateSize(const int num) const {return 3*sizeof(unsigned long long int) + num*num*sizeof(double) + sizeof(int);}
+
+		void SaveBasisState(char *buf, double **rotVec, double **currentVec, const int num) const
+		{
+			unsigned long long int ranstate[3];
+			GetState(ranstate);
+			memcpy(buf, ranstate, 3*sizeof(unsigned long long int));
+			buf += 3*sizeof(unsigned long long int);
+			for (int i = 0; i < num; i++, buf += num*sizeof(double))
+				memcpy(buf, rotVec[i], num*sizeof(double));
+			int offset = currentVec - rotVec;
+			memcpy(buf, &offset, sizeof(int));
+		}
+
+		void LoadBasisState(const char *buf, double **rotVec, double **&currentVec, const int num)
+		{
+			unsigned long long int ranstate[3];
+			memcpy(ranstate, buf, 3*sizeof(unsigned long long int));
+			SetState(ranstate);
+			buf += 3*sizeof(unsigned long long int);
+			for (int i = 0; i < num; i++, buf += num*sizeof(double))
+				memcpy(rotVec[i], buf, num*sizeof(double));
+			int offset;
+			memcpy(&offset, buf, sizeof(int));
+			currentVec = rotVec + offset;
+		}
 };
 
 class ExponDev : public Ran
@@ -860,6 +893,10 @@ public:
         }
         
         int Dim() const {return proj;}
+
+        int StateSize() const {return BasisStateSize(num);}
+        void SaveState(char *buf) const {SaveBasisState(buf, rotVec, currentVec, num);}
+        void LoadState(const char *buf) {LoadBasisState(buf, rotVec, currentVec, num);}
         
         ~RandomPlane()
         {
@@ -992,6 +1029,10 @@ class RandomBasis : public BasicDevs
 				RandRot();
 			}
 		}
+
+		int StateSize() const {return BasisStateSize(num);}
+		void SaveState(char *buf) const {SaveBasisState(buf, rotVec, currentVec, num);}
+		void LoadState(const char *buf) {LoadBasisState(buf, rotVec, currentVec, num);}
 		
 		virtual ~RandomBasis()
 		{
@@ -1343,15 +1343,17 @@ inline void SB_Profile::rotate_back(double &x, double &y)
 	x = xp;
 }
 
-double SB_Profile::surface_brightness(double x, double y)
+void SB_Profile::find_elliptical_radius(double x, double y, double& xisq, double& rsq, double& fourier_factor, const double xi_egrad)
 {
+	// Finds the (squared) elliptical radius at which the radial profile is evaluated, along with the Fourier mode factor
+	// (if any) for perturbing the surface brightness; rsq is the squared radius in the profile's own coordinates.
+	// If there is an ellipticity gradient, a non-negative xi_egrad is taken as the already-solved elliptical radius.
 	// switch to coordinate system centered on surface brightness profile
 	x -= x_center;
 	y -= y_center;
 	if ((!ellipticity_gradient) and (theta != 0)) rotate(x,y);
 
-	double xisq, rsq;
-	double fourier_factor = 0.0;
+	fourier_factor = 0.0;
 
 	rsq = x*x + y*y;
 	if (!ellipticity_gradient) {
@@ -1386,7 +1388,7 @@ double SB_Profile::surface_brightness(double x, double y)
 			if (!fourier_sb_perturbation) xisq *= fourier_factor*fourier_factor;
 		}
 	} else {
-		double xi = elliptical_radius_root(x,y);
+		double xi = (xi_egrad >= 0) ? xi_egrad : elliptical_radius_root(x,y);
 		xisq = SQR(xi);
 		if ((n_fourier_modes > 0) and (fourier_sb_perturbation)) {
 			double ep, phi0;
@@ -1433,6 +1435,12 @@ double SB_Profile::surface_brightness(double x, double y)
 			}
 		}
 	}
+}
+
+double SB_Profile::surface_brightness(double x, double y)
+{
+	double xisq, rsq, fourier_factor;
+	find_elliptical_radius(x,y,xisq,rsq,fourier_factor);
 	double sb = sb_rsq(xisq);
 	if ((n_fourier_modes > 0) and (fourier_sb_perturbation)) {
 		// create virtual sb_rsq_deriv function in base class, and versions for all inherited classes, so you don't have to do this numerically for analytic models
@@ -1457,6 +1465,81 @@ double SB_Profile::surface_brightness(double x, double y)
 	return sb;
 }
 
+void SB_Profile::surface_brightness_batch(const int npts, const double* xvals, const double* yvals, double* sbvals)
+{
+	// Same as surface_brightness(x,y), but for npts points at once. The elliptical radii are found first, so the radial
+	// profile can be evaluated in a single call to sb_rsq_batch (which the analytic models override with loops that have
+	// no virtual calls or branches, and which the compiler can vectorize)
+	int i;
+	double rsq, fourier_factor;
+	double *xivals = NULL;
+	if (ellipticity_gradient) {
+		// solve for the elliptical radii together, so each root search can start from its neighbor's solution
+		double *xc = new double[npts];
+		double *yc = new double[npts];
+		for (i=0; i < npts; i++) {
+			xc[i] = xvals[i] - x_center;
+			yc[i] = yvals[i] - y_center;
+		}
+		xivals = new double[npts];
+		elliptical_radius_root(npts,xc,yc,xivals);
+		delete[] xc;
+		delete[] yc;
+	}
+	bool perturb = ((n_fourier_modes > 0) and (fourier_sb_perturbation));
+	if ((!perturb) and (!include_truncation_radius)) {
+		for (i=0; i < npts; i++) find_elliptical_radius(xvals[i],yvals[i],sbvals[i],rsq,fourier_factor,(xivals==NULL) ? -1 : xivals[i]);
+		sb_rsq_batch(npts,sbvals,sbvals);
+	} else {
+		double *xisqvals = new double[npts];
+		double *fourier_factors = (perturb) ? new double[npts] : NULL;
+		double *pert_rsqvals = (perturb) ? new double[npts] : NULL;
+		for (i=0; i < npts; i++) {
+			find_elliptical_radius(xvals[i],yvals[i],xisqvals[i],rsq,fourier_factor,(xivals==NULL) ? -1 : xivals[i]);
+			if (perturb) {
+				fourier_factors[i] = fourier_factor;
+				pert_rsqvals[i] = (fourier_use_eccentric_anomaly) ? xisqvals[i] : rsq;
+			}
+		}
+		sb_rsq_batch(npts,xisqvals,sbvals);
+		if (perturb) {
+			// numerical derivative of the radial profile, as in surface_brightness(x,y)
+			const double h = 1e-5;
+			double *sb_plus = new double[npts];
+			double *sb_minus = new double[npts];
+			for (i=0; i < npts; i++) {
+				sb_plus[i] = pert_rsqvals[i] + h;
+				sb_minus[i] = (pert_rsqvals[i] <= h) ? pert_rsqvals[i] : pert_rsqvals[i] - h;
+			}
+			sb_rsq_batch(npts,sb_plus,sb_plus);
+			sb_rsq_batch(npts,sb_minus,sb_minus);
+			for (i=0; i < npts; i++) {
+				sbvals[i] += 2*fourier_factors[i]*pert_rsqvals[i]*(sb_plus[i]-sb_minus[i])/((pert_rsqvals[i] <= h) ? h : 2*h);
+			}
+			delete[] sb_plus;
+			delete[] sb_minus;
+			delete[] fourier_factors;
+			delete[] pert_rsqvals;
+		}
+		if (include_truncation_radius) {
+			for (i=0; i < npts; i++) sbvals[i] *= pow(1+pow(xisqvals[i]/(rt*rt),3),-2);
+		}
+		delete[] xisqvals;
+	}
+	if (xivals != NULL) delete[] xivals;
+	for (i=0; i < npts; i++) {
+		if (sbvals[i]*0.0 != 0.0) {
+			warn("surface brightness returning NAN");
+			break;
+		}
+	}
+}
+
+void SB_Profile::sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals)
+{
+	for (int i=0; i < npts; i++) sbvals[i] = sb_rsq(rsqvals[i]);
+}
+
 double SB_Profile::surface_brightness_zoom(lensvector &centerpt, lensvector &pt1, lensvector &pt2, lensvector &pt3, lensvector &pt4, const double sb_noise)
 {
 	bool subgrid = false;
@@ -2437,6 +2520,13 @@ double Gaussian::sb_rsq(const double rsq)
 	return max_sb*exp(-0.5*rsq/(sig_x*sig_x));
 }
 
+void Gaussian::sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals)
+{
+	const double fac = -0.5/(sig_x*sig_x);
+	#pragma omp simd
+	for (int i=0; i < npts; i++) sbvals[i] = max_sb*exp(fac*rsqvals[i]);
+}
+
 double Gaussian::window_rmax() // used to define the window size for pixellated surface brightness maps
 {
 	return 7*sig_x;
@@ -2515,6 +2605,14 @@ double Sersic::sb_rsq(const double rsq)
 	return s0*exp(-b*pow(rsq/(Reff*Reff),0.5/n));
 }
 
+void Sersic::sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals)
+{
+	// pow(rsq/Reff^2,0.5/n) is written as exp(0.5*(log(rsq)-log(Reff^2))/n), so that only exp and log are needed
+	const double nfac = 0.5/n, logre_sq = log(Reff*Reff);
+	#pragma omp simd
+	for (int i=0; i < npts; i++) sbvals[i] = s0*exp(-b*exp(nfac*(log(rsqvals[i])-logre_sq)));
+}
+
 double Sersic::window_rmax()
 {
 	double fac = pow(3.0/b,n);
@@ -2601,6 +2699,13 @@ double Cored_Sersic::sb_rsq(const double rsq)
 	return s0*exp(-b*pow((rsq+rc*rc)/(Reff*Reff),0.5/n));
 }
 
+void Cored_Sersic::sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals)
+{
+	const double nfac = 0.5/n, logre_sq = log(Reff*Reff), rcsq = rc*rc;
+	#pragma omp simd
+	for (int i=0; i < npts; i++) sbvals[i] = s0*exp(-b*exp(nfac*(log(rsqvals[i]+rcsq)-logre_sq)));
+}
+
 double Cored_Sersic::window_rmax()
 {
 	return Reff*pow(3.0/b,n);
@@ -2699,6 +2804,17 @@ double CoreSersic::sb_rsq(const double rsq)
 	return s0*pow(1+rca/ra,gamma/alpha)*exp(-k*pow(ra+rca,1.0/(alpha*n)));
 }
 
+void CoreSersic::sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals)
+{
+	const double rca = pow(rc,alpha), afac = alpha/2, gfac = gamma/alpha, nfac = 1.0/(alpha*n);
+	double ra;
+	#pragma omp simd private(ra)
+	for (int i=0; i < npts; i++) {
+		ra = exp(afac*log(rsqvals[i]));
+		sbvals[i] = s0*exp(gfac*log(1+rca/ra) - k*exp(nfac*log(ra+rca)));
+	}
+}
+
 double CoreSersic::window_rmax()
 {
 	return pow(3.0/k,n);
@@ -2798,6 +2914,17 @@ double DoubleSersic::sb_rsq(const double rsq)
 	return (s0_1*exp(-b1*pow(rsq/(Reff1*Reff1),0.5/n1)) + s0_2*exp(-b2*pow(rsq/(Reff2*Reff2),0.5/n2)));
 }
 
+void DoubleSersic::sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals)
+{
+	const double nfac1 = 0.5/n1, nfac2 = 0.5/n2, logre1_sq = log(Reff1*Reff1), logre2_sq = log(Reff2*Reff2);
+	double logrsq;
+	#pragma omp simd private(logrsq)
+	for (int i=0; i < npts; i++) {
+		logrsq = log(rsqvals[i]);
+		sbvals[i] = s0_1*exp(-b1*exp(nfac1*(logrsq-logre1_sq))) + s0_2*exp(-b2*exp(nfac2*(logrsq-logre2_sq)));
+	}
+}
+
 double DoubleSersic::window_rmax()
 {
 	double max1 = Reff1*pow(3.0/b1,n1);
@@ -2879,6 +3006,18 @@ double SPLE::sb_rsq(const double rsq)
 	return ((bs==0.0) ? 0.0 : ((2-alpha) * pow(bs*bs/(s*s+rsq), alpha/2) / 2));
 }
 
+void SPLE::sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals)
+{
+	int i;
+	if (bs==0.0) {
+		for (i=0; i < npts; i++) sbvals[i] = 0.0;
+		return;
+	}
+	const double fac = (2-alpha)/2, afac = alpha/2, logbsq = log(bs*bs), ssq = s*s;
+	#pragma omp simd
+	for (i=0; i < npts; i++) sbvals[i] = fac*exp(afac*(logbsq - log(ssq+rsqvals[i])));
+}
+
 double SPLE::window_rmax() // used to define the window size for pixellated surface brightness maps
 {
 	return 3*bs;
@@ -2958,6 +3097,13 @@ double dPIE::sb_rsq(const double rsq)
 	return (0.5 * bs * (pow(s*s+rsq, -0.5) - pow(a*a+rsq,-0.5)));
 }
 
+void dPIE::sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals)
+{
+	const double ssq = s*s, asq = a*a;
+	#pragma omp simd
+	for (int i=0; i < npts; i++) sbvals[i] = 0.5*bs*(1.0/sqrt(ssq+rsqvals[i]) - 1.0/sqrt(asq+rsqvals[i]));
+}
+
 double dPIE::window_rmax() // used to define the window size for pixellated surface brightness maps
 {
 	return 3*dmax(bs,a);
@@ -3189,6 +3335,11 @@ double Shapelet::surface_brightness(double x, double y)
 	return sb;
 }
 
+void Shapelet::surface_brightness_batch(const int npts, const double* xvals, const double* yvals, double* sbvals)
+{
+	for (int i=0; i < npts; i++) sbvals[i] = surface_brightness(xvals[i],yvals[i]);
+}
+
 double Shapelet::surface_brightness_zeroth_order(double x, double y)
 {
 	x -= x_center;
@@ -3450,6 +3601,11 @@ double SB_Multipole::surface_brightness(double x, double y)
 	return A_n*exp(-sqrt(x*x+y*y)/r0) * cos(m*(phi-theta_eff));
 }
 
+void SB_Multipole::surface_brightness_batch(const int npts, const double* xvals, const double* yvals, double* sbvals)
+{
+	for (int i=0; i < npts; i++) sbvals[i] = surface_brightness(xvals[i],yvals[i]);
+}
+
 double SB_Multipole::window_rmax() // used to define the window size for pixellated surface brightness maps
 {
 	return 7*r0;
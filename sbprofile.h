@@ -221,6 +221,7 @@ class SB_Profile : public EllipticityGradient, UCMC, Simplex
 
 	// the following items MUST be redefined in all derived classes
 	virtual double sb_rsq(const double rsq); // we use the r^2 version in the integrations rather than r because it is most directly used in cored models
+	virtual void sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals); // evaluates sb_rsq at npts radii (rsqvals and sbvals may be the same array)
 	virtual void window_params(double& xmin, double& xmax, double& ymin, double& ymax);
 	virtual double window_rmax();
 	virtual double length_scale(); // retrieves characteristic length scale of object (used for zoom subgridding)
@@ -228,6 +229,7 @@ class SB_Profile : public EllipticityGradient, UCMC, Simplex
 	// these functions can be redefined in the derived classes, but don't have to be
 	virtual double surface_brightness_r(const double r);
 	virtual double surface_brightness(double x, double y);
+	virtual void surface_brightness_batch(const int npts, const double* xvals, const double* yvals, double* sbvals);
 	//virtual double calculate_Lmatrix_element(const double x, const double y, const int amp_index); // used by Shapelet subclass
 	virtual void calculate_Lmatrix_elements(double x, double y, double*& Lmatrix_elements, const double weight); // used by Shapelet subclass
 	virtual void calculate_gradient_Rmatrix_elements(double* Rmatrix_elements, int* Rmatrix_index);
@@ -242,6 +244,7 @@ class SB_Profile : public EllipticityGradient, UCMC, Simplex
 
 	//virtual double surface_brightness_zoom(const double x, const double y, const double pixel_xlength, const double pixel_ylength);
 	double surface_brightness_zoom(lensvector &centerpt, lensvector &pt1, lensvector &pt2, lensvector &pt3, lensvector &pt4, const double sb_noise);
+	void find_elliptical_radius(double x, double y, double& xisq, double& rsq, double& fourier_factor, const double xi_egrad = -1);
 
 	SB_ProfileName get_sbtype() { return sbtype; }
 	void get_center_coords(double &xc, double &yc) { xc=x_center; yc=y_center; }
@@ -268,6 +271,7 @@ class Gaussian : public SB_Profile
 	double sbtot, max_sb, sig_x; // sig_x is the dispersion along the major axis
 
 	double sb_rsq(const double);
+	void sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals);
 
 	public:
 	Gaussian() : SB_Profile() {}
@@ -296,6 +300,7 @@ class Sersic : public SB_Profile
 	double Reff; // effective radius
 
 	double sb_rsq(const double);
+	void sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals);
 
 	public:
 	Sersic() : SB_Profile() {}
@@ -320,6 +325,7 @@ class CoreSersic : public SB_Profile
 	double Reff; // effective radius
 
 	double sb_rsq(const double);
+	void sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals);
 
 	public:
 	CoreSersic() : SB_Profile() {}
@@ -345,6 +351,7 @@ class Cored_Sersic : public SB_Profile
 	double Reff; // effective radius
 
 	double sb_rsq(const double);
+	void sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals);
 
 	public:
 	Cored_Sersic() : SB_Profile() {}
@@ -372,6 +379,7 @@ class DoubleSersic : public SB_Profile
 	double Reff1, Reff2; // effective radius
 
 	double sb_rsq(const double);
+	void sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals);
 
 	public:
 	DoubleSersic() : SB_Profile() {}
@@ -397,6 +405,7 @@ class SPLE : public SB_Profile
 	double bs, s, alpha;
 
 	double sb_rsq(const double);
+	void sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals);
 
 	public:
 	SPLE() : SB_Profile() {}
@@ -422,6 +431,7 @@ class dPIE : public SB_Profile
 	double bs, s, a;
 
 	double sb_rsq(const double);
+	void sb_rsq_batch(const int npts, const double* rsqvals, double* sbvals);
 
 	public:
 	dPIE() : SB_Profile() {}
@@ -487,6 +497,7 @@ class Shapelet : public SB_Profile
 	}
 
 	double surface_brightness(double x, double y);
+	void surface_brightness_batch(const int npts, const double* xvals, const double* yvals, double* sbvals);
 	double hermite_polynomial(const double x, const int n);
 
 	//double surface_brightness_zoom(const double x, const double y, const double pixel_xlength, const double pixel_ylength);
@@ -527,6 +538,7 @@ class SB_Multipole : public SB_Profile
 	~SB_Multipole() {}
 
 	double surface_brightness(double x, double y);
+	void surface_brightness_batch(const int npts, const double* xvals, const double* yvals, double* sbvals);
 
 	void assign_paramnames();
 	void assign_param_pointers();
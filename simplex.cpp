@@ -252,10 +252,239 @@ int Simplex::downhill_simplex_anneal(bool verbal)
 		}
 		if (simplex_exit_status==false) return iterations;
 	}
-	downhill_simplex(iterations,max_iterations,0); // do final run with zero temperature
+	// do final run with zero temperature
+	if (parallel_simplex) downhill_simplex_parallel(iterations,max_iterations);
+	else downhill_simplex(iterations,max_iterations,0);
 	return iterations;
 }
 
+void Simplex::simplex_set_mpi_groups(const int ngroups, const int group_num, int *group_leader)
+{
+	// likelihood evaluations in downhill_simplex_parallel are divided between the MPI groups, where each group evaluates
+	// its own points (with the processes in each group working together on each evaluation)
+	simplex_mpi_ngroups = ngroups;
+	simplex_mpi_group_num = group_num;
+	if (simplex_mpi_group_leader != NULL) delete[] simplex_mpi_group_leader;
+	simplex_mpi_group_leader = NULL;
+	if (group_leader != NULL) {
+		simplex_mpi_group_leader = new int[ngroups];
+		for (int i=0; i < ngroups; i++) simplex_mpi_group_leader[i] = group_leader[i];
+	}
+}
+
+void Simplex::simplex_evaluate_points(double** pts, double* vals, const int npts)
+{
+	int i;
+	for (i=0; i < npts; i++) {
+		if (i % simplex_mpi_ngroups == simplex_mpi_group_num) vals[i] = (this->*func)(pts[i]);
+		else vals[i] = 0;
+	}
+#ifdef USE_MPI
+	if ((simplex_mpi_ngroups > 1) and (simplex_mpi_group_leader != NULL)) {
+		for (i=0; i < npts; i++) MPI_Bcast(vals+i,1,MPI_DOUBLE,simplex_mpi_group_leader[i % simplex_mpi_ngroups],MPI_COMM_WORLD);
+		// if any process has been interrupted, they must all stop together (otherwise the others would wait on it in the next evaluation)
+		int keep_running = SIMPLEX_KEEP_RUNNING, all_running;
+		MPI_Allreduce(&keep_running,&all_running,1,MPI_INT,MPI_MIN,MPI_COMM_WORLD);
+		SIMPLEX_KEEP_RUNNING = all_running;
+	}
+#endif
+	signal(SIGABRT, &simplex_sighandler);
+	signal(SIGTERM, &simplex_sighandler);
+	signal(SIGINT, &simplex_sighandler);
+	signal(SIGUSR1, &simplex_sighandler);
+	signal(SIGQUIT, &simplex_quitproc);
+}
+
+void Simplex::simplex_record_bestfit(double* pt, const double val)
+{
+	if (val <= yb) {
+		if (val > fmin) {
+			for (int j=0; j < ndim; j++) pb[j] = pt[j];
+			yb = val;
+		} else {
+			SIMPLEX_KEEP_RUNNING = 0;
+		}
+	}
+}
+
+void Simplex::downhill_simplex_parallel(int &nfunk, const int& nmax)
+{
+	// Parallel Nelder-Mead algorithm (Lee & Wiswall 2007): in each iteration the npar worst vertices are each reflected through the
+	// centroid of the remaining vertices. The reflected points, and then the expansion/contraction points that follow from them, are
+	// evaluated in batches that are divided between the MPI groups. If none of the worst vertices can be improved upon, the simplex
+	// is shrunk toward the best vertex. With one MPI group (npar=1), this reduces to the usual downhill simplex at zero temperature.
+	SIMPLEX_KEEP_RUNNING = 1;
+	const double tiny=1e-10;
+	int i,j,k,l,ilo,ihi,inhi;
+	int npar = simplex_mpi_ngroups;
+	if (npar > ndim/2) npar = ndim/2; // if too many vertices are reflected at once, the simplex can collapse before reaching the minimum
+	if (npar < 1) npar = 1;
+	double rtol;
+
+	if (yb < 1e30) {
+		// reset simplex to start from the best-fit point from previous iterations
+		for (i=0; i < mpts; i++) {
+			for (j=0; j < ndim; j++) p[i][j] = pb[j];
+			if (i != 0) p[i][i-1] += disps[i-1];
+		}
+	}
+
+	simplex_evaluate_points(p,y,mpts);
+	if (!SIMPLEX_KEEP_RUNNING) { simplex_exit_status = false; return; }
+	if (yb == 1e30) {
+		// record initial point as best-fit point thus far
+		for (j=0;j<ndim;j++) pb[j]=p[0][j];
+		yb=y[0];
+	}
+	for (i=0; i < mpts; i++) simplex_record_bestfit(p[i],y[i]);
+
+	int *order = new int[mpts];
+	int *worst = new int[npar];
+	int *trial_type = new int[npar]; // 0 = reflection accepted, 1 = expansion, 2 = outside contraction, 3 = inside contraction, -1 = rejected
+	double *centroid = new double[ndim];
+	double **ptry = new double*[npar];
+	double **ptry2 = new double*[npar];
+	double **pshrink = new double*[mpts];
+	double *ytry = new double[npar];
+	double *ytry2 = new double[npar];
+	double *yshrink = new double[mpts];
+	for (k=0; k < npar; k++) {
+		ptry[k] = new double[ndim];
+		ptry2[k] = new double[ndim];
+	}
+	int n_trial2;
+	bool improved;
+
+	nfunk=0;
+	for (;;) {
+		if (!SIMPLEX_KEEP_RUNNING) { simplex_exit_status = false; break; }
+		// sort the vertices by function value (insertion sort, since mpts is small)
+		for (i=0; i < mpts; i++) order[i] = i;
+		for (i=1; i < mpts; i++) {
+			k = order[i];
+			for (j=i; (j > 0) and (y[order[j-1]] > y[k]); j--) order[j] = order[j-1];
+			order[j] = k;
+		}
+		ilo = order[0];
+		ihi = order[mpts-1];
+		inhi = order[mpts-1-npar]; // worst of the vertices that are retained in this iteration
+		rtol = 2.0*abs(y[ihi]-y[ilo])/(abs(y[ihi])+abs(y[ilo])+tiny);
+		if (rtol < ftol) {
+			double temp;
+			temp=y[0]; y[0]=y[ilo]; y[ilo]=temp;
+			for (i=0; i < ndim; i++) {
+				temp=p[0][i]; p[0][i]=p[ilo][i]; p[ilo][i]=temp;
+			}
+			break;
+		}
+		if (nfunk >= nmax) {
+			cout << "\n*WARNING*: Exceeded maximum number of iterations (" << nmax << ")" << endl;
+			break;
+		}
+
+		for (j=0; j < ndim; j++) centroid[j] = 0;
+		for (i=0; i < mpts-npar; i++) {
+			for (j=0; j < ndim; j++) centroid[j] += p[order[i]][j];
+		}
+		for (j=0; j < ndim; j++) centroid[j] /= (mpts-npar);
+
+		for (k=0; k < npar; k++) {
+			worst[k] = order[mpts-1-k];
+			for (j=0; j < ndim; j++) ptry[k][j] = 2*centroid[j] - p[worst[k]][j];
+		}
+		simplex_evaluate_points(ptry,ytry,npar);
+		nfunk += npar;
+		for (k=0; k < npar; k++) simplex_record_bestfit(ptry[k],ytry[k]);
+		if (!SIMPLEX_KEEP_RUNNING) { simplex_exit_status = false; break; }
+
+		// decide which second-stage point (if any) is needed for each reflected vertex, then evaluate them together
+		n_trial2 = 0;
+		for (k=0; k < npar; k++) {
+			if (ytry[k] < y[ilo]) {
+				trial_type[k] = 1;
+				for (j=0; j < ndim; j++) ptry2[n_trial2][j] = 3*centroid[j] - 2*p[worst[k]][j];
+				n_trial2++;
+			} else if (ytry[k] < y[inhi]) {
+				trial_type[k] = 0;
+			} else if (ytry[k] < y[worst[k]]) {
+				trial_type[k] = 2;
+				for (j=0; j < ndim; j++) ptry2[n_trial2][j] = 0.5*(centroid[j] + ptry[k][j]);
+				n_trial2++;
+			} else {
+				trial_type[k] = 3;
+				for (j=0; j < ndim; j++) ptry2[n_trial2][j] = 0.5*(centroid[j] + p[worst[k]][j]);
+				n_trial2++;
+			}
+		}
+		if (n_trial2 > 0) {
+			simplex_evaluate_points(ptry2,ytry2,n_trial2);
+			nfunk += n_trial2;
+			for (l=0; l < n_trial2; l++) simplex_record_bestfit(ptry2[l],ytry2[l]);
+			if (!SIMPLEX_KEEP_RUNNING) { simplex_exit_status = false; break; }
+		}
+
+		improved = false;
+		for (k=0, l=0; k < npar; k++) {
+			i = worst[k];
+			if (trial_type[k]==0) {
+				for (j=0; j < ndim; j++) p[i][j] = ptry[k][j];
+				y[i] = ytry[k];
+				improved = true;
+			} else if (trial_type[k]==1) {
+				if (ytry2[l] < ytry[k]) {
+					for (j=0; j < ndim; j++) p[i][j] = ptry2[l][j];
+					y[i] = ytry2[l];
+				} else {
+					for (j=0; j < ndim; j++) p[i][j] = ptry[k][j];
+					y[i] = ytry[k];
+				}
+				improved = true;
+				l++;
+			} else {
+				if (((trial_type[k]==2) and (ytry2[l] <= ytry[k])) or ((trial_type[k]==3) and (ytry2[l] < y[i]))) {
+					for (j=0; j < ndim; j++) p[i][j] = ptry2[l][j];
+					y[i] = ytry2[l];
+					improved = true;
+				}
+				l++;
+			}
+		}
+
+		if (!improved) {
+			// none of the worst vertices could be improved, so shrink the simplex toward the best vertex
+			for (i=0, l=0; i < mpts; i++) {
+				if (i != ilo) {
+					for (j=0; j < ndim; j++) p[i][j] = 0.5*(p[i][j]+p[ilo][j]);
+					pshrink[l++] = p[i];
+				}
+			}
+			simplex_evaluate_points(pshrink,yshrink,l);
+			nfunk += l;
+			for (i=0, l=0; i < mpts; i++) {
+				if (i != ilo) {
+					y[i] = yshrink[l++];
+					simplex_record_bestfit(p[i],y[i]);
+				}
+			}
+		}
+	}
+
+	for (k=0; k < npar; k++) {
+		delete[] ptry[k];
+		delete[] ptry2[k];
+	}
+	delete[] ptry;
+	delete[] ptry2;
+	delete[] pshrink;
+	delete[] ytry;
+	delete[] ytry2;
+	delete[] yshrink;
+	delete[] centroid;
+	delete[] trial_type;
+	delete[] worst;
+	delete[] order;
+}
+
 Simplex::~Simplex()
 {
 	if (initialized) {
@@ -265,5 +494,6 @@ Simplex::~Simplex()
 		delete[] p;
 		delete[] disps;
 	}
+	if (simplex_mpi_group_leader != NULL) delete[] simplex_mpi_group_leader;
 }
 
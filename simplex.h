@@ -8,11 +8,18 @@
 #include <iostream>
 #include <iomanip>
 
+#ifdef USE_MPI
+#include "mpi.h"
+#endif
+
 class Simplex : public Random
 {
 	bool initialized;
 	double temp;
 	double tinc, t0, tfinal;
+	bool parallel_simplex; // if true, the zero-temperature stage uses the parallel Nelder-Mead algorithm (downhill_simplex_parallel)
+	int simplex_mpi_ngroups, simplex_mpi_group_num;
+	int *simplex_mpi_group_leader;
 
 	static const double t0_default;
 	static const double tfinal_default;
@@ -45,6 +52,10 @@ class Simplex : public Random
 		simplex_display_bestfit_point = false;
 		fmin = -1e30;
 		fmin_anneal = -1e30;
+		parallel_simplex = false;
+		simplex_mpi_ngroups = 1;
+		simplex_mpi_group_num = 0;
+		simplex_mpi_group_leader = NULL;
 	}
 	Simplex(double* point, const int& ndim_in, const double& vertex_displacement, const double& ftol_in, const int seed_in)
 	{
@@ -60,6 +71,10 @@ class Simplex : public Random
 		simplex_display_bestfit_point = false;
 		fmin = -1e30;
 		fmin_anneal = -1e30;
+		parallel_simplex = false;
+		simplex_mpi_ngroups = 1;
+		simplex_mpi_group_num = 0;
+		simplex_mpi_group_leader = NULL;
 	}
 	Simplex(double* point, const int& ndim_in, double* vertex_displacements, const double& ftol_in, const int seed_in)
 	{
@@ -73,6 +88,10 @@ class Simplex : public Random
 		simplex_display_bestfit_point = false;
 		fmin = -1e30;
 		fmin_anneal = -1e30;
+		parallel_simplex = false;
+		simplex_mpi_ngroups = 1;
+		simplex_mpi_group_num = 0;
+		simplex_mpi_group_leader = NULL;
 	}
 	~Simplex();
 
@@ -88,6 +107,8 @@ class Simplex : public Random
 	void simplex_set_fmin(double fmin_in) { fmin = fmin_in; }
 	void simplex_set_fmin_anneal(double fmin_in) { fmin_anneal = fmin_in; }
 	void simplex_set_display_bfpont(bool dispbf) { simplex_display_bestfit_point = dispbf; }
+	void simplex_set_parallel(bool parallel) { parallel_simplex = parallel; }
+	void simplex_set_mpi_groups(const int ngroups, const int group_num, int *group_leader);
 	void set_annealing_schedule_parameters(double t0_in, double tfinal_in, double tinc_in, double nmax_anneal_in, double nmax_in) {
 		t0 = t0_in;
 		tfinal = tfinal_in;
@@ -123,6 +144,9 @@ class Simplex : public Random
 	}
 
 	double amotry(double* psum, const int &ihi, double& yhi, const double& fac);
+	void downhill_simplex_parallel(int &nfunk, const int& nmax);
+	void simplex_evaluate_points(double** pts, double* vals, const int npts);
+	void simplex_record_bestfit(double* pt, const double val);
 	int downhill_simplex_anneal(bool verbal = false);
 	void simplex_evaluate_bestfit_point() { yb=(this->*func)(pb); }
 };
@@ -7,6 +7,74 @@
 #include <iomanip>
 using namespace std;
 
+// SplineKnots: locates the knot interval containing a point
+
+void SplineKnots::find_spacing(const double *xa, const int n)
+{
+	const double tolerance = 1e-6; // relative to the step size; the interval found is always checked against the knots, so this need not be tight
+	int i;
+	double step;
+	spacing = Nonuniform;
+	if (n < 3) return;
+	step = (xa[n-1]-xa[0])/(n-1);
+	if (step > 0) {
+		for (i=1; i < n; i++) {
+			if (fabs(xa[i]-xa[i-1]-step) > tolerance*step) break;
+		}
+		if (i==n) {
+			spacing = Uniform;
+			x0 = xa[0];
+			inverse_step = 1.0/step;
+			return;
+		}
+	}
+	if (xa[0] <= 0) return;
+	step = log(xa[n-1]/xa[0])/(n-1);
+	if (step > 0) {
+		for (i=1; i < n; i++) {
+			if (fabs(log(xa[i]/xa[i-1])-step) > tolerance*step) break;
+		}
+		if (i==n) {
+			spacing = LogUniform;
+			x0 = log(xa[0]);
+			inverse_step = 1.0/step;
+		}
+	}
+}
+
+int SplineKnots::interval(const double *xa, const int n, const double x) const
+{
+	int k, klo, khi;
+	if (spacing==Nonuniform) {
+		klo = 0;
+		khi = n - 1;
+		while (khi-klo > 1) {
+			k = (khi+klo) >> 1;
+			if (xa[k] > x) khi = k;
+			else klo = k;
+		}
+		return klo;
+	}
+	double t = (spacing==Uniform) ? (x-x0)*inverse_step : (log(x)-x0)*inverse_step;
+	if (!(t > 0)) k = 0; // also catches x <= 0 in the log-uniform case
+	else if (t >= n-2) k = n-2;
+	else k = (int) t;
+	// correct for roundoff, so the interval is exactly the one bisection would find
+	while ((k > 0) and (xa[k] > x)) k--;
+	while ((k < n-2) and (xa[k+1] <= x)) k++;
+	return k;
+}
+
+int SplineKnots::hunt_interval(const double *xa, const int n, const double x, int klo) const
+{
+	// for sorted points, x usually lies in the same interval as the previous point or in the next one
+	if ((spacing==Nonuniform) and (klo >= 0) and (klo <= n-2) and ((x >= xa[klo]) or (klo==0))) {
+		if ((x < xa[klo+1]) or (klo==n-2)) return klo;
+		if ((klo+1==n-2) or (x < xa[klo+2])) return klo+1;
+	}
+	return interval(xa,n,x);
+}
+
 // Spline: 1-dimensional cubic spline
 
 Spline::Spline()
@@ -80,6 +148,7 @@ void Spline::input(const Spline& spline_in)
 		yarray[i] = spline_in.yarray[i];
 		yspline[i] = spline_in.yspline[i];
 	}
+	knots = spline_in.knots;
 }
 
 void Spline::input(const dvector& x, const dvector& y)
@@ -163,6 +232,7 @@ void Spline::input(const char *filename)
 void Spline::natural_spline(void)
 {
 	double p, qn, sig, un;
+	knots.find_spacing(xarray,nn);
 
 	double *u = new double[nn];
 	yspline[0] = u[0] = 0.0;
@@ -185,6 +255,7 @@ void Spline::natural_spline(void)
 void Spline::unnatural_spline(double yp1, double ypn)
 {
 	double p, qn, sig, un;
+	knots.find_spacing(xarray,nn);
 
 	double *u = new double[nn];
 	yspline[0] = -0.5;
@@ -209,17 +280,12 @@ void Spline::unnatural_spline(double yp1, double ypn)
 
 double Spline::splint(const double x)
 {
-	int klo, khi, k;
+	int klo, khi;
 	double h, b, a;
 	double yi;
 
-	klo = 0;
-	khi = nn - 1;
-	while (khi-klo > 1) {
-		k = (khi+klo) >> 1;
-		if (xarray[k] > x) khi = k;
-		else klo = k;
-	}
+	klo = knots.interval(xarray,nn,x);
+	khi = klo + 1;
 	h = xarray[khi] - xarray[klo];
 	if (h == 0.0) die("Bad xarray input to routine splint");
 	a = (xarray[khi] - x)/h;
@@ -231,17 +297,12 @@ double Spline::splint(const double x)
 
 double Spline::splint_linear(const double x)
 {
-	int klo, khi, k;
+	int klo, khi;
 	double h, b, a;
 	double yi;
 
-	klo = 0;
-	khi = nn - 1;
-	while (khi-klo > 1) {
-		k = (khi+klo) >> 1;
-		if (xarray[k] > x) khi = k;
-		else klo = k;
-	}
+	klo = knots.interval(xarray,nn,x);
+	khi = klo + 1;
 	h = xarray[khi] - xarray[klo];
 	if (h == 0.0) die("Bad xarray input to routine splint");
 	a = (xarray[khi] - x)/h;
@@ -253,17 +314,12 @@ double Spline::splint_linear(const double x)
 
 double Spline::dsplint(const double &x)
 {
-	int klo, khi, k;
+	int klo, khi;
 	double h, b, a;
 	double yi;
 
-	klo = 0;
-	khi = nn - 1;
-	while (khi-klo > 1) {
-		k = (khi+klo) >> 1;
-		if (xarray[k] > x) khi = k;
-		else klo = k;
-	}
+	klo = knots.interval(xarray,nn,x);
+	khi = klo + 1;
 	h = xarray[khi] - xarray[klo];
 	if (h == 0.0) die("Bad xarray input to routine dsplint");
 	a = (xarray[khi] - x) / h;
@@ -273,6 +329,76 @@ double Spline::dsplint(const double &x)
 	return yi;
 }
 
+// The following evaluate the spline at several points at once. For nonuniform knots, the interval of the previous point (or the one after
+// it) is tried first, which saves the bisection if the points are sorted. The intervals are found first for a chunk of points, so the
+// interpolation loop itself has no branches.
+
+void Spline::splint(const double *x, double *y, const int npts)
+{
+	const int chunk = 64;
+	int kvals[chunk];
+	int i, j, n, klo = 0, khi;
+	double h, b, a;
+	for (i=0; i < npts; i += chunk) {
+		n = (npts-i < chunk) ? npts-i : chunk;
+		for (j=0; j < n; j++) {
+			klo = kvals[j] = knots.hunt_interval(xarray,nn,x[i+j],klo);
+			if (xarray[klo+1] == xarray[klo]) die("Bad xarray input to routine splint");
+		}
+		for (j=0; j < n; j++) {
+			khi = kvals[j] + 1;
+			h = xarray[khi] - xarray[kvals[j]];
+			a = (xarray[khi] - x[i+j])/h;
+			b = (x[i+j] - xarray[kvals[j]])/h;
+			y[i+j] = a*yarray[kvals[j]] + b*yarray[khi] + ((a*a*a-a)*yspline[kvals[j]] + (b*b*b-b)*yspline[khi]) * (h*h)/6.0;
+		}
+	}
+}
+
+void Spline::splint_linear(const double *x, double *y, const int npts)
+{
+	const int chunk = 64;
+	int kvals[chunk];
+	int i, j, n, klo = 0, khi;
+	double h, b, a;
+	for (i=0; i < npts; i += chunk) {
+		n = (npts-i < chunk) ? npts-i : chunk;
+		for (j=0; j < n; j++) {
+			klo = kvals[j] = knots.hunt_interval(xarray,nn,x[i+j],klo);
+			if (xarray[klo+1] == xarray[klo]) die("Bad xarray input to routine splint");
+		}
+		for (j=0; j < n; j++) {
+			khi = kvals[j] + 1;
+			h = xarray[khi] - xarray[kvals[j]];
+			a = (xarray[khi] - x[i+j])/h;
+			b = (x[i+j] - xarray[kvals[j]])/h;
+			y[i+j] = a*yarray[kvals[j]] + b*yarray[khi];
+		}
+	}
+}
+
+void Spline::dsplint(const double *x, double *dy, const int npts)
+{
+	const int chunk = 64;
+	int kvals[chunk];
+	int i, j, n, klo = 0, khi;
+	double h, b, a;
+	for (i=0; i < npts; i += chunk) {
+		n = (npts-i < chunk) ? npts-i : chunk;
+		for (j=0; j < n; j++) {
+			klo = kvals[j] = knots.hunt_interval(xarray,nn,x[i+j],klo);
+			if (xarray[klo+1] == xarray[klo]) die("Bad xarray input to routine dsplint");
+		}
+		for (j=0; j < n; j++) {
+			khi = kvals[j] + 1;
+			h = xarray[khi] - xarray[kvals[j]];
+			a = (xarray[khi] - x[i+j]) / h;
+			b = (x[i+j] - xarray[kvals[j]]) / h;
+			dy[i+j] = (yarray[khi]-yarray[kvals[j]])/h + (-(3*a*a-1.0)*yspline[kvals[j]] + (3*b*b-1.0)*yspline[khi])*h/6.0;
+		}
+	}
+}
+
 double Spline::extend_inner_logslope(const double& x)
 {
 	double n = (log(yarray[1])-log(yarray[0]))/(log(xarray[1])-log(xarray[0]));
@@ -537,6 +663,8 @@ void Spline2D::input(Spline2D &spline_in)
 			zspline[i][j] = spline_in.zspline[i][j];
 		}
 	}
+	xknots = spline_in.xknots;
+	yknots = spline_in.yknots;
 }
 
 void Spline2D::input(const char *xyfilename, const char *zfilename)
@@ -722,6 +850,8 @@ void Spline2D::logprintall(long xsteps, long ysteps)
 
 void Spline2D::spline(void)
 {
+	xknots.find_spacing(xarray,mm);
+	yknots.find_spacing(yarray,nn);
 	for (int k=0; k < mm; k++)
 		spline1D(yarray, zmatrix[k], nn, 1.0e30, 1.0e30, zspline[k]);
 
@@ -733,6 +863,7 @@ void Spline2D::spline(void)
 
 void Spline2D::spline_invert_y(void)
 {
+	xknots.find_spacing(xarray,mm);
 	for (int k=0; k < mm; k++)
 		spline1D(zmatrix[k], yarray, nn, 1.0e30, 1.0e30, zspline[k]);
 
@@ -762,17 +893,46 @@ double Spline2D::splint(const double x, const double y)
 	double *ytmp,*yytmp;
 	ytmp = new double[mm];
 	yytmp = new double[mm];
-	double z_interp;
+	double z_interp = splint(x,y,ytmp,yytmp);
+	delete[] ytmp;
+	delete[] yytmp;
+	return z_interp;
+}
 
-	for (int j=0; j < mm; j++)
-		splint1D(yarray,zmatrix[j],zspline[j],nn,y,&yytmp[j]);
+void Spline2D::splint(const double *x, const double *y, double *z, const int npts)
+{
+	double *ytmp,*yytmp;
+	ytmp = new double[mm];
+	yytmp = new double[mm];
+	for (int i=0; i < npts; i++) z[i] = splint(x[i],y[i],ytmp,yytmp);
+	delete[] ytmp;
+	delete[] yytmp;
+}
+
+double Spline2D::splint(const double x, const double y, double *ytmp, double *yytmp)
+{
+	// every column has the same knots in y, so the interval containing y is only found once
+	int j,klo,khi;
+	double h,b,a;
+
+	klo = yknots.interval(yarray,nn,y);
+	khi = klo+1;
+	h = yarray[khi]-yarray[klo];
+	if (h == 0.0) die("Bad xa input to routine splint");
+	a = (yarray[khi]-y)/h;
+	b = (y-yarray[klo])/h;
+	for (j=0; j < mm; j++)
+		yytmp[j] = a*zmatrix[j][klo]+b*zmatrix[j][khi]+((a*a*a-a)*zspline[j][klo]+(b*b*b-b)*zspline[j][khi])*(h*h)/6.0;
 
 	spline1D(xarray,yytmp,mm,1.0e30,1.0e30,ytmp);
-	splint1D(xarray,yytmp,ytmp,mm,x,&z_interp);
 
-	delete[] ytmp;
-	delete[] yytmp;
-	return z_interp;
+	klo = xknots.interval(xarray,mm,x);
+	khi = klo+1;
+	h = xarray[khi]-xarray[klo];
+	if (h == 0.0) die("Bad xa input to routine splint");
+	a = (xarray[khi]-x)/h;
+	b = (x-xarray[klo])/h;
+	return a*yytmp[klo]+b*yytmp[khi]+((a*a*a-a)*ytmp[klo]+(b*b*b-b)*ytmp[khi])*(h*h)/6.0;
 }
 
 void Spline2D::spline1D(double x[], double y[], int n, double yp1, double ypn, double y2[])
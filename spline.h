@@ -6,11 +6,25 @@
 #include "matrix.h"
 #include "errors.h"
 
+// Spacing of the knots of a spline, used to find the interval containing a given point. If the knots are evenly spaced in x or in log(x),
+// the interval is computed directly instead of by bisection.
+struct SplineKnots
+{
+	enum { Nonuniform, Uniform, LogUniform } spacing;
+	double x0, inverse_step; // x0 and the step are in log(x) if spacing is LogUniform
+
+	SplineKnots() { spacing = Nonuniform; x0 = 0; inverse_step = 0; }
+	void find_spacing(const double *xa, const int n);
+	int interval(const double *xa, const int n, const double x) const; // returns klo such that xa[klo] <= x < xa[klo+1], with 0 <= klo <= n-2
+	int hunt_interval(const double *xa, const int n, const double x, int klo) const; // same, but tries the interval found for a previous point first
+};
+
 class Spline
 {
 	private:
 		double *xarray, *yarray, *yspline;
 		int nn;
+		SplineKnots knots;
 
 	public:
 		int length(void) { return nn; }
@@ -42,6 +56,9 @@ class Spline
 		void unnatural_spline(double yp1, double ypn);
 		double splint(const double x);
 		double splint_linear(const double x);
+		void splint(const double *x, double *y, const int npts);
+		void splint_linear(const double *x, double *y, const int npts);
+		void dsplint(const double *x, double *dy, const int npts);
 		double extend_inner_logslope(const double& x);
 		double extend_outer_logslope(const double& x);
 		double extend_outer_line(const double& x);
@@ -68,6 +85,8 @@ class Spline2D
 		double **zspline, **z2spline;
 		int nn, mm;
 		bool invert_y;
+		SplineKnots xknots, yknots;
+		double splint(const double x, const double y, double *ytmp, double *yytmp);
 
 	public:
 		int xlength(void) { return mm; }
@@ -98,6 +117,7 @@ class Spline2D
 		void splint1D(double xa[], double ya[], double y2a[], int n, double x, double *y);
 
 		double splint(const double x, const double y);
+		void splint(const double *x, const double *y, double *z, const int npts);
 		double splint_invert_y(const double x, const double y);
 		void unspline();
 		void print(double, double, long, double, double, long);
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <iomanip>
+#include <cmath>
 #include "errors.h"
 #include "trirectangle.h"
 using namespace std;
@@ -7,166 +8,129 @@ using namespace std;
 #define plus_one(i) (((temp_index = (i)+1) < 3) ? temp_index : 0)
 #define minus_one(i) (((temp_index = (i)-1) >= 0) ? temp_index : 2)
 #define swap_index(i1,i2) temp_index = (i2); (i2) = (i1); (i1) = temp_index;
-#define swap_vectors(v1,v2) temp_vector = (v2); (v2) = (v1); (v1) = temp_vector;
 
 TriRectangleOverlap::TriRectangleOverlap()
 {
-	r01 = new lensvector;
-	r02 = new lensvector;
-	n_overlap_pts = 0;
-	for (int i=0; i < 7; i++) { overlap_pts[i][0] = 0; overlap_pts[i][1] = 0; }
+	n_rectangles = 0;
 }
 
 double TriRectangleOverlap::find_overlap_area(lensvector& a, lensvector& b, lensvector& c, double xmin, double xmax, double ymin, double ymax)
 {
-	// The assignment of the rectangle corner and side indices will be as follows:
-	// 3-2-2
-	// 3   1
-	// 0-0-1
-
-	// this is a bit ugly, but seg faults occur if the rectangle shares any x/y values with the square and this is a quick fix
-	if (a[0]==xmin) xmin -= 1e-10;
-	if (b[0]==xmin) xmin -= 1e-10;
-	if (b[0]==xmin) xmin -= 1e-10;
-	if (a[0]==xmax) xmax += 1e-10;
-	if (b[0]==xmax) xmax += 1e-10;
-	if (b[0]==xmax) xmax += 1e-10;
-
-	if (a[1]==ymin) ymin -= 1e-10;
-	if (b[1]==ymin) ymin -= 1e-10;
-	if (b[1]==ymin) ymin -= 1e-10;
-	if (a[1]==ymax) ymax += 1e-10;
-	if (b[1]==ymax) ymax += 1e-10;
-	if (b[1]==ymax) ymax += 1e-10;
-
-	vertex[0] = &a; vertex[1] = &b; vertex[2] = &c;
-	ab[0] = (*vertex[1])[0] - (*vertex[0])[0];
-	ab[1] = (*vertex[1])[1] - (*vertex[0])[1];
-	bc[0] = (*vertex[2])[0] - (*vertex[1])[0];
-	bc[1] = (*vertex[2])[1] - (*vertex[1])[1];
-	triangle_area = 0.5 * (ab ^ bc);
-	if (triangle_area < 0) { vertex[1] = &c; vertex[2] = &b; triangle_area = -triangle_area; }
-
-	for (i=0; i < 3; i++) {
-		for (j=0; j < 4; j++) {
-			in_side_region[i][j] = false;
-		}
-	}
-	n_overlap_pts = 0;
-	n_rectangle_overlap_pts = 0;
+	double tri_area = 0.5*((b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0]));
+	if (tri_area==0) return 0;
+	if (tri_area < 0) return clipped_triangle_area(a[0],a[1],c[0],c[1],b[0],b[1],xmin,xmax,ymin,ymax);
+	return clipped_triangle_area(a[0],a[1],b[0],b[1],c[0],c[1],xmin,xmax,ymin,ymax);
+}
 
-	for (i=0; i < 3; i++) {
-		outside_rectangle = false;
-		if ((*vertex[i])[0] < xmin) {
-			in_side_region[i][3] = true;
-			outside_rectangle = true;
-		} else if ((*vertex[i])[0] > xmax) {
-			in_side_region[i][1] = true;
-			outside_rectangle = true;
-		}
-		if ((*vertex[i])[1] < ymin) {
-			in_side_region[i][0] = true;
-			outside_rectangle = true;
-		} else if ((*vertex[i])[1] > ymax) {
-			in_side_region[i][2] = true;
-			outside_rectangle = true;
-		}
-		if (outside_rectangle==false) {
-			overlap_pts[n_overlap_pts][0] = (*vertex[i])[0];
-			overlap_pts[n_overlap_pts][1] = (*vertex[i])[1];
-			n_overlap_pts++;
+// clips the polygon (px,py) against the half-plane sign*(coordinate - bound) >= 0, where the coordinate is x if
+// clip_x is true (or y otherwise); the clipped polygon is written to (qx,qy) and its number of vertices is returned
+static inline int clip_polygon(const double* px, const double* py, const int n, double* qx, double* qy, const bool clip_x, const double bound, const double sign)
+{
+	int k, kprev, m = 0;
+	double dprev, d, t;
+	kprev = n-1;
+	dprev = sign*(((clip_x) ? px[kprev] : py[kprev]) - bound);
+	for (k=0; k < n; k++) {
+		d = sign*(((clip_x) ? px[k] : py[k]) - bound);
+		if ((d >= 0) != (dprev >= 0)) {
+			t = dprev/(dprev-d);
+			qx[m] = px[kprev] + t*(px[k]-px[kprev]);
+			qy[m] = py[kprev] + t*(py[k]-py[kprev]);
+			m++;
 		}
-	}
-	if (n_overlap_pts==3) return triangle_area;
-	if (n_overlap_pts==0) {
-		for (j=0; j < 4; j++) {
-			if ((in_side_region[0][j]) and (in_side_region[1][j]) and (in_side_region[2][j])) return 0; // all on same side of rectangle, so there's no overlap
+		if (d >= 0) {
+			qx[m] = px[k];
+			qy[m] = py[k];
+			m++;
 		}
+		kprev = k;
+		dprev = d;
 	}
-	if (test_if_inside(xmin,ymin)) {
-		overlap_pts[n_overlap_pts][0] = xmin;
-		overlap_pts[n_overlap_pts][1] = ymin;
-		n_rectangle_overlap_pts++;
-		n_overlap_pts++;
-	}
-	if (test_if_inside(xmax,ymin)) {
-		overlap_pts[n_overlap_pts][0] = xmax;
-		overlap_pts[n_overlap_pts][1] = ymin;
-		n_rectangle_overlap_pts++;
-		n_overlap_pts++;
-	}
-	if (test_if_inside(xmin,ymax)) {
-		overlap_pts[n_overlap_pts][0] = xmin;
-		overlap_pts[n_overlap_pts][1] = ymax;
-		n_rectangle_overlap_pts++;
-		n_overlap_pts++;
+	return m;
+}
+
+double TriRectangleOverlap::clipped_triangle_area(const double ax, const double ay, const double bx, const double by, const double cx, const double cy, const double xmin, const double xmax, const double ymin, const double ymax)
+{
+	// Clips the (counterclockwise) triangle against each side of the rectangle in turn (Sutherland-Hodgman), then finds the
+	// area of the resulting polygon, which has at most seven vertices
+	double px[8], py[8], qx[8], qy[8];
+	int n = 3;
+	px[0] = ax; py[0] = ay;
+	px[1] = bx; py[1] = by;
+	px[2] = cx; py[2] = cy;
+	if ((n = clip_polygon(px,py,n,qx,qy,true,xmin,1.0)) < 3) return 0;
+	if ((n = clip_polygon(qx,qy,n,px,py,true,xmax,-1.0)) < 3) return 0;
+	if ((n = clip_polygon(px,py,n,qx,qy,false,ymin,1.0)) < 3) return 0;
+	if ((n = clip_polygon(qx,qy,n,px,py,false,ymax,-1.0)) < 3) return 0;
+	double area = 0;
+	for (int k=0, kprev=n-1; k < n; kprev=k, k++) area += px[kprev]*py[k] - px[k]*py[kprev];
+	return 0.5*abs(area);
+}
+
+void TriRectangleOverlap::add_rectangle(const double xmin, const double xmax, const double ymin, const double ymax)
+{
+	if (n_rectangles == (int) rect_xmin.size()) {
+		rect_xmin.push_back(xmin);
+		rect_xmax.push_back(xmax);
+		rect_ymin.push_back(ymin);
+		rect_ymax.push_back(ymax);
+		rect_overlap.push_back(0);
+		rect_needs_clipping.push_back(0);
+	} else {
+		rect_xmin[n_rectangles] = xmin;
+		rect_xmax[n_rectangles] = xmax;
+		rect_ymin[n_rectangles] = ymin;
+		rect_ymax[n_rectangles] = ymax;
+		rect_overlap[n_rectangles] = 0;
 	}
-	if (test_if_inside(xmax,ymax)) {
-		overlap_pts[n_overlap_pts][0] = xmax;
-		overlap_pts[n_overlap_pts][1] = ymax;
-		n_rectangle_overlap_pts++;
-		n_overlap_pts++;
+	n_rectangles++;
+}
+
+void TriRectangleOverlap::add_overlap_areas(lensvector& a, lensvector& b, lensvector& c)
+{
+	// Adds the overlap area of triangle abc with each of the stored rectangles. In a first (vectorized) pass, each rectangle
+	// is tested against the triangle's bounding box and the lines through its three edges; rectangles lying beyond any of
+	// these (no overlap), lying entirely inside the triangle, or containing the whole triangle are settled right away.
+	// The remaining rectangles, which are crossed by an edge of the triangle, are clipped in a second pass.
+	double ax=a[0], ay=a[1], bx, by, cx, cy;
+	double tri_area = 0.5*((b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0]));
+	if (tri_area==0) return;
+	if (tri_area > 0) { bx = b[0]; by = b[1]; cx = c[0]; cy = c[1]; }
+	else { bx = c[0]; by = c[1]; cx = b[0]; cy = b[1]; tri_area = -tri_area; }
+
+	double txmin, txmax, tymin, tymax;
+	txmin = (ax < bx) ? ((ax < cx) ? ax : cx) : ((bx < cx) ? bx : cx);
+	txmax = (ax > bx) ? ((ax > cx) ? ax : cx) : ((bx > cx) ? bx : cx);
+	tymin = (ay < by) ? ((ay < cy) ? ay : cy) : ((by < cy) ? by : cy);
+	tymax = (ay > by) ? ((ay > cy) ? ay : cy) : ((by > cy) ? by : cy);
+
+	// points inside the triangle have n_x*x + n_y*y + d >= 0 for each edge
+	double n0x = ay-by, n0y = bx-ax, d0 = -(n0x*ax + n0y*ay);
+	double n1x = by-cy, n1y = cx-bx, d1 = -(n1x*bx + n1y*by);
+	double n2x = cy-ay, n2y = ax-cx, d2 = -(n2x*cx + n2y*cy);
+
+	const double *xmn = rect_xmin.data(), *xmx = rect_xmax.data(), *ymn = rect_ymin.data(), *ymx = rect_ymax.data();
+	double *overlap = rect_overlap.data();
+	char *needs_clipping = rect_needs_clipping.data();
+	int k;
+	#pragma omp simd
+	for (k=0; k < n_rectangles; k++) {
+		// the minimum and maximum of each edge function over the rectangle's corners
+		double e0min = n0x*((n0x > 0) ? xmn[k] : xmx[k]) + n0y*((n0y > 0) ? ymn[k] : ymx[k]) + d0;
+		double e0max = n0x*((n0x > 0) ? xmx[k] : xmn[k]) + n0y*((n0y > 0) ? ymx[k] : ymn[k]) + d0;
+		double e1min = n1x*((n1x > 0) ? xmn[k] : xmx[k]) + n1y*((n1y > 0) ? ymn[k] : ymx[k]) + d1;
+		double e1max = n1x*((n1x > 0) ? xmx[k] : xmn[k]) + n1y*((n1y > 0) ? ymx[k] : ymn[k]) + d1;
+		double e2min = n2x*((n2x > 0) ? xmn[k] : xmx[k]) + n2y*((n2y > 0) ? ymn[k] : ymx[k]) + d2;
+		double e2max = n2x*((n2x > 0) ? xmx[k] : xmn[k]) + n2y*((n2y > 0) ? ymx[k] : ymn[k]) + d2;
+		bool outside = (xmx[k] <= txmin) | (xmn[k] >= txmax) | (ymx[k] <= tymin) | (ymn[k] >= tymax) | (e0max <= 0) | (e1max <= 0) | (e2max <= 0);
+		bool rect_inside = (e0min >= 0) & (e1min >= 0) & (e2min >= 0);
+		bool tri_inside = (txmin >= xmn[k]) & (txmax <= xmx[k]) & (tymin >= ymn[k]) & (tymax <= ymx[k]);
+		overlap[k] += (outside) ? 0 : (rect_inside) ? (xmx[k]-xmn[k])*(ymx[k]-ymn[k]) : (tri_inside) ? tri_area : 0;
+		needs_clipping[k] = !((outside) | (rect_inside) | (tri_inside));
 	}
-	if (n_rectangle_overlap_pts==4) return ((xmax-xmin)*(ymax-ymin)); // the rectangle is completely inside the triangle
-	int i_xmax, i_xmin, i_ymax, i_ymin;
-	for (i=0; i < 3; i++) {
-		i_plus_one = plus_one(i);
-		if ((*vertex[i_plus_one])[0] != (*vertex[i])[0]) {
-			slope = ((*vertex[i_plus_one])[1] - (*vertex[i])[1]) / ((*vertex[i_plus_one])[0] - (*vertex[i])[0]);
-			if ((*vertex[i_plus_one])[0] > (*vertex[i])[0]) { i_xmin = i; i_xmax = i_plus_one; }
-			else { i_xmin = i_plus_one; i_xmax = i; }
-			y = slope*(xmin-(*vertex[i])[0]) + (*vertex[i])[1];
-			if ((y > ymin) and (y < ymax)) {
-				if (test_if_in_xrange(xmin,y,i_xmin,i_xmax)) {
-					overlap_pts[n_overlap_pts][0] = xmin;
-					overlap_pts[n_overlap_pts][1] = y;
-					n_overlap_pts++;
-				}
-			}
-			y = slope*(xmax-(*vertex[i])[0]) + (*vertex[i])[1];
-			if ((y > ymin) and (y < ymax)) {
-				if (test_if_in_xrange(xmax,y,i_xmin,i_xmax)) {
-					overlap_pts[n_overlap_pts][0] = xmax;
-					overlap_pts[n_overlap_pts][1] = y;
-					n_overlap_pts++;
-				}
-			}
-			x = (ymin-(*vertex[i])[1])/slope + (*vertex[i])[0];
-			if ((x > xmin) and (x < xmax)) {
-				if (test_if_in_xrange(x,ymin,i_xmin,i_xmax)) {
-					overlap_pts[n_overlap_pts][0] = x;
-					overlap_pts[n_overlap_pts][1] = ymin;
-					n_overlap_pts++;
-				}
-			}
-			x = (ymax-(*vertex[i])[1])/slope + (*vertex[i])[0];
-			if ((x > xmin) and (x < xmax)) {
-				if (test_if_in_xrange(x,ymax,i_xmin,i_xmax)) {
-					overlap_pts[n_overlap_pts][0] = x;
-					overlap_pts[n_overlap_pts][1] = ymax;
-					n_overlap_pts++;
-				}
-			}
-		}
-		else {
-			if ((*vertex[i_plus_one])[1] > (*vertex[i])[1]) { i_ymin = i; i_ymax = i_plus_one; }
-			else { i_ymin = i_plus_one; i_ymax = i; }
-			if (((*vertex[i])[0] > xmin) and ((*vertex[i])[0] < xmax)) {
-				if (test_if_in_yrange((*vertex[i])[0],ymin,i_ymin,i_ymax)) {
-					overlap_pts[n_overlap_pts][0] = (*vertex[i])[0];
-					overlap_pts[n_overlap_pts][1] = ymin;
-					n_overlap_pts++;
-				}
-				if (test_if_in_yrange((*vertex[i])[0],ymax,i_ymin,i_ymax)) {
-					overlap_pts[n_overlap_pts][0] = (*vertex[i])[0];
-					overlap_pts[n_overlap_pts][1] = ymax;
-					n_overlap_pts++;
-				}
-			}
-		}
+	for (k=0; k < n_rectangles; k++) {
+		if (needs_clipping[k]) overlap[k] += clipped_triangle_area(ax,ay,bx,by,cx,cy,xmn[k],xmx[k],ymn[k],ymx[k]);
 	}
-
-	return calculate_polygon_area();
 }
 
 inline bool TriRectangleOverlap::test_if_inside(const double& x, const double& y)
@@ -192,99 +156,6 @@ inline double TriRectangleOverlap::dif_cross_product(const double& x, const doub
 	return (((*A)[0]-x)*((*B)[1]-y) - ((*A)[1]-y)*((*B)[0]-x));
 }
 
-double TriRectangleOverlap::calculate_polygon_area(void)
-{
-	overlap_area = 0;
-	overlap_pts_list = new lensvector*[n_overlap_pts];
-	for (i=0; i < n_overlap_pts; i++) overlap_pts_list[i] = &overlap_pts[i];
-	bool duplicate_pts;
-	int k;
-	do {
-		// Duplicate points really should not occur, but very rarely they do...and I don't have time to figure out why, so here they will just be removed when they occur
-		duplicate_pts = false;
-		for (i=0; i < n_overlap_pts; i++) {
-			for (j=i+1; j < n_overlap_pts; j++) {
-				if ((overlap_pts[i][0] == overlap_pts[j][0]) and (overlap_pts[i][1] == overlap_pts[j][1])) {
-					k = j;
-					duplicate_pts = true;
-				}
-			}
-		}
-		if (duplicate_pts) {
-			newlist = new lensvector*[n_overlap_pts-1];
-			for (i=0; i < k; i++) {
-				newlist[i] = overlap_pts_list[i];
-			}
-			for (i=k+1; i < n_overlap_pts; i++) {
-				newlist[i-1] = overlap_pts_list[i];
-			}
-			delete[] overlap_pts_list;
-			overlap_pts_list = newlist;
-			n_overlap_pts--;
-		}
-	} while (duplicate_pts);
-
-	for (i=0; i < n_overlap_pts; i++) {
-		for (j=i+1; j < n_overlap_pts; j++) {
-			if ((overlap_pts[i][0] == overlap_pts[j][0]) and (overlap_pts[i][1] == overlap_pts[j][1])) {
-				cout << "Duplicate points (THIS SHOULD NOT HAPPEN!)" << i << " and " << j << ": (" << overlap_pts[i][0] << "," << overlap_pts[i][1] << ") and (" << overlap_pts[j][0] << "," << overlap_pts[j][1] << ")\n";
-			}
-		}
-	}
-
-	while (n_overlap_pts > 2)
-	{
-		swapped1 = false;
-		swapped2 = false;
-		(*r01)[0] = (*overlap_pts_list[1])[0] - (*overlap_pts_list[0])[0];
-		(*r01)[1] = (*overlap_pts_list[1])[1] - (*overlap_pts_list[0])[1];
-		(*r02)[0] = (*overlap_pts_list[2])[0] - (*overlap_pts_list[0])[0];
-		(*r02)[1] = (*overlap_pts_list[2])[1] - (*overlap_pts_list[0])[1];
-		subtriangle_area = (*r01) ^ (*r02);
-		if (n_overlap_pts==3) { overlap_area += abs(subtriangle_area); break; }
-		if (subtriangle_area < 0) {
-			swap_vectors(overlap_pts_list[1],overlap_pts_list[2]);
-			swap_vectors(r01,r02);
-			subtriangle_area = -subtriangle_area;
-		}
-		for (i=3; i < n_overlap_pts; i++) {
-			aa[0] = (*overlap_pts_list[0])[0] - (*overlap_pts_list[i])[0];
-			aa[1] = (*overlap_pts_list[0])[1] - (*overlap_pts_list[i])[1];
-			bb[0] = (*overlap_pts_list[1])[0] - (*overlap_pts_list[i])[0];
-			bb[1] = (*overlap_pts_list[1])[1] - (*overlap_pts_list[i])[1];
-			if ((aa ^ bb) < 0) { swap_vectors(overlap_pts_list[1],overlap_pts_list[i]); swapped1 = true; continue; }
-			bb[0] = (*overlap_pts_list[2])[0] - (*overlap_pts_list[i])[0];
-			bb[1] = (*overlap_pts_list[2])[1] - (*overlap_pts_list[i])[1];
-			if ((aa ^ bb) > 0) { swap_vectors(overlap_pts_list[2],overlap_pts_list[i]); swapped2 = true; continue; }
-		}
-		if (swapped1) {
-			(*r01)[0] = (*overlap_pts_list[1])[0] - (*overlap_pts_list[0])[0];
-			(*r01)[1] = (*overlap_pts_list[1])[1] - (*overlap_pts_list[0])[1];
-			if (swapped2) {
-				(*r02)[0] = (*overlap_pts_list[2])[0] - (*overlap_pts_list[0])[0];
-				(*r02)[1] = (*overlap_pts_list[2])[1] - (*overlap_pts_list[0])[1];
-			}
-			subtriangle_area = (*r01) ^ (*r02);
-		} else if (swapped2) {
-			(*r02)[0] = (*overlap_pts_list[2])[0] - (*overlap_pts_list[0])[0];
-			(*r02)[1] = (*overlap_pts_list[2])[1] - (*overlap_pts_list[0])[1];
-			subtriangle_area = (*r01) ^ (*r02);
-			if (subtriangle_area < 0) die("shouldn't have the wrong orientation!"); // remove this later after testing
-		}
-		overlap_area += abs(subtriangle_area);
-		newlist = new lensvector*[n_overlap_pts-1];
-		for (i=0; i < n_overlap_pts-1; i++) {
-			newlist[i] = overlap_pts_list[i+1];
-		}
-		delete[] overlap_pts_list;
-		overlap_pts_list = newlist;
-		n_overlap_pts--;
-	}
-
-	delete[] overlap_pts_list;
-	return 0.5*overlap_area;
-}
-
 bool TriRectangleOverlap::determine_if_in_neighborhood(lensvector& a, lensvector& b, lensvector& c, lensvector& d, const double& xmin, const double& xmax, const double& ymin, const double& ymax, bool &inside)
 {
 	inside = false;
@@ -463,10 +334,3 @@ bool TriRectangleOverlap::determine_if_overlap_rough(lensvector& a, lensvector&
 	if (test_if_inside(xmax,ymax)) return true;
 	return false;
 }
-
-TriRectangleOverlap::~TriRectangleOverlap()
-{
-	delete r01;
-	delete r02;
-}
-
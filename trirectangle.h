@@ -2,20 +2,17 @@
 #define TRIRECTANGLE_H
 
 #include "lensvec.h"
+#include <vector>
 //using namespace std;
 
 class TriRectangleOverlap
 {
 	private:
 	lensvector *vertex[4];
-	lensvector overlap_pts[7];
-	lensvector **overlap_pts_list;
 	int i,j,i_plus_one;
-	double triangle_area;
 	double x,y;
 
 	protected:
-	int n_overlap_pts, n_rectangle_overlap_pts;
 	bool in_side_region[4][4];
 	bool outside_rectangle;
 
@@ -23,16 +20,13 @@ class TriRectangleOverlap
 	lensvector ab, bc;
 	double slope;
 	int temp_index;
-	lensvector *temp_vector;
 
-	double overlap_area;
-	double subtriangle_area;
-	lensvector *r01, *r02;
-	lensvector aa, bb;
-	bool swapped1, swapped2;
-	lensvector **newlist;
+	// rectangles stored for batched overlap calculations, along with the accumulated overlap area for each
+	int n_rectangles;
+	std::vector<double> rect_xmin, rect_xmax, rect_ymin, rect_ymax, rect_overlap;
+	std::vector<char> rect_needs_clipping;
 
-	double calculate_polygon_area();
+	static double clipped_triangle_area(const double ax, const double ay, const double bx, const double by, const double cx, const double cy, const double xmin, const double xmax, const double ymin, const double ymax);
 	inline bool test_if_inside(const double& x, const double& y);
 	inline double dif_cross_product(const double& x, const double& y, const lensvector* A, const lensvector* B);
 	inline bool test_if_in_xrange(const double& x, const double& y, const int& i_xmin, const int& i_xmax);
@@ -40,12 +34,18 @@ class TriRectangleOverlap
 
 	public:
 	TriRectangleOverlap();
-	~TriRectangleOverlap();
 	double find_overlap_area(lensvector& a, lensvector& b, lensvector& c, double xmin, double xmax, double ymin, double ymax);
 	bool determine_if_overlap(lensvector& a, lensvector& b, lensvector& c, const double& xmin, const double& xmax, const double& ymin, const double& ymax);
 	bool determine_if_overlap_rough(lensvector& a, lensvector& b, lensvector& c, const double& xmin, const double& xmax, const double& ymin, const double& ymax);
 	bool determine_if_in_neighborhood(lensvector& a, lensvector& b, lensvector& c, lensvector& d, const double& xmin, const double& xmax, const double& ymin, const double& ymax, bool &inside);
 	bool determine_if_in_neighborhood(lensvector& a, lensvector& b, lensvector& c, const double& xmin, const double& xmax, const double& ymin, const double& ymax, bool &inside);
+
+	// Batched overlaps: store a list of rectangles, then add the overlap of one or more triangles with all of them at once
+	void clear_rectangles() { n_rectangles = 0; }
+	void add_rectangle(const double xmin, const double xmax, const double ymin, const double ymax);
+	void add_overlap_areas(lensvector& a, lensvector& b, lensvector& c);
+	int get_n_rectangles() { return n_rectangles; }
+	double get_overlap_area(const int k) { return rect_overlap[k]; }
 };
 
 #endif // TRIRECTANGLE_H